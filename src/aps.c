@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
+#include <Eina.h>
 #include "aps.h"
 #include "mt.h"
 #include "mt_af.h"
+#include "routes.h"
 #include "utils.h"
 #include "zcl.h"
 #include "logs.h"
@@ -16,9 +18,23 @@ typedef struct ApsEndpoint
 {
     uint8_t endpoint;
     ApsMsgCb cb;
+    ApsInterPanMsgCb inter_pan_cb;
     struct ApsEndpoint *next;
 } ApsEndpoint;
 
+/* Frame waiting for its sleepy destination to check in */
+typedef struct
+{
+    uint16_t dst_pan;
+    uint8_t src_endpoint;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+    uint8_t frame_control;
+    uint8_t command;
+    uint8_t *data;
+    int len;
+    SyncActionCb cb;
+} ApsHeldFrame;
 
 /********************************
  *          Constants           *
@@ -31,6 +47,20 @@ typedef struct ApsEndpoint
 #define INDEX_COMMAND               0x2
 
 #define APS_DEFAULT_FRAME_CONTROL   0x11
+/* Profile wide, client to server, default response disabled */
+#define APS_PROFILE_FRAME_CONTROL   0x10
+/* Cluster specific, server to client, default response disabled */
+#define APS_RESPONSE_FRAME_CONTROL  0x19
+
+/* Destination PAN id of messages sent on our own network */
+#define APS_INTRA_PAN               0x0000
+
+/* Highest short address designating a single device */
+#define APS_MAX_UNICAST_ADDR        0xFFF7
+/* Source routed data requests carry a one byte length */
+#define APS_MAX_SRC_RTG_DATA_LEN    0xFF
+/* Frames held for a single sleepy device, oldest ones are dropped beyond */
+#define APS_HELD_MAX_FRAMES         8
 
 /* APS incoming message format */
 #define INDEX_GROUP_ID              0
@@ -56,7 +86,10 @@ static ApsEndpoint *_endpoints_list = NULL;
 static int _log_domain = -1;
 static int _init_count = 0;
 static uint8_t _transaction_sequence_number = 0;
-static SyncActionCb _current_cb = NULL;
+static ApsDataConfirmCb _data_confirm_cb = NULL;
+static ApsSleepyDeviceCb _sleepy_device_cb = NULL;
+/* Lists of held frames, indexed by short address of their destination */
+static Eina_Hash *_held_frames = NULL;
 
 /********************************
  *          Internal            *
@@ -116,26 +149,107 @@ static void _clear_endpoint_list()
     }
 }
 
-static void _af_data_request_ext_cb(void)
+uint8_t _build_frame_control()
 {
-    _transaction_sequence_number++;
-    if(_current_cb)
-    {
-        _current_cb();
-        _current_cb = NULL;
-    }
+    return APS_DEFAULT_FRAME_CONTROL;
 }
 
-uint8_t _build_frame_control()
+static void _free_held_frame(ApsHeldFrame *frame)
 {
-    return APS_DEFAULT_FRAME_CONTROL;
+    free(frame->data);
+    free(frame);
+}
+
+static void _free_held_frames_list(void *data)
+{
+    Eina_List *list = data;
+    ApsHeldFrame *frame = NULL;
+
+    EINA_LIST_FREE(list, frame)
+        _free_held_frame(frame);
+}
+
+static uint8_t _hold_frame(  uint16_t dst_addr,
+                             uint16_t dst_pan,
+                             uint8_t src_endpoint,
+                             uint8_t dst_endpoint,
+                             uint16_t cluster,
+                             uint8_t frame_control,
+                             uint8_t command,
+                             void *data,
+                             int len,
+                             SyncActionCb cb)
+{
+    uint32_t key = dst_addr;
+    Eina_List *list = NULL;
+    Eina_List *l = NULL;
+    Eina_List *l_next = NULL;
+    ApsHeldFrame *frame = NULL;
+    ApsHeldFrame *held = NULL;
+
+    frame = calloc(1, sizeof(ApsHeldFrame));
+    if(!frame)
+    {
+        CRI("Cannot allocate memory to hold frame for device 0x%04X", dst_addr);
+        return 1;
+    }
+    if(len > 0 && data)
+    {
+        frame->data = malloc(len);
+        if(!frame->data)
+        {
+            CRI("Cannot allocate memory to hold frame for device 0x%04X", dst_addr);
+            free(frame);
+            return 1;
+        }
+        memcpy(frame->data, data, len);
+        frame->len = len;
+    }
+    frame->dst_pan = dst_pan;
+    frame->src_endpoint = src_endpoint;
+    frame->dst_endpoint = dst_endpoint;
+    frame->cluster = cluster;
+    frame->frame_control = frame_control;
+    frame->command = command;
+    frame->cb = cb;
+
+    /* Only the last state asked to the device matters : a newer frame replaces
+     * the same command held before */
+    list = eina_hash_find(_held_frames, &key);
+    EINA_LIST_FOREACH_SAFE(list, l, l_next, held)
+    {
+        if(held->src_endpoint == src_endpoint &&
+                held->dst_endpoint == dst_endpoint &&
+                held->cluster == cluster &&
+                held->frame_control == frame_control &&
+                held->command == command)
+        {
+            DBG("Held command 0x%02X of cluster 0x%04X for device 0x%04X is superseded",
+                    command, cluster, dst_addr);
+            _free_held_frame(held);
+            list = eina_list_remove_list(list, l);
+        }
+    }
+    if(eina_list_count(list) >= APS_HELD_MAX_FRAMES)
+    {
+        WRN("Too many frames held for device 0x%04X, dropping oldest one", dst_addr);
+        _free_held_frame(eina_list_data_get(list));
+        list = eina_list_remove_list(list, list);
+    }
+    list = eina_list_append(list, frame);
+    eina_hash_set(_held_frames, &key, list);
+    INF("Device 0x%04X is asleep, holding command 0x%02X of cluster 0x%04X (%d held)",
+            dst_addr, command, cluster, eina_list_count(list));
+    return 0;
 }
 
+static void _flush_held_frames(uint16_t addr);
+
 /************************************
  *     APS msg callbacks            *
  ***********************************/
 
-static void _process_aps_msg(uint16_t addr, uint8_t endpoint_num, uint16_t cluster, void *data, int len)
+static void _process_aps_msg(uint16_t addr, uint8_t src_endpoint, uint8_t endpoint_num, uint16_t cluster, void *data, int len)
 {
     ApsEndpoint *endpoint = NULL;
     uint8_t *aps_data = data;
@@ -146,9 +260,162 @@ static void _process_aps_msg(uint16_t addr, uint8_t endpoint_num, uint16_t clust
     }
     endpoint = _find_endpoint(endpoint_num);
     if(endpoint)
-        endpoint->cb(addr, cluster, aps_data, len);
+        endpoint->cb(addr, src_endpoint, cluster, aps_data, len);
     else
         WRN("Received message is not for one of registered endpoint (0x%02X)", endpoint_num);
+
+    /* A sleepy device only listens for a short while after it has sent
+     * something : deliver what has been held for it */
+    _flush_held_frames(addr);
+}
+
+static void _process_inter_pan_msg(uint64_t ext_addr, uint8_t endpoint_num, uint16_t cluster, uint8_t link_quality, void *data, int len)
+{
+    ApsEndpoint *endpoint = NULL;
+    if(!data || len <= 0)
+    {
+        WRN("Received empty inter-pan message");
+        return;
+    }
+    endpoint = _find_endpoint(endpoint_num);
+    if(endpoint && endpoint->inter_pan_cb)
+        endpoint->inter_pan_cb(ext_addr, cluster, link_quality, data, len);
+    else
+        WRN("Received inter-pan message is not for one of registered endpoint (0x%02X)", endpoint_num);
+}
+
+static void _process_data_confirm(uint8_t trans, uint8_t status)
+{
+    if(_data_confirm_cb)
+        _data_confirm_cb(trans, status);
+}
+
+/* A negative sequence number uses the running transaction sequence number */
+static int _send_data(  uint64_t dst_addr,
+                        uint16_t dst_pan,
+                        uint8_t src_endpoint,
+                        uint8_t dst_endpoint,
+                        uint16_t cluster,
+                        uint8_t frame_control,
+                        int seq,
+                        uint8_t command,
+                        void *data,
+                        int len,
+                        SyncActionCb cb)
+{
+    uint8_t *aps_data = NULL;
+    int aps_data_len = len;
+    uint8_t relay_count = 0;
+    uint16_t *relays = NULL;
+    int trans = -1;
+
+    if(src_endpoint != ZCL_ZDP_ENDPOINT)
+        aps_data_len += ZCL_HEADER_SIZE;
+
+    aps_data = calloc(aps_data_len, sizeof(uint8_t));
+    if(!aps_data)
+    {
+        CRI("Cannot allocate memory for AF request");
+        return -1;
+    }
+
+    if(src_endpoint != ZCL_ZDP_ENDPOINT)
+    {
+        aps_data[INDEX_FCS] = frame_control;
+        aps_data[INDEX_TRANS_SEQ_NUM] = seq < 0 ? _transaction_sequence_number++ : seq;
+        aps_data[INDEX_COMMAND] = command;
+        if(len > 0 && data)
+            memcpy(aps_data + ZCL_HEADER_SIZE, data, len);
+    }
+    else
+    {
+        memcpy(aps_data, data, len);
+    }
+
+    /* Use the source route reported by the device when we know it, it avoids
+     * a route discovery broadcast on the whole network */
+    if(dst_addr <= APS_MAX_UNICAST_ADDR &&
+            dst_pan != ZCL_BROADCAST_INTER_PAN &&
+            aps_data_len <= APS_MAX_SRC_RTG_DATA_LEN &&
+            zg_routes_get(dst_addr, &relay_count, &relays) == 0)
+    {
+        trans = zg_mt_af_send_data_request_src_rtg(dst_addr,
+                src_endpoint,
+                dst_endpoint,
+                cluster,
+                relay_count,
+                relays,
+                aps_data_len,
+                aps_data,
+                cb);
+    }
+    else
+    {
+        trans = zg_mt_af_send_data_request_ext(dst_addr,
+                dst_pan,
+                src_endpoint,
+                dst_endpoint,
+                cluster,
+                aps_data_len,
+                aps_data,
+                cb);
+    }
+    free(aps_data);
+    return trans;
+}
+
+static void _flush_held_frames(uint16_t addr)
+{
+    uint32_t key = addr;
+    Eina_List *list = NULL;
+    ApsHeldFrame *frame = NULL;
+
+    if(!_held_frames)
+        return;
+    list = eina_hash_find(_held_frames, &key);
+    if(!list)
+        return;
+
+    /* Detach list first : sending may hold new frames for this device */
+    eina_hash_set(_held_frames, &key, NULL);
+    INF("Device 0x%04X is awake, sending %d held frames", addr, eina_list_count(list));
+    EINA_LIST_FREE(list, frame)
+    {
+        if(_send_data(addr, frame->dst_pan, frame->src_endpoint, frame->dst_endpoint,
+                    frame->cluster, frame->frame_control, -1, frame->command,
+                    frame->data, frame->len, frame->cb) < 0)
+            WRN("Cannot send held command 0x%02X to device 0x%04X", frame->command, addr);
+        _free_held_frame(frame);
+    }
+}
+
+static int _send_or_hold_data(  uint16_t dst_addr,
+                                uint16_t dst_pan,
+                                uint8_t src_endpoint,
+                                uint8_t dst_endpoint,
+                                uint16_t cluster,
+                                uint8_t frame_control,
+                                uint8_t command,
+                                void *data,
+                                int len,
+                                SyncActionCb cb)
+{
+    /* ZDP requests are left to the parent indirect queue : they are sent
+     * while learning a device, which is awake then */
+    if(_sleepy_device_cb && _held_frames &&
+            src_endpoint != ZCL_ZDP_ENDPOINT &&
+            dst_addr <= APS_MAX_UNICAST_ADDR &&
+            dst_pan != ZCL_BROADCAST_INTER_PAN &&
+            _sleepy_device_cb(dst_addr))
+    {
+        if(_hold_frame(dst_addr, dst_pan, src_endpoint, dst_endpoint, cluster,
+                    frame_control, command, data, len, cb) != 0)
+            return -1;
+        return ZG_APS_DATA_HELD;
+    }
+
+    return _send_data(dst_addr, dst_pan, src_endpoint, dst_endpoint, cluster,
+            frame_control, -1, command, data, len, cb);
 }
 
 /************************************
@@ -161,6 +428,14 @@ int zg_aps_init()
     zg_mt_init();
     _log_domain = zg_logs_domain_register("zg_aps", ZG_COLOR_YELLOW);
     zg_mt_af_register_incoming_message_callback(_process_aps_msg);
+    zg_mt_af_register_inter_pan_message_callback(_process_inter_pan_msg);
+    zg_mt_af_register_data_confirm_callback(_process_data_confirm);
+    _held_frames = eina_hash_int32_new(_free_held_frames_list);
+    if(!_held_frames)
+    {
+        CRI("Cannot allocate held frames table");
+        return 1;
+    }
     return 0;
 }
 
@@ -169,6 +444,9 @@ void zg_aps_shutdown()
     ENSURE_SINGLE_SHUTDOWN(_init_count);
     zg_mt_shutdown();
     _clear_endpoint_list();
+    if(_held_frames)
+        eina_hash_free(_held_frames);
+    _held_frames = NULL;
 }
 
 void zg_aps_register_endpoint(  uint8_t endpoint,
@@ -204,7 +482,20 @@ void zg_aps_register_endpoint(  uint8_t endpoint,
             cb);
 }
 
-void zg_aps_send_data(  uint16_t dst_addr,
+uint8_t zg_aps_register_inter_pan_callback(uint8_t endpoint, ApsInterPanMsgCb msg_cb)
+{
+    ApsEndpoint *buffer = _find_endpoint(endpoint);
+
+    if(!buffer)
+    {
+        ERR("Cannot register inter-pan callback : endpoint 0x%02X is not registered", endpoint);
+        return 1;
+    }
+    buffer->inter_pan_cb = msg_cb;
+    return 0;
+}
+
+int zg_aps_send_data(   uint16_t dst_addr,
                         uint16_t dst_pan,
                         uint8_t src_endpoint,
                         uint8_t dst_endpoint,
@@ -214,42 +505,62 @@ void zg_aps_send_data(  uint16_t dst_addr,
                         int len,
                         SyncActionCb cb)
 {
-    uint8_t *aps_data = NULL;
-    int aps_data_len = len;
+    return _send_or_hold_data(dst_addr, dst_pan, src_endpoint, dst_endpoint, cluster,
+            _build_frame_control(), command, data, len, cb);
+}
 
-    if(src_endpoint != ZCL_ZDP_ENDPOINT)
-        aps_data_len += ZCL_HEADER_SIZE;
+int zg_aps_send_profile_command(uint16_t dst_addr,
+                                uint16_t dst_pan,
+                                uint8_t src_endpoint,
+                                uint8_t dst_endpoint,
+                                uint16_t cluster,
+                                uint8_t command,
+                                void *data,
+                                int len,
+                                SyncActionCb cb)
+{
+    return _send_or_hold_data(dst_addr, dst_pan, src_endpoint, dst_endpoint, cluster,
+            APS_PROFILE_FRAME_CONTROL, command, data, len, cb);
+}
 
-    aps_data = calloc(aps_data_len, sizeof(uint8_t));
-    if(!aps_data)
-    {
-        CRI("Cannot allocate memory for AF request");
-        return;
-    }
+int zg_aps_send_inter_pan_data( uint64_t dst_addr,
+                                uint8_t src_endpoint,
+                                uint8_t dst_endpoint,
+                                uint16_t cluster,
+                                uint8_t command,
+                                void *data,
+                                int len,
+                                SyncActionCb cb)
+{
+    return _send_data(dst_addr, ZCL_BROADCAST_INTER_PAN, src_endpoint, dst_endpoint, cluster,
+            _build_frame_control(), -1, command, data, len, cb);
+}
 
-    _current_cb = cb;
+int zg_aps_send_response(   uint16_t dst_addr,
+                            uint8_t src_endpoint,
+                            uint8_t dst_endpoint,
+                            uint16_t cluster,
+                            uint8_t command,
+                            uint8_t seq,
+                            void *data,
+                            int len,
+                            SyncActionCb cb)
+{
+    return _send_data(dst_addr, APS_INTRA_PAN, src_endpoint, dst_endpoint, cluster,
+            APS_RESPONSE_FRAME_CONTROL, seq, command, data, len, cb);
+}
 
-    if(src_endpoint != ZCL_ZDP_ENDPOINT)
-    {
-        aps_data[INDEX_FCS] = _build_frame_control();
-        aps_data[INDEX_TRANS_SEQ_NUM] = _transaction_sequence_number;
-        aps_data[INDEX_COMMAND] = command;
-        if(len > 0 && data)
-            memcpy(aps_data + ZCL_HEADER_SIZE, data, len);
-    }
-    else
-    {
-        memcpy(aps_data, data, len);
-    }
+void zg_aps_register_data_confirm_callback(ApsDataConfirmCb cb)
+{
+    _data_confirm_cb = cb;
+}
 
-    zg_mt_af_send_data_request_ext(dst_addr,
-            dst_pan,
-            src_endpoint,
-            dst_endpoint,
-            cluster,
-            aps_data_len,
-            aps_data,
-            _af_data_request_ext_cb);
-    free(aps_data);
+void zg_aps_register_sleepy_device_callback(ApsSleepyDeviceCb cb)
+{
+    _sleepy_device_cb = cb;
 }
 
+void zg_aps_device_awake(uint16_t addr)
+{
+    _flush_held_frames(addr);
+}
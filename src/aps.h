@@ -4,8 +4,15 @@
 #include <stdint.h>
 #include "types.h"
 
+/* Returned instead of a transaction id when data is held until its sleepy
+ * destination wakes up */
+#define ZG_APS_DATA_HELD    -2
+
 /* APS callbacks, registered by proper applications */
-typedef void (*ApsMsgCb)(uint16_t addr, uint16_t cluster, void *data, int len);
+typedef void (*ApsMsgCb)(uint16_t addr, uint8_t src_endpoint, uint16_t cluster, void *data, int len);
+typedef void (*ApsInterPanMsgCb)(uint64_t ext_addr, uint16_t cluster, uint8_t link_quality, void *data, int len);
+typedef void (*ApsDataConfirmCb)(uint8_t trans, uint8_t status);
+typedef uint8_t (*ApsSleepyDeviceCb)(uint16_t addr);
 
 /**
  * \brief Intialize the APS layer.
@@ -54,12 +61,25 @@ void zg_aps_register_endpoint(  uint8_t endpoint,
                                 ApsMsgCb msg_cb,
                                 SyncActionCb cb);
 
+/**
+ * \brief Register the callback receiving inter-pan messages targeted to an
+ * already registered endpoint
+ * \param endpoint The registered endpoint
+ * \param msg_cb The callback to be called whenever a new inter-pan message
+ * targeted to this endpoint arrives, with the sender extended address and the
+ * link quality of the received message
+ * \return 0 if callback has been registered, 1 if endpoint is unknown
+ */
+uint8_t zg_aps_register_inter_pan_callback(uint8_t endpoint, ApsInterPanMsgCb msg_cb);
+
 /**
  * \brief Send data to a specific remote application
  *
  * This API is the main function to send data to a remote entity. This entity
  * has to be fully defined by its network address, its destination endpoint, the
- * targeted cluster, and finally the cluster specific command
+ * targeted cluster, and finally the cluster specific command. Data sent to a
+ * sleepy device is held until the device wakes up, newer data for the same
+ * cluster command replacing the held one
  * \param dst_addr The destination address of the device on the network
  * \param dst_pan The PAN ID on which is the target device
  * \param src_endpoint The local endpoint emitting the data
@@ -69,8 +89,10 @@ void zg_aps_register_endpoint(  uint8_t endpoint,
  * \param data The command payload we want to send
  * \param len The command payload len
  * \param cb A callback to be called when data has been sent to ZNP
+ * \return The transaction id of the request, ZG_APS_DATA_HELD if data is held
+ * for a sleepy device, or -1 if it could not be sent
  */
-void zg_aps_send_data(  uint16_t dst_addr,
+int zg_aps_send_data(   uint16_t dst_addr,
                         uint16_t dst_pan,
                         uint8_t src_endpoint,
                         uint8_t dst_endpoint,
@@ -80,5 +102,89 @@ void zg_aps_send_data(  uint16_t dst_addr,
                         int len,
                         SyncActionCb cb);
 
+/**
+ * \brief Send a profile wide command (e.g. Read Attributes) to a remote
+ * cluster. Parameters and return value are the same as zg_aps_send_data ones
+ */
+int zg_aps_send_profile_command(uint16_t dst_addr,
+                                uint16_t dst_pan,
+                                uint8_t src_endpoint,
+                                uint8_t dst_endpoint,
+                                uint16_t cluster,
+                                uint8_t command,
+                                void *data,
+                                int len,
+                                SyncActionCb cb);
+
+/**
+ * \brief Send inter-pan data to a single device, on current inter-pan channel
+ * \param dst_addr The extended address of the target device
+ * \param src_endpoint The local inter-pan endpoint emitting the data
+ * \param dst_endpoint The target remote endpoint
+ * \param cluster The targeted cluster on the remote endpoint
+ * \param command The command we want to send to remote cluster
+ * \param data The command payload we want to send
+ * \param len The command payload len
+ * \param cb A callback to be called when data has been sent to ZNP
+ * \return The transaction id of the request, or -1 if it could not be sent
+ */
+int zg_aps_send_inter_pan_data( uint64_t dst_addr,
+                                uint8_t src_endpoint,
+                                uint8_t dst_endpoint,
+                                uint16_t cluster,
+                                uint8_t command,
+                                void *data,
+                                int len,
+                                SyncActionCb cb);
+
+/**
+ * \brief Answer a cluster command received by a local server cluster. The
+ * answer is sent from server to client, with the sequence number of the
+ * command it answers
+ * \param dst_addr The short address of the device which has sent the command
+ * \param src_endpoint The local endpoint which has received the command
+ * \param dst_endpoint The remote endpoint which has sent the command
+ * \param cluster The cluster of the command
+ * \param command The answer command
+ * \param seq The sequence number of the command
+ * \param data The answer payload
+ * \param len The answer payload len
+ * \param cb A callback to be called when data has been sent to ZNP
+ * \return The transaction id of the request, or -1 if it could not be sent
+ */
+int zg_aps_send_response(   uint16_t dst_addr,
+                            uint8_t src_endpoint,
+                            uint8_t dst_endpoint,
+                            uint16_t cluster,
+                            uint8_t command,
+                            uint8_t seq,
+                            void *data,
+                            int len,
+                            SyncActionCb cb);
+
+/**
+ * \brief Register the callback to call when a data request sent with one of
+ * the APIs above is over
+ * \param cb The callback, called with the transaction id returned when sending
+ * the data, and ZSUCCESS if data has been delivered, otherwise the error
+ * status
+ */
+void zg_aps_register_data_confirm_callback(ApsDataConfirmCb cb);
+
+/**
+ * \brief Register the callback telling whether a device is sleepy, i.e. has
+ * its receiver off when idle. Data sent to such device is held until it sends
+ * a message or zg_aps_device_awake is called
+ * \param cb The callback, returning 1 if device with given short address is
+ * sleepy
+ */
+void zg_aps_register_sleepy_device_callback(ApsSleepyDeviceCb cb);
+
+/**
+ * \brief Send data held for a device, e.g. when it has announced itself
+ * \param addr The short address of the device
+ */
+void zg_aps_device_awake(uint16_t addr);
+
 #endif
 
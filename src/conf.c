@@ -12,6 +12,8 @@
 #define SECTION_GENERAL             "general"
 #define KEY_ZNP_DEVICE_PATH             "znp_device_path"
 #define KEY_ZNP_BAUDRATE                "znp_baudrate"
+#define KEY_ZNP_FLOW_CONTROL            "znp_flow_control"
+#define KEY_ZNP_LOW_LATENCY             "znp_low_latency"
 #define SECTION_SECURITY            "security"
 #define KEY_NETWORK_KEY_PATH            "network_key_path"
 #define SECTION_DEVICES             "devices"
@@ -22,6 +24,25 @@
 #define SECTION_TCP_SERVER         "tcp_server"
 #define KEY_TCP_SERVER_ADDR            "tcp_server_address"
 #define KEY_TCP_SERVER_PORT            "tcp_server_port"
+#define SECTION_INTERFACES          "interfaces"
+#define KEY_INTERFACES_PLUGINS          "plugins"
+#define KEY_INTERFACES_AGGREGATION_WINDOW   "aggregation_window_ms"
+#define KEY_INTERFACES_STATE_MIN_INTERVAL   "state_min_interval_ms"
+#define KEY_INTERFACES_SPOOL_SIZE           "spool_size"
+#define KEY_INTERFACES_COMMAND_TIMEOUT      "command_timeout_ms"
+#define KEY_INTERFACES_COMMAND_MIN_INTERVAL "command_min_interval_ms"
+#define SECTION_OTA                 "ota"
+#define KEY_OTA_IMAGE_DIR               "image_dir"
+#define KEY_OTA_BLOCK_INTERVAL          "block_interval_ms"
+#define KEY_OTA_MAX_BLOCKS_RATE         "max_blocks_per_second"
+#define SECTION_RULES               "rules"
+#define KEY_RULES_PATH                  "rules_path"
+#define SECTION_POLL                "poll"
+#define KEY_POLL_PATH                   "poll_path"
+#define KEY_POLL_MAX_READS_RATE         "max_reads_per_second"
+#define SECTION_HISTORY             "history"
+#define KEY_HISTORY_PATH                "history_path"
+#define KEY_HISTORY_MAX_SERIES          "max_series"
 
 #define PRINT_STRING_VALUE(section, key, val)   {INF("%s/%s : %s", section, key, val?val:"NULL");}
 #define PRINT_INT_VALUE(section, key, val)      {INF("%s/%s : %d", section, key, val);}
@@ -48,10 +69,26 @@ typedef struct
     char *device_list_path;
     char *znp_device_path;
     int znp_baudrate;
+    int znp_flow_control;
+    int znp_low_latency;
     char *http_server_address;
     int http_server_port;
     char *tcp_server_address;
     int tcp_server_port;
+    char *interfaces_plugins;
+    int interfaces_aggregation_window;
+    int interfaces_state_min_interval;
+    int interfaces_spool_size;
+    int interfaces_command_timeout;
+    int interfaces_command_min_interval;
+    char *ota_image_dir;
+    int ota_block_interval;
+    int ota_max_blocks_rate;
+    char *rules_path;
+    char *poll_path;
+    int poll_max_reads_rate;
+    char *history_path;
+    int history_max_series;
 } Configuration;
 
 typedef enum
@@ -122,12 +159,28 @@ static void _print_configuration()
 {
     PRINT_STRING_VALUE(SECTION_GENERAL, KEY_ZNP_DEVICE_PATH, _configuration.znp_device_path);
     PRINT_INT_VALUE(SECTION_GENERAL, KEY_ZNP_BAUDRATE, _configuration.znp_baudrate);
+    PRINT_INT_VALUE(SECTION_GENERAL, KEY_ZNP_FLOW_CONTROL, _configuration.znp_flow_control);
+    PRINT_INT_VALUE(SECTION_GENERAL, KEY_ZNP_LOW_LATENCY, _configuration.znp_low_latency);
     PRINT_STRING_VALUE(SECTION_SECURITY, KEY_NETWORK_KEY_PATH, _configuration.network_key_path);
     PRINT_STRING_VALUE(SECTION_DEVICES, KEY_DEVICE_LIST_PATH, _configuration.device_list_path);
     PRINT_STRING_VALUE(SECTION_HTTP_SERVER, KEY_HTTP_SERVER_ADDR, _configuration.http_server_address);
     PRINT_INT_VALUE(SECTION_HTTP_SERVER, KEY_HTTP_SERVER_PORT, _configuration.http_server_port);
     PRINT_STRING_VALUE(SECTION_TCP_SERVER, KEY_TCP_SERVER_ADDR, _configuration.tcp_server_address);
     PRINT_INT_VALUE(SECTION_TCP_SERVER, KEY_TCP_SERVER_PORT, _configuration.tcp_server_port);
+    PRINT_STRING_VALUE(SECTION_INTERFACES, KEY_INTERFACES_PLUGINS, _configuration.interfaces_plugins);
+    PRINT_INT_VALUE(SECTION_INTERFACES, KEY_INTERFACES_AGGREGATION_WINDOW, _configuration.interfaces_aggregation_window);
+    PRINT_INT_VALUE(SECTION_INTERFACES, KEY_INTERFACES_STATE_MIN_INTERVAL, _configuration.interfaces_state_min_interval);
+    PRINT_INT_VALUE(SECTION_INTERFACES, KEY_INTERFACES_SPOOL_SIZE, _configuration.interfaces_spool_size);
+    PRINT_INT_VALUE(SECTION_INTERFACES, KEY_INTERFACES_COMMAND_TIMEOUT, _configuration.interfaces_command_timeout);
+    PRINT_INT_VALUE(SECTION_INTERFACES, KEY_INTERFACES_COMMAND_MIN_INTERVAL, _configuration.interfaces_command_min_interval);
+    PRINT_STRING_VALUE(SECTION_OTA, KEY_OTA_IMAGE_DIR, _configuration.ota_image_dir);
+    PRINT_INT_VALUE(SECTION_OTA, KEY_OTA_BLOCK_INTERVAL, _configuration.ota_block_interval);
+    PRINT_INT_VALUE(SECTION_OTA, KEY_OTA_MAX_BLOCKS_RATE, _configuration.ota_max_blocks_rate);
+    PRINT_STRING_VALUE(SECTION_RULES, KEY_RULES_PATH, _configuration.rules_path);
+    PRINT_STRING_VALUE(SECTION_POLL, KEY_POLL_PATH, _configuration.poll_path);
+    PRINT_INT_VALUE(SECTION_POLL, KEY_POLL_MAX_READS_RATE, _configuration.poll_max_reads_rate);
+    PRINT_STRING_VALUE(SECTION_HISTORY, KEY_HISTORY_PATH, _configuration.history_path);
+    PRINT_INT_VALUE(SECTION_HISTORY, KEY_HISTORY_MAX_SERIES, _configuration.history_max_series);
 }
 /****************************************
  *                  API                 *
@@ -152,10 +205,26 @@ uint8_t zg_conf_init(char *conf_path)
         _load_value(dict, SECTION_DEVICES, KEY_DEVICE_LIST_PATH, &(_configuration.device_list_path), CONF_VAL_STRING);
         _load_value(dict, SECTION_GENERAL, KEY_ZNP_DEVICE_PATH, &(_configuration.znp_device_path), CONF_VAL_STRING);
         _load_value(dict, SECTION_GENERAL, KEY_ZNP_BAUDRATE, &(_configuration.znp_baudrate), CONF_VAL_INT);
+        _load_value(dict, SECTION_GENERAL, KEY_ZNP_FLOW_CONTROL, &(_configuration.znp_flow_control), CONF_VAL_INT);
+        _load_value(dict, SECTION_GENERAL, KEY_ZNP_LOW_LATENCY, &(_configuration.znp_low_latency), CONF_VAL_INT);
         _load_value(dict, SECTION_HTTP_SERVER, KEY_HTTP_SERVER_ADDR, &(_configuration.http_server_address), CONF_VAL_STRING);
         _load_value(dict, SECTION_HTTP_SERVER, KEY_HTTP_SERVER_PORT, &(_configuration.http_server_port), CONF_VAL_INT);
         _load_value(dict, SECTION_TCP_SERVER, KEY_TCP_SERVER_ADDR, &(_configuration.tcp_server_address), CONF_VAL_STRING);
         _load_value(dict, SECTION_TCP_SERVER, KEY_TCP_SERVER_PORT, &(_configuration.tcp_server_port), CONF_VAL_INT);
+        _load_value(dict, SECTION_INTERFACES, KEY_INTERFACES_PLUGINS, &(_configuration.interfaces_plugins), CONF_VAL_STRING);
+        _load_value(dict, SECTION_INTERFACES, KEY_INTERFACES_AGGREGATION_WINDOW, &(_configuration.interfaces_aggregation_window), CONF_VAL_INT);
+        _load_value(dict, SECTION_INTERFACES, KEY_INTERFACES_STATE_MIN_INTERVAL, &(_configuration.interfaces_state_min_interval), CONF_VAL_INT);
+        _load_value(dict, SECTION_INTERFACES, KEY_INTERFACES_SPOOL_SIZE, &(_configuration.interfaces_spool_size), CONF_VAL_INT);
+        _load_value(dict, SECTION_INTERFACES, KEY_INTERFACES_COMMAND_TIMEOUT, &(_configuration.interfaces_command_timeout), CONF_VAL_INT);
+        _load_value(dict, SECTION_INTERFACES, KEY_INTERFACES_COMMAND_MIN_INTERVAL, &(_configuration.interfaces_command_min_interval), CONF_VAL_INT);
+        _load_value(dict, SECTION_OTA, KEY_OTA_IMAGE_DIR, &(_configuration.ota_image_dir), CONF_VAL_STRING);
+        _load_value(dict, SECTION_OTA, KEY_OTA_BLOCK_INTERVAL, &(_configuration.ota_block_interval), CONF_VAL_INT);
+        _load_value(dict, SECTION_OTA, KEY_OTA_MAX_BLOCKS_RATE, &(_configuration.ota_max_blocks_rate), CONF_VAL_INT);
+        _load_value(dict, SECTION_RULES, KEY_RULES_PATH, &(_configuration.rules_path), CONF_VAL_STRING);
+        _load_value(dict, SECTION_POLL, KEY_POLL_PATH, &(_configuration.poll_path), CONF_VAL_STRING);
+        _load_value(dict, SECTION_POLL, KEY_POLL_MAX_READS_RATE, &(_configuration.poll_max_reads_rate), CONF_VAL_INT);
+        _load_value(dict, SECTION_HISTORY, KEY_HISTORY_PATH, &(_configuration.history_path), CONF_VAL_STRING);
+        _load_value(dict, SECTION_HISTORY, KEY_HISTORY_MAX_SERIES, &(_configuration.history_max_series), CONF_VAL_INT);
         iniparser_freedict(dict);
     }
     _print_configuration();
@@ -168,6 +237,11 @@ void zg_conf_shutdown()
     ZG_VAR_FREE(_configuration.device_list_path);
     ZG_VAR_FREE(_configuration.http_server_address);
     ZG_VAR_FREE(_configuration.tcp_server_address);
+    ZG_VAR_FREE(_configuration.interfaces_plugins);
+    ZG_VAR_FREE(_configuration.ota_image_dir);
+    ZG_VAR_FREE(_configuration.rules_path);
+    ZG_VAR_FREE(_configuration.poll_path);
+    ZG_VAR_FREE(_configuration.history_path);
     memset(&_configuration, 0, sizeof(_configuration));
 }
 
@@ -181,6 +255,16 @@ int zg_conf_get_znp_baudrate()
     return _configuration.znp_baudrate;
 }
 
+int zg_conf_get_znp_flow_control()
+{
+    return _configuration.znp_flow_control;
+}
+
+int zg_conf_get_znp_low_latency()
+{
+    return _configuration.znp_low_latency;
+}
+
 const char *zg_conf_get_network_key_path()
 {
     return _configuration.network_key_path;
@@ -210,3 +294,73 @@ int zg_conf_get_tcp_server_port()
 {
     return _configuration.tcp_server_port;
 }
+
+const char *zg_conf_get_interfaces_plugins()
+{
+    return _configuration.interfaces_plugins;
+}
+
+int zg_conf_get_interfaces_aggregation_window()
+{
+    return _configuration.interfaces_aggregation_window;
+}
+
+int zg_conf_get_interfaces_state_min_interval()
+{
+    return _configuration.interfaces_state_min_interval;
+}
+
+int zg_conf_get_interfaces_spool_size()
+{
+    return _configuration.interfaces_spool_size;
+}
+
+int zg_conf_get_interfaces_command_timeout()
+{
+    return _configuration.interfaces_command_timeout;
+}
+
+int zg_conf_get_interfaces_command_min_interval()
+{
+    return _configuration.interfaces_command_min_interval;
+}
+
+const char *zg_conf_get_ota_image_dir()
+{
+    return _configuration.ota_image_dir;
+}
+
+int zg_conf_get_ota_block_interval()
+{
+    return _configuration.ota_block_interval;
+}
+
+int zg_conf_get_ota_max_blocks_rate()
+{
+    return _configuration.ota_max_blocks_rate;
+}
+
+const char *zg_conf_get_rules_path()
+{
+    return _configuration.rules_path;
+}
+
+const char *zg_conf_get_poll_path()
+{
+    return _configuration.poll_path;
+}
+
+int zg_conf_get_poll_max_reads_rate()
+{
+    return _configuration.poll_max_reads_rate;
+}
+
+const char *zg_conf_get_history_path()
+{
+    return _configuration.history_path;
+}
+
+int zg_conf_get_history_max_series()
+{
+    return _configuration.history_max_series;
+}
@@ -7,12 +7,28 @@ uint8_t zg_conf_init(char *conf_path);
 void zg_conf_shutdown();
 const char *zg_conf_get_znp_device_path();
 int zg_conf_get_znp_baudrate();
+int zg_conf_get_znp_flow_control();
+int zg_conf_get_znp_low_latency();
 const char *zg_conf_get_network_key_path();
 const char *zg_conf_get_device_list_path();
 const char *zg_conf_get_http_server_address();
 int zg_conf_get_http_server_port();
 const char *zg_conf_get_tcp_server_address();
 int zg_conf_get_tcp_server_port();
+const char *zg_conf_get_interfaces_plugins();
+int zg_conf_get_interfaces_aggregation_window();
+int zg_conf_get_interfaces_state_min_interval();
+int zg_conf_get_interfaces_spool_size();
+int zg_conf_get_interfaces_command_timeout();
+int zg_conf_get_interfaces_command_min_interval();
+const char *zg_conf_get_ota_image_dir();
+int zg_conf_get_ota_block_interval();
+int zg_conf_get_ota_max_blocks_rate();
+const char *zg_conf_get_rules_path();
+const char *zg_conf_get_poll_path();
+int zg_conf_get_poll_max_reads_rate();
+const char *zg_conf_get_history_path();
+int zg_conf_get_history_max_series();
 
 #endif
 
@@ -3,7 +3,9 @@
 #include "zdp.h"
 #include "zha.h"
 #include "zll.h"
-#include "action_list.h"
+#include "ota.h"
+#include "zcl.h"
+#include "action_graph.h"
 #include "aps.h"
 #include "mt.h"
 #include "mt_af.h"
@@ -12,24 +14,29 @@
 #include "mt_util.h"
 #include "stdin.h"
 #include "interfaces.h"
+#include "aggregator.h"
 #include "device.h"
+#include "topology.h"
+#include "routes.h"
+#include "bindings.h"
+#include "polling.h"
 #include "keys.h"
+#include "rules.h"
+#include "history.h"
 #include "sm.h"
 #include "logs.h"
+#include "worker.h"
+#include "utils.h"
 
 /********************************
  *     Constants and macros     *
  *******************************/
 
 #define DEMO_DEVICE_ID              0
+#define DEMO_DEVICE_ENDPOINT        0x0B
 #define GATEWAY_ADDR                0x0000
 #define GATEWAY_CHANNEL             11
-
-#define EVENT_STR_TEMPERATURE       "temperature"
-#define EVENT_STR_PRESSURE          "pressure"
-#define EVENT_STR_HUMIDITY          "humidity"
-#define EVENT_STR_BUTTON            "button"
-#define EVENT_STR_NEW_DEV           "new_device"
+#define CONCENTRATOR_DISCOVERY_S    60
 
 /*** For demo purpose, pre-calculated values */
 #define X_RED       65535
@@ -47,19 +54,24 @@ static int _log_domain = -1;
  * Initialization state machine *
  *******************************/
 
-static ZgAl *_init_sm = NULL;
+static ZgAg *_init_ag = NULL;
 static uint8_t _initialized = 0;
 static uint8_t _reset_network = 0;
 
 /* Callback triggered when core initialization is complete */
 
-static void _general_init_cb(void)
+static void _init_done_cb(int nb_failed)
 {
-    if(zg_al_continue(_init_sm) != 0)
+    if(nb_failed)
     {
-        INF("Core application is initialized");
-        _initialized = 1;
+        CRI("Core application initialization has failed");
+        return;
     }
+    INF("Core application is initialized");
+    _initialized = 1;
+    zg_topology_start();
+    zg_bindings_start();
+    zg_polling_start();
 }
 
 static void _write_clear_flag(SyncActionCb cb)
@@ -75,6 +87,11 @@ static void _write_channel(SyncActionCb cb)
     zg_mt_sys_nv_write_channel(GATEWAY_CHANNEL, cb);
 }
 
+static void _write_concentrator_discovery(SyncActionCb cb)
+{
+    zg_mt_sys_nv_write_concentrator_discovery(CONCENTRATOR_DISCOVERY_S, cb);
+}
+
 static void _announce_gateway(SyncActionCb cb)
 {
     zg_mt_zdo_device_annce(GATEWAY_ADDR, zg_mt_sys_get_ext_addr(), cb);
@@ -83,7 +100,10 @@ static void _announce_gateway(SyncActionCb cb)
 
 static void _get_demo_device_route(SyncActionCb cb)
 {
-    zg_mt_zdo_ext_route_disc_request(zg_device_get_short_addr(DEMO_DEVICE_ID), cb);
+    if(_reset_network)
+        cb();
+    else
+        zg_routes_discover(zg_device_get_short_addr(DEMO_DEVICE_ID), cb);
 }
 
 static void _zll_init(SyncActionCb cb)
@@ -97,56 +117,105 @@ static void _zha_init(SyncActionCb cb)
         ERR("Error initializing ZHA profile");
 }
 
+static void _ota_init(SyncActionCb cb)
+{
+    if(zg_ota_init(cb) != 0)
+        ERR("Error initializing OTA server");
+}
+
 static void _zdp_init(SyncActionCb cb)
 {
     if(zg_zdp_init(cb) != 0)
         ERR("Error initializing ZDP profile");
 }
 
-
-static ZgAlState _init_states_reset[] = {
-    {_write_clear_flag, _general_init_cb},
-    {zg_mt_sys_reset_dongle, _general_init_cb},
-    {zg_mt_sys_nv_write_nwk_key, _general_init_cb},
-    {zg_mt_sys_reset_dongle, _general_init_cb},
-    {zg_mt_sys_check_ext_addr, _general_init_cb},
-    {zg_mt_sys_nv_write_coord_flag, _general_init_cb},
-    {zg_mt_sys_nv_set_pan_id, _general_init_cb},
-    {_write_channel, _general_init_cb},
-    {zg_mt_sys_ping, _general_init_cb},
-    {zg_mt_util_af_subscribe_cmd, _general_init_cb},
-    {_zll_init, _general_init_cb},
-    {_zha_init, _general_init_cb},
-    {_zdp_init, _general_init_cb},
-    {zg_mt_zdo_startup_from_app, _general_init_cb},
-    {zg_mt_sys_nv_write_enable_security, _general_init_cb},
-    {_announce_gateway, _general_init_cb},
+/* Requests are pipelined by RPC module, so steps without dependencies between
+ * them run at the same time. Steps completed by an indication (resets and
+ * startup) must not run along with other requests of the same MT subsystem,
+ * and NV steps are chained so that items are written in a known order.
+ * Network key is written once extended address is known, since the digest of
+ * the last key written is bound to the ZNP */
+enum
+{
+    INIT_CLEAR_FLAG,
+    INIT_RESET,
+    INIT_EXT_ADDR,
+    INIT_NV_LOAD,
+    INIT_NWK_KEY,
+    INIT_NV_RESET,
+    INIT_COORD_FLAG,
+    INIT_PAN_ID,
+    INIT_CHANNEL,
+    INIT_CONCENTRATOR_ENABLE,
+    INIT_CONCENTRATOR_DISCOVERY,
+    INIT_PING,
+    INIT_AF_SUBSCRIBE,
+    INIT_ZLL,
+    INIT_ZHA,
+    INIT_OTA,
+    INIT_ZDP,
+    INIT_STARTUP,
+    INIT_SECURITY,
+    INIT_CONCENTRATOR_CHANGE,
+    INIT_DEMO_ROUTE,
+    INIT_ANNOUNCE,
 };
 
-static int _init_reset_nb_states = sizeof(_init_states_reset)/sizeof(ZgAlState);
-
-static ZgAlState _init_states_restart[] = {
-    {zg_mt_sys_reset_dongle, _general_init_cb},
-    {zg_mt_sys_check_ext_addr, _general_init_cb},
-    {zg_mt_sys_ping, _general_init_cb},
-    {zg_mt_util_af_subscribe_cmd, _general_init_cb},
-    {_zll_init, _general_init_cb},
-    {_zha_init, _general_init_cb},
-    {_zdp_init, _general_init_cb},
-    {zg_mt_zdo_startup_from_app, _general_init_cb},
-    {zg_mt_sys_nv_write_enable_security, _general_init_cb},
-    {_get_demo_device_route, _general_init_cb},
-    {_announce_gateway, _general_init_cb}
+#define INIT_AFTER_NV_RESET         (ZG_AG_DEP(INIT_NV_RESET))
+#define INIT_STARTUP_TIMEOUT_MS     30000
+
+/* When network is not reset, clear flag is not written and NV items are only
+ * written if ZNP does not hold the expected value anymore (eg dongle has been
+ * flashed or replaced), so that flash is not worn out on each restart */
+static const ZgAgStep _init_steps[] = {
+    [INIT_CLEAR_FLAG] = {"clear flag", _write_clear_flag, 0, 0},
+    [INIT_RESET] = {"reset", zg_mt_sys_reset_dongle, ZG_AG_DEP(INIT_CLEAR_FLAG), 0},
+    [INIT_EXT_ADDR] = {"ext addr", zg_mt_sys_check_ext_addr, ZG_AG_DEP(INIT_RESET), 0},
+    [INIT_NV_LOAD] = {"nv load", zg_mt_sys_nv_load, ZG_AG_DEP(INIT_RESET), 0},
+    [INIT_NWK_KEY] = {"network key", zg_mt_sys_nv_write_nwk_key,
+        ZG_AG_DEP(INIT_EXT_ADDR)|ZG_AG_DEP(INIT_NV_LOAD), 0},
+    [INIT_NV_RESET] = {"nv reset", zg_mt_sys_reset_dongle_if_needed,
+        ZG_AG_DEP(INIT_EXT_ADDR)|ZG_AG_DEP(INIT_NWK_KEY), 0},
+    [INIT_COORD_FLAG] = {"coordinator flag", zg_mt_sys_nv_write_coord_flag, INIT_AFTER_NV_RESET, 0},
+    [INIT_PAN_ID] = {"pan id", zg_mt_sys_nv_set_pan_id, ZG_AG_DEP(INIT_COORD_FLAG), 0},
+    [INIT_CHANNEL] = {"channel", _write_channel, ZG_AG_DEP(INIT_PAN_ID), 0},
+    [INIT_CONCENTRATOR_ENABLE] = {"concentrator enable", zg_mt_sys_nv_write_concentrator_enable,
+        ZG_AG_DEP(INIT_CHANNEL), 0},
+    [INIT_CONCENTRATOR_DISCOVERY] = {"concentrator discovery", _write_concentrator_discovery,
+        ZG_AG_DEP(INIT_CONCENTRATOR_ENABLE), 0},
+    [INIT_PING] = {"ping", zg_mt_sys_ping, INIT_AFTER_NV_RESET, 0},
+    [INIT_AF_SUBSCRIBE] = {"af subscribe", zg_mt_util_af_subscribe_cmd, INIT_AFTER_NV_RESET, 0},
+    [INIT_ZLL] = {"zll", _zll_init, INIT_AFTER_NV_RESET, 0},
+    [INIT_ZHA] = {"zha", _zha_init, INIT_AFTER_NV_RESET, 0},
+    [INIT_OTA] = {"ota", _ota_init, INIT_AFTER_NV_RESET, 0},
+    [INIT_ZDP] = {"zdp", _zdp_init, INIT_AFTER_NV_RESET, 0},
+    [INIT_STARTUP] = {"startup", zg_mt_zdo_startup_from_app,
+        ZG_AG_DEP(INIT_CONCENTRATOR_DISCOVERY)|ZG_AG_DEP(INIT_PING)|ZG_AG_DEP(INIT_AF_SUBSCRIBE)
+            |ZG_AG_DEP(INIT_ZLL)|ZG_AG_DEP(INIT_ZHA)|ZG_AG_DEP(INIT_OTA)|ZG_AG_DEP(INIT_ZDP),
+        INIT_STARTUP_TIMEOUT_MS},
+    [INIT_SECURITY] = {"security", zg_mt_sys_nv_write_enable_security, ZG_AG_DEP(INIT_STARTUP), 0},
+    [INIT_CONCENTRATOR_CHANGE] = {"concentrator change", zg_mt_zdo_force_concentrator_change,
+        ZG_AG_DEP(INIT_STARTUP), 0},
+    [INIT_DEMO_ROUTE] = {"demo route", _get_demo_device_route, ZG_AG_DEP(INIT_CONCENTRATOR_CHANGE), 0},
+    [INIT_ANNOUNCE] = {"announce", _announce_gateway, ZG_AG_DEP(INIT_STARTUP), 0},
 };
-static int _init_restart_nb_states = sizeof(_init_states_restart)/sizeof(ZgAlState);
+static int _init_nb_steps = sizeof(_init_steps)/sizeof(ZgAgStep);
 
 /********************************
  *  New device learning SM      *
  *******************************/
 
+#define NEW_DEVICE_DISCOVERY_TIMEOUT_MS     10000
+
+typedef struct
+{
+    uint16_t addr;
+} NewDeviceContext;
+
 /*** Local variables ***/
-static uint16_t _current_learning_device_addr = 0xFFFD;
-ZgSm *_new_device_sm = NULL;
+/* ZDP responses do not tell which request they answer, so only one device is
+ * learnt at a time */
+static ZgSm *_new_device_sm = NULL;
 
 enum
 {
@@ -154,6 +223,7 @@ enum
     STATE_ACTIVE_ENDPOINT_DISC,
     STATE_SIMPLE_DESC_DISC,
     STATE_SHUTDOWN,
+    NB_STATES
 };
 
 enum
@@ -162,47 +232,78 @@ enum
     EVENT_ACTIVE_ENDPOINTS_RESP,
     EVENT_SIMPLE_DESC_RECEIVED,
     EVENT_ALL_SIMPLE_DESC_RECEIVED,
+    EVENT_TIMEOUT,
+    NB_EVENTS
 };
 
-static void _init_new_device_sm(void)
+static uint16_t _get_learning_device_addr(void)
+{
+    NewDeviceContext *ctx = zg_sm_get_context(_new_device_sm);
+
+    return ctx ? ctx->addr : 0xFFFD;
+}
+
+static void _stop_new_device_sm(void)
+{
+    NewDeviceContext *ctx = zg_sm_get_context(_new_device_sm);
+
+    zg_sm_destroy(_new_device_sm);
+    _new_device_sm = NULL;
+    ZG_VAR_FREE(ctx);
+}
+
+static void _init_new_device_sm(ZgSm *sm, void *ctx __attribute__((unused)))
 {
-    zg_sm_send_event(_new_device_sm, EVENT_INIT_DONE);
+    zg_sm_send_event(sm, EVENT_INIT_DONE);
 }
 
-static void _query_active_endpoints(void)
+static void _query_active_endpoints(ZgSm *sm __attribute__((unused)), void *ctx)
 {
-    zg_zdp_query_active_endpoints(_current_learning_device_addr, NULL);
+    NewDeviceContext *data = ctx;
+
+    zg_zdp_query_active_endpoints(data->addr, NULL);
 }
 
-static void _query_simple_desc(void)
+static void _query_simple_desc(ZgSm *sm __attribute__((unused)), void *ctx)
 {
-    uint8_t endpoint = zg_device_get_next_empty_endpoint(_current_learning_device_addr);
-    zg_zdp_query_simple_descriptor(_current_learning_device_addr, endpoint, NULL);
+    NewDeviceContext *data = ctx;
+    uint8_t endpoint = zg_device_get_next_empty_endpoint(data->addr);
+
+    zg_zdp_query_simple_descriptor(data->addr, endpoint, NULL);
 }
 
-static void _shutdown_new_device_sm(void)
+static void _shutdown_new_device_sm(ZgSm *sm __attribute__((unused)), void *ctx __attribute__((unused)))
 {
     INF("Learning device process finished");
-    _current_learning_device_addr = 0xFFFD;
-    zg_sm_destroy(_new_device_sm);
-    _new_device_sm = NULL;
+    _stop_new_device_sm();
+    /* Rules targeting the new device can now be resolved */
+    zg_rules_refresh();
 }
 
-static ZgSmStateData _new_device_states[] = {
-    {STATE_INIT, _init_new_device_sm},
-    {STATE_ACTIVE_ENDPOINT_DISC, _query_active_endpoints},
-    {STATE_SIMPLE_DESC_DISC, _query_simple_desc},
-    {STATE_SHUTDOWN, _shutdown_new_device_sm}
+static const ZgSmStateData _new_device_states[] = {
+    {STATE_INIT, _init_new_device_sm, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_ACTIVE_ENDPOINT_DISC, _query_active_endpoints, NULL, NEW_DEVICE_DISCOVERY_TIMEOUT_MS, EVENT_TIMEOUT},
+    {STATE_SIMPLE_DESC_DISC, _query_simple_desc, NULL, NEW_DEVICE_DISCOVERY_TIMEOUT_MS, EVENT_TIMEOUT},
+    {STATE_SHUTDOWN, _shutdown_new_device_sm, NULL, ZG_SM_NO_TIMEOUT, 0}
 };
-static ZgSmStateNb _new_device_nb_states = sizeof(_new_device_states)/sizeof(ZgSmStateData);
 
-static ZgSmTransitionData _new_device_transitions[] = {
+static const ZgSmTransitionData _new_device_transitions[] = {
     {STATE_INIT, EVENT_INIT_DONE, STATE_ACTIVE_ENDPOINT_DISC},
     {STATE_ACTIVE_ENDPOINT_DISC, EVENT_ACTIVE_ENDPOINTS_RESP, STATE_SIMPLE_DESC_DISC},
+    {STATE_ACTIVE_ENDPOINT_DISC, EVENT_TIMEOUT, STATE_SHUTDOWN},
     {STATE_SIMPLE_DESC_DISC, EVENT_SIMPLE_DESC_RECEIVED, STATE_SIMPLE_DESC_DISC},
     {STATE_SIMPLE_DESC_DISC, EVENT_ALL_SIMPLE_DESC_RECEIVED, STATE_SHUTDOWN},
+    {STATE_SIMPLE_DESC_DISC, EVENT_TIMEOUT, STATE_SHUTDOWN},
+};
+
+static ZgSmDefinition _new_device_sm_def = {
+    .name = "New device",
+    .states = _new_device_states,
+    .nb_states = NB_STATES,
+    .transitions = _new_device_transitions,
+    .nb_transitions = sizeof(_new_device_transitions)/sizeof(ZgSmTransitionData),
+    .nb_events = NB_EVENTS,
 };
-static ZgSmTransitionNb _new_device_nb_transitions = sizeof(_new_device_transitions)/sizeof(ZgSmTransitionData);
 
 /********************************
  *  Network Events processing   *
@@ -210,38 +311,34 @@ static ZgSmTransitionNb _new_device_nb_transitions = sizeof(_new_device_transiti
 
 static void _send_event_new_device(DeviceId id)
 {
-    json_t *root = NULL;
-
-    root = json_object();
-    if(root)
-        json_object_set_new(root, "id", json_integer(id));
-    else
-        return;
+    ZgInterfacesEvent event;
 
-    zg_interfaces_send_event(EVENT_STR_NEW_DEV, root);
-    json_decref(root);
+    zg_interfaces_event_init(&event, ZG_INTERFACES_EVENT_NEW_DEVICE, id);
+    zg_interfaces_send_event(&event);
 }
 
 static void _start_or_restart_new_device_sm(uint16_t addr)
 {
+    NewDeviceContext *ctx = NULL;
+
     if(_new_device_sm)
+        _stop_new_device_sm();
+
+    ctx = calloc(1, sizeof(NewDeviceContext));
+    if(!ctx)
     {
-        zg_sm_destroy(_new_device_sm);
-        _new_device_sm = NULL;
+        CRI("Cannot allocate memory to learn new device");
+        return;
     }
-
-    _new_device_sm = zg_sm_create(  "New device",
-            _new_device_states,
-            _new_device_nb_states,
-            _new_device_transitions,
-            _new_device_nb_transitions);
+    ctx->addr = addr;
+    _new_device_sm = zg_sm_create(&_new_device_sm_def, ctx);
     if(!_new_device_sm)
     {
         ERR("Abort new device learning");
+        ZG_VAR_FREE(ctx);
         return;
     }
     INF("Start learning new device properties");
-    _current_learning_device_addr = addr;
     zg_sm_start(_new_device_sm);
 }
 
@@ -256,7 +353,7 @@ static void _new_device_cb(uint16_t short_addr, uint64_t ext_addr)
         _send_event_new_device(id);
         _start_or_restart_new_device_sm(short_addr);
     }
-    else if(_new_device_sm && short_addr == _current_learning_device_addr)
+    else if(_new_device_sm && short_addr == _get_learning_device_addr())
     {
         INF("Restart learning procedure for device 0x%04X", short_addr);
         _start_or_restart_new_device_sm(short_addr);
@@ -267,6 +364,18 @@ static void _new_device_cb(uint16_t short_addr, uint64_t ext_addr)
     }
 }
 
+static void _device_annce_cb(uint16_t short_addr, uint64_t ext_addr __attribute__((unused)), uint8_t capabilities)
+{
+    zg_device_set_rx_on_when_idle(short_addr, capabilities & ZG_MT_ZDO_CAPABILITY_RX_ON_WHEN_IDLE);
+    /* Device has just woken up to announce itself */
+    zg_aps_device_awake(short_addr);
+}
+
+static uint8_t _is_device_sleepy(uint16_t short_addr)
+{
+    return !zg_device_is_rx_on_when_idle(short_addr);
+}
+
 static void _active_endpoints_cb(uint16_t short_addr, uint8_t nb_ep, uint8_t *ep_list)
 {
     uint8_t index = 0;
@@ -281,12 +390,17 @@ static void _active_endpoints_cb(uint16_t short_addr, uint8_t nb_ep, uint8_t *ep
 
 static void _simple_desc_cb(uint8_t endpoint, uint16_t profile, uint16_t device_id)
 {
+    uint16_t addr = _get_learning_device_addr();
     uint8_t next_endpoint;
+
+    if(!_new_device_sm)
+        return;
+
     INF("Endpoint 0x%02X of device 0x%04X has profile 0x%04X",
-            endpoint, _current_learning_device_addr, profile);
-    zg_device_update_endpoint_data(_current_learning_device_addr, endpoint, profile, device_id);
+            endpoint, addr, profile);
+    zg_device_update_endpoint_data(addr, endpoint, profile, device_id);
 
-    next_endpoint = zg_device_get_next_empty_endpoint(_current_learning_device_addr);
+    next_endpoint = zg_device_get_next_empty_endpoint(addr);
     if(next_endpoint)
         zg_sm_send_event(_new_device_sm, EVENT_SIMPLE_DESC_RECEIVED);
     else
@@ -300,13 +414,11 @@ static void _simple_desc_cb(uint8_t endpoint, uint16_t profile, uint16_t device_
 
 static void _send_ipc_event_button_state_change(DeviceId id, uint8_t state)
 {
-    json_t *root;
-    root = json_object();
-    json_object_set_new(root, "id", json_integer(id));
-    json_object_set_new(root, "state", json_integer(state));
+    ZgInterfacesEvent event;
 
-    zg_interfaces_send_event(EVENT_STR_BUTTON, root);
-    json_decref(root);
+    zg_interfaces_event_init(&event, ZG_INTERFACES_EVENT_BUTTON, id);
+    zg_interfaces_event_add_int(&event, "state", state);
+    zg_interfaces_send_event(&event);
 }
 
 
@@ -316,52 +428,32 @@ static void _button_change_cb(uint16_t addr, uint8_t state)
 
     INF("Button pressed");
     id = zg_device_get_id(addr);
+    zg_rules_process(id, ZCL_CLUSTER_ON_OFF, state);
     _send_ipc_event_button_state_change(id, state);
 }
 
 static void _send_event_temperature(DeviceId id, uint16_t temp)
 {
-    json_t *root;
-
     if(!_initialized)
         return;
 
-    root = json_object();
-    json_object_set_new(root, "id", json_integer(id));
-    json_object_set_new(root, "temperature", json_integer(temp));
-
-    zg_interfaces_send_event(EVENT_STR_TEMPERATURE, root);
-    json_decref(root);
+    zg_aggregator_push_int(ZG_INTERFACES_EVENT_TEMPERATURE, id, "temperature", temp);
 }
 
 static void _send_event_pressure(DeviceId id, uint16_t temp)
 {
-    json_t *root;
-
     if(!_initialized)
         return;
 
-    root = json_object();
-    json_object_set_new(root, "id", json_integer(id));
-    json_object_set_new(root, "pressure", json_integer(temp));
-
-    zg_interfaces_send_event(EVENT_STR_PRESSURE, root);
-    json_decref(root);
+    zg_aggregator_push_int(ZG_INTERFACES_EVENT_PRESSURE, id, "pressure", temp);
 }
 
 static void _send_event_humidity(DeviceId id, uint16_t temp)
 {
-    json_t *root;
-
     if(!_initialized)
         return;
 
-    root = json_object();
-    json_object_set_new(root, "id", json_integer(id));
-    json_object_set_new(root, "humidity", json_integer(temp));
-
-    zg_interfaces_send_event(EVENT_STR_HUMIDITY, root);
-    json_decref(root);
+    zg_aggregator_push_int(ZG_INTERFACES_EVENT_HUMIDITY, id, "humidity", temp);
 }
 
 static void _temperature_cb(uint16_t addr, int16_t temp)
@@ -370,6 +462,8 @@ static void _temperature_cb(uint16_t addr, int16_t temp)
 
     INF("New temperature report (%.2f°C)",(float)(temp/100.0));
     id = zg_device_get_id(addr);
+    zg_rules_process(id, ZCL_CLUSTER_TEMPERATURE_MEASUREMENT, temp);
+    zg_history_record(id, ZCL_CLUSTER_TEMPERATURE_MEASUREMENT, temp);
     _send_event_temperature(id, temp);
 }
 
@@ -379,6 +473,8 @@ static void _pressure_cb(uint16_t addr __attribute((unused)), int16_t pressure)
 
     INF("New pressure report (%.2fkPa)",(float)(pressure/10.0));
     id = zg_device_get_id(addr);
+    zg_rules_process(id, ZCL_CLUSTER_PRESSURE_MEASUREMENT, pressure);
+    zg_history_record(id, ZCL_CLUSTER_PRESSURE_MEASUREMENT, pressure);
     _send_event_pressure(id, pressure);
 }
 
@@ -388,15 +484,26 @@ static void _humidity_cb(uint16_t addr __attribute((unused)), uint16_t humidity)
 
     INF("New humidity report (%.2f%%)",(float)(humidity/100.0));
     id = zg_device_get_id(addr);
+    zg_rules_process(id, ZCL_CLUSTER_HUMIDITY_MEASUREMENT, humidity);
+    zg_history_record(id, ZCL_CLUSTER_HUMIDITY_MEASUREMENT, humidity);
     _send_event_humidity(id, humidity);
 }
 
-static void _process_command_touchlink()
+static void _process_command_touchlink(StdinCommand cmd)
 {
-    if(_initialized)
-        zg_zll_start_touchlink();
-    else
+    if(!_initialized)
+    {
         WRN("Core application has not finished initializing, cannot start touchlink");
+        return;
+    }
+
+    /* From stdin, identify and reset target the best candidate of last scan */
+    if(cmd == ZG_STDIN_COMMAND_TOUCHLINK_IDENTIFY)
+        zg_zll_touchlink_identify(0);
+    else if(cmd == ZG_STDIN_COMMAND_TOUCHLINK_RESET)
+        zg_zll_touchlink_reset(0);
+    else
+        zg_zll_start_touchlink();
 }
 
 static void _process_command_switch_light()
@@ -433,7 +540,7 @@ static void _process_command_move_predefined_color(uint16_t x, uint16_t y)
     {
         addr = zg_device_get_short_addr(DEMO_DEVICE_ID);
         if(addr != 0xFFFD)
-            zg_zha_move_to_color(addr, x, y, 1);
+            zg_zha_move_to_color(addr, DEMO_DEVICE_ENDPOINT, x, y, 10);
         else
             WRN("Device is not installed, cannot switch light to predefined color");
     }
@@ -454,7 +561,9 @@ static void _process_user_command(StdinCommand cmd)
     switch(cmd)
     {
         case ZG_STDIN_COMMAND_TOUCHLINK:
-            _process_command_touchlink();
+        case ZG_STDIN_COMMAND_TOUCHLINK_IDENTIFY:
+        case ZG_STDIN_COMMAND_TOUCHLINK_RESET:
+            _process_command_touchlink(cmd);
             break;
         case ZG_STDIN_COMMAND_SWITCH_DEMO_LIGHT:
             _process_command_switch_light();
@@ -483,6 +592,7 @@ int zg_core_init(uint8_t reset_network)
 {
     _log_domain = zg_logs_domain_register("zg_core", ZG_COLOR_BLACK);
     INF("Initializing core application");
+    zg_worker_init();
 
     _reset_network = reset_network;
     _reset_network |= !zg_keys_check_network_key_exists();
@@ -493,6 +603,8 @@ int zg_core_init(uint8_t reset_network)
     {
         return 1;
     }
+    zg_rules_init();
+    zg_history_init();
 
     zg_stdin_register_command_cb(_process_user_command);
     zg_zha_register_device_ind_callback(_new_device_cb);
@@ -502,27 +614,45 @@ int zg_core_init(uint8_t reset_network)
     zg_zha_register_humidity_cb(_humidity_cb);
     zg_zdp_register_active_endpoints_rsp(_active_endpoints_cb);
     zg_zdp_register_simple_desc_rsp(_simple_desc_cb);
+    zg_mt_zdo_register_device_annce_cb(_device_annce_cb);
+    zg_aps_register_sleepy_device_callback(_is_device_sleepy);
     zg_interfaces_init();
     zg_mt_init();
     zg_keys_init();
+    zg_topology_init();
+    zg_routes_init();
+    zg_bindings_init();
+    zg_polling_init();
 
-    if(_reset_network)
-        _init_sm = zg_al_create(_init_states_reset, _init_reset_nb_states);
-    else
-        _init_sm = zg_al_create(_init_states_restart, _init_restart_nb_states);
-    zg_al_continue(_init_sm);
+    _init_ag = zg_ag_create(_init_steps, _init_nb_steps, _init_done_cb);
+    if(!_init_ag)
+    {
+        CRI("Cannot create core initialization steps");
+        return 1;
+    }
+    zg_ag_run(_init_ag);
 
     return 0;
 }
 
 void zg_core_shutdown(void)
 {
+    zg_ag_destroy(_init_ag);
+    _init_ag = NULL;
+    zg_polling_shutdown();
+    zg_bindings_shutdown();
+    zg_routes_shutdown();
+    zg_topology_shutdown();
+    zg_history_shutdown();
+    zg_rules_shutdown();
     zg_device_shutdown();
     zg_keys_shutdown();
     zg_zll_shutdown();
     zg_zha_shutdown();
+    zg_ota_shutdown();
     zg_zdp_shutdown();
     zg_interfaces_shutdown();
     zg_mt_init();
+    zg_worker_shutdown();
 }
 
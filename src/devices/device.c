@@ -10,12 +10,15 @@
 #include "device.h"
 #include "utils.h"
 #include "conf.h"
+#include "worker.h"
 
 /********************************
  *    Constants and macros      *
  *******************************/
 
 #define DEVICES_NB_INDENT       4
+/* All device list saves go through the same worker so that they are written in order */
+#define DEVICES_WORKER_KEY      0
 
 /********************************
  *          Data types          *
@@ -34,14 +37,36 @@ typedef struct
     uint16_t short_addr;
     uint64_t ext_addr;
     Eina_List *endpoints;
+    /* Bindings which must be kept in device binding table */
+    Eina_List *bindings;
+    /* Cleared for sleepy end devices, which only receive data when polling */
+    uint8_t rx_on_when_idle;
+    /* Device list version of the last change of the device */
+    uint32_t version;
 } DeviceData;
 
+typedef struct
+{
+    json_t *root;
+    const char *path;
+    int status;
+} DeviceListSave;
+
 /********************************
  *          Local variables     *
  *******************************/
 
 static Eina_List *_device_list = NULL;
 static int _log_domain = -1;
+/* Increased on every change of the device list, and saved with it */
+static uint32_t _version = 0;
+/* Changes older than this version are unknown (e.g. done before gateway
+ * restart), a client holding an older version must get the whole list */
+static uint32_t _full_since = 0;
+/* Device list built once per version, and its serialized form */
+static json_t *_snapshot = NULL;
+static char *_snapshot_dump = NULL;
+static size_t _snapshot_len = 0;
 
 /********************************
  *  Device data retrievement    *
@@ -141,20 +166,39 @@ static DeviceData *_create_device_data( DeviceId id,
         result->id = id;
         result->short_addr = short_addr;
         result->ext_addr = ext_addr;
+        result->rx_on_when_idle = 1;
     }
     return result;
 }
 
 static void _destroy_device_data(DeviceData *data)
 {
+    ZgDeviceBinding *binding = NULL;
+
     if(data)
     {
         _destroy_endpoints_list(data);
+        EINA_LIST_FREE(data->bindings, binding)
+            free(binding);
     }
 
     ZG_VAR_FREE(data);
 }
 
+static DeviceData *_get_device_by_id(DeviceId id)
+{
+    Eina_List *l;
+    DeviceData *data;
+
+    EINA_LIST_FOREACH(_device_list, l, data)
+    {
+        if(data->id == id)
+            break;
+    }
+
+    return data;
+}
+
 static DeviceData *_get_device_by_ext_addr(uint64_t ext_addr)
 {
     Eina_List *l;
@@ -169,6 +213,23 @@ static DeviceData *_get_device_by_ext_addr(uint64_t ext_addr)
     return data;
 }
 
+static ZgDeviceBinding *_get_binding(DeviceData *data, ZgDeviceBinding *binding)
+{
+    Eina_List *l = NULL;
+    ZgDeviceBinding *current = NULL;
+
+    EINA_LIST_FOREACH(data->bindings, l, current)
+    {
+        if(current->src_endpoint == binding->src_endpoint &&
+                current->cluster == binding->cluster &&
+                current->dst_addr_mode == binding->dst_addr_mode &&
+                current->dst_addr == binding->dst_addr &&
+                current->dst_endpoint == binding->dst_endpoint)
+            return current;
+    }
+    return NULL;
+}
+
 
 
 /********************************
@@ -262,6 +323,30 @@ static void _load_endpoint_data(DeviceData *data, json_t *endpoint)
     json_decref(profile);
 }
 
+static void _load_binding_data(DeviceData *data, json_t *binding)
+{
+    ZgDeviceBinding *entry = NULL;
+
+    if(!json_is_object(binding) || !json_is_integer(json_object_get(binding, "cluster")))
+    {
+        ERR("Cannot load binding data for device 0x%04X", data->short_addr);
+        return;
+    }
+
+    entry = calloc(1, sizeof(ZgDeviceBinding));
+    if(!entry)
+    {
+        CRI("Cannot allocate memory for binding of device 0x%04X", data->short_addr);
+        return;
+    }
+    entry->src_endpoint = json_integer_value(json_object_get(binding, "src_endpoint"));
+    entry->cluster = json_integer_value(json_object_get(binding, "cluster"));
+    entry->dst_addr_mode = json_integer_value(json_object_get(binding, "dst_addr_mode"));
+    entry->dst_addr = json_integer_value(json_object_get(binding, "dst_addr"));
+    entry->dst_endpoint = json_integer_value(json_object_get(binding, "dst_endpoint"));
+    data->bindings = eina_list_append(data->bindings, entry);
+}
+
 static void _load_device_data(json_t *device)
 {
     /* Saved data */
@@ -269,6 +354,8 @@ static void _load_device_data(json_t *device)
     json_t *short_addr = NULL;
     json_t *ext_addr = NULL;
     json_t *endpoints;
+    json_t *bindings;
+    json_t *rx_on_when_idle;
     DeviceData *data = NULL;
     uint8_t ep_index;
     json_t *ep = NULL;
@@ -299,6 +386,17 @@ static void _load_device_data(json_t *device)
                     _load_endpoint_data(data, ep);
                 }
             }
+            bindings = json_object_get(device, "bindings");
+            if(bindings && json_is_array(bindings))
+            {
+                json_array_foreach(bindings, ep_index, ep)
+                {
+                    _load_binding_data(data, ep);
+                }
+            }
+            rx_on_when_idle = json_object_get(device, "rx_on_when_idle");
+            if(json_is_boolean(rx_on_when_idle))
+                data->rx_on_when_idle = json_is_true(rx_on_when_idle);
         }
 
         else
@@ -331,6 +429,7 @@ static void _load_device_list()
             device_path, error.source, error.line, error.column, error.text);
         return;
     }
+    _version = json_integer_value(json_object_get(root, "version"));
     array = json_object_get(root, "devices");
     if(!array)
     {
@@ -359,6 +458,15 @@ void _free_device_list()
         _destroy_device_data(data);
 }
 
+static uint32_t _load_version(void)
+{
+    json_t *root = json_load_file(zg_conf_get_device_list_path(), 0, NULL);
+    uint32_t version = json_integer_value(json_object_get(root, "version"));
+
+    json_decref(root);
+    return version;
+}
+
 void _del_device_list(void)
 {
     unlink(zg_conf_get_device_list_path());
@@ -377,10 +485,26 @@ static json_t *_build_endpoint_data_json(EndpointData *data)
     return endpoint;
 }
 
+static json_t *_build_binding_data_json(ZgDeviceBinding *binding)
+{
+    json_t *result = json_object();
+
+    if(json_object_set_new(result, "src_endpoint", json_integer(binding->src_endpoint)) ||
+            json_object_set_new(result, "cluster", json_integer(binding->cluster)) ||
+            json_object_set_new(result, "dst_addr_mode", json_integer(binding->dst_addr_mode)) ||
+            json_object_set_new(result, "dst_addr", json_integer(binding->dst_addr)) ||
+            json_object_set_new(result, "dst_endpoint", json_integer(binding->dst_endpoint)))
+    {
+        ERR("Cannot build json object for binding of cluster 0x%04X", binding->cluster);
+    }
+    return result;
+}
+
 static json_t *_build_device_data_json(DeviceData *data)
 {
-    json_t *endpoints = NULL, *endpoint = NULL, *device = NULL;
+    json_t *endpoints = NULL, *endpoint = NULL, *device = NULL, *bindings = NULL;
     EndpointData *current_endpoint = NULL;
+    ZgDeviceBinding *binding = NULL;
     Eina_List *l = NULL;
 
     endpoints = json_array();
@@ -393,12 +517,17 @@ static json_t *_build_device_data_json(DeviceData *data)
             json_decref(endpoint);
         }
     }
+    bindings = json_array();
+    EINA_LIST_FOREACH(data->bindings, l, binding)
+        json_array_append_new(bindings, _build_binding_data_json(binding));
     device = json_object();
 
     if( json_object_set_new(device, "id", json_integer(data->id))                   ||
             json_object_set_new(device, "short_addr", json_integer(data->short_addr))   ||
             json_object_set_new(device, "ext_addr", json_integer(data->ext_addr))       ||
-            json_object_set_new(device, "endpoints", endpoints ))
+            json_object_set_new(device, "endpoints", endpoints )                        ||
+            json_object_set_new(device, "bindings", bindings)                       ||
+            json_object_set_new(device, "rx_on_when_idle", json_boolean(data->rx_on_when_idle)))
     {
         ERR("Cannot build json value to save device %d", data->id);
         json_decref(device);
@@ -407,54 +536,99 @@ static json_t *_build_device_data_json(DeviceData *data)
     return device;
 }
 
-static void _save_device_list()
+/* Run on a worker thread, the JSON tree being owned by the save job */
+static void _save_device_list_work(void *data)
+{
+    DeviceListSave *save = (DeviceListSave *)data;
+
+    save->status = json_dump_file(save->root, save->path, JSON_INDENT(DEVICES_NB_INDENT));
+}
+
+static void _save_device_list_done(void *data)
+{
+    DeviceListSave *save = (DeviceListSave *)data;
+
+    if(save->status)
+        ERR("Cannot save device list in file %s", save->path);
+    json_decref(save->root);
+    free(save);
+}
+
+/* Devices changed since version, all devices if version is 0 */
+static json_t *_build_devices_json(uint32_t version)
 {
     DeviceData *data = NULL;
     Eina_List *l = NULL;
-    json_t *root = NULL, *array = NULL, *device = NULL;
-    const char *device_path = zg_conf_get_device_list_path();
+    json_t *array = NULL, *device = NULL;
 
     array = json_array();
     EINA_LIST_FOREACH(_device_list, l, data)
     {
+        if(version && data->version <= version)
+            continue;
         device = _build_device_data_json(data);
         if(device)
         {
             json_array_append(array, device);
             json_decref(device);
         }
-        INF("Stored data for device 0x%04X", data->short_addr);
     }
+    return array;
+}
+
+static void _save_device_list()
+{
+    json_t *root = NULL;
+    DeviceListSave *save = NULL;
 
+    INF("Storing device list (version %u)", _version);
     root = json_object();
-    json_object_set_new(root, "devices", array);
-    if(json_dump_file(root, device_path, JSON_INDENT(DEVICES_NB_INDENT)))
-        ERR("Cannot save device list in file %s", device_path);
+    json_object_set_new(root, "version", json_integer(_version));
+    json_object_set_new(root, "devices", _build_devices_json(0));
 
-    json_decref(root);
+    /* Tree is built on main loop since it walks the device list, only file
+     * writing is deferred */
+    save = calloc(1, sizeof(DeviceListSave));
+    if(!save)
+    {
+        CRI("Cannot allocate memory to save device list");
+        json_decref(root);
+        return;
+    }
+    save->root = root;
+    save->path = zg_conf_get_device_list_path();
+    if(zg_worker_submit(DEVICES_WORKER_KEY, _save_device_list_work, _save_device_list_done, save) != 0)
+    {
+        save->status = -1;
+        _save_device_list_done(save);
+    }
 }
 
-static json_t *_get_device_list_json(void)
+static void _free_snapshot(void)
 {
-    DeviceData *data = NULL;
-    Eina_List *l = NULL;
-    json_t *root = NULL, *array = NULL, *device = NULL;
+    if(_snapshot)
+        json_decref(_snapshot);
+    _snapshot = NULL;
+    ZG_VAR_FREE(_snapshot_dump);
+    _snapshot_len = 0;
+}
 
-    array = json_array();
-    EINA_LIST_FOREACH(_device_list, l, data)
+static json_t *_get_snapshot(void)
+{
+    if(!_snapshot)
     {
-        device = _build_device_data_json(data);
-        if(device)
-        {
-            json_array_append(array, device);
-            json_decref(device);
-        }
-        INF("Stored data for device 0x%04X", data->short_addr);
+        _snapshot = json_object();
+        json_object_set_new(_snapshot, "version", json_integer(_version));
+        json_object_set_new(_snapshot, "devices", _build_devices_json(0));
     }
+    return _snapshot;
+}
 
-    root = json_object();
-    json_object_set_new(root, "devices", array);
-    return root;
+static void _device_changed(DeviceData *data)
+{
+    data->version = ++_version;
+    _free_snapshot();
+    _save_device_list();
 }
 
 /********************************
@@ -476,9 +650,15 @@ int zg_device_init(uint8_t reset_device)
     }
 
     if(reset_device)
+    {
+        /* Version keeps increasing so that clients notice the reset */
+        _version = _load_version() + 1;
         _del_device_list();
+        _save_device_list();
+    }
     else
         _load_device_list();
+    _full_since = _version;
 
     return 0;
 }
@@ -486,6 +666,7 @@ int zg_device_init(uint8_t reset_device)
 void zg_device_shutdown()
 {
     _free_device_list();
+    _free_snapshot();
     eina_shutdown();
 }
 
@@ -499,7 +680,7 @@ int zg_add_device(uint16_t short_addr, uint64_t ext_addr)
     {
         INF("Device already exists in device base, updating its data");
         data->short_addr = short_addr;
-        _save_device_list();
+        _device_changed(data);
         return -1;
     }
 
@@ -515,7 +696,7 @@ int zg_add_device(uint16_t short_addr, uint64_t ext_addr)
         {
             INF("Saving new device with id %d", tmp_id);
             _add_device_to_list(data);
-            _save_device_list();
+            _device_changed(data);
         }
         else
         {
@@ -590,7 +771,7 @@ void zg_device_update_endpoints(uint16_t short_addr, uint8_t nb_ep, uint8_t *ep_
     {
         _add_endpoint(data, ep_list[index]);
     }
-    _save_device_list();
+    _device_changed(data);
 }
 
 void zg_device_update_endpoint_data(uint16_t addr, uint8_t endpoint, uint16_t profile, uint16_t device_id)
@@ -605,7 +786,7 @@ void zg_device_update_endpoint_data(uint16_t addr, uint8_t endpoint, uint16_t pr
         {
             ep->profile = profile;
             ep->device_id = device_id;
-            _save_device_list();
+            _device_changed(device);
         }
     }
 }
@@ -634,7 +815,40 @@ uint8_t zg_device_get_next_empty_endpoint(uint16_t addr)
 
 json_t *zg_device_get_device_list_json(void)
 {
-    return _get_device_list_json();
+    return json_incref(_get_snapshot());
+}
+
+const char *zg_device_get_device_list_dump(size_t *len)
+{
+    if(!_snapshot_dump)
+    {
+        _snapshot_dump = json_dumps(_get_snapshot(), JSON_COMPACT);
+        if(!_snapshot_dump)
+        {
+            ERR("Cannot encode device list");
+            return NULL;
+        }
+        _snapshot_len = strlen(_snapshot_dump);
+    }
+    if(len)
+        *len = _snapshot_len;
+    return _snapshot_dump;
+}
+
+uint32_t zg_device_get_version(void)
+{
+    return _version;
+}
+
+json_t *zg_device_get_device_list_since_json(uint32_t version)
+{
+    uint8_t full = (version < _full_since || version > _version);
+    json_t *root = json_object();
+
+    json_object_set_new(root, "version", json_integer(_version));
+    json_object_set_new(root, "full", json_boolean(full));
+    json_object_set_new(root, "devices", _build_devices_json(full ? 0 : version));
+    return root;
 }
 
 int zg_device_zha_endpoint_get(uint16_t short_addr)
@@ -655,6 +869,109 @@ int zg_device_zha_endpoint_get(uint16_t short_addr)
     return -1;
 }
 
+uint64_t zg_device_get_ext_addr(DeviceId id)
+{
+    DeviceData *data = _get_device_by_id(id);
+
+    return data ? data->ext_addr : 0;
+}
+
+void zg_device_foreach(ZgDeviceForeachCb cb, void *data)
+{
+    Eina_List *l = NULL, *l_next = NULL;
+    DeviceData *device = NULL;
+
+    if(!cb)
+        return;
+
+    EINA_LIST_FOREACH_SAFE(_device_list, l, l_next, device)
+        cb(device->id, data);
+}
+
+uint8_t zg_device_add_binding(DeviceId id, ZgDeviceBinding *binding)
+{
+    DeviceData *data = _get_device_by_id(id);
+    ZgDeviceBinding *entry = NULL;
+
+    if(!data || !binding)
+    {
+        ERR("Cannot save binding for device %d : device is unknown", id);
+        return 1;
+    }
+    if(_get_binding(data, binding))
+        return 0;
+
+    entry = calloc(1, sizeof(ZgDeviceBinding));
+    if(!entry)
+    {
+        CRI("Cannot allocate memory for binding of device %d", id);
+        return 1;
+    }
+    memcpy(entry, binding, sizeof(ZgDeviceBinding));
+    data->bindings = eina_list_append(data->bindings, entry);
+    INF("Saving binding of cluster 0x%04X for device %d", binding->cluster, id);
+    _device_changed(data);
+    return 0;
+}
+
+uint8_t zg_device_remove_binding(DeviceId id, ZgDeviceBinding *binding)
+{
+    DeviceData *data = _get_device_by_id(id);
+    ZgDeviceBinding *entry = NULL;
 
+    if(!data || !binding)
+    {
+        ERR("Cannot remove binding for device %d : device is unknown", id);
+        return 1;
+    }
+    entry = _get_binding(data, binding);
+    if(!entry)
+        return 0;
 
+    data->bindings = eina_list_remove(data->bindings, entry);
+    free(entry);
+    INF("Removing binding of cluster 0x%04X for device %d", binding->cluster, id);
+    _device_changed(data);
+    return 0;
+}
 
+int zg_device_get_bindings(DeviceId id, ZgDeviceBinding **bindings)
+{
+    DeviceData *data = _get_device_by_id(id);
+    ZgDeviceBinding *entry = NULL;
+    Eina_List *l = NULL;
+    int count = 0;
+
+    *bindings = NULL;
+    if(!data || !data->bindings)
+        return 0;
+
+    *bindings = calloc(eina_list_count(data->bindings), sizeof(ZgDeviceBinding));
+    if(!*bindings)
+    {
+        CRI("Cannot allocate memory to retrieve bindings of device %d", id);
+        return 0;
+    }
+    EINA_LIST_FOREACH(data->bindings, l, entry)
+        memcpy(&(*bindings)[count++], entry, sizeof(ZgDeviceBinding));
+    return count;
+}
+
+void zg_device_set_rx_on_when_idle(uint16_t short_addr, uint8_t rx_on_when_idle)
+{
+    DeviceData *data = _get_device_by_short_addr(short_addr);
+
+    if(!data || data->rx_on_when_idle == !!rx_on_when_idle)
+        return;
+
+    INF("Device %d is %s", data->id, rx_on_when_idle ? "always listening" : "a sleepy end device");
+    data->rx_on_when_idle = !!rx_on_when_idle;
+    _device_changed(data);
+}
+
+uint8_t zg_device_is_rx_on_when_idle(uint16_t short_addr)
+{
+    DeviceData *data = _get_device_by_short_addr(short_addr);
+
+    return data ? data->rx_on_when_idle : 1;
+}
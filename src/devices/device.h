@@ -6,6 +6,18 @@
 #define ZG_DEVICE_ID_MAX    255
 typedef uint8_t (DeviceId);
 
+/* Binding table entry of a device. dst_addr is a group id with group
+ * addressing mode, otherwise an extended address */
+typedef struct
+{
+    uint8_t src_endpoint;
+    uint16_t cluster;
+    uint8_t dst_addr_mode;
+    uint64_t dst_addr;
+    uint8_t dst_endpoint;
+} ZgDeviceBinding;
+
+typedef void (*ZgDeviceForeachCb)(DeviceId id, void *data);
 
 int zg_device_init(uint8_t reset_network);
 void zg_device_shutdown();
@@ -16,8 +28,25 @@ uint8_t zg_device_is_device_known(uint64_t ext_addr);
 void zg_device_update_endpoints(uint16_t short_addr, uint8_t nb_ep, uint8_t *ep_list);
 void zg_device_update_endpoint_data(uint16_t addr, uint8_t endpoint, uint16_t profile, uint16_t device_id);
 uint8_t zg_device_get_next_empty_endpoint(uint16_t addr);
+/* Device list is built once per version of the list, and shared : returned
+ * tree must not be modified, only released with json_decref */
 json_t *zg_device_get_device_list_json(void);
+/* Serialized device list, valid until next change of the list */
+const char *zg_device_get_device_list_dump(size_t *len);
+/* Version of the device list, increased on every change of a device */
+uint32_t zg_device_get_version(void);
+/* Devices changed since version, or all devices with "full" set if changes
+ * since version are unknown */
+json_t *zg_device_get_device_list_since_json(uint32_t version);
 int zg_device_zha_endpoint_get(uint16_t short_addr);
+uint64_t zg_device_get_ext_addr(DeviceId id);
+void zg_device_foreach(ZgDeviceForeachCb cb, void *data);
+uint8_t zg_device_add_binding(DeviceId id, ZgDeviceBinding *binding);
+uint8_t zg_device_remove_binding(DeviceId id, ZgDeviceBinding *binding);
+int zg_device_get_bindings(DeviceId id, ZgDeviceBinding **bindings);
+void zg_device_set_rx_on_when_idle(uint16_t short_addr, uint8_t rx_on_when_idle);
+/* Unknown devices are considered as always listening */
+uint8_t zg_device_is_rx_on_when_idle(uint16_t short_addr);
 
 #endif
 
@@ -0,0 +1,602 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <uv.h>
+#include <Eina.h>
+#include "history.h"
+#include "conf.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *    Constants and macros      *
+ *******************************/
+
+#define HISTORY_MAGIC                   0x5347485A  /* "ZHGS" */
+#define HISTORY_VERSION                 1
+#define HISTORY_DEFAULT_MAX_SERIES      32
+#define HISTORY_SYNC_INTERVAL_MS        (60 * 1000)
+
+/* Raw samples : a sample takes 2 to 4 bytes once delta encoded, so blocks
+ * hold around a thousand samples */
+#define HISTORY_RAW_BLOCKS              16
+#define HISTORY_BLOCK_DATA_LEN          240
+/* Longest encoding of a sample : two 64 bits varints */
+#define HISTORY_MAX_SAMPLE_LEN          20
+
+#define HISTORY_MINUTE_POINTS           1440    /* One day */
+#define HISTORY_HOUR_POINTS             720     /* 30 days */
+#define HISTORY_DAY_POINTS              366     /* One year */
+#define HISTORY_NB_POINTS               (HISTORY_MINUTE_POINTS + HISTORY_HOUR_POINTS + HISTORY_DAY_POINTS)
+#define HISTORY_NB_LEVELS               3
+
+#define HISTORY_KEY(id, cluster)        (((uint32_t)(id) << 16) | (cluster))
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+/* Following structures are stored as is in history file */
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t series_size;
+    uint32_t max_series;
+} HistoryHeader;
+
+typedef struct
+{
+    uint32_t start;
+    int32_t avg;
+    int32_t min;
+    int32_t max;
+} HistoryPoint;
+
+/* Point being built */
+typedef struct
+{
+    int64_t sum;
+    uint32_t start;
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+} HistoryAccumulator;
+
+typedef struct
+{
+    uint32_t head;
+    uint32_t count;
+} HistoryRing;
+
+typedef struct
+{
+    uint32_t base_time;
+    int32_t base_value;
+    uint32_t last_time;
+    int32_t last_value;
+    uint16_t nb_samples;
+    uint16_t len;
+    uint8_t data[HISTORY_BLOCK_DATA_LEN];
+} HistoryBlock;
+
+typedef struct
+{
+    uint8_t used;
+    DeviceId id;
+    uint16_t cluster;
+    uint32_t current_block;
+    uint32_t nb_blocks;
+    HistoryBlock blocks[HISTORY_RAW_BLOCKS];
+    HistoryAccumulator accumulators[HISTORY_NB_LEVELS];
+    HistoryRing rings[HISTORY_NB_LEVELS];
+    HistoryPoint points[HISTORY_NB_POINTS];
+} HistorySeries;
+
+typedef struct
+{
+    const char *name;
+    uint32_t period;
+    uint32_t size;
+    uint32_t offset;
+} HistoryLevel;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uint8_t *_map = NULL;
+static size_t _map_len = 0;
+static uint8_t _persistent = 0;
+static uint8_t _dirty = 0;
+static uint32_t _max_series = HISTORY_DEFAULT_MAX_SERIES;
+static HistorySeries *_series = NULL;
+/* HistorySeries, indexed by device and cluster */
+static Eina_Hash *_index = NULL;
+static uv_timer_t _sync_timer;
+
+static const HistoryLevel _levels[HISTORY_NB_LEVELS] =
+{
+    {"minute", 60, HISTORY_MINUTE_POINTS, 0},
+    {"hour", 3600, HISTORY_HOUR_POINTS, HISTORY_MINUTE_POINTS},
+    {"day", 86400, HISTORY_DAY_POINTS, HISTORY_MINUTE_POINTS + HISTORY_HOUR_POINTS}
+};
+
+/********************************
+ *       Delta encoding         *
+ *******************************/
+
+/* Signed values are zigzag encoded, so that small negative deltas are short */
+static int _encode_varint(uint8_t *buffer, int64_t value)
+{
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    int len = 0;
+
+    do
+    {
+        buffer[len] = zigzag & 0x7F;
+        zigzag >>= 7;
+        if(zigzag)
+            buffer[len] |= 0x80;
+        len++;
+    } while(zigzag);
+    return len;
+}
+
+static int _decode_varint(const uint8_t *buffer, int len, int64_t *value)
+{
+    uint64_t zigzag = 0;
+    int shift = 0;
+    int index = 0;
+
+    do
+    {
+        if(index >= len || shift > 63)
+            return -1;
+        zigzag |= (uint64_t)(buffer[index] & 0x7F) << shift;
+        shift += 7;
+    } while(buffer[index++] & 0x80);
+
+    *value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return index;
+}
+
+static void _start_block(HistoryBlock *block, uint32_t time, int32_t value)
+{
+    memset(block, 0, sizeof(HistoryBlock));
+    block->base_time = time;
+    block->base_value = value;
+    block->last_time = time;
+    block->last_value = value;
+    block->nb_samples = 1;
+}
+
+static void _record_raw(HistorySeries *series, uint32_t time, int32_t value)
+{
+    HistoryBlock *block = &series->blocks[series->current_block];
+    uint8_t sample[HISTORY_MAX_SAMPLE_LEN];
+    int len = 0;
+
+    if(!series->nb_blocks)
+    {
+        series->nb_blocks = 1;
+        _start_block(block, time, value);
+        return;
+    }
+
+    len = _encode_varint(sample, (int64_t)time - block->last_time);
+    len += _encode_varint(sample + len, (int64_t)value - block->last_value);
+    if(block->len + len > HISTORY_BLOCK_DATA_LEN)
+    {
+        /* Oldest block is overwritten once all blocks are used */
+        series->current_block = (series->current_block + 1) % HISTORY_RAW_BLOCKS;
+        if(series->nb_blocks < HISTORY_RAW_BLOCKS)
+            series->nb_blocks++;
+        _start_block(&series->blocks[series->current_block], time, value);
+        return;
+    }
+
+    memcpy(block->data + block->len, sample, len);
+    block->len += len;
+    block->nb_samples++;
+    block->last_time = time;
+    block->last_value = value;
+}
+
+/********************************
+ *           Rollups            *
+ *******************************/
+
+static void _push_point(HistorySeries *series, int level, HistoryAccumulator *accumulator)
+{
+    HistoryRing *ring = &series->rings[level];
+    HistoryPoint *point = &series->points[_levels[level].offset + ring->head];
+
+    point->start = accumulator->start;
+    point->avg = accumulator->sum / accumulator->count;
+    point->min = accumulator->min;
+    point->max = accumulator->max;
+    ring->head = (ring->head + 1) % _levels[level].size;
+    if(ring->count < _levels[level].size)
+        ring->count++;
+}
+
+static void _record_rollups(HistorySeries *series, uint32_t time, int32_t value)
+{
+    HistoryAccumulator *accumulator = NULL;
+    uint32_t start = 0;
+    int level = 0;
+
+    for(level = 0; level < HISTORY_NB_LEVELS; level++)
+    {
+        accumulator = &series->accumulators[level];
+        start = time - time % _levels[level].period;
+        if(accumulator->count && accumulator->start != start)
+        {
+            _push_point(series, level, accumulator);
+            accumulator->count = 0;
+        }
+        if(!accumulator->count)
+        {
+            accumulator->start = start;
+            accumulator->sum = 0;
+            accumulator->min = value;
+            accumulator->max = value;
+        }
+        accumulator->sum += value;
+        accumulator->count++;
+        if(value < accumulator->min)
+            accumulator->min = value;
+        if(value > accumulator->max)
+            accumulator->max = value;
+    }
+}
+
+/********************************
+ *           Queries            *
+ *******************************/
+
+static json_t *_build_point_json(uint32_t start, int32_t avg, int32_t min, int32_t max)
+{
+    json_t *point = json_array();
+
+    json_array_append_new(point, json_integer(start));
+    json_array_append_new(point, json_integer(avg));
+    json_array_append_new(point, json_integer(min));
+    json_array_append_new(point, json_integer(max));
+    return point;
+}
+
+static json_t *_build_raw_sample_json(uint32_t time, int32_t value)
+{
+    json_t *sample = json_array();
+
+    json_array_append_new(sample, json_integer(time));
+    json_array_append_new(sample, json_integer(value));
+    return sample;
+}
+
+static HistoryBlock *_get_oldest_block(HistorySeries *series, uint32_t *index)
+{
+    if(!series->nb_blocks)
+        return NULL;
+    *index = (series->current_block + HISTORY_RAW_BLOCKS + 1 - series->nb_blocks) % HISTORY_RAW_BLOCKS;
+    return &series->blocks[*index];
+}
+
+static void _get_raw_samples(HistorySeries *series, uint32_t from, uint32_t to, json_t *points)
+{
+    HistoryBlock *block = NULL;
+    uint32_t index = 0;
+    uint32_t nb = 0;
+    int64_t time = 0, value = 0, delta = 0;
+    int offset = 0, len = 0;
+
+    if(!_get_oldest_block(series, &index))
+        return;
+
+    for(nb = 0; nb < series->nb_blocks; nb++, index = (index + 1) % HISTORY_RAW_BLOCKS)
+    {
+        block = &series->blocks[index];
+        time = block->base_time;
+        value = block->base_value;
+        offset = 0;
+        while(1)
+        {
+            if(time >= from && time <= to)
+                json_array_append_new(points, _build_raw_sample_json(time, value));
+            if(offset >= block->len)
+                break;
+            len = _decode_varint(block->data + offset, block->len - offset, &delta);
+            if(len < 0)
+                break;
+            offset += len;
+            time += delta;
+            len = _decode_varint(block->data + offset, block->len - offset, &delta);
+            if(len < 0)
+                break;
+            offset += len;
+            value += delta;
+        }
+    }
+}
+
+static void _get_points(HistorySeries *series, int level, uint32_t from, uint32_t to, json_t *points)
+{
+    HistoryRing *ring = &series->rings[level];
+    HistoryAccumulator *accumulator = &series->accumulators[level];
+    HistoryPoint *point = NULL;
+    uint32_t period = _levels[level].period;
+    uint32_t size = _levels[level].size;
+    uint32_t index = (ring->head + size - ring->count) % size;
+    uint32_t nb = 0;
+
+    for(nb = 0; nb < ring->count; nb++, index = (index + 1) % size)
+    {
+        point = &series->points[_levels[level].offset + index];
+        if(point->start + period > from && point->start <= to)
+            json_array_append_new(points, _build_point_json(point->start, point->avg, point->min, point->max));
+    }
+
+    /* Point being built is given as is */
+    if(accumulator->count && accumulator->start + period > from && accumulator->start <= to)
+        json_array_append_new(points, _build_point_json(accumulator->start,
+                    accumulator->sum / accumulator->count, accumulator->min, accumulator->max));
+}
+
+/* Raw level is -1 */
+static int _get_level(const char *resolution)
+{
+    int level = 0;
+
+    if(!strcmp(resolution, "raw"))
+        return -1;
+    for(level = 0; level < HISTORY_NB_LEVELS; level++)
+    {
+        if(!strcmp(resolution, _levels[level].name))
+            return level;
+    }
+    return HISTORY_NB_LEVELS;
+}
+
+static uint32_t _get_level_oldest(HistorySeries *series, int level)
+{
+    HistoryRing *ring = &series->rings[level];
+    uint32_t size = _levels[level].size;
+
+    if(ring->count)
+        return series->points[_levels[level].offset + (ring->head + size - ring->count) % size].start;
+    return series->accumulators[level].count ? series->accumulators[level].start : UINT32_MAX;
+}
+
+static int _get_finest_level(HistorySeries *series, uint32_t from)
+{
+    HistoryBlock *block = NULL;
+    uint32_t index = 0;
+    int level = 0;
+
+    block = _get_oldest_block(series, &index);
+    if(block && block->base_time <= from)
+        return -1;
+    for(level = 0; level < HISTORY_NB_LEVELS - 1; level++)
+    {
+        if(_get_level_oldest(series, level) <= from)
+            return level;
+    }
+    return HISTORY_NB_LEVELS - 1;
+}
+
+/********************************
+ *        Storage               *
+ *******************************/
+
+static void _sync(int flags)
+{
+    if(!_persistent || !_dirty)
+        return;
+    if(msync(_map, _map_len, flags) != 0)
+        WRN("Cannot write history to file");
+    _dirty = 0;
+}
+
+static void _sync_timer_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    _sync(MS_ASYNC);
+}
+
+static uint8_t _map_store(void)
+{
+    const char *path = zg_conf_get_history_path();
+    HistoryHeader *header = NULL;
+    int fd = -1;
+
+    _map_len = sizeof(HistoryHeader) + _max_series * sizeof(HistorySeries);
+    if(!path)
+    {
+        INF("No history file configured, history will be lost on exit");
+        _map = mmap(NULL, _map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        _persistent = 0;
+    }
+    else
+    {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if(fd < 0)
+        {
+            ERR("Cannot open history file %s", path);
+            return 1;
+        }
+        if(ftruncate(fd, _map_len) != 0)
+        {
+            ERR("Cannot resize history file %s", path);
+            close(fd);
+            return 1;
+        }
+        _map = mmap(NULL, _map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        /* Mapping stays valid once file is closed */
+        close(fd);
+        _persistent = 1;
+    }
+    if(_map == MAP_FAILED)
+    {
+        ERR("Cannot map history");
+        _map = NULL;
+        return 1;
+    }
+
+    header = (HistoryHeader *)_map;
+    _series = (HistorySeries *)(_map + sizeof(HistoryHeader));
+    if(header->magic != HISTORY_MAGIC || header->version != HISTORY_VERSION ||
+            header->series_size != sizeof(HistorySeries) || header->max_series != _max_series)
+    {
+        if(header->magic)
+            WRN("History file format has changed, history is reset");
+        memset(_map, 0, _map_len);
+        header->magic = HISTORY_MAGIC;
+        header->version = HISTORY_VERSION;
+        header->series_size = sizeof(HistorySeries);
+        header->max_series = _max_series;
+        _dirty = 1;
+    }
+    return 0;
+}
+
+static HistorySeries *_get_series(DeviceId id, uint16_t cluster, uint8_t create)
+{
+    uint32_t key = HISTORY_KEY(id, cluster);
+    HistorySeries *series = eina_hash_find(_index, &key);
+    uint32_t index = 0;
+
+    if(series || !create)
+        return series;
+
+    for(index = 0; index < _max_series; index++)
+    {
+        if(!_series[index].used)
+            break;
+    }
+    if(index == _max_series)
+    {
+        DBG("Cannot record history of cluster 0x%04X of device %d : too many series", cluster, id);
+        return NULL;
+    }
+
+    series = &_series[index];
+    memset(series, 0, sizeof(HistorySeries));
+    series->used = 1;
+    series->id = id;
+    series->cluster = cluster;
+    eina_hash_add(_index, &key, series);
+    INF("Recording history of cluster 0x%04X of device %d", cluster, id);
+    return series;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_history_init(void)
+{
+    uint32_t index = 0;
+    uint32_t key = 0;
+
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_history", ZG_COLOR_LIGHTMAGENTA);
+    _max_series = zg_conf_get_history_max_series() > 0 ?
+        (uint32_t)zg_conf_get_history_max_series() : HISTORY_DEFAULT_MAX_SERIES;
+    _index = eina_hash_int32_new(NULL);
+    if(!_index)
+    {
+        CRI("Cannot allocate history index");
+        return 1;
+    }
+    if(_map_store() != 0)
+    {
+        eina_hash_free(_index);
+        _index = NULL;
+        return 1;
+    }
+
+    for(index = 0; index < _max_series; index++)
+    {
+        if(!_series[index].used)
+            continue;
+        key = HISTORY_KEY(_series[index].id, _series[index].cluster);
+        eina_hash_add(_index, &key, &_series[index]);
+    }
+
+    uv_timer_init(uv_default_loop(), &_sync_timer);
+    if(_persistent)
+        uv_timer_start(&_sync_timer, _sync_timer_cb, HISTORY_SYNC_INTERVAL_MS, HISTORY_SYNC_INTERVAL_MS);
+    INF("History initialized (%d series out of %u, %zu bytes)", eina_hash_population(_index), _max_series, _map_len);
+    return 0;
+}
+
+void zg_history_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(!_map)
+        return;
+    uv_timer_stop(&_sync_timer);
+    uv_close((uv_handle_t *)&_sync_timer, NULL);
+    _sync(MS_SYNC);
+    munmap(_map, _map_len);
+    _map = NULL;
+    _series = NULL;
+    eina_hash_free(_index);
+    _index = NULL;
+}
+
+void zg_history_record(DeviceId id, uint16_t cluster, int32_t value)
+{
+    HistorySeries *series = NULL;
+    uint32_t now = time(NULL);
+
+    if(!_map)
+        return;
+
+    series = _get_series(id, cluster, 1);
+    if(!series)
+        return;
+
+    _record_raw(series, now, value);
+    _record_rollups(series, now, value);
+    _dirty = 1;
+}
+
+json_t *zg_history_get_json(DeviceId id, uint16_t cluster, uint32_t from, uint32_t to, const char *resolution)
+{
+    HistorySeries *series = NULL;
+    json_t *result = NULL;
+    json_t *points = NULL;
+    int level = 0;
+
+    if(!_map)
+        return NULL;
+
+    series = _get_series(id, cluster, 0);
+    if(!series)
+        return NULL;
+
+    level = resolution ? _get_level(resolution) : _get_finest_level(series, from);
+    if(level >= HISTORY_NB_LEVELS)
+        return NULL;
+
+    points = json_array();
+    if(level < 0)
+        _get_raw_samples(series, from, to, points);
+    else
+        _get_points(series, level, from, to, points);
+
+    result = json_object();
+    json_object_set_new(result, "device", json_integer(id));
+    json_object_set_new(result, "cluster", json_integer(cluster));
+    json_object_set_new(result, "resolution", json_string(level < 0 ? "raw" : _levels[level].name));
+    json_object_set_new(result, "points", points);
+    return result;
+}
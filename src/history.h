@@ -0,0 +1,54 @@
+#ifndef ZG_HISTORY_H
+#define ZG_HISTORY_H
+
+#include <stdint.h>
+#include <jansson.h>
+#include "device.h"
+
+/**
+ * \brief History of values reported by devices
+ *
+ * Each reported attribute (a device and a cluster) has its own series of
+ * fixed size. Raw values are kept in a ring of blocks, each block holding an
+ * absolute sample followed by delta encoded samples. Values are also rolled
+ * up in rings of minute, hour and day points, holding average, minimal and
+ * maximal values, so that the last day can be read minute by minute, the last
+ * month hour by hour, and the last year day by day. Series are stored in a
+ * mapped file, and survive gateway restarts.
+ */
+
+/**
+ * \brief Map the history file, or anonymous memory if no history file is
+ * configured
+ * \return 0 if history is initialized, otherwise 1
+ */
+int zg_history_init(void);
+
+/**
+ * \brief Write history to its file and unmap it
+ */
+void zg_history_shutdown(void);
+
+/**
+ * \brief Add a value to the series of a device attribute
+ * \param id The device which has reported the value
+ * \param cluster The cluster of the reported value
+ * \param value The reported value
+ */
+void zg_history_record(DeviceId id, uint16_t cluster, int32_t value);
+
+/**
+ * \brief Read values of a series over a time range
+ * \param id The device
+ * \param cluster The cluster
+ * \param from Start of range, in seconds since Epoch
+ * \param to End of range, in seconds since Epoch
+ * \param resolution "raw", "minute", "hour" or "day". If NULL, the finest
+ * resolution still holding the start of range is used
+ * \return A new JSON object holding the used resolution and the points, NULL
+ * if series is unknown or resolution is not supported. Raw points are
+ * [time, value] arrays, other points are [time, average, min, max] arrays
+ */
+json_t *zg_history_get_json(DeviceId id, uint16_t cluster, uint32_t from, uint32_t to, const char *resolution);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include <Eina.h>
+#include "aggregator.h"
+#include "conf.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    DeviceId id;
+    uint8_t pending;
+    uint64_t first_update_ms;
+    uint64_t last_publish_ms;
+    uint8_t nb_values;
+    ZgInterfacesEventValue values[ZG_INTERFACES_EVENT_MAX_VALUES];
+    /* Types of the pending values, so that subscriptions can match them */
+    uint32_t merged_mask;
+} DeviceState;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uint32_t _window_ms = 0;
+static uint32_t _min_interval_ms = 0;
+static uv_timer_t _timer;
+static DeviceState _states[ZG_DEVICE_ID_MAX + 1];
+/* Devices having values waiting to be published */
+static Eina_List *_pending = NULL;
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static uint64_t _get_deadline(DeviceState *state)
+{
+    uint64_t deadline = state->first_update_ms + _window_ms;
+
+    if(state->last_publish_ms && state->last_publish_ms + _min_interval_ms > deadline)
+        deadline = state->last_publish_ms + _min_interval_ms;
+    return deadline;
+}
+
+static void _publish(DeviceState *state)
+{
+    ZgInterfacesEvent event;
+    uint8_t i = 0;
+
+    zg_interfaces_event_init(&event, ZG_INTERFACES_EVENT_STATE, state->id);
+    event.merged_mask = state->merged_mask;
+    for(i = 0; i < state->nb_values; i++)
+        zg_interfaces_event_add_int(&event, state->values[i].key, state->values[i].integer);
+
+    DBG("Publishing %d values of device %d", state->nb_values, state->id);
+    state->last_publish_ms = uv_now(uv_default_loop());
+    state->pending = 0;
+    state->nb_values = 0;
+    state->merged_mask = 0;
+    _pending = eina_list_remove(_pending, state);
+    zg_interfaces_send_event(&event);
+}
+
+static void _timer_cb(uv_timer_t *timer __attribute__((unused)));
+
+/* Arm timer on the closest deadline of pending devices */
+static void _schedule(void)
+{
+    Eina_List *l = NULL;
+    DeviceState *state = NULL;
+    uint64_t now = uv_now(uv_default_loop());
+    uint64_t next = UINT64_MAX;
+
+    EINA_LIST_FOREACH(_pending, l, state)
+    {
+        if(_get_deadline(state) < next)
+            next = _get_deadline(state);
+    }
+
+    if(next == UINT64_MAX)
+        uv_timer_stop(&_timer);
+    else
+        uv_timer_start(&_timer, _timer_cb, next > now ? next - now : 0, 0);
+}
+
+static void _timer_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    Eina_List *l = NULL, *l_next = NULL;
+    DeviceState *state = NULL;
+    uint64_t now = uv_now(uv_default_loop());
+
+    EINA_LIST_FOREACH_SAFE(_pending, l, l_next, state)
+    {
+        if(_get_deadline(state) <= now)
+            _publish(state);
+    }
+    _schedule();
+}
+
+static void _start_pending(DeviceState *state, uint64_t now)
+{
+    state->pending = 1;
+    state->first_update_ms = now;
+    _pending = eina_list_append(_pending, state);
+}
+
+static uint8_t _store_value(DeviceState *state, const char *key, int64_t value)
+{
+    uint8_t i = 0;
+
+    /* A newer value supersedes the pending one */
+    for(i = 0; i < state->nb_values; i++)
+    {
+        if(strcmp(state->values[i].key, key) == 0)
+        {
+            state->values[i].integer = value;
+            return 0;
+        }
+    }
+
+    if(state->nb_values == ZG_INTERFACES_EVENT_MAX_VALUES)
+        return 1;
+
+    state->values[state->nb_values].key = key;
+    state->values[state->nb_values].type = ZG_INTERFACES_VALUE_INT;
+    state->values[state->nb_values].integer = value;
+    state->nb_values++;
+    return 0;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_aggregator_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_aggregator", ZG_COLOR_GREEN);
+    memset(_states, 0, sizeof(_states));
+    _window_ms = zg_conf_get_interfaces_aggregation_window() > 0 ?
+        zg_conf_get_interfaces_aggregation_window() : 0;
+    _min_interval_ms = zg_conf_get_interfaces_state_min_interval() > 0 ?
+        zg_conf_get_interfaces_state_min_interval() : 0;
+    uv_timer_init(uv_default_loop(), &_timer);
+    INF("Aggregator module initialized (window %ums, minimal interval %ums)", _window_ms, _min_interval_ms);
+    return 0;
+}
+
+void zg_aggregator_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    _pending = eina_list_free(_pending);
+    uv_timer_stop(&_timer);
+    uv_close((uv_handle_t *)&_timer, NULL);
+    INF("Aggregator module shut down");
+}
+
+void zg_aggregator_push_int(ZgInterfacesEventType type, DeviceId id, const char *key, int64_t value)
+{
+    ZgInterfacesEvent event;
+    DeviceState *state = &_states[id];
+    uint64_t now = 0;
+
+    if(!key)
+        return;
+
+    if(!_window_ms && !_min_interval_ms)
+    {
+        zg_interfaces_event_init(&event, type, id);
+        zg_interfaces_event_add_int(&event, key, value);
+        zg_interfaces_send_event(&event);
+        return;
+    }
+
+    now = uv_now(uv_default_loop());
+    state->id = id;
+
+    if(!state->pending)
+        _start_pending(state, now);
+
+    /* No room left for a new key, publish pending values even if it is early */
+    if(_store_value(state, key, value) != 0)
+    {
+        WRN("Too many values pending for device %d, publishing early", id);
+        _publish(state);
+        _start_pending(state, now);
+        _store_value(state, key, value);
+    }
+    state->merged_mask |= ZG_INTERFACES_EVENT_MASK(type);
+
+    if(_get_deadline(state) <= now)
+        _publish(state);
+    _schedule();
+}
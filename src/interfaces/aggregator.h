@@ -0,0 +1,38 @@
+#ifndef ZG_AGGREGATOR_H
+#define ZG_AGGREGATOR_H
+
+#include <stdint.h>
+#include "interfaces.h"
+#include "device.h"
+
+/**
+ * Sensor values reported by a device during the aggregation window are merged
+ * into a single ZG_INTERFACES_EVENT_STATE event carrying only the updated
+ * values, a newer value replacing an older one for the same key. State events
+ * of a device are not published more often than the configured minimal
+ * interval. Without aggregation window nor minimal interval, each value is
+ * published right away as an event of its own type
+ */
+
+/**
+ * \brief Initialize the aggregator module from configuration
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_aggregator_init(void);
+
+/**
+ * \brief Terminate the aggregator module. Pending values are dropped
+ */
+void zg_aggregator_shutdown(void);
+
+/**
+ * \brief Publish a new integer value reported by a device
+ * \param type The event type used when aggregation is disabled, state events
+ * merging this value being also matched against subscriptions to this type
+ * \param id The device id
+ * \param key The value key, which must stay valid until the value is published
+ * \param value The reported value
+ */
+void zg_aggregator_push_int(ZgInterfacesEventType type, DeviceId id, const char *key, int64_t value);
+
+#endif
@@ -0,0 +1,872 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <jansson.h>
+#include <Eina.h>
+#include "http.h"
+#include "interfaces.h"
+#include "device.h"
+#include "conf.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define HTTP_MAX_PENDING_CONNECTIONS    16
+#define HTTP_MAX_CLIENTS                32
+/* Headers and body of a single request */
+#define HTTP_MAX_REQUEST_SIZE           (16 * 1024)
+#define HTTP_KEEP_ALIVE_TIMEOUT_MS      (60 * 1000)
+/* Events not yet written to a stream client, above which it is dropped */
+#define HTTP_SSE_MAX_PENDING_SIZE       (256 * 1024)
+#define HTTP_MAX_HEADERS_SIZE           256
+#define HTTP_METHOD_SIZE                8
+#define HTTP_PATH_SIZE                  128
+/* 16 hex digits and quotes */
+#define HTTP_ETAG_SIZE                  19
+
+#define HTTP_CONTENT_TYPE_JSON          "application/json"
+#define HTTP_SSE_HEADERS                "HTTP/1.1 200 OK\r\n"\
+                                        "Content-Type: text/event-stream\r\n"\
+                                        "Cache-Control: no-cache\r\n"\
+                                        "Connection: keep-alive\r\n\r\n"
+
+#define HTTP_BODY_NOT_FOUND             "{\"status\":\"Not found\"}"
+#define HTTP_BODY_BAD_REQUEST           "{\"status\":\"Bad request\"}"
+#define HTTP_BODY_NOT_ALLOWED           "{\"status\":\"Method not allowed\"}"
+#define HTTP_BODY_TOO_LARGE             "{\"status\":\"Request too large\"}"
+
+#define HTTP_PARSE_INCOMPLETE           0
+#define HTTP_PARSE_ERROR                -1
+#define HTTP_PARSE_TOO_LARGE            -2
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    uv_tcp_t handle;
+    uv_timer_t timer;
+    /* Received data not processed yet, always NUL terminated */
+    char *buf;
+    size_t len;
+    /* Set once client receives events stream */
+    uint8_t sse;
+    uint8_t closing;
+    uint8_t closed;
+    uint8_t nb_open_handles;
+} HttpClient;
+
+typedef struct
+{
+    char method[HTTP_METHOD_SIZE];
+    char path[HTTP_PATH_SIZE];
+    uint8_t keep_alive;
+    /* Value of If-None-Match header */
+    char etag[HTTP_ETAG_SIZE + 1];
+    const char *body;
+    size_t body_len;
+} HttpRequest;
+
+/* Rendered resource, valid as long as device states have not changed */
+typedef struct
+{
+    uint32_t version;
+    char etag[HTTP_ETAG_SIZE + 1];
+    char *body;
+    size_t len;
+} HttpCacheEntry;
+
+typedef struct
+{
+    uint64_t connections;
+    uint64_t requests;
+    uint64_t not_modified;
+    uint64_t cache_hits;
+    uint64_t errors;
+    uint64_t events;
+    uint64_t sse_dropped;
+} HttpMetrics;
+
+typedef json_t *(*HttpBuildCb)(int id);
+
+/********************************
+ *      Local variables         *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uv_tcp_t _server_handle;
+static Eina_List *_clients = NULL;
+static ZgInterfacesInterface *_interface = NULL;
+static HttpMetrics _metrics;
+/* Last values reported by each device, updated from events */
+static json_t *_states[ZG_DEVICE_ID_MAX + 1];
+static uint32_t _states_version = 0;
+static Eina_Hash *_cache = NULL;
+
+/********************************
+ *            Internal          *
+ *******************************/
+
+static const char *_status_string(int status)
+{
+    switch(status)
+    {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        default: return "Internal Server Error";
+    }
+}
+
+static void _compute_etag(const char *data, size_t len, char *etag)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t index = 0;
+
+    /* FNV-1a */
+    for(index = 0; index < len; index++)
+    {
+        hash ^= (uint8_t)data[index];
+        hash *= 0x100000001b3ULL;
+    }
+    snprintf(etag, HTTP_ETAG_SIZE + 1, "\"%016"PRIx64"\"", hash);
+}
+
+static void _free_cache_entry(void *data)
+{
+    HttpCacheEntry *entry = data;
+
+    if(!entry)
+        return;
+    free(entry->body);
+    free(entry);
+}
+
+/********************************
+ *       Clients management     *
+ *******************************/
+
+static void _client_handle_closed_cb(uv_handle_t *handle)
+{
+    HttpClient *client = handle->data;
+
+    if(--client->nb_open_handles > 0)
+        return;
+    free(client->buf);
+    free(client);
+}
+
+static void _close_client(HttpClient *client)
+{
+    if(client->closed)
+        return;
+
+    client->closed = 1;
+    _clients = eina_list_remove(_clients, client);
+    uv_timer_stop(&client->timer);
+    uv_close((uv_handle_t *)&client->timer, _client_handle_closed_cb);
+    uv_close((uv_handle_t *)&client->handle, _client_handle_closed_cb);
+}
+
+static void _shutdown_cb(uv_shutdown_t *req, int status __attribute__((unused)))
+{
+    HttpClient *client = req->handle->data;
+
+    free(req);
+    _close_client(client);
+}
+
+/* Pending answers are sent before connection is closed */
+static void _end_client(HttpClient *client)
+{
+    uv_shutdown_t *req = NULL;
+
+    if(client->closing)
+        return;
+
+    client->closing = 1;
+    uv_read_stop((uv_stream_t *)&client->handle);
+    req = calloc(1, sizeof(uv_shutdown_t));
+    if(!req || uv_shutdown(req, (uv_stream_t *)&client->handle, _shutdown_cb) != 0)
+    {
+        free(req);
+        _close_client(client);
+    }
+}
+
+static void _allocated_req_sent(uv_write_t *req, int status __attribute__((unused)))
+{
+    uv_buf_t *buf = (uv_buf_t *)req->data;
+
+    free(buf->base);
+    free(buf);
+    free(req);
+}
+
+/* Data is freed once written */
+static void _write(HttpClient *client, char *data, size_t len)
+{
+    uv_write_t *req = NULL;
+    uv_buf_t *buf = NULL;
+
+    req = calloc(1, sizeof(uv_write_t));
+    buf = calloc(1, sizeof(uv_buf_t));
+    if(!req || !buf)
+    {
+        ERR("Cannot allocate memory to send HTTP data");
+        free(req);
+        free(buf);
+        free(data);
+        return;
+    }
+    buf->base = data;
+    buf->len = len;
+    req->data = buf;
+    if(uv_write(req, (uv_stream_t *)&client->handle, buf, 1, _allocated_req_sent) != 0)
+    {
+        ERR("Cannot send HTTP data");
+        _allocated_req_sent(req, 0);
+    }
+}
+
+/********************************
+ *          Responses           *
+ *******************************/
+
+static void _send_response(HttpClient *client, int status, const char *etag,
+        const char *body, size_t len, uint8_t keep_alive)
+{
+    char *data = NULL;
+    int header_len = 0;
+
+    data = malloc(HTTP_MAX_HEADERS_SIZE + len);
+    if(!data)
+    {
+        CRI("Cannot allocate HTTP response");
+        return;
+    }
+
+    /* A 304 answer has no body */
+    header_len = snprintf(data, HTTP_MAX_HEADERS_SIZE,
+            "HTTP/1.1 %d %s\r\n"
+            "%s%s%s"
+            "Content-Length: %zu\r\n"
+            "%s%s%s"
+            "Connection: %s\r\n\r\n",
+            status, _status_string(status),
+            body ? "Content-Type: " : "", body ? HTTP_CONTENT_TYPE_JSON : "", body ? "\r\n" : "",
+            len,
+            etag ? "ETag: " : "", etag ? etag : "", etag ? "\r\n" : "",
+            keep_alive ? "keep-alive" : "close");
+    if(body && len)
+        memcpy(data + header_len, body, len);
+
+    if(status >= 400)
+        _metrics.errors++;
+    _write(client, data, header_len + len);
+}
+
+static void _send_static_response(HttpClient *client, int status, const char *body, uint8_t keep_alive)
+{
+    _send_response(client, status, NULL, body, strlen(body), keep_alive);
+}
+
+static void _send_resource(HttpClient *client, HttpRequest *request, const char *etag, const char *body, size_t len)
+{
+    if(request->etag[0] && strcmp(request->etag, etag) == 0)
+    {
+        _metrics.not_modified++;
+        _send_response(client, 304, etag, NULL, 0, request->keep_alive);
+        return;
+    }
+    _send_response(client, 200, etag, body, len, request->keep_alive);
+}
+
+static void _send_json(HttpClient *client, HttpRequest *request, json_t *root)
+{
+    char etag[HTTP_ETAG_SIZE + 1];
+    char *body = NULL;
+
+    body = root ? json_dumps(root, JSON_COMPACT) : NULL;
+    json_decref(root);
+    if(!body)
+    {
+        ERR("Cannot encode HTTP resource");
+        _send_static_response(client, 500, HTTP_BODY_BAD_REQUEST, request->keep_alive);
+        return;
+    }
+    _compute_etag(body, strlen(body), etag);
+    _send_resource(client, request, etag, body, strlen(body));
+    free(body);
+}
+
+/* Device list is serialized once per version by devices module */
+static void _send_device_list(HttpClient *client, HttpRequest *request)
+{
+    char etag[HTTP_ETAG_SIZE + 1];
+    size_t len = 0;
+    const char *body = zg_device_get_device_list_dump(&len);
+
+    if(!body)
+    {
+        _send_static_response(client, 500, HTTP_BODY_BAD_REQUEST, request->keep_alive);
+        return;
+    }
+    _compute_etag(body, len, etag);
+    _send_resource(client, request, etag, body, len);
+}
+
+/* Resources built from device states are rendered again only when a device
+ * state has changed */
+static void _send_cached_json(HttpClient *client, HttpRequest *request, HttpBuildCb build, int id)
+{
+    HttpCacheEntry *entry = eina_hash_find(_cache, request->path);
+    json_t *root = NULL;
+
+    if(entry && entry->version == _states_version)
+    {
+        _metrics.cache_hits++;
+        _send_resource(client, request, entry->etag, entry->body, entry->len);
+        return;
+    }
+
+    root = build(id);
+    if(!root)
+    {
+        _send_static_response(client, 404, HTTP_BODY_NOT_FOUND, request->keep_alive);
+        return;
+    }
+
+    entry = calloc(1, sizeof(HttpCacheEntry));
+    if(!entry)
+    {
+        CRI("Cannot allocate HTTP cache entry");
+        _send_json(client, request, root);
+        return;
+    }
+    entry->body = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    if(!entry->body)
+    {
+        ERR("Cannot encode HTTP resource");
+        _free_cache_entry(entry);
+        _send_static_response(client, 500, HTTP_BODY_BAD_REQUEST, request->keep_alive);
+        return;
+    }
+    entry->len = strlen(entry->body);
+    entry->version = _states_version;
+    _compute_etag(entry->body, entry->len, entry->etag);
+    _free_cache_entry(eina_hash_set(_cache, request->path, entry));
+    _send_resource(client, request, entry->etag, entry->body, entry->len);
+}
+
+/********************************
+ *          Resources           *
+ *******************************/
+
+static json_t *_build_device_state(int id)
+{
+    if(id < 0 || id > ZG_DEVICE_ID_MAX || !_states[id])
+        return NULL;
+    return json_deep_copy(_states[id]);
+}
+
+static json_t *_build_states(int id __attribute__((unused)))
+{
+    json_t *root = json_object();
+    json_t *states = json_array();
+    int index = 0;
+
+    for(index = 0; index <= ZG_DEVICE_ID_MAX; index++)
+    {
+        if(_states[index])
+            json_array_append(states, _states[index]);
+    }
+    json_object_set_new(root, "states", states);
+    return root;
+}
+
+static json_t *_build_metrics(void)
+{
+    json_t *root = json_object();
+    Eina_List *l = NULL;
+    HttpClient *client = NULL;
+    int nb_sse = 0;
+
+    EINA_LIST_FOREACH(_clients, l, client)
+    {
+        if(client->sse)
+            nb_sse++;
+    }
+    json_object_set_new(root, "clients", json_integer(eina_list_count(_clients)));
+    json_object_set_new(root, "sse_clients", json_integer(nb_sse));
+    json_object_set_new(root, "connections", json_integer(_metrics.connections));
+    json_object_set_new(root, "requests", json_integer(_metrics.requests));
+    json_object_set_new(root, "not_modified", json_integer(_metrics.not_modified));
+    json_object_set_new(root, "cache_hits", json_integer(_metrics.cache_hits));
+    json_object_set_new(root, "errors", json_integer(_metrics.errors));
+    json_object_set_new(root, "events", json_integer(_metrics.events));
+    json_object_set_new(root, "sse_dropped", json_integer(_metrics.sse_dropped));
+    return root;
+}
+
+static void _process_command(HttpClient *client, HttpRequest *request)
+{
+    ZgInterfacesAnswerObject *answer = NULL;
+
+    answer = zg_interfaces_process_raw_command(_interface, request->body, request->body_len);
+    if(!answer || !answer->data)
+    {
+        _send_static_response(client, 400, HTTP_BODY_BAD_REQUEST, request->keep_alive);
+        zg_interfaces_free_answer_object(answer);
+        return;
+    }
+    _send_response(client, answer->status == 0 ? 200 : 400, NULL, answer->data, answer->len, request->keep_alive);
+    zg_interfaces_free_answer_object(answer);
+}
+
+static void _start_events_stream(HttpClient *client)
+{
+    char *data = strdup(HTTP_SSE_HEADERS);
+
+    if(!data)
+    {
+        CRI("Cannot allocate HTTP response");
+        return;
+    }
+    INF("New HTTP events stream");
+    client->sse = 1;
+    /* Events stream is never idle from server point of view */
+    uv_timer_stop(&client->timer);
+    _write(client, data, strlen(data));
+}
+
+static void _handle_request(HttpClient *client, HttpRequest *request)
+{
+    uint8_t get = strcmp(request->method, "GET") == 0;
+    int id = -1, end = 0;
+
+    _metrics.requests++;
+    DBG("%s %s", request->method, request->path);
+
+    if(strcmp(request->path, "/commands") == 0)
+    {
+        if(strcmp(request->method, "POST") == 0)
+            _process_command(client, request);
+        else
+            _send_static_response(client, 405, HTTP_BODY_NOT_ALLOWED, request->keep_alive);
+        return;
+    }
+
+    if(!get)
+    {
+        _send_static_response(client, 405, HTTP_BODY_NOT_ALLOWED, request->keep_alive);
+        return;
+    }
+
+    if(strcmp(request->path, "/devices") == 0)
+        _send_device_list(client, request);
+    else if(strcmp(request->path, "/state") == 0)
+        _send_cached_json(client, request, _build_states, -1);
+    else if(sscanf(request->path, "/devices/%d/state%n", &id, &end) == 1 && request->path[end] == '\0')
+        _send_cached_json(client, request, _build_device_state, id);
+    else if(strcmp(request->path, "/metrics") == 0)
+        _send_json(client, request, _build_metrics());
+    else if(strcmp(request->path, "/events") == 0)
+        _start_events_stream(client);
+    else
+        _send_static_response(client, 404, HTTP_BODY_NOT_FOUND, request->keep_alive);
+}
+
+/********************************
+ *       Requests parsing       *
+ *******************************/
+
+static void _copy_header_value(char *dst, size_t size, const char *value, const char *end)
+{
+    size_t len = end - value;
+
+    if(len >= size)
+        len = size - 1;
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+/* Content length is bounded before being added to headers size, so that it
+ * cannot wrap request size */
+static int _parse_content_length(const char *value, const char *end, size_t *len)
+{
+    size_t result = 0;
+
+    while(end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    if(value == end)
+        return 1;
+    for(; value < end; value++)
+    {
+        if(*value < '0' || *value > '9')
+            return 1;
+        result = result * 10 + (*value - '0');
+        if(result > HTTP_MAX_REQUEST_SIZE)
+            return 1;
+    }
+    *len = result;
+    return 0;
+}
+
+/* Returns the size of the parsed request, HTTP_PARSE_INCOMPLETE if more data
+ * is needed, or an error */
+static int _parse_request(HttpClient *client, HttpRequest *request)
+{
+    char *headers_end = strstr(client->buf, "\r\n\r\n");
+    char *line = NULL, *line_end = NULL, *value = NULL;
+    char connection[16] = {0};
+    size_t headers_len = 0, content_len = 0;
+    int minor = 0;
+
+    if(!headers_end)
+        return client->len > HTTP_MAX_REQUEST_SIZE ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_INCOMPLETE;
+    headers_len = headers_end - client->buf + 4;
+
+    memset(request, 0, sizeof(HttpRequest));
+    if(sscanf(client->buf, "%7s %127s HTTP/1.%d", request->method, request->path, &minor) != 3)
+        return HTTP_PARSE_ERROR;
+    /* Persistent connections are the default from HTTP/1.1 */
+    request->keep_alive = minor >= 1;
+
+    for(line = strstr(client->buf, "\r\n") + 2; line < headers_end; line = line_end + 2)
+    {
+        line_end = strstr(line, "\r\n");
+        value = memchr(line, ':', line_end - line);
+        if(!value)
+            continue;
+        for(value++; *value == ' ' || *value == '\t'; value++);
+
+        if(strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            if(_parse_content_length(value, line_end, &content_len) != 0)
+                return HTTP_PARSE_ERROR;
+        }
+        else if(strncasecmp(line, "If-None-Match:", 14) == 0)
+            _copy_header_value(request->etag, sizeof(request->etag), value, line_end);
+        else if(strncasecmp(line, "Connection:", 11) == 0)
+        {
+            _copy_header_value(connection, sizeof(connection), value, line_end);
+            if(strcasecmp(connection, "close") == 0)
+                request->keep_alive = 0;
+            else if(strcasecmp(connection, "keep-alive") == 0)
+                request->keep_alive = 1;
+        }
+    }
+
+    if(headers_len + content_len > HTTP_MAX_REQUEST_SIZE)
+        return HTTP_PARSE_TOO_LARGE;
+    if(client->len < headers_len + content_len)
+        return HTTP_PARSE_INCOMPLETE;
+
+    request->body = client->buf + headers_len;
+    request->body_len = content_len;
+    return headers_len + content_len;
+}
+
+/* Pipelined requests are processed in order, their answers being written in
+ * the same order */
+static void _process_requests(HttpClient *client)
+{
+    HttpRequest request;
+    int size = 0;
+
+    while(!client->closing && !client->sse && client->len > 0)
+    {
+        size = _parse_request(client, &request);
+        if(size == HTTP_PARSE_INCOMPLETE)
+            return;
+        if(size < 0)
+        {
+            WRN("Dropping malformed HTTP request");
+            if(size == HTTP_PARSE_TOO_LARGE)
+                _send_static_response(client, 413, HTTP_BODY_TOO_LARGE, 0);
+            else
+                _send_static_response(client, 400, HTTP_BODY_BAD_REQUEST, 0);
+            _end_client(client);
+            return;
+        }
+
+        _handle_request(client, &request);
+        client->len -= size;
+        memmove(client->buf, client->buf + size, client->len + 1);
+        if(!request.keep_alive)
+            _end_client(client);
+    }
+}
+
+/********************************
+ *    HTTP messages callbacks   *
+ *******************************/
+
+static void _idle_timeout_cb(uv_timer_t *timer)
+{
+    HttpClient *client = timer->data;
+
+    DBG("Closing idle HTTP connection");
+    _end_client(client);
+}
+
+static void _new_data_cb(uv_stream_t *s, ssize_t n, const uv_buf_t *buf)
+{
+    HttpClient *client = s->data;
+    char *data = NULL;
+
+    if(n < 0)
+    {
+        DBG("HTTP client disconnected");
+        _close_client(client);
+        free(buf->base);
+        return;
+    }
+    if(n == 0 || client->closing)
+    {
+        free(buf->base);
+        return;
+    }
+
+    data = realloc(client->buf, client->len + n + 1);
+    if(!data)
+    {
+        CRI("Cannot allocate memory for HTTP request");
+        free(buf->base);
+        _close_client(client);
+        return;
+    }
+    memcpy(data + client->len, buf->base, n);
+    client->buf = data;
+    client->len += n;
+    client->buf[client->len] = '\0';
+    free(buf->base);
+
+    if(!client->sse)
+        uv_timer_again(&client->timer);
+    _process_requests(client);
+}
+
+static void _alloc_cb(uv_handle_t *handle __attribute__((unused)), size_t size, uv_buf_t *buf)
+{
+    buf->base = malloc(size);
+    buf->len = buf->base ? size : 0;
+}
+
+static void _new_connection_cb(uv_stream_t *s, int status)
+{
+    HttpClient *client = NULL;
+
+    if(status)
+    {
+        WRN("New HTTP client connection failure");
+        return;
+    }
+
+    client = calloc(1, sizeof(HttpClient));
+    if(!client || uv_tcp_init(uv_default_loop(), &client->handle) != 0)
+    {
+        ERR("Cannot initiate new HTTP client structure");
+        ZG_VAR_FREE(client);
+        return;
+    }
+    client->handle.data = client;
+    client->timer.data = client;
+    client->nb_open_handles = 2;
+    uv_timer_init(uv_default_loop(), &client->timer);
+    _clients = eina_list_append(_clients, client);
+    _metrics.connections++;
+
+    if(uv_accept(s, (uv_stream_t *)&client->handle) != 0)
+    {
+        ERR("Error on accepting new HTTP client");
+        _close_client(client);
+        return;
+    }
+    if(eina_list_count(_clients) > HTTP_MAX_CLIENTS)
+    {
+        WRN("Cannot accept new HTTP connection : too many clients");
+        _close_client(client);
+        return;
+    }
+
+    uv_timer_start(&client->timer, _idle_timeout_cb, HTTP_KEEP_ALIVE_TIMEOUT_MS, HTTP_KEEP_ALIVE_TIMEOUT_MS);
+    if(uv_read_start((uv_stream_t *)&client->handle, _alloc_cb, _new_data_cb) != 0)
+    {
+        ERR("Cannot read from new HTTP client");
+        _close_client(client);
+    }
+}
+
+static void _update_state(json_t *root)
+{
+    json_t *data = json_object_get(root, "data");
+    json_t *id = json_object_get(data, "id");
+    json_t *values = NULL, *value = NULL;
+    const char *key = NULL;
+
+    if(!json_is_integer(id) || json_integer_value(id) < 0 || json_integer_value(id) > ZG_DEVICE_ID_MAX)
+        return;
+
+    if(!_states[json_integer_value(id)])
+    {
+        _states[json_integer_value(id)] = json_object();
+        json_object_set(_states[json_integer_value(id)], "id", id);
+        json_object_set_new(_states[json_integer_value(id)], "values", json_object());
+    }
+    values = json_object_get(_states[json_integer_value(id)], "values");
+    json_object_foreach(data, key, value)
+    {
+        if(strcmp(key, "id") != 0 && strcmp(key, "type") != 0)
+            json_object_set(values, key, value);
+    }
+    json_object_set(_states[json_integer_value(id)], "timestamp", json_object_get(root, "timestamp"));
+    _states_version++;
+}
+
+static void _send_event(uv_buf_t *buf)
+{
+    json_t *root = NULL;
+    Eina_List *l = NULL, *l_next = NULL;
+    HttpClient *client = NULL;
+    char *event = NULL, *data = NULL;
+    int len = 0;
+
+    if(!buf || !(buf->base) || !(buf->len))
+    {
+        ERR("Event to dispatch is empty");
+        return;
+    }
+
+    _metrics.events++;
+    root = json_loadb(buf->base, buf->len, 0, NULL);
+    if(!root)
+    {
+        ERR("Cannot decode event to dispatch");
+        return;
+    }
+    _update_state(root);
+
+    /* Each event must fit on a single data line */
+    event = json_dumps(root, JSON_COMPACT);
+    EINA_LIST_FOREACH_SAFE(_clients, l, l_next, client)
+    {
+        if(!event || !client->sse || client->closing)
+            continue;
+        /* A stalled client must not make events pile up in memory */
+        if(client->handle.write_queue_size > HTTP_SSE_MAX_PENDING_SIZE)
+        {
+            WRN("HTTP events stream client is not reading events, dropping it");
+            _metrics.sse_dropped++;
+            _close_client(client);
+            continue;
+        }
+        len = strlen(event) + 64;
+        data = malloc(len);
+        if(!data)
+        {
+            CRI("Cannot allocate memory to send event");
+            break;
+        }
+        len = snprintf(data, len, "id: %"JSON_INTEGER_FORMAT"\nevent: %s\ndata: %s\n\n",
+                json_integer_value(json_object_get(root, "seq")),
+                json_string_value(json_object_get(json_object_get(root, "data"), "type")),
+                event);
+        _write(client, data, len);
+    }
+    free(event);
+    json_decref(root);
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+ZgInterfacesInterface *zg_http_init(void)
+{
+    struct sockaddr_in bind_addr;
+
+    if(_init_count != 0)
+        return NULL;
+
+    _log_domain = zg_logs_domain_register("zg_http", ZG_COLOR_GREEN);
+
+    if(!zg_conf_get_http_server_address() || !zg_conf_get_http_server_port())
+    {
+        WRN("No HTTP server address configured, HTTP server is disabled");
+        return NULL;
+    }
+
+    if(uv_tcp_init(uv_default_loop(), &_server_handle) != 0)
+    {
+        ERR("Cannot initialize HTTP server handle");
+        return NULL;
+    }
+    if(uv_ip4_addr(zg_conf_get_http_server_address(), zg_conf_get_http_server_port(), &bind_addr) != 0 ||
+            uv_tcp_bind(&_server_handle, (struct sockaddr *)&bind_addr, 0) != 0)
+    {
+        ERR("Cannot bind HTTP server socket");
+        uv_close((uv_handle_t *)&_server_handle, NULL);
+        return NULL;
+    }
+    if(uv_listen((uv_stream_t *)&_server_handle, HTTP_MAX_PENDING_CONNECTIONS, _new_connection_cb) != 0)
+    {
+        ERR("Cannot start listening for new HTTP connection");
+        uv_close((uv_handle_t *)&_server_handle, NULL);
+        return NULL;
+    }
+
+    _cache = eina_hash_string_superfast_new(_free_cache_entry);
+    _interface = calloc(1, sizeof(ZgInterfacesInterface));
+    if(!_cache || !_interface)
+    {
+        CRI("Cannot allocate HTTP interface");
+        if(_cache)
+            eina_hash_free(_cache);
+        _cache = NULL;
+        ZG_VAR_FREE(_interface);
+        uv_close((uv_handle_t *)&_server_handle, NULL);
+        return NULL;
+    }
+    sprintf((char *)_interface->name, "HTTP");
+    _interface->event_cb = _send_event;
+    memset(&_metrics, 0, sizeof(HttpMetrics));
+
+    INF("HTTP server started on address %s - port %d", zg_conf_get_http_server_address(), zg_conf_get_http_server_port());
+    _init_count = 1;
+
+    return _interface;
+}
+
+void zg_http_shutdown(void)
+{
+    int index = 0;
+
+    if(_init_count != 1)
+        return;
+
+    while(_clients)
+        _close_client(eina_list_data_get(_clients));
+    uv_close((uv_handle_t *)&_server_handle, NULL);
+    for(index = 0; index <= ZG_DEVICE_ID_MAX; index++)
+    {
+        json_decref(_states[index]);
+        _states[index] = NULL;
+    }
+    eina_hash_free(_cache);
+    _cache = NULL;
+    ZG_VAR_FREE(_interface);
+    _init_count--;
+    INF("HTTP module shut down");
+}
@@ -0,0 +1,23 @@
+#ifndef ZG_HTTP_H
+#define ZG_HTTP_H
+
+#include <uv.h>
+#include "interfaces.h"
+
+/**
+ * HTTP/1.1 interface, serving several clients at once over persistent
+ * connections. Pipelined requests are answered in order. Resources :
+ * * GET /devices : device list
+ * * GET /state : last values reported by all devices
+ * * GET /devices/<id>/state : last values reported by a device
+ * * GET /metrics : HTTP server counters
+ * * GET /events : Server-Sent Events stream of all events
+ * * POST /commands : any interface command, as a JSON body
+ * GET answers carry an ETag, and clients sending it back in If-None-Match get
+ * a 304 answer without body if resource has not changed
+ */
+
+ZgInterfacesInterface *zg_http_init(void);
+void zg_http_shutdown(void);
+
+#endif
@@ -5,13 +5,28 @@
 #include <jansson.h>
 #include <Eina.h>
 #include <time.h>
+#include <dlfcn.h>
 
 #include "interfaces.h"
 #include "logs.h"
 #include "utils.h"
+#include "conf.h"
 #include "ipc.h"
 #include "tcp.h"
+#include "http.h"
 #include "zha.h"
+#include "zll.h"
+#include "topology.h"
+#include "bindings.h"
+#include "polling.h"
+#include "subscriptions.h"
+#include "aggregator.h"
+#include "spool.h"
+#include "requests.h"
+#include "tlv.h"
+#include "zcl.h"
+#include "rules.h"
+#include "history.h"
 
 /********************************
  *          Constants           *
@@ -30,6 +45,33 @@
 #define ANSWER_DATA_TOUCHLINK_OK        "{\"touchlink\":\"ok\"}"
 #define ANSWER_DATA_TOUCHLINK_KO        "{\"touchlink\":\"error\"}"
 #define ANSWER_DATA_ON_OFF_OK           "{\"on_off\":0}"
+#define ANSWER_DATA_ON_OFF_KO           "{\"on_off\":1}"
+#define ANSWER_DATA_MOVE_TO_COLOR_OK    "{\"move_to_color\":0}"
+#define ANSWER_DATA_MOVE_TO_COLOR_KO    "{\"move_to_color\":1}"
+#define ANSWER_DATA_POLL_OK             "{\"poll\":\"ok\"}"
+#define ANSWER_DATA_POLL_KO             "{\"poll\":\"error\"}"
+#define ANSWER_DATA_HISTORY_KO          "{\"history\":\"error\"}"
+#define ANSWER_DATA_TOPOLOGY_KO         "{\"topology\":\"error\"}"
+#define ANSWER_DATA_SUBSCRIBE_OK        "{\"subscribe\":\"ok\"}"
+#define ANSWER_DATA_SUBSCRIBE_KO        "{\"subscribe\":\"error\"}"
+#define ANSWER_DATA_UNSUBSCRIBE_OK      "{\"unsubscribe\":\"ok\"}"
+#define ANSWER_DATA_ENCODING_JSON       "{\"encoding\":\"json\"}"
+#define ANSWER_DATA_ENCODING_TLV        "{\"encoding\":\"tlv\"}"
+#define ANSWER_DATA_ENCODING_KO         "{\"encoding\":\"error\"}"
+#define ANSWER_DATA_REPLAY_KO           "{\"replay\":\"error\"}"
+#define ANSWER_DATA_RULES_OK            "{\"rules\":\"ok\"}"
+#define ANSWER_DATA_RULES_KO            "{\"rules\":\"error\"}"
+#define ANSWER_DATA_BINDINGS_OK         "{\"bindings\":\"ok\"}"
+#define ANSWER_DATA_BINDINGS_KO         "{\"bindings\":\"error\"}"
+
+/* Maximum number of events sent back in a single replay answer */
+#define REPLAY_DEFAULT_MAX_EVENTS       64
+
+/* Range of history sent when client does not give one */
+#define HISTORY_DEFAULT_RANGE           (24 * 3600)
+
+#define PLUGINS_SEPARATORS              ", "
+
 /********************************
  *        Local types           *
  *******************************/
@@ -43,6 +85,12 @@ typedef struct
     submodule_shutdown shutdown;
 } SubmoduleAPI;
 
+typedef struct
+{
+    void *handle;
+    const ZgInterfacesPlugin *plugin;
+    ZgInterfacesInterface *interface;
+} LoadedPlugin;
 
 /********************************
  *      Local variables         *
@@ -51,6 +99,27 @@ typedef struct
 static int _log_domain = -1;
 static int _init_count = 0;
 static Eina_List *_interfaces = NULL;
+static Eina_List *_plugins = NULL;
+/* Interfaces which negotiated binary encoding for events */
+static Eina_List *_tlv_interfaces = NULL;
+
+typedef struct
+{
+    const char *string;
+    uint16_t cluster;
+} EventEntry;
+
+/* Events description, indexed by ZgInterfacesEventType */
+static EventEntry _event_table[] =
+{
+    {"temperature", ZCL_CLUSTER_TEMPERATURE_MEASUREMENT},
+    {"pressure", ZCL_CLUSTER_PRESSURE_MEASUREMENT},
+    {"humidity", ZCL_CLUSTER_HUMIDITY_MEASUREMENT},
+    {"button", ZCL_CLUSTER_ON_OFF},
+    {"new_device", ZG_INTERFACES_EVENT_NO_CLUSTER},
+    {"touchlink_end", ZCL_CLUSTER_TOUCHLINK_COMMISSIONING},
+    {"state", ZG_INTERFACES_EVENT_NO_CLUSTER}
+};
 
 typedef struct
 {
@@ -63,15 +132,27 @@ static CommandIdEntry _command_id_table[] =
     {ZG_INTERFACES_COMMAND_GET_VERSION, "version"},
     {ZG_INTERFACES_COMMAND_OPEN_NETWORK, "open_network"},
     {ZG_INTERFACES_COMMAND_TOUCHLINK, "touchlink"},
-    {ZG_INTERFACES_COMMAND_GET_DEVICE_LIST, "device_list"},
-    {ZG_INTERFACES_COMMAND_ON_OFF, "on_off"}
+    {ZG_INTERFACES_COMMAND_GET_DEVICE_LIST, "get_device_list"},
+    {ZG_INTERFACES_COMMAND_ON_OFF, "on_off"},
+    {ZG_INTERFACES_COMMAND_TOPOLOGY, "topology"},
+    {ZG_INTERFACES_COMMAND_SUBSCRIBE, "subscribe"},
+    {ZG_INTERFACES_COMMAND_UNSUBSCRIBE, "unsubscribe"},
+    {ZG_INTERFACES_COMMAND_ENCODING, "encoding"},
+    {ZG_INTERFACES_COMMAND_REPLAY, "replay"},
+    {ZG_INTERFACES_COMMAND_RULES, "rules"},
+    {ZG_INTERFACES_COMMAND_BINDINGS, "bindings"},
+    {ZG_INTERFACES_COMMAND_MOVE_TO_COLOR, "move_to_color"},
+    {ZG_INTERFACES_COMMAND_POLL, "poll"},
+    {ZG_INTERFACES_COMMAND_HISTORY, "history"},
+    {ZG_INTERFACES_COMMAND_DEVICE_LIST_SINCE, "device_list_since"}
 };
 
 /* This table defines all enabled submodules */
 /* This is the main entry ponit if you want to add a new interface */
 static SubmoduleAPI _submodules[] = {
     {zg_ipc_init, zg_ipc_shutdown},
-    {zg_tcp_init, zg_tcp_shutdown}
+    {zg_tcp_init, zg_tcp_shutdown},
+    {zg_http_init, zg_http_shutdown}
 };
 
 static int _nb_submodules = sizeof(_submodules)/sizeof(SubmoduleAPI);
@@ -96,6 +177,126 @@ static ZgInterfacesCommandId _getcommandIdFromString(const char *string)
     return res;
 }
 
+static int _get_event_type_from_string(const char *string)
+{
+    int i = 0;
+
+    for(i = 0; i < ZG_INTERFACES_EVENT_MAX_ID; i++)
+    {
+        if(strcmp(string, _event_table[i].string) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* A state event is also wanted by interfaces listening to one of the merged
+ * event types */
+static uint8_t _interface_wants_event(ZgInterfacesInterface *interface, ZgInterfacesEvent *event)
+{
+    uint32_t mask = ZG_INTERFACES_EVENT_MASK(event->type);
+
+    if(!interface || !interface->event_cb)
+        return 0;
+    if(event->type == ZG_INTERFACES_EVENT_STATE)
+        mask |= event->merged_mask;
+    return interface->event_mask == ZG_INTERFACES_EVENT_MASK_ALL ||
+        (interface->event_mask & mask);
+}
+
+/********************************
+ *       Plugins management     *
+ *******************************/
+
+static void _load_plugin(const char *path)
+{
+    LoadedPlugin *loaded = NULL;
+    void *handle = NULL;
+    const ZgInterfacesPlugin *plugin = NULL;
+    ZgInterfacesInterface *interface = NULL;
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(!handle)
+    {
+        ERR("Cannot load interface plugin %s : %s", path, dlerror());
+        return;
+    }
+
+    plugin = dlsym(handle, ZG_INTERFACES_PLUGIN_SYMBOL);
+    if(!plugin || !plugin->init)
+    {
+        ERR("%s is not a valid interface plugin (no %s symbol)", path, ZG_INTERFACES_PLUGIN_SYMBOL);
+        dlclose(handle);
+        return;
+    }
+    if(plugin->abi_version != ZG_INTERFACES_PLUGIN_ABI_VERSION)
+    {
+        ERR("Interface plugin %s has ABI version %d, expected %d", path, plugin->abi_version,
+                ZG_INTERFACES_PLUGIN_ABI_VERSION);
+        dlclose(handle);
+        return;
+    }
+
+    loaded = calloc(1, sizeof(LoadedPlugin));
+    if(!loaded)
+    {
+        CRI("Cannot allocate memory to load interface plugin");
+        dlclose(handle);
+        return;
+    }
+
+    interface = plugin->init();
+    if(!interface)
+    {
+        ERR("Interface plugin %s failed to initialize", plugin->name ? plugin->name : path);
+        ZG_VAR_FREE(loaded);
+        dlclose(handle);
+        return;
+    }
+
+    loaded->handle = handle;
+    loaded->plugin = plugin;
+    loaded->interface = interface;
+    _plugins = eina_list_append(_plugins, loaded);
+    zg_interfaces_register_new_interface(interface);
+    INF("Interface plugin %s loaded from %s", plugin->name ? plugin->name : interface->name, path);
+}
+
+static void _load_plugins(void)
+{
+    const char *plugins = zg_conf_get_interfaces_plugins();
+    char *list = NULL;
+    char *path = NULL;
+    char *saveptr = NULL;
+
+    if(!plugins)
+        return;
+
+    list = strdup(plugins);
+    if(!list)
+    {
+        CRI("Cannot allocate memory to parse interface plugins list");
+        return;
+    }
+
+    for(path = strtok_r(list, PLUGINS_SEPARATORS, &saveptr); path; path = strtok_r(NULL, PLUGINS_SEPARATORS, &saveptr))
+        _load_plugin(path);
+    free(list);
+}
+
+static void _unload_plugins(void)
+{
+    LoadedPlugin *loaded = NULL;
+
+    EINA_LIST_FREE(_plugins, loaded)
+    {
+        zg_interfaces_unregister_interface(loaded->interface);
+        if(loaded->plugin->shutdown)
+            loaded->plugin->shutdown();
+        dlclose(loaded->handle);
+        ZG_VAR_FREE(loaded);
+    }
+}
+
 /********************************
  *       Answer functions       *
  *******************************/
@@ -120,21 +321,618 @@ static ZgInterfacesAnswerObject *_error_answer_get()
     return answer;
 }
 
-static ZgInterfacesAnswerObject *_on_off_answer_get(json_t *data)
+static ZgInterfacesAnswerObject *_static_answer_get(int status, const char *data)
 {
     ZgInterfacesAnswerObject *answer = NULL;
+    CALLOC_ANSWER_RET_NULL(answer);
+    answer->status = status;
+    answer->data = (void *)data;
+    answer->len = strlen(data);
+    return answer;
+}
+
+static int _on_off_send(json_t *data)
+{
+    uint16_t addr = zg_device_get_short_addr(json_integer_value(json_object_get(data, "id")));
+    int ep = zg_device_zha_endpoint_get(addr);
+
+    if(ep < 0)
+        return -1;
+    return zg_zha_on_off_set(addr, ep, json_integer_value(json_object_get(data, "state")));
+}
+
+static int _move_to_color_send(json_t *data)
+{
     uint16_t addr = zg_device_get_short_addr(json_integer_value(json_object_get(data, "id")));
     int ep = zg_device_zha_endpoint_get(addr);
 
-    zg_zha_on_off_set(addr, ep, json_integer_value(json_object_get(data, "state")));
+    if(ep < 0)
+        return -1;
+    return zg_zha_move_to_color(addr, ep,
+            json_integer_value(json_object_get(data, "x")),
+            json_integer_value(json_object_get(data, "y")),
+            json_integer_value(json_object_get(data, "transition")));
+}
+
+static ZgInterfacesAnswerObject *_device_command_answer_get(ZgInterfacesInterface *interface,
+        ZgInterfacesCommandObject *command, ZgRequestsSendCb send, const char *answer_ok, const char *answer_ko)
+{
+    json_t *data = (json_t *)command->data;
+    uint16_t addr = zg_device_get_short_addr(json_integer_value(json_object_get(data, "id")));
+    /* Command is answered once device has received it, or command has failed */
+    uint8_t deferred = command->client && command->request_id && interface->answer_cb;
 
+    if(zg_device_zha_endpoint_get(addr) < 0 ||
+            zg_requests_submit(deferred ? interface : NULL, command->client, command->command_string,
+                addr, command->request_id, send, data) != 0)
+        return _static_answer_get(1, answer_ko);
+
+    return deferred ? NULL : _static_answer_get(0, answer_ok);
+}
+
+static ZgInterfacesAnswerObject *_json_answer_get(json_t *root)
+{
+    ZgInterfacesAnswerObject *answer = NULL;
+
+    if(!root)
+        return NULL;
+
+    answer = calloc(1, sizeof(ZgInterfacesAnswerObject));
+    if(!answer)
+    {
+        ERR("Cannot allocate answer");
+        json_decref(root);
+        return NULL;
+    }
+    answer->data = json_dumps(root, JSON_COMPACT);
+    json_decref(root);
+    if(!answer->data)
+    {
+        ERR("Cannot encode answer");
+        ZG_VAR_FREE(answer);
+        return NULL;
+    }
+    answer->status = 0;
+    answer->len = strlen(answer->data);
+    answer->free_data = 1;
+    return answer;
+}
+
+/* Device list is serialized once per version by devices module, answer gets
+ * its own copy since the list may change before answer is sent */
+static ZgInterfacesAnswerObject *_device_list_answer_get(void)
+{
+    ZgInterfacesAnswerObject *answer = NULL;
+    size_t len = 0;
+    const char *dump = zg_device_get_device_list_dump(&len);
+
+    if(!dump)
+        return _error_answer_get();
     CALLOC_ANSWER_RET_NULL(answer);
-    answer->status = ep < 0 ? 1 : 0;
-    answer->data = ANSWER_DATA_ON_OFF_OK;
-    answer->len = strlen(ANSWER_DATA_ON_OFF_OK);
+    answer->data = malloc(len + 1);
+    if(!answer->data)
+    {
+        ERR("Cannot allocate device list answer");
+        ZG_VAR_FREE(answer);
+        return NULL;
+    }
+    memcpy(answer->data, dump, len + 1);
+    answer->status = 0;
+    answer->len = len;
+    answer->free_data = 1;
+    return answer;
+}
+
+static ZgInterfacesAnswerObject *_device_list_since_answer_get(json_t *data)
+{
+    json_t *root = json_object();
+
+    json_object_set_new(root, "device_list_since",
+            zg_device_get_device_list_since_json(json_integer_value(json_object_get(data, "version"))));
+    return _json_answer_get(root);
+}
+
+/* Give back the id of the command in its answer */
+static ZgInterfacesAnswerObject *_request_id_answer_get(ZgInterfacesAnswerObject *answer, json_t *request_id)
+{
+    ZgInterfacesAnswerObject *result = NULL;
+    json_t *root = NULL;
+
+    if(!answer || !answer->data || !request_id)
+        return answer;
+
+    root = json_loadb(answer->data, answer->len, 0, NULL);
+    if(!json_is_object(root))
+    {
+        json_decref(root);
+        return answer;
+    }
+    json_object_set(root, "request_id", request_id);
+    result = _json_answer_get(root);
+    if(!result)
+        return answer;
+    result->status = answer->status;
+    zg_interfaces_free_answer_object(answer);
+    return result;
+}
+
+static ZgInterfacesAnswerObject *_topology_answer_get(json_t *data)
+{
+    ZgInterfacesAnswerObject *answer = NULL;
+    json_t *root = NULL, *graph = NULL;
+    const char *format = json_string_value(json_object_get(data, "format"));
+    char *dot = NULL;
+
+    if(json_integer_value(json_object_get(data, "refresh")))
+        zg_topology_refresh();
+
+    if(format && strcmp(format, "dot") == 0)
+    {
+        dot = zg_topology_get_dot();
+        if(dot)
+        {
+            graph = json_string(dot);
+            free(dot);
+        }
+    }
+    else
+    {
+        graph = zg_topology_get_json();
+    }
+
+    if(graph)
+    {
+        root = json_object();
+        json_object_set_new(root, "topology", graph);
+        answer = _json_answer_get(root);
+    }
+
+    if(!answer)
+    {
+        CALLOC_ANSWER_RET_NULL(answer);
+        answer->status = 1;
+        answer->data = ANSWER_DATA_TOPOLOGY_KO;
+        answer->len = strlen(ANSWER_DATA_TOPOLOGY_KO);
+    }
+    return answer;
+}
+
+/* Touchlink runs in two steps : a scan ranks the devices in range, then one of
+ * them is identified or reset by its index in the candidates list */
+static ZgInterfacesAnswerObject *_touchlink_answer_get(json_t *data)
+{
+    json_t *root = NULL, *candidates = NULL;
+    const char *action = json_string_value(json_object_get(data, "action"));
+    int candidate = json_integer_value(json_object_get(data, "candidate"));
+    uint8_t res = 1;
+
+    if(!action || strcmp(action, "scan") == 0)
+    {
+        res = zg_zll_start_touchlink();
+    }
+    else if(strcmp(action, "candidates") == 0)
+    {
+        candidates = zg_zll_get_touchlink_candidates_json();
+        if(candidates)
+        {
+            root = json_object();
+            json_object_set_new(root, "touchlink", candidates);
+            return _json_answer_get(root);
+        }
+    }
+    else if(strcmp(action, "identify") == 0)
+    {
+        res = zg_zll_touchlink_identify(candidate);
+    }
+    else if(strcmp(action, "reset") == 0)
+    {
+        res = zg_zll_touchlink_reset(candidate);
+    }
+
+    if(res != 0)
+        return _static_answer_get(1, ANSWER_DATA_TOUCHLINK_KO);
+    return _static_answer_get(0, ANSWER_DATA_TOUCHLINK_OK);
+}
+
+static ZgInterfacesAnswerObject *_rules_answer_get(json_t *data)
+{
+    json_t *root = NULL;
+    const char *action = json_string_value(json_object_get(data, "action"));
+    uint8_t res = 1;
+
+    if(!action || strcmp(action, "list") == 0)
+    {
+        root = json_object();
+        json_object_set_new(root, "rules", zg_rules_get_json());
+        return _json_answer_get(root);
+    }
+    else if(strcmp(action, "add") == 0)
+    {
+        res = zg_rules_add(json_object_get(data, "rule"));
+    }
+    else if(strcmp(action, "remove") == 0)
+    {
+        res = zg_rules_remove(json_integer_value(json_object_get(data, "id")));
+    }
+
+    if(res != 0)
+        return _static_answer_get(1, ANSWER_DATA_RULES_KO);
+    return _static_answer_get(0, ANSWER_DATA_RULES_OK);
+}
+
+static ZgInterfacesAnswerObject *_poll_answer_get(json_t *data)
+{
+    json_t *root = NULL;
+    const char *action = json_string_value(json_object_get(data, "action"));
+    uint8_t res = 1;
+
+    if(!action || strcmp(action, "list") == 0)
+    {
+        root = json_object();
+        json_object_set_new(root, "poll", zg_polling_get_json());
+        return _json_answer_get(root);
+    }
+    else if(strcmp(action, "add") == 0)
+    {
+        res = zg_polling_add(json_object_get(data, "poll"));
+    }
+    else if(strcmp(action, "remove") == 0)
+    {
+        res = zg_polling_remove(json_integer_value(json_object_get(data, "device")),
+                json_integer_value(json_object_get(data, "cluster")));
+    }
+
+    if(res != 0)
+        return _static_answer_get(1, ANSWER_DATA_POLL_KO);
+    return _static_answer_get(0, ANSWER_DATA_POLL_OK);
+}
+
+static ZgInterfacesAnswerObject *_history_answer_get(json_t *data)
+{
+    json_t *root = NULL;
+    json_t *history = NULL;
+    json_t *device = json_object_get(data, "device");
+    json_t *cluster = json_object_get(data, "cluster");
+    json_t *from = json_object_get(data, "from");
+    json_t *to = json_object_get(data, "to");
+    uint32_t now = time(NULL);
+
+    if(!json_is_integer(device) || !json_is_integer(cluster))
+        return _static_answer_get(1, ANSWER_DATA_HISTORY_KO);
+
+    history = zg_history_get_json(json_integer_value(device), json_integer_value(cluster),
+            json_is_integer(from) ? json_integer_value(from) : now - HISTORY_DEFAULT_RANGE,
+            json_is_integer(to) ? json_integer_value(to) : now,
+            json_string_value(json_object_get(data, "resolution")));
+    if(!history)
+        return _static_answer_get(1, ANSWER_DATA_HISTORY_KO);
+
+    root = json_object();
+    json_object_set_new(root, "history", history);
+    return _json_answer_get(root);
+}
+
+/* Binding target is either a device endpoint, a group, or "gateway" */
+static uint8_t _parse_binding_target(json_t *target, ZgBindingsTargetType *type, uint16_t *value, uint8_t *endpoint)
+{
+    const char *string = json_string_value(target);
+
+    *value = 0;
+    *endpoint = 0;
+    if(string && strcmp(string, "gateway") == 0)
+    {
+        *type = ZG_BINDINGS_TARGET_GATEWAY;
+        return 0;
+    }
+    if(json_is_integer(json_object_get(target, "group")))
+    {
+        *type = ZG_BINDINGS_TARGET_GROUP;
+        *value = json_integer_value(json_object_get(target, "group"));
+        return 0;
+    }
+    if(json_is_integer(json_object_get(target, "id")))
+    {
+        *type = ZG_BINDINGS_TARGET_DEVICE;
+        *value = json_integer_value(json_object_get(target, "id"));
+        *endpoint = json_integer_value(json_object_get(target, "endpoint"));
+        return 0;
+    }
+    return 1;
+}
+
+static ZgInterfacesAnswerObject *_bindings_answer_get(json_t *data)
+{
+    json_t *root = NULL, *bindings = NULL;
+    const char *action = json_string_value(json_object_get(data, "action"));
+    DeviceId id = json_integer_value(json_object_get(data, "id"));
+    uint8_t endpoint = json_integer_value(json_object_get(data, "endpoint"));
+    uint16_t cluster = json_integer_value(json_object_get(data, "cluster"));
+    ZgBindingsTargetType type;
+    uint16_t target = 0;
+    uint8_t target_endpoint = 0;
+    uint8_t res = 1;
+
+    if(!action || strcmp(action, "list") == 0)
+    {
+        bindings = zg_bindings_get_json(id);
+        if(bindings)
+        {
+            root = json_object();
+            json_object_set_new(root, "bindings", bindings);
+            return _json_answer_get(root);
+        }
+    }
+    else if(strcmp(action, "refresh") == 0)
+    {
+        res = zg_bindings_refresh();
+    }
+    else if(_parse_binding_target(json_object_get(data, "target"), &type, &target, &target_endpoint) != 0)
+    {
+        WRN("Cannot process bindings command : target is not properly formatted");
+    }
+    else if(strcmp(action, "bind") == 0)
+    {
+        res = zg_bindings_bind(id, endpoint, cluster, type, target, target_endpoint);
+    }
+    else if(strcmp(action, "unbind") == 0)
+    {
+        res = zg_bindings_unbind(id, endpoint, cluster, type, target, target_endpoint);
+    }
+
+    if(res != 0)
+        return _static_answer_get(1, ANSWER_DATA_BINDINGS_KO);
+    return _static_answer_get(0, ANSWER_DATA_BINDINGS_OK);
+}
+
+static uint8_t _parse_subscription_filter(json_t *data, ZgSubscriptionFilter *filter)
+{
+    json_t *events = NULL, *devices = NULL, *clusters = NULL, *value = NULL;
+    size_t index = 0;
+    int type = 0;
+    json_int_t id = 0, from = 0, to = 0;
+    double max_rate = 0.0;
+
+    memset(filter, 0, sizeof(ZgSubscriptionFilter));
+
+    events = json_object_get(data, "events");
+    if(json_is_array(events))
+    {
+        json_array_foreach(events, index, value)
+        {
+            type = json_is_string(value) ? _get_event_type_from_string(json_string_value(value)) : -1;
+            if(type < 0)
+            {
+                WRN("Cannot subscribe to unknown event");
+                return 1;
+            }
+            filter->event_mask |= ZG_INTERFACES_EVENT_MASK(type);
+        }
+    }
+
+    /* Devices can either be a list of ids or a range {"from":x, "to":y} */
+    devices = json_object_get(data, "devices");
+    if(json_is_array(devices))
+    {
+        json_array_foreach(devices, index, value)
+        {
+            id = json_integer_value(value);
+            if(!json_is_integer(value) || id < 0 || id > ZG_DEVICE_ID_MAX)
+                return 1;
+            filter->devices[id / 8] |= 1 << (id % 8);
+        }
+    }
+    else if(json_is_object(devices))
+    {
+        from = json_integer_value(json_object_get(devices, "from"));
+        to = json_integer_value(json_object_get(devices, "to"));
+        if(from < 0 || to > ZG_DEVICE_ID_MAX || from > to)
+            return 1;
+        for(id = from; id <= to; id++)
+            filter->devices[id / 8] |= 1 << (id % 8);
+    }
+    else
+    {
+        filter->all_devices = 1;
+    }
+
+    clusters = json_object_get(data, "clusters");
+    if(json_is_array(clusters))
+    {
+        if(json_array_size(clusters) > ZG_SUBSCRIPTIONS_MAX_CLUSTERS)
+            return 1;
+        json_array_foreach(clusters, index, value)
+            filter->clusters[filter->nb_clusters++] = json_integer_value(value);
+    }
+
+    /* Maximum number of events per second and per device */
+    max_rate = json_number_value(json_object_get(data, "max_rate"));
+    if(max_rate < 0.0)
+        return 1;
+    if(max_rate > 0.0)
+        filter->min_interval_ms = 1000.0 / max_rate;
+
+    return 0;
+}
+
+static ZgInterfacesAnswerObject *_subscribe_answer_get(ZgInterfacesInterface *interface, json_t *data)
+{
+    ZgSubscriptionFilter filter;
+
+    if(_parse_subscription_filter(data, &filter) != 0 ||
+            zg_subscriptions_add(interface, &filter) != 0)
+    {
+        WRN("[%s] Invalid subscription request", interface->name);
+        return _static_answer_get(1, ANSWER_DATA_SUBSCRIBE_KO);
+    }
+    return _static_answer_get(0, ANSWER_DATA_SUBSCRIBE_OK);
+}
+
+static ZgInterfacesAnswerObject *_unsubscribe_answer_get(ZgInterfacesInterface *interface)
+{
+    zg_subscriptions_clear(interface);
+    return _static_answer_get(0, ANSWER_DATA_UNSUBSCRIBE_OK);
+}
+
+static ZgInterfacesAnswerObject *_encoding_answer_get(ZgInterfacesInterface *interface, json_t *data)
+{
+    const char *format = json_string_value(json_object_get(data, "format"));
+
+    _tlv_interfaces = eina_list_remove(_tlv_interfaces, interface);
+    if(!format || strcmp(format, "json") == 0)
+        return _static_answer_get(0, ANSWER_DATA_ENCODING_JSON);
+
+    if(strcmp(format, "tlv") == 0)
+    {
+        INF("[%s] Switching events to binary encoding", interface->name);
+        _tlv_interfaces = eina_list_append(_tlv_interfaces, interface);
+        return _static_answer_get(0, ANSWER_DATA_ENCODING_TLV);
+    }
+
+    WRN("[%s] Unknown encoding %s", interface->name, format);
+    return _static_answer_get(1, ANSWER_DATA_ENCODING_KO);
+}
+
+/* Answers to binary commands carry the JSON answer as body of a binary frame */
+static ZgInterfacesAnswerObject *_tlv_answer_get(ZgInterfacesAnswerObject *answer)
+{
+    uint8_t *frame = NULL;
+    size_t len = 0;
+
+    if(!answer)
+        return NULL;
+
+    frame = zg_tlv_encode_answer(answer->status, answer->data, answer->data ? answer->len : 0, &len);
+    if(!frame)
+    {
+        ERR("Cannot encode binary answer");
+        zg_interfaces_free_answer_object(answer);
+        return NULL;
+    }
+    if(answer->free_data)
+        free(answer->data);
+    answer->data = frame;
+    answer->len = len;
+    answer->free_data = 1;
     return answer;
 }
 
+static json_t *_event_json_get(const ZgInterfacesEvent *event)
+{
+    json_t *root = NULL, *data = NULL, *value = NULL;
+    uint8_t i = 0;
+
+    root = json_object();
+    data = json_object();
+    if(!root || !data)
+    {
+        ERR("Cannot create json objects to send event");
+        json_decref(root);
+        json_decref(data);
+        return NULL;
+    }
+
+    if(event->device_id != ZG_INTERFACES_EVENT_NO_DEVICE)
+        json_object_set_new(data, "id", json_integer(event->device_id));
+    for(i = 0; i < event->nb_values; i++)
+    {
+        if(event->values[i].type == ZG_INTERFACES_VALUE_INT)
+            value = json_integer(event->values[i].integer);
+        else
+            value = json_string(event->values[i].string);
+        json_object_set_new(data, event->values[i].key, value);
+    }
+
+    if(json_object_set_new(root, "type", json_string("event"))||
+            json_object_set_new(root, "timestamp", json_integer(event->timestamp)) ||
+            json_object_set_new(root, "seq", json_integer(event->seq)) ||
+            json_object_set_new(data, "type", json_string(_event_table[event->type].string)) ||
+            json_object_set_new(root, "data", data))
+    {
+        ERR("Error encoding value into event");
+        json_decref(root);
+        return NULL;
+    }
+    return root;
+}
+
+static ZgInterfacesAnswerObject *_replay_answer_get(json_t *data)
+{
+    json_t *root = NULL, *replay = NULL, *events = NULL, *event_json = NULL;
+    const ZgInterfacesEvent *event = NULL;
+    uint32_t first = zg_spool_get_first_seq();
+    uint32_t last = zg_spool_get_last_seq();
+    uint32_t seq = 0;
+    json_int_t from = json_integer_value(json_object_get(data, "from"));
+    json_int_t max = json_integer_value(json_object_get(data, "max"));
+
+    if(from < 0 || max < 0)
+        return _static_answer_get(1, ANSWER_DATA_REPLAY_KO);
+    if(max == 0 || max > REPLAY_DEFAULT_MAX_EVENTS)
+        max = REPLAY_DEFAULT_MAX_EVENTS;
+
+    root = json_object();
+    replay = json_object();
+    events = json_array();
+    if(!root || !replay || !events)
+    {
+        ERR("Cannot create json objects to replay events");
+        json_decref(root);
+        json_decref(replay);
+        json_decref(events);
+        return _static_answer_get(1, ANSWER_DATA_REPLAY_KO);
+    }
+
+    /* Events older than first are lost, client can spot it by comparing
+     * first with the sequence it asked for */
+    for(seq = from > first ? from : first; first && seq <= last && max > 0; seq++, max--)
+    {
+        event = zg_spool_get(seq);
+        event_json = event ? _event_json_get(event) : NULL;
+        if(event_json)
+            json_array_append_new(events, event_json);
+    }
+
+    json_object_set_new(replay, "first", json_integer(first));
+    json_object_set_new(replay, "last", json_integer(last));
+    json_object_set_new(replay, "events", events);
+    json_object_set_new(root, "replay", replay);
+    return _json_answer_get(root);
+}
+
+static void _event_json_encode(const ZgInterfacesEvent *event, uv_buf_t *buf)
+{
+    json_t *root = _event_json_get(event);
+    size_t size;
+
+    if(!root)
+        return;
+
+    size = json_dumpb(root, NULL, 0, JSON_DECODE_ANY);
+    if(size <= 0)
+    {
+        ERR("Cannot get size of encoded JSON");
+        json_decref(root);
+        return;
+    }
+
+    buf->base = calloc(size, sizeof(char));
+    if(!buf->base)
+    {
+        CRI("Cannot allocate memory to encode event");
+        json_decref(root);
+        return;
+    }
+    size = json_dumpb(root, buf->base, size, JSON_DECODE_ANY);
+    json_decref(root);
+    if(size <= 0)
+    {
+        ERR("Error printing encoded json event");
+        ZG_VAR_FREE(buf->base);
+        return;
+    }
+    buf->len = size;
+}
+
 /********************************
  *             API              *
  *******************************/
@@ -142,6 +940,9 @@ static ZgInterfacesAnswerObject *_on_off_answer_get(json_t *data)
 ZgInterfacesAnswerObject *zg_interfaces_process_command(ZgInterfacesInterface *interface, ZgInterfacesCommandObject *command)
 {
     ZgInterfacesCommandId command_id;
+    ZgInterfacesAnswerObject *answer = NULL;
+    ZgInterfacesInterface *handler = NULL;
+    Eina_List *l = NULL;
     if(!interface)
     {
         ERR("Cannot process interface command : unknown interface");
@@ -164,10 +965,62 @@ ZgInterfacesAnswerObject *zg_interfaces_process_command(ZgInterfacesInterface *i
         case ZG_INTERFACES_COMMAND_GET_VERSION:
             return _version_answer_get();
             break;
+        case ZG_INTERFACES_COMMAND_GET_DEVICE_LIST:
+            return _device_list_answer_get();
+            break;
+        case ZG_INTERFACES_COMMAND_DEVICE_LIST_SINCE:
+            return _device_list_since_answer_get((json_t *)command->data);
+            break;
         case ZG_INTERFACES_COMMAND_ON_OFF:
-            return _on_off_answer_get((json_t *)command->data);
+            return _device_command_answer_get(interface, command, _on_off_send,
+                    ANSWER_DATA_ON_OFF_OK, ANSWER_DATA_ON_OFF_KO);
+            break;
+        case ZG_INTERFACES_COMMAND_TOPOLOGY:
+            return _topology_answer_get((json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_TOUCHLINK:
+            return _touchlink_answer_get((json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_SUBSCRIBE:
+            return _subscribe_answer_get(interface, (json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_UNSUBSCRIBE:
+            return _unsubscribe_answer_get(interface);
+            break;
+        case ZG_INTERFACES_COMMAND_ENCODING:
+            return _encoding_answer_get(interface, (json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_REPLAY:
+            return _replay_answer_get((json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_RULES:
+            return _rules_answer_get((json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_BINDINGS:
+            return _bindings_answer_get((json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_MOVE_TO_COLOR:
+            return _device_command_answer_get(interface, command, _move_to_color_send,
+                    ANSWER_DATA_MOVE_TO_COLOR_OK, ANSWER_DATA_MOVE_TO_COLOR_KO);
+            break;
+        case ZG_INTERFACES_COMMAND_POLL:
+            return _poll_answer_get((json_t *)command->data);
+            break;
+        case ZG_INTERFACES_COMMAND_HISTORY:
+            return _history_answer_get((json_t *)command->data);
             break;
         default:
+            /* Let interfaces extend the set of supported commands */
+            EINA_LIST_FOREACH(_interfaces, l, handler)
+            {
+                if(handler->command_cb)
+                    answer = handler->command_cb(command);
+                if(answer)
+                {
+                    DBG("[%s] Command %s handled by interface", handler->name, command->command_string);
+                    return answer;
+                }
+            }
             DBG("Unknown command %s", command->command_string);
             return _error_answer_get();
             break;
@@ -175,6 +1028,67 @@ ZgInterfacesAnswerObject *zg_interfaces_process_command(ZgInterfacesInterface *i
 
 }
 
+ZgInterfacesAnswerObject *zg_interfaces_process_raw_command(ZgInterfacesInterface *interface, const char *data, int len)
+{
+    return zg_interfaces_process_client_command(interface, NULL, data, len, NULL);
+}
+
+ZgInterfacesAnswerObject *zg_interfaces_process_client_command(ZgInterfacesInterface *interface, void *client,
+        const char *data, int len, int *used)
+{
+    ZgInterfacesCommandObject command_obj;
+    ZgInterfacesAnswerObject *answer = NULL;
+    json_t *root = NULL, *command = NULL;
+    json_error_t error;
+    size_t frame_size = 0;
+    uint8_t binary = 0;
+
+    if(used)
+        *used = len;
+
+    if(!interface || !data || len <= 0)
+    {
+        ERR("Cannot process raw command : message is corrupted");
+        return _error_answer_get();
+    }
+
+    memset(&command_obj, 0, sizeof(ZgInterfacesCommandObject));
+    frame_size = zg_tlv_frame_size((const uint8_t *)data, len);
+    if(frame_size > 0)
+    {
+        binary = 1;
+        if(used)
+            *used = frame_size;
+        root = zg_tlv_decode_command((const uint8_t *)data, len, command_obj.command_string,
+                ZG_INTERFACES_MAX_COMMAND_STRING_LEN);
+        command_obj.data = root;
+    }
+    else
+    {
+        /* Following commands of the message are left to the caller */
+        root = json_loadb(data, len, JSON_DECODE_ANY | (used ? JSON_DISABLE_EOF_CHECK : 0), &error);
+        if(!root)
+            ERR("[%s] Cannot decode command : %s", interface->name, error.text);
+        else if(used)
+            *used = error.position;
+        command = json_object_get(root, "command");
+        if(json_is_string(command))
+            strncpy(command_obj.command_string, json_string_value(command), ZG_INTERFACES_MAX_COMMAND_STRING_LEN - 1);
+        command_obj.data = json_object_get(root, "data");
+        command_obj.client = client;
+        command_obj.request_id = json_object_get(root, "request_id");
+    }
+
+    if(command_obj.command_string[0] == '\0')
+        answer = _error_answer_get();
+    else
+        answer = zg_interfaces_process_command(interface, &command_obj);
+    answer = _request_id_answer_get(answer, command_obj.request_id);
+    json_decref(root);
+
+    return binary ? _tlv_answer_get(answer) : answer;
+}
+
 void zg_interfaces_free_command_object(ZgInterfacesCommandObject *obj)
 {
     ZG_VAR_FREE(obj);
@@ -183,9 +1097,39 @@ void zg_interfaces_free_command_object(ZgInterfacesCommandObject *obj)
 
 void zg_interfaces_free_answer_object(ZgInterfacesAnswerObject *obj)
 {
+    if(obj && obj->free_data)
+        ZG_VAR_FREE(obj->data);
     ZG_VAR_FREE(obj);
 }
 
+void zg_interfaces_register_new_interface(ZgInterfacesInterface *interface)
+{
+    if(!interface)
+    {
+        ERR("Cannot register empty interface");
+        return;
+    }
+
+    if(eina_list_data_find(_interfaces, interface))
+    {
+        WRN("[%s] Interface is already registered", interface->name);
+        return;
+    }
+
+    _interfaces = eina_list_append(_interfaces, interface);
+    INF("[%s] Interface added", interface->name);
+}
+
+void zg_interfaces_unregister_interface(ZgInterfacesInterface *interface)
+{
+    if(!interface)
+        return;
+
+    zg_interfaces_reset_client(interface);
+    _interfaces = eina_list_remove(_interfaces, interface);
+    INF("[%s] Interface removed", interface->name);
+}
+
 void zg_interfaces_init()
 {
     ZgInterfacesInterface *buf = NULL;
@@ -195,22 +1139,25 @@ void zg_interfaces_init()
         return;
     _log_domain = zg_logs_domain_register("zg_interfaces", ZG_COLOR_BLACK);
     _init_count++;
+    zg_tlv_init();
+    zg_subscriptions_init();
+    zg_aggregator_init();
+    zg_spool_init();
+    zg_requests_init();
 
     /* Register all submodules */
     for(i = 0; i < _nb_submodules; i++)
     {
         buf = _submodules[i].init();
         if(buf)
-        {
-            _interfaces = eina_list_append(_interfaces, buf);
-            INF("[%s] Interface added", buf->name);
-        }
+            zg_interfaces_register_new_interface(buf);
         else
-        {
             ERR("Did not manage to properly initialize an interface");
-        }
     }
 
+    /* Then all plugins listed in configuration */
+    _load_plugins();
+
     INF("Interfaces module started");
     return;
 }
@@ -222,7 +1169,13 @@ void zg_interfaces_shutdown()
     if(_init_count != 1)
         return;
 
-    eina_list_free(_interfaces);
+    _unload_plugins();
+    zg_aggregator_shutdown();
+    zg_requests_shutdown();
+    zg_spool_shutdown();
+    zg_subscriptions_shutdown();
+    _tlv_interfaces = eina_list_free(_tlv_interfaces);
+    _interfaces = eina_list_free(_interfaces);
     for(i = 0; i < _nb_submodules; i++)
     {
         _submodules[i].shutdown();
@@ -232,66 +1185,111 @@ void zg_interfaces_shutdown()
     INF("Interfaces module shut down");
 }
 
-void zg_interfaces_send_event(const char *event, json_t *data)
+void zg_interfaces_event_init(ZgInterfacesEvent *event, ZgInterfacesEventType type, int device_id)
 {
-    json_t *root = NULL;
+    if(!event)
+        return;
+    memset(event, 0, sizeof(ZgInterfacesEvent));
+    event->type = type;
+    event->device_id = device_id;
+    event->cluster = zg_interfaces_event_type_get_cluster(type);
+    event->timestamp = time(NULL);
+}
+
+uint16_t zg_interfaces_event_type_get_cluster(ZgInterfacesEventType type)
+{
+    return type < ZG_INTERFACES_EVENT_MAX_ID ? _event_table[type].cluster : ZG_INTERFACES_EVENT_NO_CLUSTER;
+}
+
+uint8_t zg_interfaces_event_add_int(ZgInterfacesEvent *event, const char *key, int64_t value)
+{
+    if(!event || event->nb_values >= ZG_INTERFACES_EVENT_MAX_VALUES)
+        return 1;
+    event->values[event->nb_values].key = key;
+    event->values[event->nb_values].type = ZG_INTERFACES_VALUE_INT;
+    event->values[event->nb_values].integer = value;
+    event->nb_values++;
+    return 0;
+}
+
+uint8_t zg_interfaces_event_add_string(ZgInterfacesEvent *event, const char *key, const char *value)
+{
+    if(!event || event->nb_values >= ZG_INTERFACES_EVENT_MAX_VALUES)
+        return 1;
+    event->values[event->nb_values].key = key;
+    event->values[event->nb_values].type = ZG_INTERFACES_VALUE_STRING;
+    event->values[event->nb_values].string = value;
+    event->nb_values++;
+    return 0;
+}
+
+void zg_interfaces_send_event(ZgInterfacesEvent *event)
+{
+    uv_buf_t json_buf = {.base = NULL, .len = 0};
+    uv_buf_t tlv_buf = {.base = NULL, .len = 0};
     uv_buf_t *buf = NULL;
+    Eina_List *targets = NULL;
     Eina_List *iterator;
     ZgInterfacesInterface *interface;
-    size_t size;
 
-    if(!data)
+    if(!event || event->type >= ZG_INTERFACES_EVENT_MAX_ID)
     {
-        ERR("Cannot send event : data is empty");
+        ERR("Cannot send event : %s", event ? "unknown event":"event is empty");
         return;
     }
 
-    INF("Sending event \"%s\" to remote clients", event);
-    root = json_object();
-    if(!root)
-    {
-        ERR("Cannot create root json to send event");
-        return;
-    }
+    /* Events are spooled even if nobody listens, so that clients can get them back */
+    zg_spool_store(event);
 
-    if(json_object_set_new(root, "type", json_string("event"))||
-            json_object_set_new(root, "timestamp", json_integer(time(NULL))) ||
-            json_object_set_new(data, "type", json_string(event)) ||
-            json_object_set_new(root, "data", data))
+    /* Interfaces with subscriptions go through their filters, others through
+     * their event mask */
+    targets = zg_subscriptions_match(event);
+    EINA_LIST_FOREACH(_interfaces, iterator, interface)
     {
-        ERR("Error encoding value into event");
-        json_decref(root);
-        return;
+        if(!zg_subscriptions_exist(interface) && _interface_wants_event(interface, event))
+            targets = eina_list_append(targets, interface);
     }
 
-    buf = calloc(1, sizeof(uv_buf_t));
-    size = json_dumpb(root, NULL, 0, JSON_DECODE_ANY);
-    if(size <= 0)
+    /* Do not bother encoding an event nobody listens to */
+    if(!targets)
     {
-        ERR("Cannot get size of encoded JSON");
-        json_decref(root);
+        DBG("No interface subscribed to event \"%s\"", _event_table[event->type].string);
         return;
     }
 
-    buf->base = calloc(size, sizeof(char));
-    size = json_dumpb(root, buf->base, size, JSON_DECODE_ANY);
-    json_decref(root);
-    if(size <= 0)
+    /* Each encoding is built at most once, and only if a target uses it */
+    INF("Sending event \"%s\" to remote clients", _event_table[event->type].string);
+    EINA_LIST_FREE(targets, interface)
     {
-        ERR("Error printing encoded json event");
-        free(buf->base);
-        free(buf);
-        return;
-    }
-    buf->len = size;
-    EINA_LIST_FOREACH(_interfaces, iterator, interface)
-    {
-       if( interface && interface->event_cb)
-       {
-           DBG("[%s] Dispatch event", interface->name);
-           interface->event_cb(buf);
-       }
+        if(!interface->event_cb)
+            continue;
+
+        if(eina_list_data_find(_tlv_interfaces, interface))
+        {
+            buf = &tlv_buf;
+            if(!buf->base)
+                buf->base = (char *)zg_tlv_encode_event(event, &buf->len);
+        }
+        else
+        {
+            buf = &json_buf;
+            if(!buf->base)
+                _event_json_encode(event, buf);
+        }
+
+        if(buf->base)
+        {
+            DBG("[%s] Dispatch event", interface->name);
+            interface->event_cb(buf);
+        }
     }
-    ZG_VAR_FREE(buf->base);
-    ZG_VAR_FREE(buf);
+    ZG_VAR_FREE(json_buf.base);
+    ZG_VAR_FREE(tlv_buf.base);
+}
+
+void zg_interfaces_reset_client(ZgInterfacesInterface *interface)
+{
+    zg_subscriptions_clear(interface);
+    zg_requests_cancel(interface, NULL);
+    _tlv_interfaces = eina_list_remove(_tlv_interfaces, interface);
 }
@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 #include <jansson.h>
 #include <uv.h>
 
@@ -30,9 +32,78 @@ typedef enum
     ZG_INTERFACES_COMMAND_TOUCHLINK,
     ZG_INTERFACES_COMMAND_GET_DEVICE_LIST,
     ZG_INTERFACES_COMMAND_ON_OFF,
+    ZG_INTERFACES_COMMAND_TOPOLOGY,
+    ZG_INTERFACES_COMMAND_SUBSCRIBE,
+    ZG_INTERFACES_COMMAND_UNSUBSCRIBE,
+    ZG_INTERFACES_COMMAND_ENCODING,
+    ZG_INTERFACES_COMMAND_REPLAY,
+    ZG_INTERFACES_COMMAND_RULES,
+    ZG_INTERFACES_COMMAND_BINDINGS,
+    ZG_INTERFACES_COMMAND_MOVE_TO_COLOR,
+    ZG_INTERFACES_COMMAND_POLL,
+    ZG_INTERFACES_COMMAND_HISTORY,
+    ZG_INTERFACES_COMMAND_DEVICE_LIST_SINCE,
     ZG_INTERFACES_COMMAND_MAX_ID
 } ZgInterfacesCommandId;
 
+/* List of events sent to external clients */
+typedef enum
+{
+    ZG_INTERFACES_EVENT_TEMPERATURE,
+    ZG_INTERFACES_EVENT_PRESSURE,
+    ZG_INTERFACES_EVENT_HUMIDITY,
+    ZG_INTERFACES_EVENT_BUTTON,
+    ZG_INTERFACES_EVENT_NEW_DEVICE,
+    ZG_INTERFACES_EVENT_TOUCHLINK_END,
+    /* Values merged by the aggregator, see aggregator.h */
+    ZG_INTERFACES_EVENT_STATE,
+    ZG_INTERFACES_EVENT_MAX_ID
+} ZgInterfacesEventType;
+
+/* Event subscription masks. An interface with an empty mask receives all events */
+#define ZG_INTERFACES_EVENT_MASK(x)             (1U << (x))
+#define ZG_INTERFACES_EVENT_MASK_ALL            0
+
+#define ZG_INTERFACES_EVENT_MAX_VALUES          4
+/* Device id used for events not related to a specific device */
+#define ZG_INTERFACES_EVENT_NO_DEVICE           -1
+/* Cluster used for events not related to a specific cluster */
+#define ZG_INTERFACES_EVENT_NO_CLUSTER          0xFFFF
+
+typedef enum
+{
+    ZG_INTERFACES_VALUE_INT,
+    ZG_INTERFACES_VALUE_STRING
+} ZgInterfacesValueType;
+
+typedef struct
+{
+    const char *key;
+    ZgInterfacesValueType type;
+    union
+    {
+        int64_t integer;
+        const char *string;
+    };
+} ZgInterfacesEventValue;
+
+/* Event as produced by Zigbridge, before being encoded for interfaces. Strings
+ * are not copied and must stay valid until the event has been sent */
+typedef struct
+{
+    ZgInterfacesEventType type;
+    int device_id;
+    uint16_t cluster;
+    /* Types of the values merged into a ZG_INTERFACES_EVENT_STATE event, as an
+     * or-combination of ZG_INTERFACES_EVENT_MASK */
+    uint32_t merged_mask;
+    time_t timestamp;
+    /* Sequence number, given when the event is sent */
+    uint32_t seq;
+    uint8_t nb_values;
+    ZgInterfacesEventValue values[ZG_INTERFACES_EVENT_MAX_VALUES];
+} ZgInterfacesEvent;
+
 /* Callback type used to dispatch an event on interfaces that support events */
 typedef void (*event_cb_t)(uv_buf_t *);
 
@@ -41,6 +112,11 @@ typedef struct
     char command_string[ZG_INTERFACES_MAX_COMMAND_STRING_LEN];
     void *data;
     int len;
+    /* Client which has sent the command, and id it has given to the command.
+     * When both are set, commands sent to devices are answered once their
+     * outcome is known, through the answer_cb of the interface */
+    void *client;
+    json_t *request_id;
 }ZgInterfacesCommandObject;
 
 typedef struct
@@ -48,14 +124,43 @@ typedef struct
     int status;
     void *data;
     int len;
+    /* Set when data has been allocated and must be freed with the answer */
+    uint8_t free_data;
 }ZgInterfacesAnswerObject;
 
+/* Callback type used to let an interface handle commands unknown to Zigbridge.
+ * It must return NULL if the command is not handled by the interface */
+typedef ZgInterfacesAnswerObject *(*command_cb_t)(ZgInterfacesCommandObject *);
+
+/* Callback type used to send a deferred answer to the client which has sent the
+ * command. The answer is freed once the callback returns */
+typedef void (*answer_cb_t)(void *client, ZgInterfacesAnswerObject *);
+
 typedef struct
 {
     const char name[ZG_INTERFACES_MAX_INTERFACE_NAME_SIZE];
     event_cb_t event_cb;
+    /* Or-combination of ZG_INTERFACES_EVENT_MASK, ZG_INTERFACES_EVENT_MASK_ALL for all events */
+    uint32_t event_mask;
+    command_cb_t command_cb;
+    /* Set by interfaces able to send answers at any time, NULL otherwise */
+    answer_cb_t answer_cb;
 } ZgInterfacesInterface;
 
+/* Interface plugins are shared objects exporting a ZgInterfacesPlugin
+ * structure under the ZG_INTERFACES_PLUGIN_SYMBOL name */
+#define ZG_INTERFACES_PLUGIN_ABI_VERSION        2
+#define ZG_INTERFACES_PLUGIN_SYMBOL             "zg_interfaces_plugin"
+
+typedef struct
+{
+    int abi_version;
+    const char *name;
+    /* Must return an allocated interface, which stays valid until shutdown is called */
+    ZgInterfacesInterface *(*init)(void);
+    void (*shutdown)(void);
+} ZgInterfacesPlugin;
+
 /**
  * \brief Register a new Zigbridge input/output interface
  * When registering itself, the new interface must provide an allocated ZgInterfacesInterface structure to plug itself
@@ -64,6 +169,13 @@ typedef struct
  */
 void zg_interfaces_register_new_interface(ZgInterfacesInterface *interface);
 
+/**
+ * \brief Unregister a previously registered interface. The interface will not
+ * receive any event anymore
+ * \param interface The interface to remove
+ */
+void zg_interfaces_unregister_interface(ZgInterfacesInterface *interface);
+
 /**
  * \brief Function used to pass a received command to Zigbridge.
  * \param command The structure representing the command and data to process by Zibridge
@@ -73,11 +185,78 @@ void zg_interfaces_register_new_interface(ZgInterfacesInterface *interface);
 ZgInterfacesAnswerObject *zg_interfaces_process_command(ZgInterfacesInterface *interface, ZgInterfacesCommandObject *command);
 
 /**
- * \brief Function used to dispatch an event to all in-use interfaces
- * \param ZgInterfacesEvent the event to dispatch
- * \data Associated string data to attach to the event
+ * \brief Function used to pass a raw message received by an interface to Zigbridge.
+ * The message is either a JSON command or a binary command frame (see tlv.h). The
+ * answer is encoded the same way as the command
+ * \param interface The interface which has received the message
+ * \param data The message
+ * \param len The message length
+ * \return A newly allocated object containing the answer to send to the client, to be
+ * freed with zg_interfaces_free_answer_object
+ */
+ZgInterfacesAnswerObject *zg_interfaces_process_raw_command(ZgInterfacesInterface *interface, const char *data, int len);
+
+/**
+ * \brief Same as zg_interfaces_process_raw_command, for interfaces supporting
+ * deferred answers. A JSON command carrying a "request_id" is answered with
+ * this id, and if it is sent to a device, its answer is given later to the
+ * answer_cb of the interface, once the device has received it or the command
+ * has failed
+ * \param interface The interface which has received the message
+ * \param client The client which has sent the message, given back to answer_cb
+ * \param data The message, which may hold several commands
+ * \param len The message length
+ * \param used If not NULL, set to the size of the processed command, so that
+ * next commands of the message can be processed
+ * \return A newly allocated answer object, or NULL if the answer is deferred
+ */
+ZgInterfacesAnswerObject *zg_interfaces_process_client_command(ZgInterfacesInterface *interface, void *client,
+        const char *data, int len, int *used);
+
+/**
+ * \brief Prepare an event before filling its values
+ * \param event The event to initialize
+ * \param type The event type
+ * \param device_id The id of the device which the event is about, or
+ * ZG_INTERFACES_EVENT_NO_DEVICE
+ */
+void zg_interfaces_event_init(ZgInterfacesEvent *event, ZgInterfacesEventType type, int device_id);
+
+/**
+ * \brief Get the cluster an event type is related to
+ * \param type The event type
+ * \return The cluster id, or ZG_INTERFACES_EVENT_NO_CLUSTER
+ */
+uint16_t zg_interfaces_event_type_get_cluster(ZgInterfacesEventType type);
+
+/**
+ * \brief Attach an integer value to an event
+ * \return 0 if value has been added, 1 if event is full
+ */
+uint8_t zg_interfaces_event_add_int(ZgInterfacesEvent *event, const char *key, int64_t value);
+
+/**
+ * \brief Attach a string value to an event. The string is not copied
+ * \return 0 if value has been added, 1 if event is full
+ */
+uint8_t zg_interfaces_event_add_string(ZgInterfacesEvent *event, const char *key, const char *value);
+
+/**
+ * \brief Function used to dispatch an event to all in-use interfaces which
+ * subscribed to it. The event is only encoded if at least one interface
+ * subscribed to it
+ * \param event The event to dispatch
+ */
+void zg_interfaces_send_event(ZgInterfacesEvent *event);
+
+/**
+ * \brief Reset client state of an interface, typically when its client
+ * disconnects : subscriptions are dropped, encoding goes back to JSON and
+ * deferred answers of pending commands are dropped. The interface then
+ * receives events following its event mask
+ * \param interface The interface
  */
-void zg_interfaces_send_event(const char *event, json_t *data);
+void zg_interfaces_reset_client(ZgInterfacesInterface *interface);
 
 void zg_interfaces_free_command_object(ZgInterfacesCommandObject *obj);
 
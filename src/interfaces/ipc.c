@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <jansson.h>
 #include "ipc.h"
+#include "tlv.h"
 #include "zha.h"
 #include "zll.h"
 #include "core.h"
@@ -73,20 +74,35 @@ static void _send_error()
 
 static void _send_device_list()
 {
-    uv_write_t *req = calloc(1, sizeof(uv_write_t));
-    size_t size;
-    json_t *devices = zg_device_get_device_list_json();
+    uv_write_t *req = NULL;
+    uv_buf_t *buf = NULL;
+    const char *dump = NULL;
+    size_t len = 0;
 
     if(!_client_handle)
         return;
 
+    /* Serialized list is shared, and may be released before being written */
+    dump = zg_device_get_device_list_dump(&len);
+    if(!dump)
+        return;
+
     INF("Sending device list to remote client");
-    uv_buf_t *buf = calloc(1, sizeof(uv_buf_t));
-    size = json_dumpb(devices, NULL, 0, JSON_DECODE_ANY);
-    buf->base = calloc(size, sizeof(char));
-    size = json_dumpb(devices, buf->base, size, JSON_DECODE_ANY);
-    json_decref(devices);
-    buf->len = size;
+    req = calloc(1, sizeof(uv_write_t));
+    buf = calloc(1, sizeof(uv_buf_t));
+    if(buf)
+        buf->base = malloc(len);
+    if(!req || !buf || !buf->base)
+    {
+        ERR("Cannot allocate memory to send device list");
+        if(buf)
+            free(buf->base);
+        free(buf);
+        free(req);
+        return;
+    }
+    memcpy(buf->base, dump, len);
+    buf->len = len;
     req->data = buf;
 
     uv_write(req,(uv_stream_t *) _client_handle, buf, 1, _allocated_req_sent);
@@ -131,11 +147,33 @@ static void _start_touchlink(void)
 }
 
 
+static void _dispatch_answer(ZgInterfacesAnswerObject *obj)
+{
+    uv_write_t *req = NULL;
+    uv_buf_t *buf = NULL;
+
+    if(!_client_handle || !obj || !(obj->data))
+        return;
+
+    INF("Sending command answer");
+    req = calloc(1, sizeof(uv_write_t));
+    buf = calloc(1, sizeof(uv_buf_t));
+    buf->base = calloc(obj->len, sizeof(char));
+    memcpy(buf->base, obj->data, obj->len);
+    buf->len = obj->len;
+    req->data = buf;
+
+    uv_write(req,(uv_stream_t *) _client_handle, buf, 1, _allocated_req_sent);
+}
+
 static void _process_ipc_data(char *data, int len)
 {
    json_t *root;
    json_t *command;
    json_error_t error;
+   ZgInterfacesCommandObject *command_obj = NULL;
+   ZgInterfacesAnswerObject *answer_obj = NULL;
+   size_t size = 0;
 
    if(!data || len <= 0)
    {
@@ -144,6 +182,16 @@ static void _process_ipc_data(char *data, int len)
       return;
    }
 
+   /* Binary frames only carry commands handled by interfaces module */
+   size = zg_tlv_frame_size((uint8_t *)data, len);
+   if(size > 0)
+   {
+       answer_obj = zg_interfaces_process_raw_command(&_interface, data, size);
+       _dispatch_answer(answer_obj);
+       zg_interfaces_free_answer_object(answer_obj);
+       return;
+   }
+
    root = json_loads(data, JSON_DECODE_ANY, &error);
    if(!root)
    {
@@ -162,13 +210,20 @@ static void _process_ipc_data(char *data, int len)
             _send_device_list();
         else if(strcmp(json_string_value(command), "open_network") == 0)
             _open_network();
-        else if(strcmp(json_string_value(command), "touchlink") == 0)
+        else if(strcmp(json_string_value(command), "touchlink") == 0 && !json_object_get(root, "data"))
             _start_touchlink();
         else
         {
-            _send_error();
+            CALLOC_COMMAND_OBJ_RET(command_obj);
+            strncpy(command_obj->command_string, json_string_value(command), ZG_INTERFACES_MAX_COMMAND_STRING_LEN - 1);
+            command_obj->data = json_object_get(root, "data");
+            answer_obj = zg_interfaces_process_command(&_interface, command_obj);
+            _dispatch_answer(answer_obj);
+            zg_interfaces_free_command_object(command_obj);
+            zg_interfaces_free_answer_object(answer_obj);
         }
    }
+   json_decref(root);
 }
 
 /********************************
@@ -180,6 +235,7 @@ static void _new_data_cb(uv_stream_t *s __attribute__((unused)), ssize_t n, cons
     if (n < 0)
     {
         ERR("User socket error");
+        zg_interfaces_reset_client(&_interface);
         return;
     }
 
@@ -223,18 +279,22 @@ static void _new_connection_cb(uv_stream_t *s, int status)
 
 static void _send_event(uv_buf_t *buf)
 {
-    uv_write_t *req = calloc(1, sizeof(uv_write_t));
-    uv_buf_t *local_buf = calloc(1, sizeof(uv_buf_t));
+    uv_write_t *req = NULL;
+    uv_buf_t *local_buf = NULL;
 
+    /* Event is spooled, no need to copy it if nobody is connected */
+    if(!_client_handle || !buf)
+        return;
+
+    req = calloc(1, sizeof(uv_write_t));
+    local_buf = calloc(1, sizeof(uv_buf_t));
     local_buf->base = calloc(buf->len, sizeof(char));
     memcpy(local_buf->base, buf->base, buf->len);
     local_buf->len = buf->len;
     req->data = local_buf;
 
     DBG("Dispatching new event on IPC");
-
-    if(_client_handle)
-        uv_write(req,(uv_stream_t *) _client_handle, local_buf, 1, _allocated_req_sent);
+    uv_write(req,(uv_stream_t *) _client_handle, local_buf, 1, _allocated_req_sent);
 }
 /********************************
  *             API              *
@@ -0,0 +1,405 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <uv.h>
+#include <Eina.h>
+#include "requests.h"
+#include "aps.h"
+#include "conf.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define REQUESTS_DEFAULT_TIMEOUT_MS     10000
+#define REQUESTS_DEFAULT_MIN_INTERVAL_MS    100
+#define REQUESTS_CHECK_INTERVAL_MS      250
+/* Frames sent and not confirmed yet. ZNP has few buffers for data requests,
+ * and other modules must still be able to send their own requests */
+#define REQUESTS_MAX_IN_FLIGHT          4
+#define REQUESTS_MAX_QUEUED             256
+#define REQUESTS_MAX_TRANS              256
+
+/* Outcomes which are not ZNP status */
+#define REQUESTS_STATUS_TIMEOUT         -1
+#define REQUESTS_STATUS_NOT_SENT        -2
+#define REQUESTS_STATUS_HELD            -3
+#define REQUESTS_STATUS_SUPERSEDED      -4
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    ZgInterfacesInterface *interface;
+    void *client;
+    char command[ZG_INTERFACES_MAX_COMMAND_STRING_LEN];
+    uint16_t addr;
+    json_t *request_id;
+    json_t *data;
+    ZgRequestsSendCb send;
+    uint64_t received;
+} Request;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uint64_t _timeout = REQUESTS_DEFAULT_TIMEOUT_MS;
+static uv_timer_t _timer;
+static uint64_t _min_interval = REQUESTS_DEFAULT_MIN_INTERVAL_MS;
+/* Time of last command sent to each device, indexed by short address */
+static Eina_Hash *_last_sent = NULL;
+static uv_timer_t _pacing_timer;
+/* Commands waiting to be sent, oldest first */
+static Eina_List *_queue = NULL;
+/* Sent commands, indexed by transaction id of their frame */
+static Request *_in_flight[REQUESTS_MAX_TRANS];
+static int _nb_in_flight = 0;
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static void _free_request(Request *request)
+{
+    json_decref(request->request_id);
+    json_decref(request->data);
+    free(request);
+}
+
+static void _complete(Request *request, int status)
+{
+    ZgInterfacesAnswerObject *answer = NULL;
+    json_t *root = NULL;
+    uint64_t latency = uv_now(uv_default_loop()) - request->received;
+
+    DBG("Command %s over with status %d after %"PRIu64" ms", request->command, status, latency);
+    if(!request->interface || !request->client || !request->interface->answer_cb)
+    {
+        _free_request(request);
+        return;
+    }
+
+    root = json_object();
+    if(status == REQUESTS_STATUS_HELD)
+    {
+        /* Accepted, will be delivered once sleepy device checks in */
+        status = ZSUCCESS;
+        json_object_set_new(root, "held", json_true());
+    }
+    else if(status == REQUESTS_STATUS_SUPERSEDED)
+    {
+        /* Device will get the newer command instead */
+        status = ZSUCCESS;
+        json_object_set_new(root, "superseded", json_true());
+    }
+    json_object_set_new(root, request->command, json_integer(status));
+    if(status == REQUESTS_STATUS_TIMEOUT)
+        json_object_set_new(root, "error", json_string("timeout"));
+    else if(status == REQUESTS_STATUS_NOT_SENT)
+        json_object_set_new(root, "error", json_string("not sent"));
+    else if(status != ZSUCCESS)
+        json_object_set_new(root, "error", json_string(zg_logs_znp_strerror(status)));
+    if(request->request_id)
+        json_object_set(root, "request_id", request->request_id);
+    json_object_set_new(root, "latency_ms", json_integer(latency));
+
+    answer = calloc(1, sizeof(ZgInterfacesAnswerObject));
+    if(answer)
+    {
+        answer->status = status == ZSUCCESS ? 0 : 1;
+        answer->data = json_dumps(root, JSON_COMPACT);
+        answer->len = answer->data ? strlen(answer->data) : 0;
+        answer->free_data = 1;
+        if(answer->data)
+            request->interface->answer_cb(request->client, answer);
+        else
+            ERR("Cannot encode answer of command %s", request->command);
+        zg_interfaces_free_answer_object(answer);
+    }
+    else
+    {
+        CRI("Cannot allocate answer of command %s", request->command);
+    }
+    json_decref(root);
+    _free_request(request);
+}
+
+static void _check_timeouts_cb(uv_timer_t *timer);
+
+static void _update_timer(void)
+{
+    if(_queue || _nb_in_flight)
+    {
+        if(!uv_is_active((uv_handle_t *)&_timer))
+            uv_timer_start(&_timer, _check_timeouts_cb, REQUESTS_CHECK_INTERVAL_MS, REQUESTS_CHECK_INTERVAL_MS);
+    }
+    else
+    {
+        uv_timer_stop(&_timer);
+    }
+}
+
+/* Delay before a new command can be sent to a device */
+static uint64_t _device_wait_get(uint16_t addr, uint64_t now)
+{
+    uint32_t key = addr;
+    uint64_t *last = NULL;
+
+    if(!_min_interval || !_last_sent)
+        return 0;
+    last = eina_hash_find(_last_sent, &key);
+    if(!last || now - *last >= _min_interval)
+        return 0;
+    return _min_interval - (now - *last);
+}
+
+static void _device_sent(uint16_t addr, uint64_t now)
+{
+    uint32_t key = addr;
+    uint64_t *last = NULL;
+
+    if(!_min_interval || !_last_sent)
+        return;
+    last = eina_hash_find(_last_sent, &key);
+    if(!last)
+    {
+        last = calloc(1, sizeof(uint64_t));
+        if(!last)
+            return;
+        eina_hash_add(_last_sent, &key, last);
+    }
+    *last = now;
+}
+
+static void _pacing_cb(uv_timer_t *timer);
+
+static void _send_next(void)
+{
+    Eina_List *l = NULL;
+    Eina_List *l_next = NULL;
+    Request *request = NULL;
+    uint64_t now = uv_now(uv_default_loop());
+    uint64_t wait = 0;
+    uint64_t next_wait = 0;
+    int trans = -1;
+
+    EINA_LIST_FOREACH_SAFE(_queue, l, l_next, request)
+    {
+        if(_nb_in_flight >= REQUESTS_MAX_IN_FLIGHT)
+            break;
+
+        /* A device which has just been sent a command must wait, commands of
+         * other devices go ahead */
+        wait = _device_wait_get(request->addr, now);
+        if(wait)
+        {
+            if(!next_wait || wait < next_wait)
+                next_wait = wait;
+            continue;
+        }
+
+        _queue = eina_list_remove_list(_queue, l);
+        _device_sent(request->addr, now);
+        trans = request->send(request->data);
+        if(trans == ZG_APS_DATA_HELD)
+        {
+            _complete(request, REQUESTS_STATUS_HELD);
+            continue;
+        }
+        if(trans < 0 || trans >= REQUESTS_MAX_TRANS)
+        {
+            WRN("Cannot send command %s", request->command);
+            _complete(request, REQUESTS_STATUS_NOT_SENT);
+            continue;
+        }
+
+        /* Transaction ids wrap around : an older command still using this id
+         * has been waiting for far too long */
+        if(_in_flight[trans])
+        {
+            _nb_in_flight--;
+            _complete(_in_flight[trans], REQUESTS_STATUS_TIMEOUT);
+        }
+        _in_flight[trans] = request;
+        _nb_in_flight++;
+    }
+    if(next_wait)
+        uv_timer_start(&_pacing_timer, _pacing_cb, next_wait, 0);
+    _update_timer();
+}
+
+static void _pacing_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    _send_next();
+}
+
+static void _data_confirm_cb(uint8_t trans, uint8_t status)
+{
+    Request *request = _in_flight[trans];
+
+    if(!request)
+        return;
+
+    _in_flight[trans] = NULL;
+    _nb_in_flight--;
+    _complete(request, status);
+    _send_next();
+}
+
+static void _check_timeouts_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    uint64_t now = uv_now(uv_default_loop());
+    Request *request = NULL;
+    int index = 0;
+
+    for(index = 0; index < REQUESTS_MAX_TRANS && _nb_in_flight > 0; index++)
+    {
+        request = _in_flight[index];
+        if(request && now - request->received >= _timeout)
+        {
+            WRN("Command %s (transaction 0x%02X) has timed out", request->command, index);
+            _in_flight[index] = NULL;
+            _nb_in_flight--;
+            _complete(request, REQUESTS_STATUS_TIMEOUT);
+        }
+    }
+
+    /* Queued commands are sorted by reception time */
+    while(_queue)
+    {
+        request = eina_list_data_get(_queue);
+        if(now - request->received < _timeout)
+            break;
+        WRN("Command %s has timed out before being sent", request->command);
+        _queue = eina_list_remove_list(_queue, _queue);
+        _complete(request, REQUESTS_STATUS_TIMEOUT);
+    }
+
+    _send_next();
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_requests_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_requests", ZG_COLOR_GREEN);
+    _timeout = zg_conf_get_interfaces_command_timeout() > 0 ?
+        (uint64_t)zg_conf_get_interfaces_command_timeout() : REQUESTS_DEFAULT_TIMEOUT_MS;
+    _min_interval = zg_conf_get_interfaces_command_min_interval() > 0 ?
+        (uint64_t)zg_conf_get_interfaces_command_min_interval() : REQUESTS_DEFAULT_MIN_INTERVAL_MS;
+    _last_sent = eina_hash_int32_new(free);
+    if(!_last_sent)
+    {
+        CRI("Cannot allocate commands pacing table");
+        return 1;
+    }
+    memset(_in_flight, 0, sizeof(_in_flight));
+    _nb_in_flight = 0;
+    uv_timer_init(uv_default_loop(), &_timer);
+    uv_timer_init(uv_default_loop(), &_pacing_timer);
+    zg_aps_register_data_confirm_callback(_data_confirm_cb);
+    INF("Requests module initialized (timeout %"PRIu64" ms, minimal interval %"PRIu64" ms)",
+            _timeout, _min_interval);
+    return 0;
+}
+
+void zg_requests_shutdown(void)
+{
+    Request *request = NULL;
+    int index = 0;
+
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    zg_aps_register_data_confirm_callback(NULL);
+    uv_timer_stop(&_timer);
+    uv_close((uv_handle_t *)&_timer, NULL);
+    uv_timer_stop(&_pacing_timer);
+    uv_close((uv_handle_t *)&_pacing_timer, NULL);
+    EINA_LIST_FREE(_queue, request)
+        _free_request(request);
+    for(index = 0; index < REQUESTS_MAX_TRANS; index++)
+    {
+        if(_in_flight[index])
+            _free_request(_in_flight[index]);
+        _in_flight[index] = NULL;
+    }
+    _nb_in_flight = 0;
+    eina_hash_free(_last_sent);
+    _last_sent = NULL;
+    INF("Requests module shut down");
+}
+
+uint8_t zg_requests_submit(ZgInterfacesInterface *interface, void *client, const char *command,
+        uint16_t addr, json_t *request_id, ZgRequestsSendCb send, json_t *data)
+{
+    Eina_List *l = NULL;
+    Request *request = NULL;
+
+    if(!command || !send)
+        return 1;
+
+    /* Only the newest state asked to a device matters : it replaces the
+     * command of same kind still waiting for this device */
+    EINA_LIST_FOREACH(_queue, l, request)
+    {
+        if(request->addr == addr && strcmp(request->command, command) == 0)
+        {
+            DBG("Command %s for device 0x%04X is superseded", command, addr);
+            _queue = eina_list_remove_list(_queue, l);
+            _complete(request, REQUESTS_STATUS_SUPERSEDED);
+            break;
+        }
+    }
+
+    if(eina_list_count(_queue) >= REQUESTS_MAX_QUEUED)
+    {
+        WRN("Cannot queue command %s : too many pending commands", command);
+        return 1;
+    }
+
+    request = calloc(1, sizeof(Request));
+    if(!request)
+    {
+        CRI("Cannot allocate memory to queue command %s", command);
+        return 1;
+    }
+    request->interface = interface;
+    request->client = client;
+    strncpy(request->command, command, ZG_INTERFACES_MAX_COMMAND_STRING_LEN - 1);
+    request->addr = addr;
+    request->request_id = json_incref(request_id);
+    request->data = json_incref(data);
+    request->send = send;
+    request->received = uv_now(uv_default_loop());
+    _queue = eina_list_append(_queue, request);
+    _send_next();
+    return 0;
+}
+
+void zg_requests_cancel(ZgInterfacesInterface *interface, void *client)
+{
+    Eina_List *l = NULL;
+    Request *request = NULL;
+    int index = 0;
+
+    EINA_LIST_FOREACH(_queue, l, request)
+    {
+        if(request->interface == interface && (!client || request->client == client))
+            request->client = NULL;
+    }
+    for(index = 0; index < REQUESTS_MAX_TRANS; index++)
+    {
+        request = _in_flight[index];
+        if(request && request->interface == interface && (!client || request->client == client))
+            request->client = NULL;
+    }
+}
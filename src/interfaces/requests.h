@@ -0,0 +1,65 @@
+#ifndef ZG_REQUESTS_H
+#define ZG_REQUESTS_H
+
+#include <stdint.h>
+#include <jansson.h>
+#include "interfaces.h"
+
+/**
+ * Commands sent by clients to devices are queued here and sent to the radio
+ * with a bounded number of frames in flight. Commands are sent to a device at
+ * a bounded rate, and a command waiting to be sent is replaced by a newer
+ * command of the same name for the same device. A command is over once ZNP has
+ * rejected its frame, once its AF_DATA_CONFIRM has been received, once its
+ * frame is held for a sleepy device, once it has been replaced, or once it has
+ * timed out. Its outcome is then given to the client through the answer_cb of
+ * its interface, along with the request id given by the client and the
+ * command latency
+ */
+
+/**
+ * \brief Callback sending the frame of a command
+ * \param data The command data
+ * \return The transaction id of the sent frame, ZG_APS_DATA_HELD if the frame
+ * is held for a sleepy device, or -1 if it could not be sent
+ */
+typedef int (*ZgRequestsSendCb)(json_t *data);
+
+/**
+ * \brief Initialize the requests module, command timeout being read from
+ * configuration
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_requests_init(void);
+
+/**
+ * \brief Terminate the requests module. Pending commands are dropped without
+ * answer
+ */
+void zg_requests_shutdown(void);
+
+/**
+ * \brief Queue a command
+ * \param interface The interface which has received the command, or NULL if
+ * command outcome must not be sent
+ * \param client The client which has sent the command, given back to the
+ * interface answer_cb
+ * \param command The command name, used as key of the answer
+ * \param addr The short address of the target device
+ * \param request_id The id given by the client to the command, may be NULL
+ * \param send The callback sending the command frame
+ * \param data The command data, given to send callback
+ * \return 0 if command has been queued, 1 if queue is full
+ */
+uint8_t zg_requests_submit(ZgInterfacesInterface *interface, void *client, const char *command,
+        uint16_t addr, json_t *request_id, ZgRequestsSendCb send, json_t *data);
+
+/**
+ * \brief Drop answers of pending commands of a client, e.g. when it
+ * disconnects. Commands are still sent
+ * \param interface The interface of the client
+ * \param client The client, or NULL for all clients of the interface
+ */
+void zg_requests_cancel(ZgInterfacesInterface *interface, void *client);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "spool.h"
+#include "conf.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define SPOOL_DEFAULT_SIZE          256
+#define SPOOL_KEY_MAX_LEN           32
+#define SPOOL_STRING_MAX_LEN        32
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+/* Event strings are not owned by events, so they are copied along with them */
+typedef struct
+{
+    ZgInterfacesEvent event;
+    char keys[ZG_INTERFACES_EVENT_MAX_VALUES][SPOOL_KEY_MAX_LEN];
+    char strings[ZG_INTERFACES_EVENT_MAX_VALUES][SPOOL_STRING_MAX_LEN];
+} SpoolEntry;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static SpoolEntry *_entries = NULL;
+static uint32_t _size = 0;
+static uint32_t _count = 0;
+static uint32_t _last_seq = 0;
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_spool_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_spool", ZG_COLOR_GREEN);
+    _size = zg_conf_get_interfaces_spool_size() > 0 ? zg_conf_get_interfaces_spool_size() : SPOOL_DEFAULT_SIZE;
+    _entries = calloc(_size, sizeof(SpoolEntry));
+    if(!_entries)
+    {
+        CRI("Cannot allocate events spool (%u events)", _size);
+        _init_count--;
+        return 1;
+    }
+    _count = 0;
+    _last_seq = 0;
+    INF("Spool module initialized (%u events)", _size);
+    return 0;
+}
+
+void zg_spool_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    ZG_VAR_FREE(_entries);
+    _size = 0;
+    _count = 0;
+    INF("Spool module shut down");
+}
+
+void zg_spool_store(ZgInterfacesEvent *event)
+{
+    SpoolEntry *entry = NULL;
+    uint8_t i = 0;
+
+    if(!event)
+        return;
+
+    event->seq = ++_last_seq;
+    if(!_entries)
+        return;
+
+    entry = &_entries[event->seq % _size];
+    memcpy(&entry->event, event, sizeof(ZgInterfacesEvent));
+    for(i = 0; i < event->nb_values; i++)
+    {
+        snprintf(entry->keys[i], SPOOL_KEY_MAX_LEN, "%s", event->values[i].key);
+        entry->event.values[i].key = entry->keys[i];
+        if(event->values[i].type == ZG_INTERFACES_VALUE_STRING)
+        {
+            snprintf(entry->strings[i], SPOOL_STRING_MAX_LEN, "%s",
+                    event->values[i].string ? event->values[i].string : "");
+            entry->event.values[i].string = entry->strings[i];
+        }
+    }
+    if(_count < _size)
+        _count++;
+}
+
+uint32_t zg_spool_get_first_seq(void)
+{
+    return _count ? _last_seq - _count + 1 : 0;
+}
+
+uint32_t zg_spool_get_last_seq(void)
+{
+    return _count ? _last_seq : 0;
+}
+
+const ZgInterfacesEvent *zg_spool_get(uint32_t seq)
+{
+    if(!_count || seq < zg_spool_get_first_seq() || seq > _last_seq)
+        return NULL;
+    return &_entries[seq % _size].event;
+}
@@ -0,0 +1,51 @@
+#ifndef ZG_SPOOL_H
+#define ZG_SPOOL_H
+
+#include <stdint.h>
+#include "interfaces.h"
+
+/**
+ * Bounded in-memory ring keeping the last sent events, so that a client
+ * reconnecting after a while can ask for the events it has missed. Each event
+ * gets a sequence number when stored, starting at 1 and increasing by one for
+ * each event. Once the ring is full, the oldest events are overwritten
+ */
+
+/**
+ * \brief Initialize the spool module, its size being read from configuration
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_spool_init(void);
+
+/**
+ * \brief Terminate the spool module and drop all stored events
+ */
+void zg_spool_shutdown(void);
+
+/**
+ * \brief Give a sequence number to an event and store a copy of it
+ * \param event The event to store, its seq field is updated
+ */
+void zg_spool_store(ZgInterfacesEvent *event);
+
+/**
+ * \brief Get the sequence number of the oldest stored event
+ * \return The sequence number, or 0 if spool is empty
+ */
+uint32_t zg_spool_get_first_seq(void);
+
+/**
+ * \brief Get the sequence number of the most recent stored event
+ * \return The sequence number, or 0 if spool is empty
+ */
+uint32_t zg_spool_get_last_seq(void);
+
+/**
+ * \brief Retrieve a stored event
+ * \param seq The sequence number of the event
+ * \return The event, valid until the next call to zg_spool_store, or NULL if
+ * the event is not stored anymore
+ */
+const ZgInterfacesEvent *zg_spool_get(uint32_t seq);
+
+#endif
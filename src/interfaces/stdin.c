@@ -59,6 +59,10 @@ static void _process_stdin_message_cb(uv_poll_t *handler __attribute__((unused))
                 cmd = ZG_STDIN_COMMAND_TOUCHLINK;
             if(strcmp((char *)buffer, "t") == 0)
                 cmd = ZG_STDIN_COMMAND_TOUCHLINK;
+            else if(strcmp((char *)buffer, "ti") == 0)
+                cmd = ZG_STDIN_COMMAND_TOUCHLINK_IDENTIFY;
+            else if(strcmp((char *)buffer, "tr") == 0)
+                cmd = ZG_STDIN_COMMAND_TOUCHLINK_RESET;
             else if(strcmp((char *)buffer, "d") == 0)
                 cmd = ZG_STDIN_COMMAND_DISCOVERY;
             else if(strcmp((char*)buffer, "o") == 0)
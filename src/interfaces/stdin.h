@@ -6,6 +6,8 @@
 typedef enum
 {
     ZG_STDIN_COMMAND_TOUCHLINK,
+    ZG_STDIN_COMMAND_TOUCHLINK_IDENTIFY,
+    ZG_STDIN_COMMAND_TOUCHLINK_RESET,
     ZG_STDIN_COMMAND_SWITCH_DEMO_LIGHT,
     ZG_STDIN_COMMAND_MOVE_TO_BLUE,
     ZG_STDIN_COMMAND_MOVE_TO_RED,
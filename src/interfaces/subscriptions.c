@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include <Eina.h>
+#include "subscriptions.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+/* Rate limit slot used for events which are not related to a device */
+#define SUBSCRIPTION_NO_DEVICE_SLOT     (ZG_DEVICE_ID_MAX + 1)
+
+#define DEVICE_BIT_IS_SET(bitmap, id)   ((bitmap)[(id) / 8] & (1 << ((id) % 8)))
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    ZgInterfacesInterface *interface;
+    ZgSubscriptionFilter filter;
+    uint64_t last_sent_ms[SUBSCRIPTION_NO_DEVICE_SLOT + 1];
+} Subscription;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static Eina_List *_subscriptions = NULL;
+
+/* Subscriptions sorted by event type, rebuilt each time subscriptions change,
+ * so that matching an event only walks the subscriptions interested in its type */
+static Eina_List *_index[ZG_INTERFACES_EVENT_MAX_ID];
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static uint8_t _type_matches(const ZgSubscriptionFilter *filter, ZgInterfacesEventType type)
+{
+    return filter->event_mask == ZG_INTERFACES_EVENT_MASK_ALL ||
+        (filter->event_mask & ZG_INTERFACES_EVENT_MASK(type));
+}
+
+static void _build_index(void)
+{
+    Eina_List *l = NULL;
+    Subscription *subscription = NULL;
+    int type = 0;
+
+    for(type = 0; type < ZG_INTERFACES_EVENT_MAX_ID; type++)
+    {
+        _index[type] = eina_list_free(_index[type]);
+        EINA_LIST_FOREACH(_subscriptions, l, subscription)
+        {
+            /* State events merge values of other types, they are matched
+             * against all subscriptions */
+            if(type == ZG_INTERFACES_EVENT_STATE || _type_matches(&subscription->filter, type))
+                _index[type] = eina_list_append(_index[type], subscription);
+        }
+    }
+}
+
+static uint8_t _cluster_matches(const ZgSubscriptionFilter *filter, uint16_t cluster)
+{
+    uint8_t i = 0;
+
+    if(filter->nb_clusters == 0)
+        return 1;
+
+    for(i = 0; i < filter->nb_clusters; i++)
+    {
+        if(filter->clusters[i] == cluster)
+            return 1;
+    }
+    return 0;
+}
+
+/* A state event matches a subscription as soon as one of its merged values
+ * does, either through its own type or through the state type */
+static uint8_t _event_matches(const ZgSubscriptionFilter *filter, const ZgInterfacesEvent *event)
+{
+    int type = 0;
+
+    if(event->type != ZG_INTERFACES_EVENT_STATE || !event->merged_mask)
+        return _type_matches(filter, event->type) && _cluster_matches(filter, event->cluster);
+
+    for(type = 0; type < ZG_INTERFACES_EVENT_MAX_ID; type++)
+    {
+        if(!(event->merged_mask & ZG_INTERFACES_EVENT_MASK(type)))
+            continue;
+        if((_type_matches(filter, type) || _type_matches(filter, ZG_INTERFACES_EVENT_STATE)) &&
+                _cluster_matches(filter, zg_interfaces_event_type_get_cluster(type)))
+            return 1;
+    }
+    return 0;
+}
+
+static uint8_t _device_matches(const ZgSubscriptionFilter *filter, int device_id)
+{
+    if(filter->all_devices)
+        return 1;
+    if(device_id < 0 || device_id > ZG_DEVICE_ID_MAX)
+        return 0;
+    return DEVICE_BIT_IS_SET(filter->devices, device_id) ? 1 : 0;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_subscriptions_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_subscriptions", ZG_COLOR_GREEN);
+    memset(_index, 0, sizeof(_index));
+    INF("Subscriptions module initialized");
+    return 0;
+}
+
+void zg_subscriptions_shutdown(void)
+{
+    Subscription *subscription = NULL;
+    int type = 0;
+
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    for(type = 0; type < ZG_INTERFACES_EVENT_MAX_ID; type++)
+        _index[type] = eina_list_free(_index[type]);
+    EINA_LIST_FREE(_subscriptions, subscription)
+        free(subscription);
+    INF("Subscriptions module shut down");
+}
+
+uint8_t zg_subscriptions_add(ZgInterfacesInterface *interface, const ZgSubscriptionFilter *filter)
+{
+    Subscription *subscription = NULL;
+
+    if(!interface || !filter)
+        return 1;
+
+    subscription = calloc(1, sizeof(Subscription));
+    if(!subscription)
+    {
+        CRI("Cannot allocate memory for new subscription");
+        return 1;
+    }
+    subscription->interface = interface;
+    memcpy(&subscription->filter, filter, sizeof(ZgSubscriptionFilter));
+    _subscriptions = eina_list_append(_subscriptions, subscription);
+    _build_index();
+    INF("[%s] New subscription (events 0x%08X, %s, %d clusters, %dms interval)", interface->name,
+            filter->event_mask, filter->all_devices ? "all devices":"filtered devices",
+            filter->nb_clusters, filter->min_interval_ms);
+    return 0;
+}
+
+void zg_subscriptions_clear(ZgInterfacesInterface *interface)
+{
+    Eina_List *l = NULL, *l_next = NULL;
+    Subscription *subscription = NULL;
+    uint8_t removed = 0;
+
+    EINA_LIST_FOREACH_SAFE(_subscriptions, l, l_next, subscription)
+    {
+        if(subscription->interface == interface)
+        {
+            _subscriptions = eina_list_remove_list(_subscriptions, l);
+            free(subscription);
+            removed = 1;
+        }
+    }
+    if(removed)
+    {
+        _build_index();
+        INF("[%s] Subscriptions cleared", interface->name);
+    }
+}
+
+uint8_t zg_subscriptions_exist(ZgInterfacesInterface *interface)
+{
+    Eina_List *l = NULL;
+    Subscription *subscription = NULL;
+
+    EINA_LIST_FOREACH(_subscriptions, l, subscription)
+    {
+        if(subscription->interface == interface)
+            return 1;
+    }
+    return 0;
+}
+
+Eina_List *zg_subscriptions_match(const ZgInterfacesEvent *event)
+{
+    Eina_List *result = NULL;
+    Eina_List *l = NULL;
+    Subscription *subscription = NULL;
+    uint64_t now = 0;
+    int slot = 0;
+
+    if(!event || event->type >= ZG_INTERFACES_EVENT_MAX_ID || !_index[event->type])
+        return NULL;
+
+    now = uv_now(uv_default_loop());
+    slot = (event->device_id >= 0 && event->device_id <= ZG_DEVICE_ID_MAX) ?
+        event->device_id : SUBSCRIPTION_NO_DEVICE_SLOT;
+
+    EINA_LIST_FOREACH(_index[event->type], l, subscription)
+    {
+        if(!_device_matches(&subscription->filter, event->device_id) ||
+                !_event_matches(&subscription->filter, event))
+            continue;
+
+        if(subscription->filter.min_interval_ms &&
+                subscription->last_sent_ms[slot] &&
+                now - subscription->last_sent_ms[slot] < subscription->filter.min_interval_ms)
+            continue;
+
+        subscription->last_sent_ms[slot] = now;
+        if(!eina_list_data_find(result, subscription->interface))
+            result = eina_list_append(result, subscription->interface);
+    }
+    return result;
+}
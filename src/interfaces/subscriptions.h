@@ -0,0 +1,69 @@
+#ifndef ZG_SUBSCRIPTIONS_H
+#define ZG_SUBSCRIPTIONS_H
+
+#include <stdint.h>
+#include <Eina.h>
+#include "interfaces.h"
+#include "device.h"
+
+#define ZG_SUBSCRIPTIONS_DEVICE_BITMAP_SIZE     ((ZG_DEVICE_ID_MAX + 1) / 8)
+#define ZG_SUBSCRIPTIONS_MAX_CLUSTERS           8
+
+/* Filter describing which events a client wants to receive */
+typedef struct
+{
+    /* Or-combination of ZG_INTERFACES_EVENT_MASK, ZG_INTERFACES_EVENT_MASK_ALL for all events */
+    uint32_t event_mask;
+    /* When not set, only events from devices set in the devices bitmap match */
+    uint8_t all_devices;
+    uint8_t devices[ZG_SUBSCRIPTIONS_DEVICE_BITMAP_SIZE];
+    /* When not 0, only events related to one of the listed clusters match */
+    uint8_t nb_clusters;
+    uint16_t clusters[ZG_SUBSCRIPTIONS_MAX_CLUSTERS];
+    /* Minimal interval between two events of the same device, 0 for no limit */
+    uint32_t min_interval_ms;
+} ZgSubscriptionFilter;
+
+/**
+ * \brief Initialize the subscriptions module
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_subscriptions_init(void);
+
+/**
+ * \brief Terminate the subscriptions module and drop all subscriptions
+ */
+void zg_subscriptions_shutdown(void);
+
+/**
+ * \brief Add a subscription for an interface. An interface receives an event
+ * as soon as one of its subscriptions matches it
+ * \param interface The interface subscribing
+ * \param filter The filter to apply, copied by the module
+ * \return 0 if subscription has been added, otherwise 1
+ */
+uint8_t zg_subscriptions_add(ZgInterfacesInterface *interface, const ZgSubscriptionFilter *filter);
+
+/**
+ * \brief Remove all subscriptions of an interface
+ * \param interface The interface
+ */
+void zg_subscriptions_clear(ZgInterfacesInterface *interface);
+
+/**
+ * \brief Check if an interface has any subscription
+ * \param interface The interface
+ * \return 1 if interface has at least one subscription, otherwise 0
+ */
+uint8_t zg_subscriptions_exist(ZgInterfacesInterface *interface);
+
+/**
+ * \brief Find all interfaces having a subscription matching an event. Rate
+ * limits of matching subscriptions are updated, so the event is expected to be
+ * sent to the returned interfaces
+ * \param event The event to match
+ * \return A list of interfaces, to be freed with eina_list_free
+ */
+Eina_List *zg_subscriptions_match(const ZgInterfacesEvent *event);
+
+#endif
@@ -1,8 +1,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <jansson.h>
 #include "interfaces.h"
+#include "tlv.h"
 #include "logs.h"
 #include "conf.h"
 #include "tcp.h"
@@ -151,7 +153,6 @@ static void _start_touchlink(void)
 static void _dispatch_answer(ZgInterfacesAnswerObject *obj)
 {
     uv_write_t *req = NULL;
-    json_t *devices = zg_device_get_device_list_json();
 
     if(!_client_handle || !obj || !(obj->data))
     {
@@ -162,21 +163,26 @@ static void _dispatch_answer(ZgInterfacesAnswerObject *obj)
     req = calloc(1, sizeof(uv_write_t));
     uv_buf_t *buf = calloc(1, sizeof(uv_buf_t));
     buf->base = calloc(obj->len, sizeof(char));
-    strncpy(buf->base, obj->data, obj->len);
-    json_decref(devices);
+    memcpy(buf->base, obj->data, obj->len);
     buf->len = obj->len;
-    DBG("Data : [%s] (%zd)", buf->base, buf->len);
+    DBG("Answer length : %zd", buf->len);
     req->data = buf;
 
     uv_write(req,(uv_stream_t *) _client_handle, buf, 1, _allocated_req_sent);
 }
+
+/* Deferred answers are dropped if their client has gone */
+static void _send_answer(void *client, ZgInterfacesAnswerObject *obj)
+{
+    if(client != _client_handle)
+        return;
+    _dispatch_answer(obj);
+}
+
 static void _process_tcp_data(char *data, int len)
 {
-   json_t *root;
-   json_t *command;
-   json_error_t error;
-   ZgInterfacesCommandObject *command_obj = NULL;
    ZgInterfacesAnswerObject *answer_obj = NULL;
+   int size = 0;
 
    if(!data || len <= 0)
    {
@@ -185,26 +191,22 @@ static void _process_tcp_data(char *data, int len)
       return;
    }
 
-   root = json_loads(data, JSON_DECODE_ANY, &error);
-   if(!root)
-   {
-       ERR("Cannot decode TCP command : %s", error.text);
-      _send_error();
-       return;
-   }
-
-   command = json_object_get(root, "command");
-   if(command && json_is_string(command))
+   /* Several binary frames or JSON commands may be received at once */
+   while(len > 0)
    {
-        INF("TCP server received command [%s]", json_string_value(command));
-        CALLOC_COMMAND_OBJ_RET(command_obj);
-        strcpy(command_obj->command_string, json_string_value(json_object_get(root, "command")));
-        command_obj->data = json_object_get(root, "data");
-        command_obj->len = 0; /* Need to better define Command object */
-        answer_obj = zg_interfaces_process_command(_interface, command_obj);
-        _dispatch_answer(answer_obj);
-        zg_interfaces_free_command_object(command_obj);
-        zg_interfaces_free_answer_object(answer_obj);
+       if(isspace((unsigned char)*data))
+       {
+           data++;
+           len--;
+           continue;
+       }
+       answer_obj = zg_interfaces_process_client_command(_interface, _client_handle, data, len, &size);
+       _dispatch_answer(answer_obj);
+       zg_interfaces_free_answer_object(answer_obj);
+       if(size <= 0)
+           break;
+       data += size;
+       len -= size;
    }
 }
 
@@ -214,10 +216,13 @@ static void _new_data_cb(uv_stream_t *s __attribute__((unused)), ssize_t n, cons
     {
         ERR("User socket error");
         CLOSE_CLIENT(_client_handle);
+        zg_interfaces_reset_client(_interface);
+        free(buf->base);
         return;
     }
 
     _process_tcp_data(buf->base, n);
+    free(buf->base);
 }
 
 static void alloc_cb(uv_handle_t *handle __attribute__((unused)), size_t size, uv_buf_t *buf)
@@ -262,6 +267,10 @@ static void _send_event(uv_buf_t *buf)
     uv_write_t *req = NULL;
     uv_buf_t *local_buf = NULL;
 
+    /* Event is spooled, no need to copy it if nobody is connected */
+    if(!_client_handle)
+        return;
+
     if(!buf || !(buf->base) || !(buf->len))
     {
         ERR("Event to dispatch is empty");
@@ -276,8 +285,7 @@ static void _send_event(uv_buf_t *buf)
     req->data = local_buf;
 
     DBG("Dispatching new event on TCP interface");
-    if(_client_handle)
-        uv_write(req,(uv_stream_t *) _client_handle, local_buf, 1, _allocated_req_sent);
+    uv_write(req,(uv_stream_t *) _client_handle, local_buf, 1, _allocated_req_sent);
 }
 
 /********************************
@@ -315,6 +323,7 @@ ZgInterfacesInterface *zg_tcp_init()
     _interface = calloc(1, sizeof(ZgInterfacesInterface));
     sprintf((char *)_interface->name, "TCP");
     _interface->event_cb = _send_event;
+    _interface->answer_cb = _send_answer;
 
     INF("TCP server started on address %s - port %d", zg_conf_get_tcp_server_address(), zg_conf_get_tcp_server_port());
     _init_count = 1;
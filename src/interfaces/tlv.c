@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include "tlv.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define TLV_MAGIC_0                 'Z'
+#define TLV_MAGIC_1                 'G'
+
+#define TLV_INDEX_MAGIC             0
+#define TLV_INDEX_VERSION           2
+#define TLV_INDEX_FRAME_TYPE        3
+#define TLV_INDEX_PAYLOAD_LEN       4
+
+#define TLV_FIELD_HEADER_SIZE       2
+#define TLV_FIELD_MAX_LEN           0xFF
+#define TLV_MAX_PAYLOAD_LEN         0xFFFF
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    uint8_t error;
+} TlvWriter;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+
+/********************************
+ *          Writer              *
+ *******************************/
+
+static void _write_le(uint8_t *dst, uint64_t value, uint8_t size)
+{
+    uint8_t i = 0;
+
+    for(i = 0; i < size; i++)
+        dst[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint64_t _read_le(const uint8_t *src, uint8_t size)
+{
+    uint64_t value = 0;
+    uint8_t i = 0;
+
+    for(i = 0; i < size; i++)
+        value |= ((uint64_t)src[i]) << (8 * i);
+    return value;
+}
+
+static void _writer_init(TlvWriter *writer, size_t size, ZgTlvFrameType type)
+{
+    memset(writer, 0, sizeof(TlvWriter));
+    writer->size = ZG_TLV_HEADER_SIZE + size;
+    writer->data = calloc(writer->size, sizeof(uint8_t));
+    if(!writer->data)
+    {
+        CRI("Cannot allocate memory to encode binary frame");
+        writer->error = 1;
+        return;
+    }
+    writer->data[TLV_INDEX_MAGIC] = TLV_MAGIC_0;
+    writer->data[TLV_INDEX_MAGIC + 1] = TLV_MAGIC_1;
+    writer->data[TLV_INDEX_VERSION] = ZG_TLV_VERSION;
+    writer->data[TLV_INDEX_FRAME_TYPE] = type;
+    writer->len = ZG_TLV_HEADER_SIZE;
+}
+
+/* Fields are made of up to two parts, so that key/value pairs can be written
+ * without intermediate copy */
+static void _writer_add(TlvWriter *writer, ZgTlvTag tag, const void *part1, size_t len1, const void *part2, size_t len2)
+{
+    if(writer->error)
+        return;
+
+    if(len1 + len2 > TLV_FIELD_MAX_LEN ||
+            writer->len + TLV_FIELD_HEADER_SIZE + len1 + len2 > writer->size)
+    {
+        ERR("Cannot encode binary field 0x%02X (%zd bytes)", tag, len1 + len2);
+        writer->error = 1;
+        return;
+    }
+
+    writer->data[writer->len++] = tag;
+    writer->data[writer->len++] = len1 + len2;
+    if(len1)
+        memcpy(writer->data + writer->len, part1, len1);
+    writer->len += len1;
+    if(len2)
+        memcpy(writer->data + writer->len, part2, len2);
+    writer->len += len2;
+}
+
+static void _writer_add_uint(TlvWriter *writer, ZgTlvTag tag, uint64_t value, uint8_t size)
+{
+    uint8_t buf[sizeof(uint64_t)];
+
+    _write_le(buf, value, size);
+    _writer_add(writer, tag, buf, size, NULL, 0);
+}
+
+static uint8_t *_writer_finish(TlvWriter *writer, size_t *len)
+{
+    if(writer->error || writer->len - ZG_TLV_HEADER_SIZE > TLV_MAX_PAYLOAD_LEN)
+    {
+        ZG_VAR_FREE(writer->data);
+        return NULL;
+    }
+
+    _write_le(writer->data + TLV_INDEX_PAYLOAD_LEN, writer->len - ZG_TLV_HEADER_SIZE, sizeof(uint16_t));
+    if(len)
+        *len = writer->len;
+    return writer->data;
+}
+
+/* Integers are sent on the smallest size keeping their sign */
+static uint8_t _int_size(int64_t value)
+{
+    if(value >= INT8_MIN && value <= INT8_MAX)
+        return 1;
+    if(value >= INT16_MIN && value <= INT16_MAX)
+        return 2;
+    if(value >= INT32_MIN && value <= INT32_MAX)
+        return 4;
+    return 8;
+}
+
+static int64_t _read_int(const uint8_t *src, uint8_t size)
+{
+    uint64_t value = _read_le(src, size);
+
+    /* Sign extension */
+    if(size < sizeof(uint64_t) && (value & (1ULL << (8 * size - 1))))
+        value |= ~0ULL << (8 * size);
+    return (int64_t)value;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+void zg_tlv_init(void)
+{
+    _log_domain = zg_logs_domain_register("zg_tlv", ZG_COLOR_GREEN);
+}
+
+size_t zg_tlv_frame_size(const uint8_t *data, size_t len)
+{
+    size_t payload_len = 0;
+
+    if(!data || len < ZG_TLV_HEADER_SIZE ||
+            data[TLV_INDEX_MAGIC] != TLV_MAGIC_0 ||
+            data[TLV_INDEX_MAGIC + 1] != TLV_MAGIC_1)
+        return 0;
+
+    if(data[TLV_INDEX_VERSION] != ZG_TLV_VERSION)
+    {
+        WRN("Unsupported binary frame version %d", data[TLV_INDEX_VERSION]);
+        return 0;
+    }
+
+    payload_len = _read_le(data + TLV_INDEX_PAYLOAD_LEN, sizeof(uint16_t));
+    if(len < ZG_TLV_HEADER_SIZE + payload_len)
+    {
+        WRN("Binary frame is truncated (%zd/%zd bytes)", len, ZG_TLV_HEADER_SIZE + payload_len);
+        return 0;
+    }
+    return ZG_TLV_HEADER_SIZE + payload_len;
+}
+
+uint8_t *zg_tlv_encode_event(const ZgInterfacesEvent *event, size_t *len)
+{
+    TlvWriter writer;
+    size_t size = 0;
+    int64_t value = 0;
+    uint8_t buf[sizeof(int64_t)];
+    uint8_t i = 0;
+
+    if(!event)
+        return NULL;
+
+    /* Compute the frame size so that it is allocated at once */
+    size = 5 * TLV_FIELD_HEADER_SIZE + sizeof(uint8_t) * 2 + sizeof(uint16_t) + sizeof(uint64_t) + sizeof(uint32_t);
+    for(i = 0; i < event->nb_values; i++)
+    {
+        size += TLV_FIELD_HEADER_SIZE + strlen(event->values[i].key) + 1;
+        if(event->values[i].type == ZG_INTERFACES_VALUE_INT)
+            size += sizeof(int64_t);
+        else if(event->values[i].string)
+            size += strlen(event->values[i].string);
+    }
+
+    _writer_init(&writer, size, ZG_TLV_FRAME_EVENT);
+    _writer_add_uint(&writer, ZG_TLV_TAG_EVENT_TYPE, event->type, sizeof(uint8_t));
+    if(event->device_id != ZG_INTERFACES_EVENT_NO_DEVICE)
+        _writer_add_uint(&writer, ZG_TLV_TAG_DEVICE_ID, event->device_id, sizeof(uint8_t));
+    if(event->cluster != ZG_INTERFACES_EVENT_NO_CLUSTER)
+        _writer_add_uint(&writer, ZG_TLV_TAG_CLUSTER, event->cluster, sizeof(uint16_t));
+    _writer_add_uint(&writer, ZG_TLV_TAG_TIMESTAMP, event->timestamp, sizeof(uint64_t));
+    _writer_add_uint(&writer, ZG_TLV_TAG_SEQ, event->seq, sizeof(uint32_t));
+
+    for(i = 0; i < event->nb_values; i++)
+    {
+        if(event->values[i].type == ZG_INTERFACES_VALUE_INT)
+        {
+            value = event->values[i].integer;
+            _write_le(buf, value, _int_size(value));
+            _writer_add(&writer, ZG_TLV_TAG_INT, event->values[i].key, strlen(event->values[i].key) + 1,
+                    buf, _int_size(value));
+        }
+        else
+        {
+            _writer_add(&writer, ZG_TLV_TAG_STRING, event->values[i].key, strlen(event->values[i].key) + 1,
+                    event->values[i].string, event->values[i].string ? strlen(event->values[i].string) : 0);
+        }
+    }
+
+    return _writer_finish(&writer, len);
+}
+
+uint8_t *zg_tlv_encode_answer(int status, const void *body, size_t body_len, size_t *len)
+{
+    TlvWriter writer;
+    size_t offset = 0;
+    size_t chunk = 0;
+
+    /* Bodies longer than a field are split on several consecutive fields */
+    _writer_init(&writer, TLV_FIELD_HEADER_SIZE + sizeof(uint8_t) +
+            (body_len / TLV_FIELD_MAX_LEN + 1) * TLV_FIELD_HEADER_SIZE + body_len, ZG_TLV_FRAME_ANSWER);
+    _writer_add_uint(&writer, ZG_TLV_TAG_STATUS, status, sizeof(uint8_t));
+    while(offset < body_len)
+    {
+        chunk = body_len - offset > TLV_FIELD_MAX_LEN ? TLV_FIELD_MAX_LEN : body_len - offset;
+        _writer_add(&writer, ZG_TLV_TAG_BODY, (const uint8_t *)body + offset, chunk, NULL, 0);
+        offset += chunk;
+    }
+    return _writer_finish(&writer, len);
+}
+
+json_t *zg_tlv_decode_command(const uint8_t *data, size_t len, char *command, size_t command_size)
+{
+    json_t *result = NULL, *value = NULL, *array = NULL;
+    size_t frame_size = zg_tlv_frame_size(data, len);
+    size_t index = ZG_TLV_HEADER_SIZE;
+    const uint8_t *field = NULL;
+    const char *key = NULL;
+    size_t key_len = 0;
+    uint8_t tag = 0;
+    uint8_t field_len = 0;
+
+    if(!frame_size || data[TLV_INDEX_FRAME_TYPE] != ZG_TLV_FRAME_COMMAND || !command || !command_size)
+        return NULL;
+
+    command[0] = '\0';
+    result = json_object();
+    while(result && index + TLV_FIELD_HEADER_SIZE <= frame_size)
+    {
+        tag = data[index];
+        field_len = data[index + 1];
+        field = data + index + TLV_FIELD_HEADER_SIZE;
+        index += TLV_FIELD_HEADER_SIZE + field_len;
+        if(index > frame_size)
+            break;
+
+        if(tag == ZG_TLV_TAG_COMMAND)
+        {
+            if(field_len >= command_size)
+                break;
+            memcpy(command, field, field_len);
+            command[field_len] = '\0';
+            continue;
+        }
+
+        /* Remaining fields are key/value pairs, key being NUL-terminated */
+        key = (const char *)field;
+        key_len = strnlen(key, field_len);
+        if(key_len == field_len)
+        {
+            WRN("Ignoring binary field 0x%02X without key", tag);
+            continue;
+        }
+        field += key_len + 1;
+        field_len -= key_len + 1;
+
+        switch(tag)
+        {
+            case ZG_TLV_TAG_INT:
+            case ZG_TLV_TAG_INT_ITEM:
+                if(field_len != 1 && field_len != 2 && field_len != 4 && field_len != 8)
+                    continue;
+                value = json_integer(_read_int(field, field_len));
+                break;
+            case ZG_TLV_TAG_STRING:
+            case ZG_TLV_TAG_STRING_ITEM:
+                value = json_stringn((const char *)field, field_len);
+                break;
+            default:
+                WRN("Ignoring unknown binary field 0x%02X", tag);
+                continue;
+        }
+
+        if(tag == ZG_TLV_TAG_INT_ITEM || tag == ZG_TLV_TAG_STRING_ITEM)
+        {
+            array = json_object_get(result, key);
+            if(!json_is_array(array))
+            {
+                array = json_array();
+                json_object_set_new(result, key, array);
+            }
+            json_array_append_new(array, value);
+        }
+        else
+        {
+            json_object_set_new(result, key, value);
+        }
+    }
+
+    if(!result || index != frame_size || command[0] == '\0')
+    {
+        WRN("Cannot decode binary command");
+        json_decref(result);
+        return NULL;
+    }
+    return result;
+}
@@ -0,0 +1,87 @@
+#ifndef ZG_TLV_H
+#define ZG_TLV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <jansson.h>
+#include "interfaces.h"
+
+/**
+ * Binary encoding of interface messages. A frame is made of a 6 bytes header
+ * followed by a list of Tag-Length-Value fields :
+ * \li magic (2 bytes, "ZG"), version (1 byte), frame type (1 byte), payload
+ * length (2 bytes, little endian)
+ * \li each field : tag (1 byte), value length (1 byte), value
+ * All integers are little endian
+ */
+
+#define ZG_TLV_HEADER_SIZE              6
+#define ZG_TLV_VERSION                  1
+
+typedef enum
+{
+    ZG_TLV_FRAME_EVENT = 0x01,
+    ZG_TLV_FRAME_COMMAND = 0x02,
+    ZG_TLV_FRAME_ANSWER = 0x03
+} ZgTlvFrameType;
+
+typedef enum
+{
+    ZG_TLV_TAG_EVENT_TYPE = 0x01,
+    ZG_TLV_TAG_DEVICE_ID = 0x02,
+    ZG_TLV_TAG_CLUSTER = 0x03,
+    ZG_TLV_TAG_TIMESTAMP = 0x04,
+    ZG_TLV_TAG_SEQ = 0x05,
+    ZG_TLV_TAG_INT = 0x10,
+    ZG_TLV_TAG_STRING = 0x11,
+    ZG_TLV_TAG_INT_ITEM = 0x12,
+    ZG_TLV_TAG_STRING_ITEM = 0x13,
+    ZG_TLV_TAG_COMMAND = 0x20,
+    ZG_TLV_TAG_STATUS = 0x30,
+    ZG_TLV_TAG_BODY = 0x31
+} ZgTlvTag;
+
+/**
+ * \brief Initialize the binary encoding module
+ */
+void zg_tlv_init(void);
+
+/**
+ * \brief Check if received data starts with a binary frame
+ * \param data The received data
+ * \param len The received data length
+ * \return The size of the whole frame if data starts with a complete binary
+ * frame, otherwise 0
+ */
+size_t zg_tlv_frame_size(const uint8_t *data, size_t len);
+
+/**
+ * \brief Encode an event into a binary frame, straight from its C structure
+ * \param event The event to encode
+ * \param len Filled with the encoded frame length
+ * \return A newly allocated buffer holding the frame, or NULL on error
+ */
+uint8_t *zg_tlv_encode_event(const ZgInterfacesEvent *event, size_t *len);
+
+/**
+ * \brief Encode a command answer into a binary frame
+ * \param status The answer status
+ * \param body The answer body
+ * \param body_len The answer body length
+ * \param len Filled with the encoded frame length
+ * \return A newly allocated buffer holding the frame, or NULL on error
+ */
+uint8_t *zg_tlv_encode_answer(int status, const void *body, size_t body_len, size_t *len);
+
+/**
+ * \brief Decode a binary command frame
+ * \param data The frame
+ * \param len The frame length
+ * \param command Filled with the command name
+ * \param command_size Size of the command buffer
+ * \return A new JSON object holding the command data, or NULL on error. Int
+ * and string fields are mapped on object members, items on array members
+ */
+json_t *zg_tlv_decode_command(const uint8_t *data, size_t len, char *command, size_t command_size);
+
+#endif
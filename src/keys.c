@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -10,8 +11,12 @@
 #include "keys.h"
 #include "conf.h"
 #include "utils.h"
+#include "types.h"
 
 #define NETWORK_KEY_SIZE        16
+#define NETWORK_KEY_DIGEST_EXT  ".digest"
+#define FNV_OFFSET_BASIS        0xCBF29CE484222325ULL
+#define FNV_PRIME               0x100000001B3ULL
 
 static uint8_t *nwk_key = NULL;
 static int _log_domain = -1;
@@ -102,6 +107,24 @@ void _load_network_key(void)
     return;
 }
 
+static void _get_network_key_digest_path(char *path)
+{
+    snprintf(path, PATH_STRING_MAX_SIZE, "%s%s", zg_conf_get_network_key_path(), NETWORK_KEY_DIGEST_EXT);
+}
+
+/* FNV-1a digest of network key and of the ZNP it is written to */
+static uint64_t _compute_network_key_digest(uint64_t ext_addr)
+{
+    uint64_t digest = FNV_OFFSET_BASIS;
+    uint8_t index = 0;
+
+    for(index = 0; index < NETWORK_KEY_SIZE; index++)
+        digest = (digest ^ nwk_key[index]) * FNV_PRIME;
+    for(index = 0; index < sizeof(ext_addr); index++)
+        digest = (digest ^ ((ext_addr >> (8 * index)) & 0xFF)) * FNV_PRIME;
+    return digest;
+}
+
 void zg_keys_init()
 {
     _log_domain = zg_logs_domain_register("zg_keys", ZG_COLOR_LIGHTRED);
@@ -127,9 +150,61 @@ uint8_t zg_keys_network_key_size_get()
 void zg_keys_network_key_del(void)
 {
     unlink(zg_conf_get_network_key_path());
+    zg_keys_network_key_digest_del();
 }
 
 uint8_t zg_keys_check_network_key_exists(void)
 {
     return !access(zg_conf_get_network_key_path(), F_OK);
 }
+
+void zg_keys_network_key_digest_store(uint64_t ext_addr)
+{
+    char path[PATH_STRING_MAX_SIZE];
+    uint64_t digest = 0;
+    int fd = -1;
+
+    if(!nwk_key)
+        return;
+
+    _get_network_key_digest_path(path);
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    if(fd < 0)
+    {
+        WRN("Network key digest file cannot be opened : %s", strerror(errno));
+        return;
+    }
+
+    digest = _compute_network_key_digest(ext_addr);
+    if(write(fd, &digest, sizeof(digest)) < 0)
+        ERR("Cannot store network key digest to file : %s", strerror(errno));
+    close(fd);
+}
+
+uint8_t zg_keys_network_key_digest_check(uint64_t ext_addr)
+{
+    char path[PATH_STRING_MAX_SIZE];
+    uint64_t digest = 0;
+    int fd = -1;
+    ssize_t ret = 0;
+
+    if(!nwk_key)
+        return 0;
+
+    _get_network_key_digest_path(path);
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return 0;
+    ret = read(fd, &digest, sizeof(digest));
+    close(fd);
+
+    return ret == sizeof(digest) && digest == _compute_network_key_digest(ext_addr);
+}
+
+void zg_keys_network_key_digest_del(void)
+{
+    char path[PATH_STRING_MAX_SIZE];
+
+    _get_network_key_digest_path(path);
+    unlink(path);
+}
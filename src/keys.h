@@ -43,5 +43,28 @@ void zg_keys_network_key_del(void);
  */
 uint8_t zg_keys_check_network_key_exists(void);
 
+/**
+ * \brief Remember that the network key has been written to a ZNP
+ *
+ * ZNP does not allow to read the network key back, so a digest of the key and
+ * of the ZNP extended address is stored on host instead
+ * \param ext_addr The extended address of the ZNP
+ */
+void zg_keys_network_key_digest_store(uint64_t ext_addr);
+
+/**
+ * \brief Indicates if the current network key has already been written to a
+ * ZNP (see zg_keys_network_key_digest_store)
+ * \param ext_addr The extended address of the ZNP
+ * \return 1 if key has already been written, otherwise 0
+ */
+uint8_t zg_keys_network_key_digest_check(uint64_t ext_addr);
+
+/**
+ * \brief Forget that the network key has been written to a ZNP, e.g. because
+ * ZNP configuration is about to be cleared
+ */
+void zg_keys_network_key_digest_del(void);
+
 #endif
 
@@ -13,7 +13,6 @@
 #include "ipc.h"
 
 uv_loop_t *loop = NULL;
-uv_poll_t znp_poll;
 uv_poll_t user_poll;
 static uint8_t _reset_network = 0;
 static int _log_domain = -1;
@@ -24,25 +23,10 @@ static void signal_handler(uv_signal_t *handle __attribute__((unused)), int sign
     uv_stop(loop);
 }
 
-static void znp_poll_cb(uv_poll_t *handle __attribute__((unused)), int status, int events)
-{
-    if(status < 0)
-    {
-        ERR("ZNP socket error : %s (%s)", uv_err_name(status), uv_strerror(status));
-        return;
-    }
-
-    if(events & UV_READABLE)
-    {
-        DBG("ZNP socket has received data");
-        zg_rpc_read();
-    }
-}
-
 int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
 {
     uv_signal_t sig_int;
-    int znp_fd = -1, user_fd =0;
+    int user_fd =0;
     int status = -1;
     char config_file_path[PATH_STRING_MAX_SIZE] = {0};
     int c = 0;
@@ -93,17 +77,9 @@ int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
     }
 
 
+    /* ZNP media are polled by RPC module */
     loop = uv_default_loop();
-    znp_fd = zg_rpc_get_fd();
-    status = uv_poll_init(loop, &znp_poll, znp_fd);
-    if(status < 0)
-    {
-        ERR("Cannot add ZNP socket descriptor (%d) to main event loop : %s (%s)",
-                znp_fd, uv_err_name(status), uv_strerror(status));
-        goto main_end;
-    }
     status = uv_poll_init(loop, &user_poll, user_fd);
-    uv_poll_start(&znp_poll, UV_READABLE, znp_poll_cb);
     uv_poll_start(&user_poll, UV_READABLE, zg_stdin_get_stdin_main_callback());
 
     uv_signal_init(loop, &sig_int);
@@ -117,7 +93,6 @@ main_end:
     INF("Quitting application");
     uv_signal_stop(&sig_int);
     uv_poll_stop(&user_poll);
-    uv_poll_stop(&znp_poll);
     zg_core_shutdown();
 general_init_fail:
 rpc_end:
@@ -14,6 +14,11 @@
 #define DATA_REQUEST_DEFAULT_RADIUS         0x5
 #define DEFAULT_LATENCY                     0
 
+/* Number of source routed transactions tracked until their confirmation */
+#define SRC_RTG_MAX_PENDING                 16
+/* Number of data requests tracked until their SRSP, must divide 256 */
+#define DATA_REQUEST_MAX_PENDING_SRSP       32
+
 /* Inter-Pan commands */
 #define INTER_PAN_CLEAR                     0x00
 #define INTER_PAN_SET                       0x01
@@ -63,17 +68,78 @@ typedef struct __attribute__((packed))
     uint16_t len;
 } IncomingMstExtData;
 
+typedef struct
+{
+    uint8_t used;
+    uint8_t trans;
+    uint16_t dst_addr;
+} SrcRtgTransaction;
 
 /********************************
  *       Static variables       *
  *******************************/
 
 static AfIncomingMessageCb _af_incoming_msg_cb = NULL;
+static AfInterPanMessageCb _af_inter_pan_msg_cb = NULL;
+static AfSrcRtgErrorCb _af_src_rtg_error_cb = NULL;
+static AfDataConfirmCb _af_data_confirm_cb = NULL;
+static SrcRtgTransaction _src_rtg_transactions[SRC_RTG_MAX_PENDING];
+/* Transactions of data requests waiting for their SRSP, in sending order */
+static uint8_t _srsp_transactions[DATA_REQUEST_MAX_PENDING_SRSP];
+static uint8_t _srsp_head = 0;
+static uint8_t _srsp_tail = 0;
 static SyncActionCb sync_action_cb = NULL;
 static uint8_t _transaction_id = 0;
 static int _log_domain = -1;
 static int _init_count = 0;
 
+/********************************
+ *          Internal            *
+ *******************************/
+
+static void _track_data_request(uint8_t trans)
+{
+    if((uint8_t)(_srsp_tail - _srsp_head) == DATA_REQUEST_MAX_PENDING_SRSP)
+    {
+        WRN("Too many data requests waiting for SRSP, dropping oldest one");
+        _srsp_head++;
+    }
+    _srsp_transactions[_srsp_tail++ % DATA_REQUEST_MAX_PENDING_SRSP] = trans;
+}
+
+/* A data request rejected by ZNP never gets an AF_DATA_CONFIRM, so its
+ * failure is reported right away */
+static void _data_request_answered(uint8_t status)
+{
+    uint8_t trans = 0;
+
+    if(_srsp_head == _srsp_tail)
+    {
+        WRN("Received data request SRSP without pending data request");
+        return;
+    }
+    trans = _srsp_transactions[_srsp_head++ % DATA_REQUEST_MAX_PENDING_SRSP];
+    if(status != ZSUCCESS && _af_data_confirm_cb)
+        _af_data_confirm_cb(trans, status);
+}
+
+/* A request confirmed while still waiting for its SRSP means that the SRSP of
+ * this request, or of older ones, has been lost (e.g. on RPC timeout) */
+static void _data_request_confirmed(uint8_t trans)
+{
+    uint8_t index = 0;
+
+    for(index = _srsp_head; index != _srsp_tail; index++)
+    {
+        if(_srsp_transactions[index % DATA_REQUEST_MAX_PENDING_SRSP] == trans)
+        {
+            WRN("Missed SRSP of %d data request(s)", (uint8_t)(index - _srsp_head) + 1);
+            _srsp_head = index + 1;
+            return;
+        }
+    }
+}
+
 /********************************
  *      MT AF callbacks         *
  *******************************/
@@ -108,6 +174,7 @@ static uint8_t _data_request_srsp_cb(ZgMtMsg *msg)
     if(!msg || !msg->data)
     {
         WRN("Cannot extract AF_DATA_REQUEST SRSP data");
+        _data_request_answered(ZFAILURE);
     }
     else
     {
@@ -119,8 +186,8 @@ static uint8_t _data_request_srsp_cb(ZgMtMsg *msg)
         else
         {
             INF("Data request sent to remote device");
-            _transaction_id++;
         }
+        _data_request_answered(status);
     }
 
     if(sync_action_cb)
@@ -135,6 +202,7 @@ static uint8_t _data_request_ext_srsp_cb(ZgMtMsg *msg)
     if(!msg || !msg->data)
     {
         WRN("Cannot extract AF_DATA_REQUEST_EXT SRSP data");
+        _data_request_answered(ZFAILURE);
     }
     else
     {
@@ -146,8 +214,36 @@ static uint8_t _data_request_ext_srsp_cb(ZgMtMsg *msg)
         else
         {
             INF("Extended data request sent to remote device");
-            _transaction_id++;
         }
+        _data_request_answered(status);
+    }
+
+    if(sync_action_cb)
+        sync_action_cb();
+
+    return 0;
+}
+
+static uint8_t _data_request_src_rtg_srsp_cb(ZgMtMsg *msg)
+{
+    uint8_t status = 0;
+    if(!msg || !msg->data)
+    {
+        WRN("Cannot extract AF_DATA_REQUEST_SRC_RTG SRSP data");
+        _data_request_answered(ZFAILURE);
+    }
+    else
+    {
+        status = msg->data[0];
+        if(status != ZSUCCESS)
+        {
+            ERR("Error sending source routed data request to remote device : %s", zg_logs_znp_strerror(status));
+        }
+        else
+        {
+            INF("Source routed data request sent to remote device");
+        }
+        _data_request_answered(status);
     }
 
     if(sync_action_cb)
@@ -236,7 +332,7 @@ static uint8_t _incoming_msg_cb(ZgMtMsg *msg)
         INF("Length : %d", len);
 
         if(_af_incoming_msg_cb)
-            _af_incoming_msg_cb(src_addr, dst_endpoint, cluster, msg->data + index, len);
+            _af_incoming_msg_cb(src_addr, src_endpoint, dst_endpoint, cluster, msg->data + index, len);
    }
 
     return 0;
@@ -269,9 +365,19 @@ static uint8_t _incoming_msg_ext_cb(ZgMtMsg *msg)
     INF("Length : %d", parsed_data.len);
     /* TODO : add parsing for huge buffer, ie with multiple AF_DATA_RETRIEVE
     */
-    if(_af_incoming_msg_cb)
+    if(parsed_data.src_addr_mode == EXT_ADDR_MODE && _af_inter_pan_msg_cb)
+    {
+        _af_inter_pan_msg_cb(parsed_data.src_addr,
+                parsed_data.dst_endpoint,
+                parsed_data.cluster,
+                parsed_data.link_quality,
+                msg->data + sizeof(parsed_data),
+                parsed_data.len);
+    }
+    else if(_af_incoming_msg_cb)
     {
         _af_incoming_msg_cb(parsed_data.src_addr,
+                parsed_data.src_endpoint,
                 parsed_data.dst_endpoint,
                 parsed_data.cluster,
                 msg->data + sizeof(parsed_data),
@@ -287,6 +393,7 @@ static uint8_t _data_confirm_cb(ZgMtMsg *msg)
     uint8_t endpoint;
     uint8_t trans;
     uint8_t index = 0;
+    SrcRtgTransaction *slot = NULL;
 
     if(!msg||!msg->data)
     {
@@ -310,6 +417,18 @@ static uint8_t _data_confirm_cb(ZgMtMsg *msg)
         {
             INF("AF_DATA_CONFIRM received for transaction 0x%02X - endpoint 0x%02X", trans, endpoint);
         }
+
+        slot = &_src_rtg_transactions[trans % SRC_RTG_MAX_PENDING];
+        if(slot->used && slot->trans == trans)
+        {
+            slot->used = 0;
+            if(status != ZSUCCESS && _af_src_rtg_error_cb)
+                _af_src_rtg_error_cb(slot->dst_addr);
+        }
+
+        _data_request_confirmed(trans);
+        if(_af_data_confirm_cb)
+            _af_data_confirm_cb(trans, status);
     }
     return 0;
 }
@@ -329,6 +448,9 @@ static void _process_mt_af_srsp(ZgMtMsg *msg)
         case AF_DATA_REQUEST_EXT:
             _data_request_ext_srsp_cb(msg);
             break;
+        case AF_DATA_REQUEST_SRC_RTG:
+            _data_request_src_rtg_srsp_cb(msg);
+            break;
         case AF_INTER_PAN_CTL:
             _inter_pan_ctl_srsp_cb(msg);
             break;
@@ -412,7 +534,6 @@ void zg_mt_af_register_endpoint(   uint8_t endpoint,
     uint8_t default_latency = 0x00;
 
     INF("Registering new endpoint with profile 0x%4X", profile);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_AF;
     msg.cmd = AF_REGISTER;
@@ -450,7 +571,7 @@ void zg_mt_af_register_endpoint(   uint8_t endpoint,
     memcpy(buffer + index , out_clusters_list, out_clusters_num * sizeof(uint16_t));
     index += out_clusters_num * sizeof(uint16_t);
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
@@ -461,7 +582,6 @@ void zg_mt_af_set_inter_pan_endpoint(uint8_t endpoint, SyncActionCb cb)
     uint8_t *buffer;
 
     INF("Setting inter-pan endpoint 0x%02X", endpoint);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_AF;
     msg.cmd = AF_INTER_PAN_CTL;
@@ -475,7 +595,7 @@ void zg_mt_af_set_inter_pan_endpoint(uint8_t endpoint, SyncActionCb cb)
     buffer[0] = interpan_command_data;
     buffer[1] = endpoint;
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
@@ -486,7 +606,6 @@ void zg_mt_af_set_inter_pan_channel(uint8_t channel, SyncActionCb cb)
     uint8_t *buffer = NULL;
 
     INF("Setting inter-pan channel 0x%02X", channel);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_AF;
     msg.cmd = AF_INTER_PAN_CTL;
@@ -500,7 +619,7 @@ void zg_mt_af_set_inter_pan_channel(uint8_t channel, SyncActionCb cb)
     buffer[0] = interpan_command_data;
     buffer[1] = channel;
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
@@ -509,7 +628,12 @@ void zg_mt_af_register_incoming_message_callback(AfIncomingMessageCb cb)
     _af_incoming_msg_cb = cb;
 }
 
-void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
+void zg_mt_af_register_inter_pan_message_callback(AfInterPanMessageCb cb)
+{
+    _af_inter_pan_msg_cb = cb;
+}
+
+int zg_mt_af_send_data_request_ext(    uint64_t dst_addr,
                                     uint16_t dst_pan,
                                     uint8_t src_endpoint,
                                     uint8_t dst_endpoint,
@@ -518,7 +642,8 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
                                     void *data,
                                     SyncActionCb cb)
 {
-    uint8_t addr_mode = SHORT_ADDR_MODE;
+    uint8_t addr_mode = dst_addr > 0xFFFF ? EXT_ADDR_MODE : SHORT_ADDR_MODE;
+    uint8_t trans = _transaction_id;
     uint8_t options = DATA_REQUEST_DEFAULT_OPTIONS;
     uint8_t radius = DATA_REQUEST_DEFAULT_RADIUS;
     uint8_t *buffer = NULL;
@@ -528,11 +653,10 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
     if(len == 0 || !data)
     {
         ERR("Cannot send AF_DATA_REQUEST_EXT (%s)", data ? "length is invalid":"no data provided");
-        return;
+        return -1;
     }
 
     DBG("Sending AF_DATA_REQUEST_EXT");
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_AF;
     msg.cmd = AF_DATA_REQUEST_EXT;
@@ -542,7 +666,7 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
               + sizeof(dst_pan) \
               + sizeof(src_endpoint) \
               + sizeof(cluster) \
-              + sizeof(_transaction_id) \
+              + sizeof(trans) \
               + sizeof(options) \
               + sizeof(radius) \
               + sizeof(len) \
@@ -551,7 +675,7 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
     if(!buffer)
     {
         CRI("Cannot allocate memory to send AF_REGISTER command");
-        return;
+        return -1;
     }
 
     memcpy(buffer + index, &addr_mode, sizeof(addr_mode));
@@ -566,8 +690,8 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
     index += sizeof(src_endpoint);
     memcpy(buffer + index , &cluster, sizeof(cluster));
     index += sizeof(cluster);
-    memcpy(buffer + index , &_transaction_id, sizeof(_transaction_id));
-    index += sizeof(_transaction_id);
+    memcpy(buffer + index , &trans, sizeof(trans));
+    index += sizeof(trans);
     memcpy(buffer + index , &options, sizeof(options));
     index += sizeof(options);
     memcpy(buffer + index , &radius, sizeof(radius));
@@ -576,6 +700,111 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
     index += sizeof(len);
     memcpy(buffer + index , data, len);
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    if(zg_rpc_write_sync(&msg, &sync_action_cb, cb) != 0)
+    {
+        ZG_VAR_FREE(buffer);
+        return -1;
+    }
+    /* Each request gets its own transaction id, so that requests queued
+     * before the previous SRSP can be told apart in AF_DATA_CONFIRM */
+    _transaction_id++;
+    _track_data_request(trans);
     ZG_VAR_FREE(buffer);
+    return trans;
+}
+
+int zg_mt_af_send_data_request_src_rtg(    uint16_t dst_addr,
+                                        uint8_t src_endpoint,
+                                        uint8_t dst_endpoint,
+                                        uint16_t cluster,
+                                        uint8_t relay_count,
+                                        uint16_t *relays,
+                                        uint8_t len,
+                                        void *data,
+                                        SyncActionCb cb)
+{
+    uint8_t trans = _transaction_id;
+    uint8_t options = DATA_REQUEST_DEFAULT_OPTIONS;
+    uint8_t radius = DATA_REQUEST_DEFAULT_RADIUS;
+    uint8_t *buffer = NULL;
+    uint8_t index = 0;
+    SrcRtgTransaction *slot = NULL;
+    ZgMtMsg msg;
+
+    if(len == 0 || !data || (relay_count && !relays))
+    {
+        ERR("Cannot send AF_DATA_REQUEST_SRC_RTG (%s)", data ? "invalid length or relay list":"no data provided");
+        return -1;
+    }
+
+    DBG("Sending AF_DATA_REQUEST_SRC_RTG (%d relays)", relay_count);
+    msg.type = ZG_MT_CMD_SREQ;
+    msg.subsys = ZG_MT_SUBSYS_AF;
+    msg.cmd = AF_DATA_REQUEST_SRC_RTG;
+    msg.len = sizeof(dst_addr) \
+              + sizeof(dst_endpoint) \
+              + sizeof(src_endpoint) \
+              + sizeof(cluster) \
+              + sizeof(trans) \
+              + sizeof(options) \
+              + sizeof(radius) \
+              + sizeof(relay_count) \
+              + relay_count * sizeof(uint16_t) \
+              + sizeof(len) \
+              + len;
+    buffer = calloc(msg.len, sizeof(uint8_t));
+    if(!buffer)
+    {
+        CRI("Cannot allocate memory to send AF_DATA_REQUEST_SRC_RTG command");
+        return -1;
+    }
+
+    memcpy(buffer + index, &dst_addr, sizeof(dst_addr));
+    index += sizeof(dst_addr);
+    memcpy(buffer + index, &dst_endpoint, sizeof(dst_endpoint));
+    index += sizeof(dst_endpoint);
+    memcpy(buffer + index, &src_endpoint, sizeof(src_endpoint));
+    index += sizeof(src_endpoint);
+    memcpy(buffer + index, &cluster, sizeof(cluster));
+    index += sizeof(cluster);
+    memcpy(buffer + index, &trans, sizeof(trans));
+    index += sizeof(trans);
+    memcpy(buffer + index, &options, sizeof(options));
+    index += sizeof(options);
+    memcpy(buffer + index, &radius, sizeof(radius));
+    index += sizeof(radius);
+    memcpy(buffer + index, &relay_count, sizeof(relay_count));
+    index += sizeof(relay_count);
+    memcpy(buffer + index, relays, relay_count * sizeof(uint16_t));
+    index += relay_count * sizeof(uint16_t);
+    memcpy(buffer + index, &len, sizeof(len));
+    index += sizeof(len);
+    memcpy(buffer + index, data, len);
+    msg.data = buffer;
+
+    /* Remember the destination, so that a failed AF_DATA_CONFIRM can be
+     * reported as a broken source route */
+    if(zg_rpc_write_sync(&msg, &sync_action_cb, cb) != 0)
+    {
+        ZG_VAR_FREE(buffer);
+        return -1;
+    }
+    slot = &_src_rtg_transactions[trans % SRC_RTG_MAX_PENDING];
+    slot->used = 1;
+    slot->trans = trans;
+    slot->dst_addr = dst_addr;
+    _transaction_id++;
+    _track_data_request(trans);
+    ZG_VAR_FREE(buffer);
+    return trans;
+}
+
+void zg_mt_af_register_data_confirm_callback(AfDataConfirmCb cb)
+{
+    _af_data_confirm_cb = cb;
+}
+
+void zg_mt_af_register_src_rtg_error_callback(AfSrcRtgErrorCb cb)
+{
+    _af_src_rtg_error_cb = cb;
 }
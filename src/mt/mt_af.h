@@ -4,7 +4,10 @@
 #include <stdint.h>
 #include "types.h"
 
-typedef void (*AfIncomingMessageCb)(uint16_t addr, uint8_t endpoint_num, uint16_t cluster, void *data, int len);
+typedef void (*AfIncomingMessageCb)(uint16_t addr, uint8_t src_endpoint, uint8_t endpoint_num, uint16_t cluster, void *data, int len);
+typedef void (*AfInterPanMessageCb)(uint64_t ext_addr, uint8_t endpoint_num, uint16_t cluster, uint8_t link_quality, void *data, int len);
+typedef void (*AfSrcRtgErrorCb)(uint16_t dst_addr);
+typedef void (*AfDataConfirmCb)(uint8_t trans, uint8_t status);
 
 /**
  * \brief Initialize the MT AF module
@@ -83,12 +86,21 @@ void zg_mt_af_set_inter_pan_channel(uint8_t channel, SyncActionCb cb);
  */
 void zg_mt_af_register_incoming_message_callback(AfIncomingMessageCb cb);
 
+/**
+ * \brief Register the callback to which module will transmit incoming messages
+ * carrying an extended source address, as inter-pan messages do. If no callback
+ * is registered, those messages are given to the incoming message callback
+ * \param cb The callback which will be called with the extended source address
+ * and the link quality of the received message
+ */
+void zg_mt_af_register_inter_pan_message_callback(AfInterPanMessageCb cb);
+
 /**
  * \brief Send an extended data request to ZNP
  * This API is the base of any applicative message
  * \param dst_addr The address of node on network to which we want to send a
  * message. If set to 0xFFFF, message will be broadcasted to all nodes on
- * network
+ * network. Values above 0xFFFF are extended addresses
  * \param dst_pan Destination PAN ID of message. If set to 0xFFFD, message will
  * be broadcast on all PAN availables on current channel
  * \param src_endpoint The id of local endpoint sending the message
@@ -99,8 +111,10 @@ void zg_mt_af_register_incoming_message_callback(AfIncomingMessageCb cb);
  * - pan - endpoint - cluster
  * \param cb The callback to trigger when ZNP ahs received and processed the
  * data sending request
+ * \return The transaction id of the request, as given back in its
+ * confirmation, or -1 if request could not be sent
  */
-void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
+int zg_mt_af_send_data_request_ext(    uint64_t dst_addr,
                                     uint16_t dst_pan,
                                     uint8_t src_endpoint,
                                     uint8_t dst_endpoint,
@@ -109,5 +123,49 @@ void zg_mt_af_send_data_request_ext(   uint64_t dst_addr,
                                     void *data,
                                     SyncActionCb cb);
 
+/**
+ * \brief Send a data request to ZNP using a known source route
+ * Unlike zg_mt_af_send_data_request_ext, the message will not trigger any
+ * route discovery since the full path to destination is provided
+ * \param dst_addr The short address of destination node
+ * \param src_endpoint The id of local endpoint sending the message
+ * \param dst_endpoint The destination endpoint
+ * \param cluster The remote destination cluster
+ * \param relay_count The number of relays in the relay list
+ * \param relays The list of relays to reach destination, the first one being
+ * the closest to destination, as reported by ZDO_SRC_RTG_IND
+ * \param len The data length to send
+ * \param data The data effectively sent to targeted node
+ * \param cb The callback to trigger when ZNP has received and processed the
+ * data sending request
+ * \return The transaction id of the request, as given back in its
+ * confirmation, or -1 if request could not be sent
+ */
+int zg_mt_af_send_data_request_src_rtg(    uint16_t dst_addr,
+                                        uint8_t src_endpoint,
+                                        uint8_t dst_endpoint,
+                                        uint16_t cluster,
+                                        uint8_t relay_count,
+                                        uint16_t *relays,
+                                        uint8_t len,
+                                        void *data,
+                                        SyncActionCb cb);
+
+/**
+ * \brief Register the callback to call when a source routed message could not
+ * be delivered, meaning that the route used is not valid anymore
+ * \param cb The callback, called with the destination address of the failed
+ * message
+ */
+void zg_mt_af_register_src_rtg_error_callback(AfSrcRtgErrorCb cb);
+
+/**
+ * \brief Register the callback to call when a data request is over, either
+ * because ZNP has rejected it or because its AF_DATA_CONFIRM has been received
+ * \param cb The callback, called with the transaction id returned when
+ * sending the request and the final request status
+ */
+void zg_mt_af_register_data_confirm_callback(AfDataConfirmCb cb);
+
 #endif
 
@@ -66,6 +66,34 @@
 #define SYS_RESET_IND               0x80
 #define SYS_OSAL_TIMER_EXPIRED      0x81
 
+/* OSAL NV items */
+#define NV_STARTUP_OPTION           0x0003
+#define NV_PRECFGKEY                0x0062
+#define NV_SECURITY_MODE            0x0064
+#define NV_PANID                    0x0083
+#define NV_CHANLIST                 0x0084
+#define NV_LOGICAL_TYPE             0x0087
+#define NV_CONCENTRATOR_ENABLE      0x00A1
+#define NV_CONCENTRATOR_DISCOVERY   0x00A2
+
+#define NV_ITEM_MAX_LEN             16
+/* NV requests waiting for their answer. Must be a power of 2 */
+#define NV_PENDING_QUEUE_SIZE       16
+#define NV_PENDING_QUEUE_MASK       (NV_PENDING_QUEUE_SIZE - 1)
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+/* Last known value of a ZNP NV item, either read from or written to ZNP */
+typedef struct
+{
+    uint16_t id;
+    uint8_t valid;
+    uint8_t len;
+    uint8_t data[NV_ITEM_MAX_LEN];
+} NvCacheEntry;
+
 /********************************
  *       Local variables        *
  *******************************/
@@ -77,6 +105,29 @@ static int _init_count = 0;
 static SyncActionCb sync_action_cb = NULL;
 static uint64_t _ext_addr = 0x0000000000000000;
 
+/* NV items configured by gateway. They are loaded once at startup so that
+ * items already holding the expected value are not written again. Network key
+ * cannot be read back from ZNP, so it is checked against a digest stored on
+ * host instead (see keys.h) */
+static NvCacheEntry _nv_cache[] = {
+    {.id = NV_SECURITY_MODE},
+    {.id = NV_PANID},
+    {.id = NV_CHANLIST},
+    {.id = NV_LOGICAL_TYPE},
+    {.id = NV_CONCENTRATOR_ENABLE},
+    {.id = NV_CONCENTRATOR_DISCOVERY},
+};
+static uint8_t _nv_cache_size = sizeof(_nv_cache)/sizeof(NvCacheEntry);
+/* Items being read or written, and values being written, in requests order.
+ * Answers do not hold the item id, so each one pops the oldest entry */
+static NvCacheEntry _nv_pending[NV_PENDING_QUEUE_SIZE];
+static unsigned int _nv_pending_head = 0;
+static unsigned int _nv_pending_tail = 0;
+static uint8_t _nv_load_index = 0;
+static SyncActionCb _nv_load_cb = NULL;
+/* Some NV items have been written since last ZNP reset */
+static uint8_t _nv_dirty = 0;
+
 /********************************
  *     MT SYS callbacks         *
  *******************************/
@@ -112,20 +163,109 @@ static uint8_t _get_ext_addr_srsp_cb(ZgMtMsg *msg)
     return 0;
 }
 
+static NvCacheEntry *_nv_cache_get(uint16_t id)
+{
+    uint8_t index = 0;
+
+    for(index = 0; index < _nv_cache_size; index++)
+    {
+        if(_nv_cache[index].id == id)
+            return &_nv_cache[index];
+    }
+    return NULL;
+}
+
+static NvCacheEntry *_nv_pending_push(uint16_t id)
+{
+    NvCacheEntry *pending = NULL;
+
+    if(_nv_pending_tail - _nv_pending_head == NV_PENDING_QUEUE_SIZE)
+    {
+        ERR("Cannot access NV item 0x%04X : too many NV requests pending", id);
+        return NULL;
+    }
+    pending = &_nv_pending[_nv_pending_tail & NV_PENDING_QUEUE_MASK];
+    _nv_pending_tail++;
+    memset(pending, 0, sizeof(NvCacheEntry));
+    pending->id = id;
+    return pending;
+}
+
+static NvCacheEntry *_nv_pending_pop(void)
+{
+    NvCacheEntry *pending = NULL;
+
+    if(_nv_pending_head == _nv_pending_tail)
+        return NULL;
+    pending = &_nv_pending[_nv_pending_head & NV_PENDING_QUEUE_MASK];
+    _nv_pending_head++;
+    return pending;
+}
+
 static uint8_t _osal_nv_write_srsp_cb(ZgMtMsg *msg)
 {
+    NvCacheEntry *pending = _nv_pending_pop();
+    NvCacheEntry *entry = pending ? _nv_cache_get(pending->id) : NULL;
     uint8_t status;
+
+    if(!pending)
+        WRN("Received SYS_OSAL_NV_WRITE answer while no NV item is being written");
     if(!msg || !msg->data)
     {
         WRN("Cannot extract SYS_OSAL_NV_WRITE data");
+        if(entry)
+            entry->valid = 0;
     }
     else
     {
         status = msg->data[0];
         if(status)
+        {
             ERR("SYS_OSAL_NV_WRITE failed with status 0x%02X", status);
+            if(entry)
+                entry->valid = 0;
+        }
         else
+        {
             INF("SYS_OSAL_NV_WRITE OK");
+            _nv_dirty = 1;
+            if(entry)
+                memcpy(entry, pending, sizeof(NvCacheEntry));
+            if(pending && pending->id == NV_PRECFGKEY)
+                zg_keys_network_key_digest_store(_ext_addr);
+        }
+    }
+
+    if(sync_action_cb)
+        sync_action_cb();
+
+    return 0;
+}
+
+static uint8_t _osal_nv_read_srsp_cb(ZgMtMsg *msg)
+{
+    NvCacheEntry *pending = _nv_pending_pop();
+    NvCacheEntry *entry = pending ? _nv_cache_get(pending->id) : NULL;
+
+    /* Status, length, then value */
+    if(!pending)
+    {
+        WRN("Received SYS_OSAL_NV_READ answer while no NV item is being read");
+    }
+    else if(!msg || !msg->data || msg->len < 2 || msg->len < 2 + msg->data[1])
+    {
+        WRN("Cannot extract SYS_OSAL_NV_READ data");
+    }
+    else if(msg->data[0])
+    {
+        WRN("Cannot read NV item 0x%04X (status 0x%02X)", pending->id, msg->data[0]);
+    }
+    else if(entry && msg->data[1] <= NV_ITEM_MAX_LEN)
+    {
+        DBG("NV item 0x%04X read (%d bytes)", entry->id, msg->data[1]);
+        entry->len = msg->data[1];
+        memcpy(entry->data, msg->data + 2, entry->len);
+        entry->valid = 1;
     }
 
     if(sync_action_cb)
@@ -151,6 +291,10 @@ static uint8_t _reset_ind_cb(ZgMtMsg *msg)
         INF("Product ID : %d", msg->data[2]);
         INF("ZNP version : %d.%d.%d", msg->data[3], msg->data[4], msg->data[5]);
     }
+    /* Requests left unanswered before reset will never be */
+    if(_nv_pending_head != _nv_pending_tail)
+        WRN("%u NV requests have not been answered before reset", _nv_pending_tail - _nv_pending_head);
+    _nv_pending_head = _nv_pending_tail;
     if(sync_action_cb)
         sync_action_cb();
 
@@ -183,6 +327,9 @@ static void _process_mt_sys_srsp(ZgMtMsg *msg)
         case SYS_OSAL_NV_WRITE:
             _osal_nv_write_srsp_cb(msg);
             break;
+        case SYS_OSAL_NV_READ:
+            _osal_nv_read_srsp_cb(msg);
+            break;
         default:
             WRN("Unknown SRSP command 0x%02X", msg->cmd);
             break;
@@ -228,7 +375,7 @@ static void _process_mt_sys_cb(ZgMtMsg *msg)
  *          Internals           *
  *******************************/
 
-static void _sys_osal_nv_write(uint16_t id, uint8_t offset, uint8_t length, uint8_t *data)
+static void _sys_osal_nv_write(uint16_t id, uint8_t offset, uint8_t length, uint8_t *data, SyncActionCb cb)
 {
     if(!data)
     {
@@ -238,6 +385,7 @@ static void _sys_osal_nv_write(uint16_t id, uint8_t offset, uint8_t length, uint
 
     ZgMtMsg msg;
     uint8_t *buffer = NULL;
+    NvCacheEntry *pending = NULL;
 
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_SYS;
@@ -255,10 +403,69 @@ static void _sys_osal_nv_write(uint16_t id, uint8_t offset, uint8_t length, uint
     memcpy(buffer + sizeof(id) + sizeof(offset) + sizeof(length),
             data, length);
     msg.data = buffer;
-    zg_rpc_write(&msg);
+
+    pending = _nv_pending_push(id);
+    if(pending)
+    {
+        if(offset == 0 && length <= NV_ITEM_MAX_LEN)
+        {
+            pending->valid = 1;
+            pending->len = length;
+            memcpy(pending->data, data, length);
+        }
+        if(zg_rpc_write_sync(&msg, &sync_action_cb, cb) != 0)
+            _nv_pending_tail--;
+    }
     ZG_VAR_FREE(msg.data);
 }
 
+static void _sys_osal_nv_read(uint16_t id, uint8_t offset, SyncActionCb cb)
+{
+    ZgMtMsg msg;
+    uint8_t buffer[sizeof(id) + sizeof(offset)];
+
+    memcpy(buffer, &id, sizeof(id));
+    memcpy(buffer + sizeof(id), &offset, sizeof(offset));
+    msg.type = ZG_MT_CMD_SREQ;
+    msg.subsys = ZG_MT_SUBSYS_SYS;
+    msg.cmd = SYS_OSAL_NV_READ;
+    msg.len = sizeof(buffer);
+    msg.data = buffer;
+    if(!_nv_pending_push(id))
+        return;
+    if(zg_rpc_write_sync(&msg, &sync_action_cb, cb) != 0)
+        _nv_pending_tail--;
+}
+
+/* Write a NV item only if ZNP is not already known to hold the same value */
+static void _sys_osal_nv_update(uint16_t id, uint8_t length, uint8_t *data, SyncActionCb cb)
+{
+    NvCacheEntry *entry = _nv_cache_get(id);
+
+    if(entry && entry->valid && entry->len == length && memcmp(entry->data, data, length) == 0)
+    {
+        INF("NV item 0x%04X is already up to date", id);
+        if(cb)
+            cb();
+        return;
+    }
+
+    _sys_osal_nv_write(id, 0, length, data, cb);
+}
+
+static void _nv_load_next(void)
+{
+    if(_nv_load_index >= _nv_cache_size)
+    {
+        INF("NV items loaded");
+        if(_nv_load_cb)
+            _nv_load_cb();
+        return;
+    }
+
+    _sys_osal_nv_read(_nv_cache[_nv_load_index++].id, 0, _nv_load_next);
+}
+
 /********************************
  *          API                 *
  *******************************/
@@ -286,13 +493,14 @@ void zg_mt_sys_reset_dongle (SyncActionCb cb)
     uint8_t reset_type = 1;
 
     INF("Resetting ZNP");
-    sync_action_cb = cb;
-    msg.type = ZG_MT_CMD_SREQ;
+    _nv_dirty = 0;
+    /* Reset is not answered with a SRSP but with a SYS_RESET_IND */
+    msg.type = ZG_MT_CMD_AREQ;
     msg.subsys = ZG_MT_SUBSYS_SYS;
     msg.cmd = SYS_RESET_REQ;
     msg.data = &reset_type; /* Ask for a soft reset to avoid dealing with USB re-enumeration */
     msg.len = sizeof(reset_type);
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
 }
 
 void zg_mt_sys_ping(SyncActionCb cb)
@@ -300,29 +508,34 @@ void zg_mt_sys_ping(SyncActionCb cb)
     ZgMtMsg msg;
 
     INF("Ping dongle");
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_SYS;
     msg.cmd = SYS_PING;
     msg.len = 0;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
 }
 
 void zg_mt_sys_nv_write_startup_options(MtSysStartupOptions options,SyncActionCb cb)
 {
     uint8_t nv_options = 0x00;
+    uint8_t index = 0;
 
     INF("Writing startup options");
-    sync_action_cb = cb;
 
     if(options & STARTUP_CLEAR_NWK_FRAME_COUNTER)
         nv_options |= 0x1 << 7;
     if(options & STARTUP_CLEAR_STATE)
         nv_options |= 0x1 << 1;
     if(options & STARTUP_CLEAR_CONFIG)
+    {
         nv_options |= 0x1;
+        /* All items go back to their default value on next reset */
+        for(index = 0; index < _nv_cache_size; index++)
+            _nv_cache[index].valid = 0;
+        zg_keys_network_key_digest_del();
+    }
 
-    _sys_osal_nv_write(3, 0, 1, &nv_options);
+    _sys_osal_nv_write(NV_STARTUP_OPTION, 0, 1, &nv_options, cb);
 }
 
 void zg_mt_sys_nv_write_coord_flag(SyncActionCb cb)
@@ -330,8 +543,7 @@ void zg_mt_sys_nv_write_coord_flag(SyncActionCb cb)
     uint8_t nv_coord_data[] = {0};
 
     INF("Setting device as coordinator");
-    sync_action_cb = cb;
-    _sys_osal_nv_write(0x87, 0, 1, nv_coord_data);
+    _sys_osal_nv_update(NV_LOGICAL_TYPE, 1, nv_coord_data, cb);
 }
 
 void zg_mt_sys_nv_write_disable_security(SyncActionCb cb)
@@ -339,8 +551,7 @@ void zg_mt_sys_nv_write_disable_security(SyncActionCb cb)
     uint8_t nv_disable_sec_data[] = {0};
 
     INF("Disabling NWK security");
-    sync_action_cb = cb;
-    _sys_osal_nv_write(0x64, 0, 1, nv_disable_sec_data);
+    _sys_osal_nv_update(NV_SECURITY_MODE, 1, nv_disable_sec_data, cb);
 }
 
 void zg_mt_sys_nv_write_enable_security(SyncActionCb cb)
@@ -348,8 +559,7 @@ void zg_mt_sys_nv_write_enable_security(SyncActionCb cb)
     uint8_t nv_enable_sec_data[] = {1};
 
     INF("Enabling NWK security");
-    sync_action_cb = cb;
-    _sys_osal_nv_write(0x64, 0, 1, nv_enable_sec_data);
+    _sys_osal_nv_update(NV_SECURITY_MODE, 1, nv_enable_sec_data, cb);
 }
 
 void zg_mt_sys_nv_set_pan_id(SyncActionCb cb)
@@ -357,16 +567,20 @@ void zg_mt_sys_nv_set_pan_id(SyncActionCb cb)
     uint8_t nv_set_pan_id[] = {0xCD, 0xAB};
 
     INF("Setting PAN ID");
-    sync_action_cb = cb;
-    _sys_osal_nv_write(0x83, 0, 2, nv_set_pan_id);
+    _sys_osal_nv_update(NV_PANID, 2, nv_set_pan_id, cb);
 }
 
 void zg_mt_sys_nv_write_nwk_key(SyncActionCb cb)
 {
     INF("Setting network key");
-
-    sync_action_cb = cb;
-    _sys_osal_nv_write(0x62, 0, zg_keys_network_key_size_get(), zg_keys_network_key_get());
+    if(zg_keys_network_key_digest_check(_ext_addr))
+    {
+        INF("Network key is already up to date");
+        if(cb)
+            cb();
+        return;
+    }
+    _sys_osal_nv_write(NV_PRECFGKEY, 0, zg_keys_network_key_size_get(), zg_keys_network_key_get(), cb);
 }
 
 void zg_mt_sys_check_ext_addr(SyncActionCb cb)
@@ -374,13 +588,11 @@ void zg_mt_sys_check_ext_addr(SyncActionCb cb)
     ZgMtMsg msg;
     INF("Retrieving extended address");
 
-    sync_action_cb = cb;
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SREQ;
     msg.subsys = ZG_MT_SUBSYS_SYS;
     msg.cmd = SYS_GET_EXTADRR;
     msg.len = 0;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
 }
 
 uint64_t zg_mt_sys_get_ext_addr(void)
@@ -450,6 +662,39 @@ void zg_mt_sys_nv_write_channel(uint8_t channel, SyncActionCb cb)
             break;
     }
     INF("Setting radio to operate on channel %d", channel);
-    sync_action_cb = cb;
-    _sys_osal_nv_write(0x84, 0, sizeof(channel_mask), (uint8_t *)&channel_mask);
+    _sys_osal_nv_update(NV_CHANLIST, sizeof(channel_mask), (uint8_t *)&channel_mask, cb);
+}
+
+void zg_mt_sys_nv_write_concentrator_enable(SyncActionCb cb)
+{
+    uint8_t nv_concentrator_enable[] = {1};
+
+    INF("Enabling many-to-one concentrator mode");
+    _sys_osal_nv_update(NV_CONCENTRATOR_ENABLE, 1, nv_concentrator_enable, cb);
+}
+
+void zg_mt_sys_nv_write_concentrator_discovery(uint8_t period, SyncActionCb cb)
+{
+    INF("Setting many-to-one route requests period to %ds", period);
+    _sys_osal_nv_update(NV_CONCENTRATOR_DISCOVERY, 1, &period, cb);
+}
+
+void zg_mt_sys_nv_load(SyncActionCb cb)
+{
+    INF("Loading NV items from ZNP");
+    _nv_load_index = 0;
+    _nv_load_cb = cb;
+    _nv_load_next();
+}
+
+void zg_mt_sys_reset_dongle_if_needed(SyncActionCb cb)
+{
+    if(!_nv_dirty)
+    {
+        INF("No NV item has changed, ZNP reset skipped");
+        if(cb)
+            cb();
+        return;
+    }
+    zg_mt_sys_reset_dongle(cb);
 }
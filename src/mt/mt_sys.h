@@ -104,5 +104,35 @@ uint64_t zg_mt_sys_get_ext_addr(void);
  */
 void zg_mt_sys_nv_write_channel(uint8_t channel, SyncActionCb cb);
 
+/**
+ * \brief Write persistent flag to make ZNP act as a many-to-one concentrator.
+ * Remote devices will then send route records to ZNP, allowing it to reach
+ * them with source routing instead of route discoveries
+ * \param cb The callback to be called when command has been processed by ZNP
+ */
+void zg_mt_sys_nv_write_concentrator_enable(SyncActionCb cb);
+
+/**
+ * \brief Write in persistent memory the period between two many-to-one route
+ * requests
+ * \param period The period in seconds
+ * \param cb The callback to be called when command has been processed by ZNP
+ */
+void zg_mt_sys_nv_write_concentrator_discovery(uint8_t period, SyncActionCb cb);
+
+/**
+ * \brief Read from ZNP all NV items written by gateway. Writing afterwards an
+ * item which already holds the expected value is then skipped
+ * \param cb The callback to be called when all items have been read
+ */
+void zg_mt_sys_nv_load(SyncActionCb cb);
+
+/**
+ * \brief Ask to ZNP to process a soft reset, only if some NV items have been
+ * written since last reset
+ * \param cb The callback to be called when reset is done or has been skipped
+ */
+void zg_mt_sys_reset_dongle_if_needed(SyncActionCb cb);
+
 #endif
 
@@ -143,7 +143,6 @@ void zg_mt_util_af_subscribe_cmd (SyncActionCb cb)
     uint8_t *buffer = NULL;
 
     INF("Subscribing to MT_AF callbacks");
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_UTIL;
     msg.cmd = UTIL_CALLBACK_SUB_CMD;
@@ -155,6 +154,6 @@ void zg_mt_util_af_subscribe_cmd (SyncActionCb cb)
         return;
     }
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
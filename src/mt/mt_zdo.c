@@ -20,6 +20,23 @@
 #define ROUTE_REQ_OPTIONS                   0x00
 #define ROUTE_REQ_RADIUS                    0x05
 
+/* Mgmt_Lqi and Mgmt_Rtg responses format */
+#define MGMT_RSP_HEADER_SIZE                6
+#define MGMT_LQI_NEIGHBOR_SIZE              22
+#define MGMT_RTG_ROUTE_SIZE                 5
+
+/* ZDO_SRC_RTG_IND format */
+#define SRC_RTG_IND_HEADER_SIZE             3
+
+/* Bind and Unbind requests format, destination address field is 8 bytes long
+ * whatever the addressing mode */
+#define BIND_REQ_SIZE                       23
+
+/* Mgmt_Bind response format, destination endpoint is only present with
+ * extended addressing */
+#define MGMT_BIND_ENTRY_GROUP_SIZE          14
+#define MGMT_BIND_ENTRY_EXT_SIZE            21
+
 /* MT ZDO commands */
 #define ZDO_NWK_ADDR_REQ                    0x00
 #define ZDO_IEEE_ADDR_REQ                   0x01
@@ -137,9 +154,20 @@ typedef struct __attribute__((packed))
 static int _log_domain = -1;
 static int _init_count = 0;
 static SyncActionCb sync_action_cb = NULL;
+/* Management table requests are sent while other ZDO requests may be in
+ * flight (e.g. endpoints discovery of a new device), so they have their own
+ * callback slot */
+static SyncActionCb _mgmt_action_cb = NULL;
 static void (*_zdo_tc_dev_ind_cb)(uint16_t addr, uint64_t ext_addr) = NULL;
 static void (*_zdo_active_ep_rsp_cb)(uint16_t short_addr, uint8_t nb_ep, uint8_t *ep_list) = NULL;
 static void (*_zdo_simple_desc_rsp_cb)(uint8_t endpoint, uint16_t profile, uint16_t deviceId) = NULL;
+static MgmtLqiRspCb _zdo_mgmt_lqi_rsp_cb = NULL;
+static MgmtRtgRspCb _zdo_mgmt_rtg_rsp_cb = NULL;
+static SrcRtgIndCb _zdo_src_rtg_ind_cb = NULL;
+static BindRspCb _zdo_bind_rsp_cb = NULL;
+static BindRspCb _zdo_unbind_rsp_cb = NULL;
+static MgmtBindRspCb _zdo_mgmt_bind_rsp_cb = NULL;
+static DeviceAnnceCb _zdo_device_annce_cb = NULL;
 
 /********************************
  *     MT ZDO callbacks         *
@@ -260,6 +288,93 @@ static uint8_t _permit_join_req_srsp_cb(ZgMtMsg *msg)
 
 }
 
+static uint8_t _mgmt_lqi_req_srsp_cb(ZgMtMsg *msg)
+{
+    uint8_t status;
+    if(!msg||!msg->data)
+    {
+        WRN("Cannot extract ZDO_MGMT_LQI_REQ SRSP data");
+    }
+    else
+    {
+        status = msg->data[0];
+        if(status != ZSUCCESS)
+            WRN("Error sending neighbor table request : %s", zg_logs_znp_strerror(status));
+        else
+            DBG("Neighbor table request sent");
+    }
+
+    if(_mgmt_action_cb)
+        _mgmt_action_cb();
+
+    return 0;
+}
+
+static uint8_t _mgmt_rtg_req_srsp_cb(ZgMtMsg *msg)
+{
+    uint8_t status;
+    if(!msg||!msg->data)
+    {
+        WRN("Cannot extract ZDO_MGMT_RTG_REQ SRSP data");
+    }
+    else
+    {
+        status = msg->data[0];
+        if(status != ZSUCCESS)
+            WRN("Error sending routing table request : %s", zg_logs_znp_strerror(status));
+        else
+            DBG("Routing table request sent");
+    }
+
+    if(_mgmt_action_cb)
+        _mgmt_action_cb();
+
+    return 0;
+}
+
+static uint8_t _force_concentrator_change_srsp_cb(ZgMtMsg *msg)
+{
+    uint8_t status = ZSUCCESS;
+
+    /* Depending on firmware, this SRSP may not carry any status */
+    if(msg && msg->data && msg->len > 0)
+        status = msg->data[0];
+
+    if(status != ZSUCCESS)
+        WRN("Error forcing many-to-one route request : %s", zg_logs_znp_strerror(status));
+    else
+        INF("Many-to-one route request sent");
+
+    if(sync_action_cb)
+        sync_action_cb();
+
+    return 0;
+}
+
+/* Binding table requests share their SRSP processing, but management requests
+ * complete through their own callback slot */
+static uint8_t _bind_table_req_srsp_cb(ZgMtMsg *msg, const char *request, SyncActionCb cb)
+{
+    uint8_t status;
+    if(!msg||!msg->data)
+    {
+        WRN("Cannot extract %s SRSP data", request);
+    }
+    else
+    {
+        status = msg->data[0];
+        if(status != ZSUCCESS)
+            WRN("Error sending %s : %s", request, zg_logs_znp_strerror(status));
+        else
+            DBG("%s sent", request);
+    }
+
+    if(cb)
+        cb();
+
+    return 0;
+}
+
 /* MT ZDO AREQ callbacks */
 
 static uint8_t _active_ep_rsp_cb(ZgMtMsg *msg)
@@ -516,6 +631,8 @@ uint8_t _zdo_end_device_annce_join_cb(ZgMtMsg *msg)
         INF("Network address : 0x%04X", nwk_addr);
         INF("IEEE address : 0x%016lX", ieee_addr);
         INF("Capabilities : 0x%02X", capabilities);
+        if(_zdo_device_annce_cb)
+            _zdo_device_annce_cb(nwk_addr, ieee_addr, capabilities);
     }
 
     return 0;
@@ -556,6 +673,264 @@ uint8_t _zdo_leave_ind_cb(ZgMtMsg *msg)
     return 0;
 }
 
+static uint8_t _mgmt_lqi_rsp_cb(ZgMtMsg *msg)
+{
+    uint16_t src_addr;
+    uint8_t status;
+    uint8_t total;
+    uint8_t start_index;
+    uint8_t count;
+    ZgMtZdoNeighbor *neighbors = NULL;
+    uint8_t *entry = NULL;
+    uint8_t index = 0;
+
+    if(!msg||!msg->data||msg->len < MGMT_RSP_HEADER_SIZE)
+    {
+        WRN("Cannot extract ZDO_MGMT_LQI_RSP data");
+        return 1;
+    }
+
+    memcpy(&src_addr, msg->data, sizeof(src_addr));
+    status = msg->data[2];
+    total = msg->data[3];
+    start_index = msg->data[4];
+    count = msg->data[5];
+    if(status != ZSUCCESS)
+    {
+        WRN("Device 0x%04X refused neighbor table request : %s", src_addr, zg_logs_znp_strerror(status));
+        count = 0;
+    }
+    else if(msg->len < MGMT_RSP_HEADER_SIZE + count * MGMT_LQI_NEIGHBOR_SIZE)
+    {
+        ERR("ZDO_MGMT_LQI_RSP from 0x%04X is truncated (%d entries announced)", src_addr, count);
+        return 1;
+    }
+
+    if(count)
+    {
+        neighbors = calloc(count, sizeof(ZgMtZdoNeighbor));
+        if(!neighbors)
+        {
+            CRI("Cannot allocate memory to retrieve neighbor table");
+            return 1;
+        }
+    }
+    for(index = 0; index < count; index++)
+    {
+        entry = msg->data + MGMT_RSP_HEADER_SIZE + index * MGMT_LQI_NEIGHBOR_SIZE;
+        memcpy(&neighbors[index].ext_pan_id, entry, sizeof(uint64_t));
+        memcpy(&neighbors[index].ext_addr, entry + 8, sizeof(uint64_t));
+        memcpy(&neighbors[index].nwk_addr, entry + 16, sizeof(uint16_t));
+        neighbors[index].device_type = entry[18] & 0x03;
+        neighbors[index].rx_on_when_idle = (entry[18] >> 2) & 0x03;
+        neighbors[index].relationship = (entry[18] >> 4) & 0x07;
+        neighbors[index].permit_joining = entry[19] & 0x03;
+        neighbors[index].depth = entry[20];
+        neighbors[index].lqi = entry[21];
+    }
+
+    DBG("MT_ZDO_MGMT_LQI_RSP received from 0x%04X (%d/%d from index %d)", src_addr, count, total, start_index);
+    if(_zdo_mgmt_lqi_rsp_cb)
+        _zdo_mgmt_lqi_rsp_cb(src_addr, status, total, start_index, count, neighbors);
+    ZG_VAR_FREE(neighbors);
+
+    return 0;
+}
+
+static uint8_t _mgmt_rtg_rsp_cb(ZgMtMsg *msg)
+{
+    uint16_t src_addr;
+    uint8_t status;
+    uint8_t total;
+    uint8_t start_index;
+    uint8_t count;
+    ZgMtZdoRoute *routes = NULL;
+    uint8_t *entry = NULL;
+    uint8_t index = 0;
+
+    if(!msg||!msg->data||msg->len < MGMT_RSP_HEADER_SIZE)
+    {
+        WRN("Cannot extract ZDO_MGMT_RTG_RSP data");
+        return 1;
+    }
+
+    memcpy(&src_addr, msg->data, sizeof(src_addr));
+    status = msg->data[2];
+    total = msg->data[3];
+    start_index = msg->data[4];
+    count = msg->data[5];
+    if(status != ZSUCCESS)
+    {
+        WRN("Device 0x%04X refused routing table request : %s", src_addr, zg_logs_znp_strerror(status));
+        count = 0;
+    }
+    else if(msg->len < MGMT_RSP_HEADER_SIZE + count * MGMT_RTG_ROUTE_SIZE)
+    {
+        ERR("ZDO_MGMT_RTG_RSP from 0x%04X is truncated (%d entries announced)", src_addr, count);
+        return 1;
+    }
+
+    if(count)
+    {
+        routes = calloc(count, sizeof(ZgMtZdoRoute));
+        if(!routes)
+        {
+            CRI("Cannot allocate memory to retrieve routing table");
+            return 1;
+        }
+    }
+    for(index = 0; index < count; index++)
+    {
+        entry = msg->data + MGMT_RSP_HEADER_SIZE + index * MGMT_RTG_ROUTE_SIZE;
+        memcpy(&routes[index].dst_addr, entry, sizeof(uint16_t));
+        routes[index].status = entry[2] & 0x07;
+        memcpy(&routes[index].next_hop, entry + 3, sizeof(uint16_t));
+    }
+
+    DBG("MT_ZDO_MGMT_RTG_RSP received from 0x%04X (%d/%d from index %d)", src_addr, count, total, start_index);
+    if(_zdo_mgmt_rtg_rsp_cb)
+        _zdo_mgmt_rtg_rsp_cb(src_addr, status, total, start_index, count, routes);
+    ZG_VAR_FREE(routes);
+
+    return 0;
+}
+
+static uint8_t _src_rtg_ind_cb(ZgMtMsg *msg)
+{
+    uint16_t dst_addr;
+    uint8_t relay_count;
+    uint16_t *relays = NULL;
+
+    if(!msg||!msg->data||msg->len < SRC_RTG_IND_HEADER_SIZE)
+    {
+        WRN("Cannot extract ZDO_SRC_RTG_IND data");
+        return 1;
+    }
+
+    memcpy(&dst_addr, msg->data, sizeof(dst_addr));
+    relay_count = msg->data[2];
+    if(msg->len < SRC_RTG_IND_HEADER_SIZE + relay_count * sizeof(uint16_t))
+    {
+        ERR("ZDO_SRC_RTG_IND for 0x%04X is truncated (%d relays announced)", dst_addr, relay_count);
+        return 1;
+    }
+
+    if(relay_count)
+    {
+        relays = calloc(relay_count, sizeof(uint16_t));
+        if(!relays)
+        {
+            CRI("Cannot allocate memory to retrieve source route");
+            return 1;
+        }
+        memcpy(relays, msg->data + SRC_RTG_IND_HEADER_SIZE, relay_count * sizeof(uint16_t));
+    }
+
+    DBG("Source route to 0x%04X received (%d relays)", dst_addr, relay_count);
+    if(_zdo_src_rtg_ind_cb)
+        _zdo_src_rtg_ind_cb(dst_addr, relay_count, relays);
+    ZG_VAR_FREE(relays);
+
+    return 0;
+}
+
+static uint8_t _bind_rsp_cb(ZgMtMsg *msg, BindRspCb cb, const char *request)
+{
+    uint16_t src_addr;
+    uint8_t status;
+
+    if(!msg||!msg->data||msg->len < 3)
+    {
+        WRN("Cannot extract %s response data", request);
+        return 1;
+    }
+
+    memcpy(&src_addr, msg->data, sizeof(src_addr));
+    status = msg->data[2];
+    if(status != ZSUCCESS)
+        WRN("Device 0x%04X refused %s request : %s", src_addr, request, zg_logs_znp_strerror(status));
+    else
+        DBG("Device 0x%04X accepted %s request", src_addr, request);
+    if(cb)
+        cb(src_addr, status);
+
+    return 0;
+}
+
+static uint8_t _mgmt_bind_rsp_cb(ZgMtMsg *msg)
+{
+    uint16_t src_addr;
+    uint8_t status;
+    uint8_t total;
+    uint8_t start_index;
+    uint8_t count;
+    ZgMtZdoBinding *bindings = NULL;
+    uint8_t *entry = NULL;
+    uint8_t index = 0;
+
+    if(!msg||!msg->data||msg->len < MGMT_RSP_HEADER_SIZE)
+    {
+        WRN("Cannot extract ZDO_MGMT_BIND_RSP data");
+        return 1;
+    }
+
+    memcpy(&src_addr, msg->data, sizeof(src_addr));
+    status = msg->data[2];
+    total = msg->data[3];
+    start_index = msg->data[4];
+    count = msg->data[5];
+    if(status != ZSUCCESS)
+    {
+        WRN("Device 0x%04X refused binding table request : %s", src_addr, zg_logs_znp_strerror(status));
+        count = 0;
+    }
+
+    if(count)
+    {
+        bindings = calloc(count, sizeof(ZgMtZdoBinding));
+        if(!bindings)
+        {
+            CRI("Cannot allocate memory to retrieve binding table");
+            return 1;
+        }
+    }
+
+    /* Entries length depends on their addressing mode */
+    entry = msg->data + MGMT_RSP_HEADER_SIZE;
+    for(index = 0; index < count; index++)
+    {
+        if(entry + MGMT_BIND_ENTRY_GROUP_SIZE > msg->data + msg->len ||
+                (entry[11] == ZG_MT_ZDO_ADDR_MODE_EXT && entry + MGMT_BIND_ENTRY_EXT_SIZE > msg->data + msg->len))
+        {
+            ERR("ZDO_MGMT_BIND_RSP from 0x%04X is truncated (%d entries announced)", src_addr, count);
+            ZG_VAR_FREE(bindings);
+            return 1;
+        }
+        memcpy(&bindings[index].src_addr, entry, sizeof(uint64_t));
+        bindings[index].src_endpoint = entry[8];
+        memcpy(&bindings[index].cluster, entry + 9, sizeof(uint16_t));
+        bindings[index].dst_addr_mode = entry[11];
+        if(bindings[index].dst_addr_mode == ZG_MT_ZDO_ADDR_MODE_EXT)
+        {
+            memcpy(&bindings[index].dst_addr, entry + 12, sizeof(uint64_t));
+            bindings[index].dst_endpoint = entry[20];
+            entry += MGMT_BIND_ENTRY_EXT_SIZE;
+        }
+        else
+        {
+            memcpy(&bindings[index].dst_addr, entry + 12, sizeof(uint16_t));
+            entry += MGMT_BIND_ENTRY_GROUP_SIZE;
+        }
+    }
+
+    DBG("MT_ZDO_MGMT_BIND_RSP received from 0x%04X (%d/%d from index %d)", src_addr, count, total, start_index);
+    if(_zdo_mgmt_bind_rsp_cb)
+        _zdo_mgmt_bind_rsp_cb(src_addr, status, total, start_index, count, bindings);
+    ZG_VAR_FREE(bindings);
+
+    return 0;
+}
+
 /* General MT ZDO frames processing callbacks */
 
 static void _process_mt_zdo_srsp(ZgMtMsg *msg)
@@ -577,6 +952,24 @@ static void _process_mt_zdo_srsp(ZgMtMsg *msg)
         case ZDO_MGMT_PERMIT_JOIN_REQ:
             _permit_join_req_srsp_cb(msg);
             break;
+        case ZDO_MGMT_LQI_REQ:
+            _mgmt_lqi_req_srsp_cb(msg);
+            break;
+        case ZDO_MGMT_RTG_REQ:
+            _mgmt_rtg_req_srsp_cb(msg);
+            break;
+        case ZDO_FORCE_CONCENTRATOR_CHANGE:
+            _force_concentrator_change_srsp_cb(msg);
+            break;
+        case ZDO_BIND_REQ:
+            _bind_table_req_srsp_cb(msg, "bind request", sync_action_cb);
+            break;
+        case ZDO_UNBIND_REQ:
+            _bind_table_req_srsp_cb(msg, "unbind request", sync_action_cb);
+            break;
+        case ZDO_MGMT_BIND_REQ:
+            _bind_table_req_srsp_cb(msg, "binding table request", _mgmt_action_cb);
+            break;
         default:
             WRN("Unknown SRSP command 0x%02X", msg->cmd);
             break;
@@ -611,6 +1004,24 @@ static void _process_mt_zdo_areq(ZgMtMsg *msg)
         case ZDO_LEAVE_IND:
             _zdo_leave_ind_cb(msg);
             break;
+        case ZDO_MGMT_LQI_RSP:
+            _mgmt_lqi_rsp_cb(msg);
+            break;
+        case ZDO_MGMT_RTG_RSP:
+            _mgmt_rtg_rsp_cb(msg);
+            break;
+        case ZDO_SRC_RTG_IND:
+            _src_rtg_ind_cb(msg);
+            break;
+        case ZDO_BIND_RSP:
+            _bind_rsp_cb(msg, _zdo_bind_rsp_cb, "bind");
+            break;
+        case ZDO_UNBIND_RSP:
+            _bind_rsp_cb(msg, _zdo_unbind_rsp_cb, "unbind");
+            break;
+        case ZDO_MGMT_BIND_RSP:
+            _mgmt_bind_rsp_cb(msg);
+            break;
         default:
             WRN("Unknown AREQ command 0x%02X", msg->cmd);
             break;
@@ -664,7 +1075,6 @@ void zg_mt_zdo_nwk_discovery_req(SyncActionCb cb)
     uint8_t *buffer = NULL;
 
     INF("Sending ZDO network discover request (%d s)", scan_duration);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_ZDO;
     msg.cmd = ZDO_NWK_DISCOVERY_REQ;
@@ -678,7 +1088,7 @@ void zg_mt_zdo_nwk_discovery_req(SyncActionCb cb)
     memcpy(buffer, &scan_param, sizeof(scan_param));
     memcpy(buffer + sizeof(scan_param), &scan_duration, sizeof(scan_duration));
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
@@ -688,13 +1098,12 @@ void zg_mt_zdo_startup_from_app(SyncActionCb cb)
     uint16_t startup_delay = ZDO_DEFAULT_STARTUP_DELAY;
 
     INF("Starting ZDO stack");
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_ZDO;
     msg.cmd = ZDO_STARTUP_FROM_APP;
     msg.len = sizeof(startup_delay);
     msg.data = (uint8_t *)&startup_delay;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
 }
 
 void zg_mt_zdo_register_visible_device_cb(void (*cb)(uint16_t addr, uint64_t ext_addr))
@@ -709,7 +1118,6 @@ void zg_mt_zdo_device_annce(uint16_t addr, uint64_t uid, SyncActionCb cb)
     uint8_t cap = DEVICE_ANNCE_CAPABILITIES;
 
     INF("Announce gateway (0x%04X - 0x%" PRIx64 ") to network", addr, uid);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_ZDO;
     msg.cmd = ZDO_END_DEVICE_ANNCE;
@@ -724,7 +1132,7 @@ void zg_mt_zdo_device_annce(uint16_t addr, uint64_t uid, SyncActionCb cb)
     memcpy(buffer + sizeof(addr), &uid, sizeof(uid));
     memcpy(buffer + sizeof(addr) + sizeof(uid), &cap, sizeof(cap));
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
@@ -736,7 +1144,6 @@ void zg_mt_zdo_ext_route_disc_request(uint16_t addr, SyncActionCb cb)
     uint8_t *buffer = NULL;
 
     INF("Asking route for device 0x%04X", addr);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_ZDO;
     msg.cmd = ZDO_EXT_ROUTE_DISC;
@@ -751,7 +1158,7 @@ void zg_mt_zdo_ext_route_disc_request(uint16_t addr, SyncActionCb cb)
     memcpy(buffer + sizeof(addr), &options, sizeof(options));
     memcpy(buffer + sizeof(addr) + sizeof(options), &radius, sizeof(radius));
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
@@ -762,7 +1169,6 @@ void zg_mt_zdo_query_active_endpoints(uint16_t short_addr, SyncActionCb cb)
     uint8_t *buffer = NULL;
 
     INF("Requesting active endpoints for device 0x%04X", short_addr);
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_ZDO;
     msg.cmd = ZDO_ACTIVE_EP_REQ;
@@ -776,7 +1182,7 @@ void zg_mt_zdo_query_active_endpoints(uint16_t short_addr, SyncActionCb cb)
     memcpy(buffer, &src_addr, sizeof(src_addr));
     memcpy(buffer + sizeof(src_addr), &short_addr, sizeof(short_addr));
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 
 }
@@ -802,7 +1208,6 @@ void zg_mt_zdo_permit_join(SyncActionCb cb)
     uint8_t index = 0;
 
     INF("Allowing new devices to join for 32s");
-    sync_action_cb = cb;
     msg.type = ZG_MT_CMD_SRSP;
     msg.subsys = ZG_MT_SUBSYS_ZDO;
     msg.cmd = ZDO_MGMT_PERMIT_JOIN_REQ;
@@ -822,7 +1227,122 @@ void zg_mt_zdo_permit_join(SyncActionCb cb)
     memcpy(buffer + index, &tcsign, sizeof(tcsign));
     index += sizeof(tcsign);
     msg.data = buffer;
-    zg_rpc_write(&msg);
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
     ZG_VAR_FREE(buffer);
 }
 
+static void _send_mgmt_table_request(uint8_t cmd, uint16_t addr, uint8_t start_index, SyncActionCb cb)
+{
+    ZgMtMsg msg;
+    uint8_t buffer[sizeof(addr) + sizeof(start_index)];
+
+    msg.type = ZG_MT_CMD_SREQ;
+    msg.subsys = ZG_MT_SUBSYS_ZDO;
+    msg.cmd = cmd;
+    msg.len = sizeof(buffer);
+    memcpy(buffer, &addr, sizeof(addr));
+    memcpy(buffer + sizeof(addr), &start_index, sizeof(start_index));
+    msg.data = buffer;
+    zg_rpc_write_sync(&msg, &_mgmt_action_cb, cb);
+}
+
+void zg_mt_zdo_mgmt_lqi_request(uint16_t addr, uint8_t start_index, SyncActionCb cb)
+{
+    DBG("Requesting neighbor table of device 0x%04X from index %d", addr, start_index);
+    _send_mgmt_table_request(ZDO_MGMT_LQI_REQ, addr, start_index, cb);
+}
+
+void zg_mt_zdo_mgmt_rtg_request(uint16_t addr, uint8_t start_index, SyncActionCb cb)
+{
+    DBG("Requesting routing table of device 0x%04X from index %d", addr, start_index);
+    _send_mgmt_table_request(ZDO_MGMT_RTG_REQ, addr, start_index, cb);
+}
+
+void zg_mt_zdo_register_mgmt_lqi_rsp_cb(MgmtLqiRspCb cb)
+{
+    _zdo_mgmt_lqi_rsp_cb = cb;
+}
+
+void zg_mt_zdo_register_mgmt_rtg_rsp_cb(MgmtRtgRspCb cb)
+{
+    _zdo_mgmt_rtg_rsp_cb = cb;
+}
+
+void zg_mt_zdo_register_src_rtg_ind_cb(SrcRtgIndCb cb)
+{
+    _zdo_src_rtg_ind_cb = cb;
+}
+
+void zg_mt_zdo_force_concentrator_change(SyncActionCb cb)
+{
+    ZgMtMsg msg;
+
+    INF("Forcing many-to-one route request");
+    msg.type = ZG_MT_CMD_SREQ;
+    msg.subsys = ZG_MT_SUBSYS_ZDO;
+    msg.cmd = ZDO_FORCE_CONCENTRATOR_CHANGE;
+    msg.len = 0;
+    msg.data = NULL;
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
+}
+
+static void _send_bind_request(uint8_t cmd, uint16_t addr, ZgMtZdoBinding *binding, SyncActionCb cb)
+{
+    ZgMtMsg msg;
+    uint8_t buffer[BIND_REQ_SIZE] = {0};
+
+    msg.type = ZG_MT_CMD_SREQ;
+    msg.subsys = ZG_MT_SUBSYS_ZDO;
+    msg.cmd = cmd;
+    msg.len = sizeof(buffer);
+    memcpy(buffer, &addr, sizeof(addr));
+    memcpy(buffer + 2, &binding->src_addr, sizeof(binding->src_addr));
+    buffer[10] = binding->src_endpoint;
+    memcpy(buffer + 11, &binding->cluster, sizeof(binding->cluster));
+    buffer[13] = binding->dst_addr_mode;
+    if(binding->dst_addr_mode == ZG_MT_ZDO_ADDR_MODE_EXT)
+        memcpy(buffer + 14, &binding->dst_addr, sizeof(binding->dst_addr));
+    else
+        memcpy(buffer + 14, &binding->dst_addr, sizeof(uint16_t));
+    buffer[22] = binding->dst_endpoint;
+    msg.data = buffer;
+    zg_rpc_write_sync(&msg, &sync_action_cb, cb);
+}
+
+void zg_mt_zdo_bind_request(uint16_t addr, ZgMtZdoBinding *binding, SyncActionCb cb)
+{
+    DBG("Binding cluster 0x%04X of device 0x%04X", binding->cluster, addr);
+    _send_bind_request(ZDO_BIND_REQ, addr, binding, cb);
+}
+
+void zg_mt_zdo_unbind_request(uint16_t addr, ZgMtZdoBinding *binding, SyncActionCb cb)
+{
+    DBG("Unbinding cluster 0x%04X of device 0x%04X", binding->cluster, addr);
+    _send_bind_request(ZDO_UNBIND_REQ, addr, binding, cb);
+}
+
+void zg_mt_zdo_mgmt_bind_request(uint16_t addr, uint8_t start_index, SyncActionCb cb)
+{
+    DBG("Requesting binding table of device 0x%04X from index %d", addr, start_index);
+    _send_mgmt_table_request(ZDO_MGMT_BIND_REQ, addr, start_index, cb);
+}
+
+void zg_mt_zdo_register_bind_rsp_cb(BindRspCb cb)
+{
+    _zdo_bind_rsp_cb = cb;
+}
+
+void zg_mt_zdo_register_unbind_rsp_cb(BindRspCb cb)
+{
+    _zdo_unbind_rsp_cb = cb;
+}
+
+void zg_mt_zdo_register_mgmt_bind_rsp_cb(MgmtBindRspCb cb)
+{
+    _zdo_mgmt_bind_rsp_cb = cb;
+}
+
+void zg_mt_zdo_register_device_annce_cb(DeviceAnnceCb cb)
+{
+    _zdo_device_annce_cb = cb;
+}
@@ -4,6 +4,54 @@
 #include <stdint.h>
 #include "types.h"
 
+/* Neighbor table entry, as reported by a ZDO_MGMT_LQI_RSP */
+typedef struct
+{
+    uint64_t ext_pan_id;
+    uint64_t ext_addr;
+    uint16_t nwk_addr;
+    uint8_t device_type;
+    uint8_t rx_on_when_idle;
+    uint8_t relationship;
+    uint8_t permit_joining;
+    uint8_t depth;
+    uint8_t lqi;
+} ZgMtZdoNeighbor;
+
+/* Routing table entry, as reported by a ZDO_MGMT_RTG_RSP */
+typedef struct
+{
+    uint16_t dst_addr;
+    uint8_t status;
+    uint16_t next_hop;
+} ZgMtZdoRoute;
+
+/* Binding destination addressing modes */
+#define ZG_MT_ZDO_ADDR_MODE_GROUP           0x01
+#define ZG_MT_ZDO_ADDR_MODE_EXT             0x03
+
+/* Capabilities flags of device announcements */
+#define ZG_MT_ZDO_CAPABILITY_RX_ON_WHEN_IDLE    0x08
+
+/* Binding table entry, as sent in Bind requests or reported by a
+ * ZDO_MGMT_BIND_RSP. With group addressing, dst_addr holds the group id and
+ * dst_endpoint is not used */
+typedef struct
+{
+    uint64_t src_addr;
+    uint8_t src_endpoint;
+    uint16_t cluster;
+    uint8_t dst_addr_mode;
+    uint64_t dst_addr;
+    uint8_t dst_endpoint;
+} ZgMtZdoBinding;
+
+typedef void (*MgmtLqiRspCb)(uint16_t src_addr, uint8_t status, uint8_t total, uint8_t start_index, uint8_t count, ZgMtZdoNeighbor *neighbors);
+typedef void (*MgmtRtgRspCb)(uint16_t src_addr, uint8_t status, uint8_t total, uint8_t start_index, uint8_t count, ZgMtZdoRoute *routes);
+typedef void (*SrcRtgIndCb)(uint16_t dst_addr, uint8_t relay_count, uint16_t *relays);
+typedef void (*BindRspCb)(uint16_t src_addr, uint8_t status);
+typedef void (*MgmtBindRspCb)(uint16_t src_addr, uint8_t status, uint8_t total, uint8_t start_index, uint8_t count, ZgMtZdoBinding *bindings);
+typedef void (*DeviceAnnceCb)(uint16_t addr, uint64_t ext_addr, uint8_t capabilities);
 
 /**
  * \brief Initialize the MT ZDO module
@@ -35,6 +83,14 @@ void zg_mt_zdo_startup_from_app(SyncActionCb);
  */
 void zg_mt_zdo_register_visible_device_cb(void (*cb)(uint16_t addr, uint64_t ext_addr));
 
+/**
+ * \brief Register a callback to be called with the content of DEVICE_ANNCE
+ * messages, sent by devices when they join or rejoin the network
+ * \param cb The callback, called with the device addresses and capabilities
+ * (see ZG_MT_ZDO_CAPABILITY_*)
+ */
+void zg_mt_zdo_register_device_annce_cb(DeviceAnnceCb cb);
+
 /**
  * \brief Ask ZNP to send a DEVICE_ANNCE message on network, to announce gateway
  * availability to all devices
@@ -92,5 +148,110 @@ void zg_mt_zdo_register_simple_desc_rsp_cb(void (*cb)(uint8_t endpoint, uint16_t
  */
 void zg_mt_zdo_permit_join(SyncActionCb cb);
 
+/**
+ * \brief Ask a remote router (or the gateway itself) for a page of its neighbor
+ * table. The answer is delivered through the callback registered with
+ * zg_mt_zdo_register_mgmt_lqi_rsp_cb
+ * \param addr The short address of the device to query
+ * \param start_index The index of the first neighbor table entry to retrieve
+ * \param cb The callback triggered when ZNP has received and processed the
+ * command
+ */
+void zg_mt_zdo_mgmt_lqi_request(uint16_t addr, uint8_t start_index, SyncActionCb cb);
+
+/**
+ * \brief Ask a remote router (or the gateway itself) for a page of its routing
+ * table. The answer is delivered through the callback registered with
+ * zg_mt_zdo_register_mgmt_rtg_rsp_cb
+ * \param addr The short address of the device to query
+ * \param start_index The index of the first routing table entry to retrieve
+ * \param cb The callback triggered when ZNP has received and processed the
+ * command
+ */
+void zg_mt_zdo_mgmt_rtg_request(uint16_t addr, uint8_t start_index, SyncActionCb cb);
+
+/**
+ * \brief Register a callback on neighbor table (Mgmt_Lqi) responses
+ * \param cb The callback which will be called with each received page
+ */
+void zg_mt_zdo_register_mgmt_lqi_rsp_cb(MgmtLqiRspCb cb);
+
+/**
+ * \brief Register a callback on routing table (Mgmt_Rtg) responses
+ * \param cb The callback which will be called with each received page
+ */
+void zg_mt_zdo_register_mgmt_rtg_rsp_cb(MgmtRtgRspCb cb);
+
+/**
+ * \brief Register a callback on source route indications. ZNP emits those
+ * indications when it receives a route record from a remote device, which
+ * happens when ZNP is configured as a many-to-one concentrator
+ * \param cb The callback which will be called with the destination address and
+ * the list of relays to use to reach it, the closest relay to the destination
+ * being the first one
+ */
+void zg_mt_zdo_register_src_rtg_ind_cb(SrcRtgIndCb cb);
+
+/**
+ * \brief Make ZNP immediately broadcast a many-to-one route request, so that
+ * all routers learn the route to the gateway and send back route records
+ * \param cb The callback triggered when ZNP has received and processed the
+ * command
+ */
+void zg_mt_zdo_force_concentrator_change(SyncActionCb cb);
+
+/**
+ * \brief Ask a remote device to add an entry in its binding table. The answer
+ * is delivered through the callback registered with
+ * zg_mt_zdo_register_bind_rsp_cb
+ * \param addr The short address of the device holding the binding table
+ * \param binding The entry to add
+ * \param cb The callback triggered when ZNP has received and processed the
+ * command
+ */
+void zg_mt_zdo_bind_request(uint16_t addr, ZgMtZdoBinding *binding, SyncActionCb cb);
+
+/**
+ * \brief Ask a remote device to remove an entry from its binding table. The
+ * answer is delivered through the callback registered with
+ * zg_mt_zdo_register_unbind_rsp_cb
+ * \param addr The short address of the device holding the binding table
+ * \param binding The entry to remove
+ * \param cb The callback triggered when ZNP has received and processed the
+ * command
+ */
+void zg_mt_zdo_unbind_request(uint16_t addr, ZgMtZdoBinding *binding, SyncActionCb cb);
+
+/**
+ * \brief Ask a remote device for a page of its binding table. The answer is
+ * delivered through the callback registered with
+ * zg_mt_zdo_register_mgmt_bind_rsp_cb
+ * \param addr The short address of the device to query
+ * \param start_index The index of the first binding table entry to retrieve
+ * \param cb The callback triggered when ZNP has received and processed the
+ * command
+ */
+void zg_mt_zdo_mgmt_bind_request(uint16_t addr, uint8_t start_index, SyncActionCb cb);
+
+/**
+ * \brief Register a callback on Bind responses
+ * \param cb The callback which will be called with the responding device
+ * address and the request status
+ */
+void zg_mt_zdo_register_bind_rsp_cb(BindRspCb cb);
+
+/**
+ * \brief Register a callback on Unbind responses
+ * \param cb The callback which will be called with the responding device
+ * address and the request status
+ */
+void zg_mt_zdo_register_unbind_rsp_cb(BindRspCb cb);
+
+/**
+ * \brief Register a callback on binding table (Mgmt_Bind) responses
+ * \param cb The callback which will be called with each received page
+ */
+void zg_mt_zdo_register_mgmt_bind_rsp_cb(MgmtBindRspCb cb);
+
 #endif
 
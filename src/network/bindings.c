@@ -0,0 +1,580 @@
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include <Eina.h>
+#include "bindings.h"
+#include "mt_zdo.h"
+#include "mt_sys.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+/* Number of requests sent at the same time, to different devices */
+#define BINDINGS_MAX_PENDING_REQUESTS       2
+#define BINDINGS_REQUEST_TIMEOUT_MS         5000
+#define BINDINGS_REQUEST_MAX_RETRIES        2
+/* First reconciliation waits for routers to be back on network */
+#define BINDINGS_FIRST_RECONCILE_MS         (60 * 1000)
+#define BINDINGS_RECONCILE_INTERVAL_MS      (60 * 60 * 1000)
+
+/* Reports bound to the gateway are received on its ZHA endpoint */
+#define BINDINGS_GATEWAY_ENDPOINT           0x01
+
+#define ZDP_STATUS_NO_ENTRY                 0x88
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef enum
+{
+    BINDINGS_REQUEST_BIND,
+    BINDINGS_REQUEST_UNBIND,
+    BINDINGS_REQUEST_TABLE,
+} BindingsRequestType;
+
+typedef struct
+{
+    BindingsRequestType type;
+    DeviceId id;
+    uint16_t addr;
+    ZgDeviceBinding binding;
+    uint8_t start_index;
+    uint8_t retries;
+    /* Binding table entries read in previous pages */
+    Eina_List *entries;
+    uv_timer_t timer;
+} BindingsRequest;
+
+typedef struct
+{
+    uint64_t ext_addr;
+    int id;
+} BindingsDeviceLookup;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static Eina_List *_pending_requests = NULL;
+static Eina_List *_in_flight_requests = NULL;
+static uint8_t _started = 0;
+static uv_timer_t _reconcile_timer;
+
+static const char *_request_strings[] = {"bind", "unbind", "binding table"};
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static Eina_List *_free_entries(Eina_List *list)
+{
+    void *entry = NULL;
+    EINA_LIST_FREE(list, entry)
+        free(entry);
+    return NULL;
+}
+
+static uint8_t _build_binding(uint8_t endpoint, uint16_t cluster, ZgBindingsTargetType type,
+        uint16_t target, uint8_t target_endpoint, ZgDeviceBinding *binding)
+{
+    memset(binding, 0, sizeof(ZgDeviceBinding));
+    binding->src_endpoint = endpoint;
+    binding->cluster = cluster;
+
+    switch(type)
+    {
+        case ZG_BINDINGS_TARGET_DEVICE:
+            binding->dst_addr_mode = ZG_MT_ZDO_ADDR_MODE_EXT;
+            binding->dst_addr = zg_device_get_ext_addr(target);
+            binding->dst_endpoint = target_endpoint;
+            if(!binding->dst_addr)
+            {
+                ERR("Cannot bind to device %d : device is unknown", target);
+                return 1;
+            }
+            break;
+        case ZG_BINDINGS_TARGET_GROUP:
+            binding->dst_addr_mode = ZG_MT_ZDO_ADDR_MODE_GROUP;
+            binding->dst_addr = target;
+            break;
+        case ZG_BINDINGS_TARGET_GATEWAY:
+            binding->dst_addr_mode = ZG_MT_ZDO_ADDR_MODE_EXT;
+            binding->dst_addr = zg_mt_sys_get_ext_addr();
+            binding->dst_endpoint = BINDINGS_GATEWAY_ENDPOINT;
+            break;
+        default:
+            ERR("Unknown binding target type %d", type);
+            return 1;
+    }
+    return 0;
+}
+
+static uint8_t _same_binding(ZgDeviceBinding *a, ZgDeviceBinding *b)
+{
+    return a->src_endpoint == b->src_endpoint && a->cluster == b->cluster
+        && a->dst_addr_mode == b->dst_addr_mode && a->dst_addr == b->dst_addr
+        && (a->dst_addr_mode != ZG_MT_ZDO_ADDR_MODE_EXT || a->dst_endpoint == b->dst_endpoint);
+}
+
+/********************************
+ *       Requests management    *
+ *******************************/
+
+static void _send_pending_requests(void);
+
+static void _request_closed_cb(uv_handle_t *handle)
+{
+    BindingsRequest *request = handle->data;
+    ZG_VAR_FREE(request);
+}
+
+static void _release_request(BindingsRequest *request)
+{
+    _in_flight_requests = eina_list_remove(_in_flight_requests, request);
+    request->entries = _free_entries(request->entries);
+    uv_timer_stop(&request->timer);
+    uv_close((uv_handle_t *)&request->timer, _request_closed_cb);
+}
+
+static BindingsRequest *_find_in_flight_request(BindingsRequestType type, uint16_t addr)
+{
+    Eina_List *l = NULL;
+    BindingsRequest *request = NULL;
+
+    EINA_LIST_FOREACH(_in_flight_requests, l, request)
+    {
+        if(request->type == type && request->addr == addr)
+            return request;
+    }
+    return NULL;
+}
+
+/* Responses only carry the device address, so a single request per device is
+ * sent at a time */
+static uint8_t _is_device_busy(uint16_t addr)
+{
+    Eina_List *l = NULL;
+    BindingsRequest *request = NULL;
+
+    EINA_LIST_FOREACH(_in_flight_requests, l, request)
+    {
+        if(request->addr == addr)
+            return 1;
+    }
+    return 0;
+}
+
+static BindingsRequest *_queue_request(BindingsRequestType type, DeviceId id, ZgDeviceBinding *binding, uint8_t start_index, uint8_t urgent)
+{
+    BindingsRequest *request = NULL;
+    uint16_t addr = zg_device_get_short_addr(id);
+
+    if(addr == 0xFFFD)
+    {
+        ERR("Cannot send %s request to device %d : device is unknown", _request_strings[type], id);
+        return NULL;
+    }
+
+    request = calloc(1, sizeof(BindingsRequest));
+    if(!request)
+    {
+        CRI("Cannot allocate memory for %s request", _request_strings[type]);
+        return NULL;
+    }
+    request->type = type;
+    request->id = id;
+    request->addr = addr;
+    request->start_index = start_index;
+    if(binding)
+        memcpy(&request->binding, binding, sizeof(ZgDeviceBinding));
+
+    /* Next pages of a table being read are sent before any new request */
+    if(urgent)
+        _pending_requests = eina_list_prepend(_pending_requests, request);
+    else
+        _pending_requests = eina_list_append(_pending_requests, request);
+    return request;
+}
+
+static void _request_timeout_cb(uv_timer_t *timer)
+{
+    BindingsRequest *request = timer->data;
+    BindingsRequest *retry = NULL;
+
+    if(request->retries < BINDINGS_REQUEST_MAX_RETRIES)
+    {
+        WRN("No answer from device 0x%04X to %s request, retrying", request->addr, _request_strings[request->type]);
+        retry = _queue_request(request->type, request->id, &request->binding, request->start_index, 1);
+        if(retry)
+        {
+            retry->retries = request->retries + 1;
+            retry->entries = request->entries;
+            request->entries = NULL;
+        }
+    }
+    else
+    {
+        WRN("Device 0x%04X did not answer to %s request, giving up", request->addr, _request_strings[request->type]);
+    }
+
+    _release_request(request);
+    _send_pending_requests();
+}
+
+static void _send_request(BindingsRequest *request)
+{
+    ZgMtZdoBinding binding;
+
+    uv_timer_init(uv_default_loop(), &request->timer);
+    request->timer.data = request;
+    uv_timer_start(&request->timer, _request_timeout_cb, BINDINGS_REQUEST_TIMEOUT_MS, 0);
+
+    if(request->type == BINDINGS_REQUEST_TABLE)
+    {
+        zg_mt_zdo_mgmt_bind_request(request->addr, request->start_index, NULL);
+        return;
+    }
+
+    binding.src_addr = zg_device_get_ext_addr(request->id);
+    binding.src_endpoint = request->binding.src_endpoint;
+    binding.cluster = request->binding.cluster;
+    binding.dst_addr_mode = request->binding.dst_addr_mode;
+    binding.dst_addr = request->binding.dst_addr;
+    binding.dst_endpoint = request->binding.dst_endpoint;
+    if(request->type == BINDINGS_REQUEST_BIND)
+        zg_mt_zdo_bind_request(request->addr, &binding, NULL);
+    else
+        zg_mt_zdo_unbind_request(request->addr, &binding, NULL);
+}
+
+static void _send_pending_requests(void)
+{
+    Eina_List *l = NULL, *l_next = NULL;
+    BindingsRequest *request = NULL;
+
+    EINA_LIST_FOREACH_SAFE(_pending_requests, l, l_next, request)
+    {
+        if(eina_list_count(_in_flight_requests) >= BINDINGS_MAX_PENDING_REQUESTS)
+            break;
+        if(_is_device_busy(request->addr))
+            continue;
+
+        _pending_requests = eina_list_remove_list(_pending_requests, l);
+        _in_flight_requests = eina_list_append(_in_flight_requests, request);
+        _send_request(request);
+    }
+}
+
+static uint8_t _is_reconciling(void)
+{
+    Eina_List *l = NULL;
+    BindingsRequest *request = NULL;
+
+    EINA_LIST_FOREACH(_pending_requests, l, request)
+    {
+        if(request->type == BINDINGS_REQUEST_TABLE)
+            return 1;
+    }
+    EINA_LIST_FOREACH(_in_flight_requests, l, request)
+    {
+        if(request->type == BINDINGS_REQUEST_TABLE)
+            return 1;
+    }
+    return 0;
+}
+
+/********************************
+ *        Reconciliation        *
+ *******************************/
+
+static void _reconcile_device(DeviceId id, Eina_List *entries)
+{
+    ZgDeviceBinding *saved = NULL, *entry = NULL;
+    Eina_List *l = NULL;
+    uint8_t found = 0;
+    int count = 0, index = 0, nb_restored = 0;
+
+    count = zg_device_get_bindings(id, &saved);
+    for(index = 0; index < count; index++)
+    {
+        found = 0;
+        EINA_LIST_FOREACH(entries, l, entry)
+        {
+            if(_same_binding(&saved[index], entry))
+            {
+                found = 1;
+                break;
+            }
+        }
+        if(found)
+            continue;
+        WRN("Binding of cluster 0x%04X is missing on device %d, restoring it", saved[index].cluster, id);
+        _queue_request(BINDINGS_REQUEST_BIND, id, &saved[index], 0, 0);
+        nb_restored++;
+    }
+    INF("Binding table of device %d checked (%d entries, %d restored)", id, eina_list_count(entries), nb_restored);
+    ZG_VAR_FREE(saved);
+}
+
+static void _queue_table_request(DeviceId id, void *data __attribute__((unused)))
+{
+    ZgDeviceBinding *saved = NULL;
+
+    /* Only devices with saved bindings are checked */
+    if(zg_device_get_bindings(id, &saved) > 0)
+        _queue_request(BINDINGS_REQUEST_TABLE, id, NULL, 0, 0);
+    ZG_VAR_FREE(saved);
+}
+
+/********************************
+ *     ZDO responses callbacks  *
+ *******************************/
+
+static void _bind_rsp_cb(uint16_t src_addr, uint8_t status)
+{
+    BindingsRequest *request = _find_in_flight_request(BINDINGS_REQUEST_BIND, src_addr);
+
+    if(!request)
+    {
+        DBG("Ignoring unsolicited bind response from 0x%04X", src_addr);
+        return;
+    }
+
+    if(status == ZSUCCESS)
+        zg_device_add_binding(request->id, &request->binding);
+    _release_request(request);
+    _send_pending_requests();
+}
+
+static void _unbind_rsp_cb(uint16_t src_addr, uint8_t status)
+{
+    BindingsRequest *request = _find_in_flight_request(BINDINGS_REQUEST_UNBIND, src_addr);
+
+    if(!request)
+    {
+        DBG("Ignoring unsolicited unbind response from 0x%04X", src_addr);
+        return;
+    }
+
+    /* Binding may have been removed by someone else */
+    if(status == ZSUCCESS || status == ZDP_STATUS_NO_ENTRY)
+        zg_device_remove_binding(request->id, &request->binding);
+    _release_request(request);
+    _send_pending_requests();
+}
+
+static void _mgmt_bind_rsp_cb(uint16_t src_addr, uint8_t status, uint8_t total, uint8_t start_index, uint8_t count, ZgMtZdoBinding *bindings)
+{
+    BindingsRequest *request = _find_in_flight_request(BINDINGS_REQUEST_TABLE, src_addr);
+    BindingsRequest *next = NULL;
+    ZgDeviceBinding *entry = NULL;
+    Eina_List *entries = NULL;
+    uint8_t index = 0;
+
+    if(!request)
+    {
+        DBG("Ignoring unsolicited binding table from 0x%04X", src_addr);
+        return;
+    }
+    entries = request->entries;
+    request->entries = NULL;
+
+    if(status != ZSUCCESS)
+    {
+        entries = _free_entries(entries);
+        goto mgmt_bind_rsp_end;
+    }
+
+    for(index = 0; index < count; index++)
+    {
+        entry = calloc(1, sizeof(ZgDeviceBinding));
+        if(!entry)
+        {
+            CRI("Cannot allocate memory for binding table entry");
+            break;
+        }
+        entry->src_endpoint = bindings[index].src_endpoint;
+        entry->cluster = bindings[index].cluster;
+        entry->dst_addr_mode = bindings[index].dst_addr_mode;
+        entry->dst_addr = bindings[index].dst_addr;
+        entry->dst_endpoint = bindings[index].dst_endpoint;
+        entries = eina_list_append(entries, entry);
+    }
+
+    if(count > 0 && start_index + count < total)
+    {
+        next = _queue_request(BINDINGS_REQUEST_TABLE, request->id, NULL, start_index + count, 1);
+        if(next)
+        {
+            next->entries = entries;
+            entries = NULL;
+        }
+    }
+    else
+    {
+        _reconcile_device(request->id, entries);
+    }
+    entries = _free_entries(entries);
+
+mgmt_bind_rsp_end:
+    _release_request(request);
+    _send_pending_requests();
+}
+
+static void _reconcile_timer_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    zg_bindings_refresh();
+}
+
+static void _find_device_by_ext_addr(DeviceId id, void *data)
+{
+    BindingsDeviceLookup *lookup = data;
+
+    if(zg_device_get_ext_addr(id) == lookup->ext_addr)
+        lookup->id = id;
+}
+
+static json_t *_build_binding_json(ZgDeviceBinding *binding)
+{
+    BindingsDeviceLookup lookup = {binding->dst_addr, -1};
+    json_t *result = json_object();
+    json_t *target = NULL;
+
+    if(binding->dst_addr_mode == ZG_MT_ZDO_ADDR_MODE_GROUP)
+    {
+        target = json_object();
+        json_object_set_new(target, "group", json_integer(binding->dst_addr));
+    }
+    else if(binding->dst_addr == zg_mt_sys_get_ext_addr())
+    {
+        target = json_string("gateway");
+    }
+    else
+    {
+        zg_device_foreach(_find_device_by_ext_addr, &lookup);
+        target = json_object();
+        json_object_set_new(target, "id", json_integer(lookup.id));
+        json_object_set_new(target, "endpoint", json_integer(binding->dst_endpoint));
+    }
+
+    json_object_set_new(result, "endpoint", json_integer(binding->src_endpoint));
+    json_object_set_new(result, "cluster", json_integer(binding->cluster));
+    json_object_set_new(result, "target", target);
+    return result;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_bindings_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_bindings", ZG_COLOR_LIGHTGREEN);
+    zg_mt_zdo_register_bind_rsp_cb(_bind_rsp_cb);
+    zg_mt_zdo_register_unbind_rsp_cb(_unbind_rsp_cb);
+    zg_mt_zdo_register_mgmt_bind_rsp_cb(_mgmt_bind_rsp_cb);
+    INF("Bindings module initialized");
+    return 0;
+}
+
+void zg_bindings_shutdown(void)
+{
+    BindingsRequest *request = NULL;
+
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(_started)
+    {
+        uv_timer_stop(&_reconcile_timer);
+        uv_close((uv_handle_t *)&_reconcile_timer, NULL);
+        _started = 0;
+    }
+    EINA_LIST_FREE(_pending_requests, request)
+    {
+        _free_entries(request->entries);
+        free(request);
+    }
+    while(_in_flight_requests)
+        _release_request(eina_list_data_get(_in_flight_requests));
+    zg_mt_zdo_register_bind_rsp_cb(NULL);
+    zg_mt_zdo_register_unbind_rsp_cb(NULL);
+    zg_mt_zdo_register_mgmt_bind_rsp_cb(NULL);
+    INF("Bindings module shut down");
+}
+
+void zg_bindings_start(void)
+{
+    if(_started)
+        return;
+
+    uv_timer_init(uv_default_loop(), &_reconcile_timer);
+    uv_timer_start(&_reconcile_timer, _reconcile_timer_cb, BINDINGS_FIRST_RECONCILE_MS, BINDINGS_RECONCILE_INTERVAL_MS);
+    _started = 1;
+}
+
+uint8_t zg_bindings_bind(DeviceId id, uint8_t endpoint, uint16_t cluster,
+        ZgBindingsTargetType type, uint16_t target, uint8_t target_endpoint)
+{
+    ZgDeviceBinding binding;
+
+    if(_build_binding(endpoint, cluster, type, target, target_endpoint, &binding) != 0)
+        return 1;
+    if(!_queue_request(BINDINGS_REQUEST_BIND, id, &binding, 0, 0))
+        return 1;
+
+    INF("Binding cluster 0x%04X of device %d", cluster, id);
+    _send_pending_requests();
+    return 0;
+}
+
+uint8_t zg_bindings_unbind(DeviceId id, uint8_t endpoint, uint16_t cluster,
+        ZgBindingsTargetType type, uint16_t target, uint8_t target_endpoint)
+{
+    ZgDeviceBinding binding;
+
+    if(_build_binding(endpoint, cluster, type, target, target_endpoint, &binding) != 0)
+        return 1;
+    if(!_queue_request(BINDINGS_REQUEST_UNBIND, id, &binding, 0, 0))
+        return 1;
+
+    INF("Unbinding cluster 0x%04X of device %d", cluster, id);
+    _send_pending_requests();
+    return 0;
+}
+
+uint8_t zg_bindings_refresh(void)
+{
+    if(_is_reconciling())
+    {
+        WRN("Binding tables reconciliation is already in progress");
+        return 1;
+    }
+
+    INF("Starting binding tables reconciliation");
+    zg_device_foreach(_queue_table_request, NULL);
+    _send_pending_requests();
+    return 0;
+}
+
+json_t *zg_bindings_get_json(DeviceId id)
+{
+    ZgDeviceBinding *saved = NULL;
+    json_t *result = NULL;
+    int count = 0, index = 0;
+
+    if(zg_device_get_short_addr(id) == 0xFFFD)
+        return NULL;
+
+    result = json_array();
+    count = zg_device_get_bindings(id, &saved);
+    for(index = 0; index < count; index++)
+        json_array_append_new(result, _build_binding_json(&saved[index]));
+    ZG_VAR_FREE(saved);
+    return result;
+}
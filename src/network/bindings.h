@@ -0,0 +1,77 @@
+#ifndef ZG_BINDINGS_H
+#define ZG_BINDINGS_H
+
+#include <stdint.h>
+#include <jansson.h>
+#include "device.h"
+
+/**
+ * \brief Binding destinations : a device endpoint, a group, or the gateway
+ * itself (e.g. to receive attribute reports)
+ */
+typedef enum
+{
+    ZG_BINDINGS_TARGET_DEVICE,
+    ZG_BINDINGS_TARGET_GROUP,
+    ZG_BINDINGS_TARGET_GATEWAY
+} ZgBindingsTargetType;
+
+/**
+ * \brief Initialize the bindings module
+ *
+ * This module sends ZDO Bind and Unbind requests to devices, and saves
+ * accepted bindings in the device list. Binding tables of devices are
+ * periodically read back with paged Mgmt_Bind requests, and saved bindings
+ * missing from a device table are sent again
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_bindings_init(void);
+
+/**
+ * \brief Terminate the bindings module
+ */
+void zg_bindings_shutdown(void);
+
+/**
+ * \brief Start periodic reconciliation of binding tables. Must be called once
+ * the network stack is up
+ */
+void zg_bindings_start(void);
+
+/**
+ * \brief Ask a device to bind one of its clusters to a destination
+ * \param id The device holding the binding
+ * \param endpoint The device endpoint holding the cluster
+ * \param cluster The bound cluster
+ * \param type The destination type
+ * \param target The destination device id or group id, unused for gateway
+ * \param target_endpoint The destination device endpoint, only used for
+ * devices
+ * \return 0 if request has been queued, otherwise 1
+ */
+uint8_t zg_bindings_bind(DeviceId id, uint8_t endpoint, uint16_t cluster,
+        ZgBindingsTargetType type, uint16_t target, uint8_t target_endpoint);
+
+/**
+ * \brief Ask a device to remove a binding. Parameters are the same as the
+ * ones given to zg_bindings_bind
+ * \return 0 if request has been queued, otherwise 1
+ */
+uint8_t zg_bindings_unbind(DeviceId id, uint8_t endpoint, uint16_t cluster,
+        ZgBindingsTargetType type, uint16_t target, uint8_t target_endpoint);
+
+/**
+ * \brief Read back binding tables of all devices with saved bindings right
+ * away, and restore missing bindings
+ * \return 0 if reconciliation has been started, 1 if one is already running
+ */
+uint8_t zg_bindings_refresh(void);
+
+/**
+ * \brief Export saved bindings of a device as a JSON array
+ * \param id The device id
+ * \return A new JSON array (to be released with json_decref), or NULL
+ */
+json_t *zg_bindings_get_json(DeviceId id);
+
+#endif
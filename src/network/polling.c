@@ -0,0 +1,524 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <uv.h>
+#include <Eina.h>
+#include "polling.h"
+#include "zha.h"
+#include "conf.h"
+#include "worker.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *    Constants and macros      *
+ *******************************/
+
+#define POLL_NB_INDENT                  4
+/* Poll file saves go through the same worker so that they are written in order */
+#define POLL_WORKER_KEY                 2
+#define POLL_TICK_MS                    1000
+#define POLL_WHEEL_SLOTS                64
+/* A poll is due within the last eighth of its interval, in the least loaded
+ * slot */
+#define POLL_SPREAD_DIVIDER             8
+#define POLL_DEFAULT_MIN_INTERVAL_S     60
+#define POLL_DEFAULT_MAX_INTERVAL_S     900
+#define POLL_DEFAULT_READS_RATE         2
+#define POLL_MAX_ATTRIBUTES             16
+/* Only the beginning of longer read attributes responses is compared */
+#define POLL_MAX_RECORDS_LEN            64
+
+#define POLL_KEY(id, cluster)           (((uint32_t)(id) << 16) | (cluster))
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    DeviceId id;
+    uint16_t cluster;
+    uint16_t attributes[POLL_MAX_ATTRIBUTES];
+    uint8_t nb_attributes;
+    uint32_t min_interval;
+    uint32_t max_interval;
+    /* Current interval, in seconds */
+    uint32_t interval;
+    /* Wheel slot holding the poll, -1 if it is not scheduled */
+    int slot;
+    /* Wheel turns to wait before the poll is due */
+    uint32_t rounds;
+    /* Poll is due and waits for airtime */
+    uint8_t ready;
+    uint8_t records[POLL_MAX_RECORDS_LEN];
+    int records_len;
+} PollTarget;
+
+typedef struct
+{
+    json_t *root;
+    const char *path;
+    int status;
+} PollSave;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uint8_t _started = 0;
+/* Polls descriptions, as loaded from or saved to poll file */
+static json_t *_polls = NULL;
+/* PollTarget, indexed by device and cluster */
+static Eina_Hash *_targets = NULL;
+static Eina_List *_wheel[POLL_WHEEL_SLOTS];
+static int _current_slot = 0;
+/* Due polls, oldest first */
+static Eina_List *_ready = NULL;
+static int _reads_rate = POLL_DEFAULT_READS_RATE;
+static uv_timer_t _timer;
+
+/********************************
+ *          Timer wheel         *
+ *******************************/
+
+static void _unschedule(PollTarget *target)
+{
+    if(target->slot >= 0)
+        _wheel[target->slot] = eina_list_remove(_wheel[target->slot], target);
+    target->slot = -1;
+    if(target->ready)
+        _ready = eina_list_remove(_ready, target);
+    target->ready = 0;
+}
+
+/* Poll is placed in the least loaded slot between min_delay and max_delay
+ * seconds from now, the latest one on equal load */
+static void _schedule(PollTarget *target, uint32_t min_delay, uint32_t max_delay)
+{
+    uint32_t delay = 0;
+    uint32_t best = 0;
+    unsigned int load = 0;
+    unsigned int best_load = UINT_MAX;
+
+    _unschedule(target);
+    if(min_delay < 1)
+        min_delay = 1;
+    if(max_delay < min_delay)
+        max_delay = min_delay;
+    /* Delays a wheel turn apart share the same slot */
+    if(max_delay - min_delay >= POLL_WHEEL_SLOTS)
+        min_delay = max_delay - POLL_WHEEL_SLOTS + 1;
+
+    for(delay = max_delay; delay >= min_delay; delay--)
+    {
+        load = eina_list_count(_wheel[(_current_slot + delay) % POLL_WHEEL_SLOTS]);
+        if(load < best_load)
+        {
+            best_load = load;
+            best = delay;
+        }
+    }
+
+    target->slot = (_current_slot + best) % POLL_WHEEL_SLOTS;
+    target->rounds = (best - 1) / POLL_WHEEL_SLOTS;
+    _wheel[target->slot] = eina_list_append(_wheel[target->slot], target);
+}
+
+static void _schedule_next(PollTarget *target)
+{
+    _schedule(target, target->interval - target->interval / POLL_SPREAD_DIVIDER, target->interval);
+}
+
+static void _send_read(PollTarget *target)
+{
+    uint16_t addr = zg_device_get_short_addr(target->id);
+    int endpoint = zg_device_zha_endpoint_get(addr);
+
+    if(endpoint < 0)
+    {
+        WRN("Cannot poll device %d : device has no ZHA endpoint", target->id);
+        return;
+    }
+
+    DBG("Polling cluster 0x%04X of device %d", target->cluster, target->id);
+    if(zg_zha_read_attributes(addr, endpoint, target->cluster, target->attributes, target->nb_attributes) == -1)
+        WRN("Cannot poll cluster 0x%04X of device %d", target->cluster, target->id);
+}
+
+static void _tick_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    Eina_List *l = NULL;
+    Eina_List *l_next = NULL;
+    PollTarget *target = NULL;
+    int nb_reads = 0;
+
+    _current_slot = (_current_slot + 1) % POLL_WHEEL_SLOTS;
+    EINA_LIST_FOREACH_SAFE(_wheel[_current_slot], l, l_next, target)
+    {
+        if(target->rounds > 0)
+        {
+            target->rounds--;
+            continue;
+        }
+        _wheel[_current_slot] = eina_list_remove_list(_wheel[_current_slot], l);
+        target->slot = -1;
+        target->ready = 1;
+        _ready = eina_list_append(_ready, target);
+    }
+
+    /* Unused airtime is not saved up, it would allow bursts */
+    while(_ready && nb_reads < _reads_rate)
+    {
+        target = eina_list_data_get(_ready);
+        _ready = eina_list_remove_list(_ready, _ready);
+        target->ready = 0;
+        _send_read(target);
+        _schedule_next(target);
+        nb_reads++;
+    }
+    if(_ready)
+        DBG("%d polls are waiting for airtime", eina_list_count(_ready));
+}
+
+static Eina_Bool _schedule_first_cb(const Eina_Hash *hash __attribute__((unused)),
+        const void *key __attribute__((unused)), void *data, void *fdata __attribute__((unused)))
+{
+    PollTarget *target = data;
+
+    /* Polls loaded together are spread over their whole interval */
+    _schedule(target, 1, target->interval);
+    return EINA_TRUE;
+}
+
+/********************************
+ *       Values processing      *
+ *******************************/
+
+static void _attributes_cb(uint16_t addr, uint16_t cluster, uint8_t reported, uint8_t *records, int len)
+{
+    uint32_t key = POLL_KEY(zg_device_get_id(addr), cluster);
+    PollTarget *target = NULL;
+    int records_len = len < POLL_MAX_RECORDS_LEN ? len : POLL_MAX_RECORDS_LEN;
+
+    if(!_targets)
+        return;
+    target = eina_hash_find(_targets, &key);
+    if(!target)
+        return;
+
+    if(reported)
+    {
+        /* Cluster reports by itself, polls only check that device is alive */
+        target->interval = target->max_interval;
+    }
+    else if(records_len != target->records_len || memcmp(records, target->records, records_len) != 0)
+    {
+        target->interval = target->min_interval;
+        memcpy(target->records, records, records_len);
+        target->records_len = records_len;
+    }
+    else
+    {
+        target->interval *= 2;
+        if(target->interval > target->max_interval)
+            target->interval = target->max_interval;
+    }
+
+    DBG("Cluster 0x%04X of device %d will be polled in %u s", cluster, target->id, target->interval);
+    if(_started)
+        _schedule_next(target);
+}
+
+/********************************
+ *       Polls compilation      *
+ *******************************/
+
+static void _free_target(void *data)
+{
+    PollTarget *target = data;
+
+    _unschedule(target);
+    free(target);
+}
+
+static uint32_t _get_interval(json_t *poll, const char *name, uint32_t default_value)
+{
+    json_int_t value = json_integer_value(json_object_get(poll, name));
+
+    return value > 0 ? (uint32_t)value : default_value;
+}
+
+/* Returns NULL if poll is malformed */
+static PollTarget *_compile_poll(json_t *poll)
+{
+    json_t *attributes = json_object_get(poll, "attributes");
+    json_t *attribute = NULL;
+    PollTarget *target = NULL;
+    size_t index;
+
+    if(!json_is_integer(json_object_get(poll, "device"))
+            || !json_is_integer(json_object_get(poll, "cluster"))
+            || !json_is_array(attributes)
+            || json_array_size(attributes) == 0
+            || json_array_size(attributes) > POLL_MAX_ATTRIBUTES)
+    {
+        ERR("Poll is not properly formatted");
+        return NULL;
+    }
+
+    target = calloc(1, sizeof(PollTarget));
+    if(!target)
+    {
+        CRI("Cannot allocate memory for poll");
+        return NULL;
+    }
+
+    target->id = json_integer_value(json_object_get(poll, "device"));
+    target->cluster = json_integer_value(json_object_get(poll, "cluster"));
+    json_array_foreach(attributes, index, attribute)
+        target->attributes[index] = json_integer_value(attribute);
+    target->nb_attributes = json_array_size(attributes);
+    target->min_interval = _get_interval(poll, "min_interval", POLL_DEFAULT_MIN_INTERVAL_S);
+    target->max_interval = _get_interval(poll, "max_interval", POLL_DEFAULT_MAX_INTERVAL_S);
+    if(target->max_interval < target->min_interval)
+        target->max_interval = target->min_interval;
+    target->interval = target->min_interval;
+    target->slot = -1;
+    return target;
+}
+
+static void _add_target(PollTarget *target)
+{
+    uint32_t key = POLL_KEY(target->id, target->cluster);
+
+    eina_hash_del_by_key(_targets, &key);
+    eina_hash_add(_targets, &key, target);
+    if(_started)
+        _schedule(target, 1, target->interval);
+}
+
+/********************************
+ *       Poll file storage      *
+ *******************************/
+
+static void _load_polls(void)
+{
+    const char *path = zg_conf_get_poll_path();
+    PollTarget *target = NULL;
+    json_t *root = NULL;
+    json_t *poll = NULL;
+    json_error_t error;
+    size_t index;
+
+    _polls = json_array();
+    if(!path)
+    {
+        INF("No poll file configured");
+        return;
+    }
+
+    root = json_load_file(path, 0, &error);
+    if(!root)
+    {
+        WRN("Cannot load polls from file %s : [%s] l.%d c.%d : %s",
+            path, error.source, error.line, error.column, error.text);
+        return;
+    }
+    if(json_is_array(json_object_get(root, "polls")))
+        json_array_extend(_polls, json_object_get(root, "polls"));
+    else
+        ERR("Cannot get polls array from poll file");
+    json_decref(root);
+
+    json_array_foreach(_polls, index, poll)
+    {
+        target = _compile_poll(poll);
+        if(target)
+            _add_target(target);
+    }
+}
+
+/* Run on a worker thread, the JSON tree being owned by the save job */
+static void _save_polls_work(void *data)
+{
+    PollSave *save = data;
+
+    save->status = json_dump_file(save->root, save->path, JSON_INDENT(POLL_NB_INDENT));
+}
+
+static void _save_polls_done(void *data)
+{
+    PollSave *save = data;
+
+    if(save->status)
+        ERR("Cannot save polls in file %s", save->path);
+    json_decref(save->root);
+    free(save);
+}
+
+static void _save_polls(void)
+{
+    PollSave *save = NULL;
+
+    if(!zg_conf_get_poll_path())
+    {
+        WRN("No poll file configured, polls will be lost on exit");
+        return;
+    }
+
+    save = calloc(1, sizeof(PollSave));
+    if(!save)
+    {
+        CRI("Cannot allocate memory to save polls");
+        return;
+    }
+    save->root = json_object();
+    json_object_set_new(save->root, "polls", json_deep_copy(_polls));
+    save->path = zg_conf_get_poll_path();
+    if(zg_worker_submit(POLL_WORKER_KEY, _save_polls_work, _save_polls_done, save) != 0)
+    {
+        save->status = -1;
+        _save_polls_done(save);
+    }
+}
+
+static int _find_poll(DeviceId id, uint16_t cluster)
+{
+    json_t *poll = NULL;
+    size_t index;
+
+    json_array_foreach(_polls, index, poll)
+    {
+        if(json_integer_value(json_object_get(poll, "device")) == id &&
+                json_integer_value(json_object_get(poll, "cluster")) == cluster)
+            return index;
+    }
+    return -1;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_polling_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_polling", ZG_COLOR_LIGHTBLUE);
+    _reads_rate = zg_conf_get_poll_max_reads_rate() > 0 ?
+        zg_conf_get_poll_max_reads_rate() : POLL_DEFAULT_READS_RATE;
+    _targets = eina_hash_int32_new(_free_target);
+    if(!_targets)
+    {
+        CRI("Cannot allocate polls table");
+        return 1;
+    }
+    memset(_wheel, 0, sizeof(_wheel));
+    _current_slot = 0;
+    _load_polls();
+    zg_zha_register_attributes_cb(_attributes_cb);
+    INF("Polling module initialized (%d polls, %d reads per second)",
+            eina_hash_population(_targets), _reads_rate);
+    return 0;
+}
+
+void zg_polling_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    zg_zha_register_attributes_cb(NULL);
+    if(_started)
+    {
+        uv_timer_stop(&_timer);
+        uv_close((uv_handle_t *)&_timer, NULL);
+        _started = 0;
+    }
+    if(_targets)
+        eina_hash_free(_targets);
+    _targets = NULL;
+    json_decref(_polls);
+    _polls = NULL;
+    INF("Polling module shut down");
+}
+
+void zg_polling_start(void)
+{
+    if(_started || !_targets)
+        return;
+
+    _started = 1;
+    eina_hash_foreach(_targets, _schedule_first_cb, NULL);
+    uv_timer_init(uv_default_loop(), &_timer);
+    uv_timer_start(&_timer, _tick_cb, POLL_TICK_MS, POLL_TICK_MS);
+}
+
+uint8_t zg_polling_add(json_t *poll)
+{
+    PollTarget *target = NULL;
+    int index = -1;
+
+    if(!_polls || !_targets)
+        return 1;
+
+    target = _compile_poll(poll);
+    if(!target)
+        return 1;
+
+    index = _find_poll(target->id, target->cluster);
+    if(index >= 0)
+        json_array_set(_polls, index, poll);
+    else
+        json_array_append(_polls, poll);
+    INF("Poll of cluster 0x%04X of device %d %s", target->cluster, target->id,
+            index >= 0 ? "replaced" : "added");
+    _add_target(target);
+    _save_polls();
+    return 0;
+}
+
+uint8_t zg_polling_remove(DeviceId id, uint16_t cluster)
+{
+    uint32_t key = POLL_KEY(id, cluster);
+    int index = -1;
+
+    if(!_polls || !_targets)
+        return 1;
+
+    index = _find_poll(id, cluster);
+    if(index < 0)
+    {
+        WRN("Cannot remove poll of cluster 0x%04X of device %d : poll is unknown", cluster, id);
+        return 1;
+    }
+    json_array_remove(_polls, index);
+    eina_hash_del_by_key(_targets, &key);
+    INF("Poll of cluster 0x%04X of device %d removed", cluster, id);
+    _save_polls();
+    return 0;
+}
+
+json_t *zg_polling_get_json(void)
+{
+    json_t *result = json_array();
+    json_t *poll = NULL;
+    json_t *entry = NULL;
+    PollTarget *target = NULL;
+    uint32_t key = 0;
+    size_t index;
+
+    if(!_polls)
+        return result;
+
+    json_array_foreach(_polls, index, poll)
+    {
+        entry = json_deep_copy(poll);
+        key = POLL_KEY(json_integer_value(json_object_get(poll, "device")),
+                json_integer_value(json_object_get(poll, "cluster")));
+        target = _targets ? eina_hash_find(_targets, &key) : NULL;
+        if(target)
+            json_object_set_new(entry, "interval", json_integer(target->interval));
+        json_array_append_new(result, entry);
+    }
+    return result;
+}
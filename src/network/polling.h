@@ -0,0 +1,69 @@
+#ifndef ZG_POLLING_H
+#define ZG_POLLING_H
+
+#include <stdint.h>
+#include <jansson.h>
+#include "device.h"
+
+/**
+ * \brief Attributes polling of devices which do not report them
+ *
+ * Polls are loaded from the poll file. Each poll reads some attributes of a
+ * device cluster in a single Read Attributes request, at an interval which
+ * adapts to the values read : it is reset to the minimal interval when values
+ * change, and doubled up to the maximal interval when they do not. Polls are
+ * kept in a timer wheel with one second slots, and spread over the least
+ * loaded slots so that polls do not come in bursts. A cluster reporting its
+ * attributes by itself is only polled at the maximal interval. All requests
+ * share a global airtime budget, set as a number of requests per second.
+ *
+ * A poll is described in JSON as follows :
+ * {
+ *   "device": 2,
+ *   "cluster": 1026,
+ *   "attributes": [0],
+ *   "min_interval": 60,
+ *   "max_interval": 900
+ * }
+ * Intervals are given in seconds.
+ */
+
+/**
+ * \brief Load polls from poll file
+ * \return 0 if poll module is initialized, otherwise 1
+ */
+int zg_polling_init(void);
+
+/**
+ * \brief Stop polling and free all polls
+ */
+void zg_polling_shutdown(void);
+
+/**
+ * \brief Start polling devices. Must be called once the network stack is up
+ */
+void zg_polling_start(void);
+
+/**
+ * \brief Add a new poll, or replace the poll of the same device and cluster.
+ * Poll file is updated accordingly
+ * \param poll The JSON description of the poll
+ * \return 0 if poll has been added, otherwise 1
+ */
+uint8_t zg_polling_add(json_t *poll);
+
+/**
+ * \brief Remove a poll. Poll file is updated accordingly
+ * \param id The polled device
+ * \param cluster The polled cluster
+ * \return 0 if poll has been removed, otherwise 1
+ */
+uint8_t zg_polling_remove(DeviceId id, uint16_t cluster);
+
+/**
+ * \brief Get all polls, with their current interval
+ * \return A new JSON array containing all polls descriptions
+ */
+json_t *zg_polling_get_json(void);
+
+#endif
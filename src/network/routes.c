@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <Eina.h>
+#include "routes.h"
+#include "mt_af.h"
+#include "mt_zdo.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+/* Longest source route supported by ZNP */
+#define ROUTES_MAX_RELAY_COUNT      12
+
+/* A route which has not been refreshed by a route record for this duration is
+ * not trusted anymore. Route records are sent again by remote devices after
+ * each many-to-one route request, so this has to be larger than the
+ * concentrator discovery period */
+#define ROUTES_EXPIRY_S             (60 * 60)
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    int dst_addr;
+    uint8_t relay_count;
+    uint16_t relays[ROUTES_MAX_RELAY_COUNT];
+    time_t last_update;
+} SourceRoute;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static Eina_Hash *_routes = NULL;
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static SourceRoute *_find_route(uint16_t dst_addr)
+{
+    int key = dst_addr;
+    SourceRoute *route = NULL;
+
+    if(!_routes)
+        return NULL;
+
+    route = eina_hash_find(_routes, &key);
+    if(route && time(NULL) - route->last_update > ROUTES_EXPIRY_S)
+    {
+        DBG("Source route to 0x%04X has expired", dst_addr);
+        eina_hash_del_by_key(_routes, &key);
+        route = NULL;
+    }
+    return route;
+}
+
+static void _src_rtg_ind_cb(uint16_t dst_addr, uint8_t relay_count, uint16_t *relays)
+{
+    int key = dst_addr;
+    SourceRoute *route = NULL;
+
+    if(relay_count > ROUTES_MAX_RELAY_COUNT)
+    {
+        WRN("Source route to 0x%04X is too long (%d relays), ignoring it", dst_addr, relay_count);
+        return;
+    }
+
+    route = eina_hash_find(_routes, &key);
+    if(!route)
+    {
+        route = calloc(1, sizeof(SourceRoute));
+        if(!route)
+        {
+            CRI("Cannot allocate memory for new source route");
+            return;
+        }
+        route->dst_addr = key;
+        eina_hash_add(_routes, &route->dst_addr, route);
+    }
+
+    route->relay_count = relay_count;
+    if(relay_count)
+        memcpy(route->relays, relays, relay_count * sizeof(uint16_t));
+    route->last_update = time(NULL);
+    DBG("Source route to 0x%04X updated (%d relays)", dst_addr, relay_count);
+}
+
+static void _src_rtg_error_cb(uint16_t dst_addr)
+{
+    WRN("Source route to 0x%04X failed, falling back on network routing", dst_addr);
+    zg_routes_invalidate(dst_addr);
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_routes_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_routes", ZG_COLOR_LIGHTGREEN);
+    _routes = eina_hash_int32_new(free);
+    if(!_routes)
+    {
+        CRI("Cannot create source routes table");
+        _init_count--;
+        return 1;
+    }
+    zg_mt_zdo_register_src_rtg_ind_cb(_src_rtg_ind_cb);
+    zg_mt_af_register_src_rtg_error_callback(_src_rtg_error_cb);
+    INF("Routes module initialized");
+    return 0;
+}
+
+void zg_routes_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    zg_mt_zdo_register_src_rtg_ind_cb(NULL);
+    zg_mt_af_register_src_rtg_error_callback(NULL);
+    eina_hash_free(_routes);
+    _routes = NULL;
+    INF("Routes module shut down");
+}
+
+uint8_t zg_routes_get(uint16_t dst_addr, uint8_t *relay_count, uint16_t **relays)
+{
+    SourceRoute *route = _find_route(dst_addr);
+
+    if(!route || !relay_count || !relays)
+        return 1;
+
+    *relay_count = route->relay_count;
+    *relays = route->relays;
+    return 0;
+}
+
+void zg_routes_invalidate(uint16_t dst_addr)
+{
+    int key = dst_addr;
+
+    if(_routes)
+        eina_hash_del_by_key(_routes, &key);
+}
+
+void zg_routes_discover(uint16_t dst_addr, SyncActionCb cb)
+{
+    if(_find_route(dst_addr))
+    {
+        DBG("Source route to 0x%04X is already known, skipping route discovery", dst_addr);
+        if(cb)
+            cb();
+        return;
+    }
+    zg_mt_zdo_ext_route_disc_request(dst_addr, cb);
+}
@@ -0,0 +1,47 @@
+#ifndef ZG_ROUTES_H
+#define ZG_ROUTES_H
+
+#include <stdint.h>
+#include "types.h"
+
+/**
+ * \brief Initialize the source routes module
+ *
+ * This module caches the source routes reported by ZNP (ZDO_SRC_RTG_IND) for
+ * each destination, so that unicast messages can be sent along a known path
+ * instead of triggering a route discovery
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_routes_init(void);
+
+/**
+ * \brief Terminate the source routes module and drop all cached routes
+ */
+void zg_routes_shutdown(void);
+
+/**
+ * \brief Retrieve the cached source route to a device
+ * \param dst_addr The short address of the destination
+ * \param relay_count Filled with the number of relays of the route
+ * \param relays Filled with a pointer to the relay list, owned by the module.
+ * It is only valid until the next call to the module
+ * \return 0 if a valid route has been found, otherwise 1
+ */
+uint8_t zg_routes_get(uint16_t dst_addr, uint8_t *relay_count, uint16_t **relays);
+
+/**
+ * \brief Remove the cached source route to a device, if any
+ * \param dst_addr The short address of the destination
+ */
+void zg_routes_invalidate(uint16_t dst_addr);
+
+/**
+ * \brief Make sure a route to a device exists. A route discovery is only
+ * broadcast if no source route is known for this device
+ * \param dst_addr The short address of the destination
+ * \param cb The callback to trigger when route is known or discovery has been
+ * sent
+ */
+void zg_routes_discover(uint16_t dst_addr, SyncActionCb cb);
+
+#endif
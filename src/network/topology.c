@@ -0,0 +1,628 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <uv.h>
+#include <Eina.h>
+#include "topology.h"
+#include "mt_zdo.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define TOPOLOGY_COORDINATOR_ADDR           0x0000
+#define TOPOLOGY_MAX_VALID_ADDR             0xFFF7
+
+/* Number of routers queried at the same time */
+#define TOPOLOGY_MAX_PENDING_REQUESTS       2
+#define TOPOLOGY_REQUEST_TIMEOUT_MS         5000
+#define TOPOLOGY_REQUEST_MAX_RETRIES        2
+#define TOPOLOGY_REFRESH_INTERVAL_MS        (15 * 60 * 1000)
+
+/* A node which has not been seen during this number of crawls is removed */
+#define TOPOLOGY_MAX_MISSED_ROUNDS          3
+
+#define DEVICE_TYPE_COORDINATOR             0x0
+#define DEVICE_TYPE_ROUTER                  0x1
+#define DEVICE_TYPE_END_DEVICE              0x2
+#define DEVICE_TYPE_UNKNOWN                 0x3
+
+#define ROUTE_STATUS_ACTIVE                 0x0
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef enum
+{
+    TOPOLOGY_REQUEST_LQI,
+    TOPOLOGY_REQUEST_RTG,
+} TopologyRequestType;
+
+typedef struct
+{
+    uint16_t addr;
+    uint64_t ext_addr;
+    uint8_t device_type;
+    uint8_t relationship;
+    uint8_t depth;
+    uint8_t lqi;
+} TopologyLink;
+
+typedef struct
+{
+    uint16_t dst_addr;
+    uint16_t next_hop;
+    uint8_t status;
+} TopologyRoute;
+
+typedef struct
+{
+    uint16_t addr;
+    uint64_t ext_addr;
+    uint8_t device_type;
+    uint8_t depth;
+    unsigned int seen_round;
+    unsigned int queried_round;
+    time_t last_update;
+    Eina_List *links;
+    Eina_List *routes;
+    /* Tables being collected page after page */
+    Eina_List *next_links;
+    Eina_List *next_routes;
+} TopologyNode;
+
+typedef struct
+{
+    TopologyRequestType type;
+    uint16_t addr;
+    uint8_t start_index;
+    uint8_t retries;
+    uv_timer_t timer;
+} TopologyRequest;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static Eina_List *_nodes = NULL;
+static Eina_List *_pending_requests = NULL;
+static Eina_List *_in_flight_requests = NULL;
+static unsigned int _round = 0;
+static uint8_t _started = 0;
+static uv_timer_t _refresh_timer;
+
+static const char *_device_type_strings[] = {"coordinator", "router", "end_device", "unknown"};
+static const char *_relationship_strings[] = {"parent", "child", "sibling", "none", "previous_child"};
+static const char *_route_status_strings[] = {"active", "discovery_underway", "discovery_failed", "inactive", "validation_underway"};
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static const char *_string_from_table(const char **table, size_t size, uint8_t value)
+{
+    return value < size ? table[value] : "unknown";
+}
+
+#define DEVICE_TYPE_STR(x)      _string_from_table(_device_type_strings, sizeof(_device_type_strings)/sizeof(char *), x)
+#define RELATIONSHIP_STR(x)     _string_from_table(_relationship_strings, sizeof(_relationship_strings)/sizeof(char *), x)
+#define ROUTE_STATUS_STR(x)     _string_from_table(_route_status_strings, sizeof(_route_status_strings)/sizeof(char *), x)
+
+static Eina_List *_free_entries(Eina_List *list)
+{
+    void *entry = NULL;
+    EINA_LIST_FREE(list, entry)
+        free(entry);
+    return NULL;
+}
+
+static void _destroy_node(TopologyNode *node)
+{
+    if(!node)
+        return;
+    node->links = _free_entries(node->links);
+    node->routes = _free_entries(node->routes);
+    node->next_links = _free_entries(node->next_links);
+    node->next_routes = _free_entries(node->next_routes);
+    ZG_VAR_FREE(node);
+}
+
+static TopologyNode *_get_node(uint16_t addr)
+{
+    Eina_List *l = NULL;
+    TopologyNode *node = NULL;
+
+    EINA_LIST_FOREACH(_nodes, l, node)
+    {
+        if(node->addr == addr)
+            return node;
+    }
+    return NULL;
+}
+
+static TopologyNode *_get_or_add_node(uint16_t addr)
+{
+    TopologyNode *node = _get_node(addr);
+
+    if(node)
+        return node;
+
+    node = calloc(1, sizeof(TopologyNode));
+    if(!node)
+    {
+        CRI("Cannot allocate memory for new topology node");
+        return NULL;
+    }
+    node->addr = addr;
+    node->device_type = DEVICE_TYPE_UNKNOWN;
+    _nodes = eina_list_append(_nodes, node);
+    return node;
+}
+
+static void _prune_nodes(void)
+{
+    Eina_List *l = NULL, *l_next = NULL;
+    TopologyNode *node = NULL;
+
+    EINA_LIST_FOREACH_SAFE(_nodes, l, l_next, node)
+    {
+        if(node->addr != TOPOLOGY_COORDINATOR_ADDR &&
+                _round - node->seen_round >= TOPOLOGY_MAX_MISSED_ROUNDS)
+        {
+            INF("Device 0x%04X has not been seen for %d crawls, removing it from topology",
+                    node->addr, TOPOLOGY_MAX_MISSED_ROUNDS);
+            _nodes = eina_list_remove_list(_nodes, l);
+            _destroy_node(node);
+        }
+    }
+}
+
+/********************************
+ *       Requests management    *
+ *******************************/
+
+static void _send_pending_requests(void);
+
+static void _request_closed_cb(uv_handle_t *handle)
+{
+    TopologyRequest *request = handle->data;
+    ZG_VAR_FREE(request);
+}
+
+static void _release_request(TopologyRequest *request)
+{
+    _in_flight_requests = eina_list_remove(_in_flight_requests, request);
+    uv_timer_stop(&request->timer);
+    uv_close((uv_handle_t *)&request->timer, _request_closed_cb);
+}
+
+static TopologyRequest *_find_in_flight_request(TopologyRequestType type, uint16_t addr)
+{
+    Eina_List *l = NULL;
+    TopologyRequest *request = NULL;
+
+    EINA_LIST_FOREACH(_in_flight_requests, l, request)
+    {
+        if(request->type == type && request->addr == addr)
+            return request;
+    }
+    return NULL;
+}
+
+static TopologyRequest *_queue_request(TopologyRequestType type, uint16_t addr, uint8_t start_index, uint8_t urgent)
+{
+    TopologyRequest *request = calloc(1, sizeof(TopologyRequest));
+
+    if(!request)
+    {
+        CRI("Cannot allocate memory for topology request");
+        return NULL;
+    }
+    request->type = type;
+    request->addr = addr;
+    request->start_index = start_index;
+
+    /* Next pages of a table being read are sent before any new router */
+    if(urgent)
+        _pending_requests = eina_list_prepend(_pending_requests, request);
+    else
+        _pending_requests = eina_list_append(_pending_requests, request);
+    return request;
+}
+
+static void _crawl_finished(void)
+{
+    _prune_nodes();
+    INF("Network topology crawl finished (%d nodes known)", eina_list_count(_nodes));
+}
+
+static void _request_timeout_cb(uv_timer_t *timer)
+{
+    TopologyRequest *request = timer->data;
+    TopologyRequest *retry = NULL;
+    TopologyNode *node = _get_node(request->addr);
+
+    if(request->retries < TOPOLOGY_REQUEST_MAX_RETRIES)
+    {
+        WRN("No answer from device 0x%04X to %s request, retrying", request->addr,
+                request->type == TOPOLOGY_REQUEST_LQI ? "neighbor table":"routing table");
+        retry = _queue_request(request->type, request->addr, request->start_index, 1);
+        if(retry)
+            retry->retries = request->retries + 1;
+    }
+    else
+    {
+        WRN("Device 0x%04X did not answer to %s request, giving up", request->addr,
+                request->type == TOPOLOGY_REQUEST_LQI ? "neighbor table":"routing table");
+        /* Keep previously known tables, drop partial ones */
+        if(node && request->type == TOPOLOGY_REQUEST_LQI)
+            node->next_links = _free_entries(node->next_links);
+        else if(node)
+            node->next_routes = _free_entries(node->next_routes);
+    }
+
+    _release_request(request);
+    _send_pending_requests();
+}
+
+static void _send_pending_requests(void)
+{
+    TopologyRequest *request = NULL;
+
+    while(_pending_requests && eina_list_count(_in_flight_requests) < TOPOLOGY_MAX_PENDING_REQUESTS)
+    {
+        request = eina_list_data_get(_pending_requests);
+        _pending_requests = eina_list_remove_list(_pending_requests, _pending_requests);
+        _in_flight_requests = eina_list_append(_in_flight_requests, request);
+
+        uv_timer_init(uv_default_loop(), &request->timer);
+        request->timer.data = request;
+        uv_timer_start(&request->timer, _request_timeout_cb, TOPOLOGY_REQUEST_TIMEOUT_MS, 0);
+
+        if(request->type == TOPOLOGY_REQUEST_LQI)
+            zg_mt_zdo_mgmt_lqi_request(request->addr, request->start_index, NULL);
+        else
+            zg_mt_zdo_mgmt_rtg_request(request->addr, request->start_index, NULL);
+    }
+
+    if(!_pending_requests && !_in_flight_requests)
+        _crawl_finished();
+}
+
+static void _query_node(TopologyNode *node)
+{
+    if(!node || node->queried_round == _round)
+        return;
+
+    node->queried_round = _round;
+    _queue_request(TOPOLOGY_REQUEST_LQI, node->addr, 0, 0);
+    _queue_request(TOPOLOGY_REQUEST_RTG, node->addr, 0, 0);
+}
+
+/********************************
+ *     ZDO responses callbacks  *
+ *******************************/
+
+static void _discover_neighbors(TopologyNode *node)
+{
+    Eina_List *l = NULL;
+    TopologyLink *link = NULL;
+    TopologyNode *neighbor = NULL;
+
+    EINA_LIST_FOREACH(node->links, l, link)
+    {
+        neighbor = _get_or_add_node(link->addr);
+        if(!neighbor)
+            continue;
+
+        neighbor->seen_round = _round;
+        neighbor->ext_addr = link->ext_addr;
+        neighbor->device_type = link->device_type;
+        neighbor->depth = link->depth;
+
+        /* Only routers hold neighbor and routing tables */
+        if(link->device_type == DEVICE_TYPE_ROUTER ||
+                link->device_type == DEVICE_TYPE_COORDINATOR)
+            _query_node(neighbor);
+    }
+}
+
+static void _mgmt_lqi_rsp_cb(uint16_t src_addr, uint8_t status, uint8_t total, uint8_t start_index, uint8_t count, ZgMtZdoNeighbor *neighbors)
+{
+    TopologyRequest *request = _find_in_flight_request(TOPOLOGY_REQUEST_LQI, src_addr);
+    TopologyNode *node = NULL;
+    TopologyLink *link = NULL;
+    uint8_t index = 0;
+
+    if(!request)
+    {
+        DBG("Ignoring unsolicited neighbor table from 0x%04X", src_addr);
+        return;
+    }
+    _release_request(request);
+
+    node = _get_or_add_node(src_addr);
+    if(!node)
+        goto lqi_rsp_end;
+
+    node->seen_round = _round;
+    if(status != ZSUCCESS)
+    {
+        node->next_links = _free_entries(node->next_links);
+        goto lqi_rsp_end;
+    }
+
+    for(index = 0; index < count; index++)
+    {
+        if(neighbors[index].nwk_addr > TOPOLOGY_MAX_VALID_ADDR)
+            continue;
+        link = calloc(1, sizeof(TopologyLink));
+        if(!link)
+        {
+            CRI("Cannot allocate memory for topology link");
+            break;
+        }
+        link->addr = neighbors[index].nwk_addr;
+        link->ext_addr = neighbors[index].ext_addr;
+        link->device_type = neighbors[index].device_type;
+        link->relationship = neighbors[index].relationship;
+        link->depth = neighbors[index].depth;
+        link->lqi = neighbors[index].lqi;
+        node->next_links = eina_list_append(node->next_links, link);
+    }
+
+    if(count > 0 && start_index + count < total)
+    {
+        _queue_request(TOPOLOGY_REQUEST_LQI, src_addr, start_index + count, 1);
+    }
+    else
+    {
+        _free_entries(node->links);
+        node->links = node->next_links;
+        node->next_links = NULL;
+        node->last_update = time(NULL);
+        DBG("Neighbor table of device 0x%04X updated (%d entries)", src_addr, eina_list_count(node->links));
+        _discover_neighbors(node);
+    }
+
+lqi_rsp_end:
+    _send_pending_requests();
+}
+
+static void _mgmt_rtg_rsp_cb(uint16_t src_addr, uint8_t status, uint8_t total, uint8_t start_index, uint8_t count, ZgMtZdoRoute *routes)
+{
+    TopologyRequest *request = _find_in_flight_request(TOPOLOGY_REQUEST_RTG, src_addr);
+    TopologyNode *node = NULL;
+    TopologyRoute *route = NULL;
+    uint8_t index = 0;
+
+    if(!request)
+    {
+        DBG("Ignoring unsolicited routing table from 0x%04X", src_addr);
+        return;
+    }
+    _release_request(request);
+
+    node = _get_or_add_node(src_addr);
+    if(!node)
+        goto rtg_rsp_end;
+
+    node->seen_round = _round;
+    if(status != ZSUCCESS)
+    {
+        node->next_routes = _free_entries(node->next_routes);
+        goto rtg_rsp_end;
+    }
+
+    for(index = 0; index < count; index++)
+    {
+        route = calloc(1, sizeof(TopologyRoute));
+        if(!route)
+        {
+            CRI("Cannot allocate memory for topology route");
+            break;
+        }
+        route->dst_addr = routes[index].dst_addr;
+        route->next_hop = routes[index].next_hop;
+        route->status = routes[index].status;
+        node->next_routes = eina_list_append(node->next_routes, route);
+    }
+
+    if(count > 0 && start_index + count < total)
+    {
+        _queue_request(TOPOLOGY_REQUEST_RTG, src_addr, start_index + count, 1);
+    }
+    else
+    {
+        _free_entries(node->routes);
+        node->routes = node->next_routes;
+        node->next_routes = NULL;
+        DBG("Routing table of device 0x%04X updated (%d entries)", src_addr, eina_list_count(node->routes));
+    }
+
+rtg_rsp_end:
+    _send_pending_requests();
+}
+
+static void _refresh_timer_cb(uv_timer_t *timer __attribute__((unused)))
+{
+    zg_topology_refresh();
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_topology_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_topology", ZG_COLOR_LIGHTGREEN);
+    zg_mt_zdo_register_mgmt_lqi_rsp_cb(_mgmt_lqi_rsp_cb);
+    zg_mt_zdo_register_mgmt_rtg_rsp_cb(_mgmt_rtg_rsp_cb);
+    INF("Topology module initialized");
+    return 0;
+}
+
+void zg_topology_shutdown(void)
+{
+    TopologyNode *node = NULL;
+    TopologyRequest *request = NULL;
+
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(_started)
+    {
+        uv_timer_stop(&_refresh_timer);
+        uv_close((uv_handle_t *)&_refresh_timer, NULL);
+        _started = 0;
+    }
+    EINA_LIST_FREE(_pending_requests, request)
+        free(request);
+    while(_in_flight_requests)
+        _release_request(eina_list_data_get(_in_flight_requests));
+    EINA_LIST_FREE(_nodes, node)
+        _destroy_node(node);
+    zg_mt_zdo_register_mgmt_lqi_rsp_cb(NULL);
+    zg_mt_zdo_register_mgmt_rtg_rsp_cb(NULL);
+    INF("Topology module shut down");
+}
+
+void zg_topology_start(void)
+{
+    if(_started)
+        return;
+
+    uv_timer_init(uv_default_loop(), &_refresh_timer);
+    uv_timer_start(&_refresh_timer, _refresh_timer_cb, 0, TOPOLOGY_REFRESH_INTERVAL_MS);
+    _started = 1;
+}
+
+uint8_t zg_topology_refresh(void)
+{
+    TopologyNode *coordinator = NULL;
+
+    if(_pending_requests || _in_flight_requests)
+    {
+        WRN("A topology crawl is already in progress");
+        return 1;
+    }
+
+    _round++;
+    INF("Starting network topology crawl #%u", _round);
+    coordinator = _get_or_add_node(TOPOLOGY_COORDINATOR_ADDR);
+    if(!coordinator)
+        return 1;
+    coordinator->device_type = DEVICE_TYPE_COORDINATOR;
+    coordinator->seen_round = _round;
+    _query_node(coordinator);
+    _send_pending_requests();
+    return 0;
+}
+
+json_t *zg_topology_get_json(void)
+{
+    Eina_List *l = NULL, *l_entry = NULL;
+    TopologyNode *node = NULL;
+    TopologyLink *link = NULL;
+    TopologyRoute *route = NULL;
+    json_t *root = NULL, *nodes = NULL, *entries = NULL, *entry = NULL, *json_node = NULL;
+
+    nodes = json_array();
+    EINA_LIST_FOREACH(_nodes, l, node)
+    {
+        json_node = json_object();
+        json_object_set_new(json_node, "addr", json_integer(node->addr));
+        json_object_set_new(json_node, "ext_addr", json_integer(node->ext_addr));
+        json_object_set_new(json_node, "type", json_string(DEVICE_TYPE_STR(node->device_type)));
+        json_object_set_new(json_node, "depth", json_integer(node->depth));
+        json_object_set_new(json_node, "last_update", json_integer(node->last_update));
+
+        entries = json_array();
+        EINA_LIST_FOREACH(node->links, l_entry, link)
+        {
+            entry = json_object();
+            json_object_set_new(entry, "addr", json_integer(link->addr));
+            json_object_set_new(entry, "lqi", json_integer(link->lqi));
+            json_object_set_new(entry, "relationship", json_string(RELATIONSHIP_STR(link->relationship)));
+            json_array_append_new(entries, entry);
+        }
+        json_object_set_new(json_node, "neighbors", entries);
+
+        entries = json_array();
+        EINA_LIST_FOREACH(node->routes, l_entry, route)
+        {
+            entry = json_object();
+            json_object_set_new(entry, "dst", json_integer(route->dst_addr));
+            json_object_set_new(entry, "next_hop", json_integer(route->next_hop));
+            json_object_set_new(entry, "status", json_string(ROUTE_STATUS_STR(route->status)));
+            json_array_append_new(entries, entry);
+        }
+        json_object_set_new(json_node, "routes", entries);
+        json_array_append_new(nodes, json_node);
+    }
+
+    root = json_object();
+    json_object_set_new(root, "round", json_integer(_round));
+    json_object_set_new(root, "nodes", nodes);
+    return root;
+}
+
+char *zg_topology_get_dot(void)
+{
+    Eina_List *l = NULL, *l_entry = NULL;
+    Eina_Strbuf *buf = NULL;
+    TopologyNode *node = NULL;
+    TopologyLink *link = NULL;
+    TopologyRoute *route = NULL;
+    char *result = NULL;
+    const char *shape = NULL;
+
+    buf = eina_strbuf_new();
+    if(!buf)
+    {
+        ERR("Cannot allocate buffer to export topology");
+        return NULL;
+    }
+
+    eina_strbuf_append(buf, "digraph zigbee {\n");
+    EINA_LIST_FOREACH(_nodes, l, node)
+    {
+        switch(node->device_type)
+        {
+            case DEVICE_TYPE_COORDINATOR:
+                shape = "doublecircle";
+                break;
+            case DEVICE_TYPE_ROUTER:
+                shape = "circle";
+                break;
+            default:
+                shape = "box";
+                break;
+        }
+        eina_strbuf_append_printf(buf, "    \"0x%04X\" [shape=%s];\n", node->addr, shape);
+    }
+    EINA_LIST_FOREACH(_nodes, l, node)
+    {
+        EINA_LIST_FOREACH(node->links, l_entry, link)
+        {
+            eina_strbuf_append_printf(buf, "    \"0x%04X\" -> \"0x%04X\" [label=\"%d\"];\n",
+                    node->addr, link->addr, link->lqi);
+        }
+        EINA_LIST_FOREACH(node->routes, l_entry, route)
+        {
+            if(route->status != ROUTE_STATUS_ACTIVE)
+                continue;
+            eina_strbuf_append_printf(buf, "    \"0x%04X\" -> \"0x%04X\" [style=dashed, label=\"to 0x%04X\"];\n",
+                    node->addr, route->next_hop, route->dst_addr);
+        }
+    }
+    eina_strbuf_append(buf, "}\n");
+
+    result = eina_strbuf_string_steal(buf);
+    eina_strbuf_free(buf);
+    return result;
+}
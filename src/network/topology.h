@@ -0,0 +1,46 @@
+#ifndef ZG_TOPOLOGY_H
+#define ZG_TOPOLOGY_H
+
+#include <stdint.h>
+#include <jansson.h>
+
+/**
+ * \brief Initialize the network topology module
+ *
+ * This module walks the routers of the network with paged Mgmt_Lqi and
+ * Mgmt_Rtg requests and keeps an in-memory graph of neighbors and routes
+ * \return 0 if initialization has passed properly, otherwise 1
+ */
+int zg_topology_init(void);
+
+/**
+ * \brief Terminate the network topology module and free the cached graph
+ */
+void zg_topology_shutdown(void);
+
+/**
+ * \brief Start crawling the network, and refresh the graph periodically.
+ * Must be called once the network stack is up
+ */
+void zg_topology_start(void);
+
+/**
+ * \brief Trigger a new crawl of the network right away. Already known nodes
+ * stay in the graph and are updated as fresh tables arrive
+ * \return 0 if the crawl has been started, 1 if a crawl is already running
+ */
+uint8_t zg_topology_refresh(void);
+
+/**
+ * \brief Export the cached graph as a JSON object
+ * \return A new JSON object (to be released with json_decref), or NULL
+ */
+json_t *zg_topology_get_json(void);
+
+/**
+ * \brief Export the cached graph in Graphviz DOT format
+ * \return A newly allocated string to be freed by the caller, or NULL
+ */
+char *zg_topology_get_dot(void);
+
+#endif
@@ -0,0 +1,573 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <uv.h>
+#include <Eina.h>
+#include "ota.h"
+#include "aps.h"
+#include "zcl.h"
+#include "conf.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define OTA_ENDPOINT                            0x3
+
+/********** Format **********/
+
+/* OTA Upgrade cluster commands */
+#define COMMAND_QUERY_NEXT_IMAGE_REQUEST        0x01
+#define COMMAND_QUERY_NEXT_IMAGE_RESPONSE       0x02
+#define COMMAND_IMAGE_BLOCK_REQUEST             0x03
+#define COMMAND_IMAGE_PAGE_REQUEST              0x04
+#define COMMAND_IMAGE_BLOCK_RESPONSE            0x05
+#define COMMAND_UPGRADE_END_REQUEST             0x06
+#define COMMAND_UPGRADE_END_RESPONSE            0x07
+
+/* ZCL status */
+#define STATUS_SUCCESS                          0x00
+#define STATUS_ABORT                            0x95
+#define STATUS_WAIT_FOR_DATA                    0x97
+#define STATUS_NO_IMAGE_AVAILABLE               0x98
+
+/* ZCL header */
+#define ZCL_HEADER_SIZE                         3
+#define INDEX_TRANS_SEQ_NUM                     1
+#define INDEX_COMMAND                           2
+
+/* Query Next Image Request format, after ZCL header */
+#define LEN_QUERY_NEXT_IMAGE_REQUEST            9
+#define INDEX_QUERY_MANUFACTURER                1
+#define INDEX_QUERY_IMAGE_TYPE                  3
+#define INDEX_QUERY_FILE_VERSION                5
+
+/* Image Block Request format, after ZCL header */
+#define LEN_IMAGE_BLOCK_REQUEST                 14
+#define INDEX_BLOCK_MANUFACTURER                1
+#define INDEX_BLOCK_IMAGE_TYPE                  3
+#define INDEX_BLOCK_FILE_VERSION                5
+#define INDEX_BLOCK_FILE_OFFSET                 9
+#define INDEX_BLOCK_MAX_DATA_SIZE               13
+
+/* Upgrade End Request format, after ZCL header */
+#define LEN_UPGRADE_END_REQUEST                 9
+#define INDEX_END_STATUS                        0
+#define INDEX_END_MANUFACTURER                  1
+#define INDEX_END_IMAGE_TYPE                    3
+#define INDEX_END_FILE_VERSION                  5
+
+/* OTA file header format */
+#define OTA_FILE_IDENTIFIER                     0x0BEEF11E
+#define LEN_OTA_HEADER                          56
+#define INDEX_HEADER_FILE_IDENTIFIER            0
+#define INDEX_HEADER_MANUFACTURER               10
+#define INDEX_HEADER_IMAGE_TYPE                 12
+#define INDEX_HEADER_FILE_VERSION               14
+#define INDEX_HEADER_TOTAL_IMAGE_SIZE           52
+
+/* Largest block fitting in a single AF data request along with headers */
+#define OTA_MAX_BLOCK_SIZE                      64
+#define LEN_IMAGE_BLOCK_RESPONSE_HEADER         14
+
+/********** Application data **********/
+
+#define OTA_PROFIL_ID                           0x0104  /* ZHA */
+#define OTA_DEVICE_ID                           0x0050  /* Home gateway */
+#define OTA_DEVICE_VERSION                      0x1
+
+#define OTA_DEFAULT_BLOCK_INTERVAL_MS           250
+#define OTA_DEFAULT_MAX_BLOCKS_RATE             10
+
+/* Build index keys */
+#define OTA_IMAGE_KEY(manufacturer, type, version)  ((int64_t)(((uint64_t)(manufacturer) << 48) | ((uint64_t)(type) << 32) | (version)))
+#define OTA_LATEST_KEY(manufacturer, type)          ((int)(((uint32_t)(manufacturer) << 16) | (type)))
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    int64_t key;
+    int latest_key;
+    uint16_t manufacturer;
+    uint16_t image_type;
+    uint32_t version;
+    uint32_t size;
+    /* Whole file mapping, image blocks are read from it */
+    uint8_t *data;
+    size_t map_len;
+} OtaImage;
+
+/* Devices downloading an image */
+typedef struct
+{
+    int addr;
+    /* Time before which no block is sent to this device */
+    uint64_t next_block;
+} OtaClient;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uint8_t _enabled = 0;
+
+static uint16_t _ota_in_clusters[] = {
+    ZCL_CLUSTER_OTA_UPGRADE};
+static uint8_t _ota_in_clusters_num = sizeof(_ota_in_clusters)/sizeof(uint16_t);
+
+/* Images indexed by manufacturer, type and version */
+static Eina_Hash *_images = NULL;
+/* Latest version of each manufacturer and type, pointing to _images entries */
+static Eina_Hash *_latest = NULL;
+static Eina_Hash *_clients = NULL;
+
+static uint64_t _block_interval = OTA_DEFAULT_BLOCK_INTERVAL_MS;
+static int _max_blocks_rate = OTA_DEFAULT_MAX_BLOCKS_RATE;
+/* All devices blocks budget, renewed every second */
+static uint64_t _window_start = 0;
+static int _window_blocks = 0;
+
+/********************************
+ *        Images index          *
+ *******************************/
+
+static void _free_image(void *data)
+{
+    OtaImage *image = data;
+
+    if(!image)
+        return;
+    munmap(image->data, image->map_len);
+    free(image);
+}
+
+static OtaImage *_map_image(const char *path)
+{
+    OtaImage *image = NULL;
+    struct stat st;
+    uint32_t identifier = 0;
+    uint8_t *data = NULL;
+    int fd = -1;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        WRN("Cannot open OTA image %s", path);
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < LEN_OTA_HEADER)
+    {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* Mapping stays valid once file is closed */
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        WRN("Cannot map OTA image %s", path);
+        return NULL;
+    }
+
+    memcpy(&identifier, data + INDEX_HEADER_FILE_IDENTIFIER, sizeof(identifier));
+    if(identifier != OTA_FILE_IDENTIFIER)
+    {
+        DBG("%s is not an OTA image", path);
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    image = calloc(1, sizeof(OtaImage));
+    if(!image)
+    {
+        CRI("Cannot allocate memory for OTA image");
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    image->data = data;
+    image->map_len = st.st_size;
+    memcpy(&image->manufacturer, data + INDEX_HEADER_MANUFACTURER, sizeof(image->manufacturer));
+    memcpy(&image->image_type, data + INDEX_HEADER_IMAGE_TYPE, sizeof(image->image_type));
+    memcpy(&image->version, data + INDEX_HEADER_FILE_VERSION, sizeof(image->version));
+    memcpy(&image->size, data + INDEX_HEADER_TOTAL_IMAGE_SIZE, sizeof(image->size));
+    if(image->size > image->map_len || image->size < LEN_OTA_HEADER)
+    {
+        WRN("OTA image %s is truncated (%u bytes announced, %zu bytes found)", path, image->size, image->map_len);
+        _free_image(image);
+        return NULL;
+    }
+    image->key = OTA_IMAGE_KEY(image->manufacturer, image->image_type, image->version);
+    image->latest_key = OTA_LATEST_KEY(image->manufacturer, image->image_type);
+    return image;
+}
+
+static void _index_image(OtaImage *image)
+{
+    OtaImage *latest = NULL;
+
+    if(eina_hash_find(_images, &image->key))
+    {
+        WRN("OTA image 0x%04X/0x%04X version 0x%08X is provided twice, ignoring duplicate",
+                image->manufacturer, image->image_type, image->version);
+        _free_image(image);
+        return;
+    }
+    eina_hash_add(_images, &image->key, image);
+
+    latest = eina_hash_find(_latest, &image->latest_key);
+    if(!latest || latest->version < image->version)
+        eina_hash_set(_latest, &image->latest_key, image);
+
+    INF("OTA image 0x%04X/0x%04X version 0x%08X indexed (%u bytes)",
+            image->manufacturer, image->image_type, image->version, image->size);
+}
+
+static int _load_images(const char *dir_path)
+{
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    OtaImage *image = NULL;
+    char path[PATH_MAX];
+
+    dir = opendir(dir_path);
+    if(!dir)
+    {
+        ERR("Cannot open OTA image directory %s", dir_path);
+        return 0;
+    }
+    while((entry = readdir(dir)) != NULL)
+    {
+        if(entry->d_name[0] == '.')
+            continue;
+        if(snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= (int)sizeof(path))
+            continue;
+        image = _map_image(path);
+        if(image)
+            _index_image(image);
+    }
+    closedir(dir);
+    return eina_hash_population(_images);
+}
+
+/********************************
+ *        Rate limiting         *
+ *******************************/
+
+static OtaClient *_get_client(uint16_t addr)
+{
+    OtaClient *client = NULL;
+    int key = addr;
+
+    client = eina_hash_find(_clients, &key);
+    if(client)
+        return client;
+
+    client = calloc(1, sizeof(OtaClient));
+    if(!client)
+    {
+        CRI("Cannot allocate memory for OTA client");
+        return NULL;
+    }
+    client->addr = addr;
+    eina_hash_add(_clients, &client->addr, client);
+    return client;
+}
+
+static void _remove_client(uint16_t addr)
+{
+    int key = addr;
+
+    eina_hash_del_by_key(_clients, &key);
+}
+
+/* Each device gets at most one block per interval, and all devices together
+ * share a blocks budget per second, so that OTA traffic leaves room on the
+ * ZNP link for user commands. Return the delay before next block can be sent */
+static uint64_t _get_block_delay(OtaClient *client)
+{
+    uint64_t now = uv_now(uv_default_loop());
+
+    if(now < client->next_block)
+        return client->next_block - now;
+
+    if(now - _window_start >= 1000)
+    {
+        _window_start = now;
+        _window_blocks = 0;
+    }
+    if(_window_blocks >= _max_blocks_rate)
+        return _window_start + 1000 - now;
+
+    _window_blocks++;
+    client->next_block = now + _block_interval;
+    return 0;
+}
+
+/********************************
+ *     OTA commands processing  *
+ *******************************/
+
+static void _send_status(uint16_t addr, uint8_t endpoint, uint8_t seq, uint8_t command, uint8_t status)
+{
+    zg_aps_send_response(addr, OTA_ENDPOINT, endpoint, ZCL_CLUSTER_OTA_UPGRADE,
+            command, seq, &status, sizeof(status), NULL);
+}
+
+static void _process_query_next_image(uint16_t addr, uint8_t endpoint, uint8_t seq, uint8_t *payload, int len)
+{
+    uint8_t response[13] = {0};
+    uint16_t manufacturer = 0;
+    uint16_t image_type = 0;
+    uint32_t version = 0;
+    int key = 0;
+    OtaImage *image = NULL;
+
+    if(len < LEN_QUERY_NEXT_IMAGE_REQUEST)
+    {
+        WRN("Query Next Image request from 0x%04X is too short", addr);
+        return;
+    }
+    memcpy(&manufacturer, payload + INDEX_QUERY_MANUFACTURER, sizeof(manufacturer));
+    memcpy(&image_type, payload + INDEX_QUERY_IMAGE_TYPE, sizeof(image_type));
+    memcpy(&version, payload + INDEX_QUERY_FILE_VERSION, sizeof(version));
+    DBG("Device 0x%04X runs image 0x%04X/0x%04X version 0x%08X", addr, manufacturer, image_type, version);
+
+    key = OTA_LATEST_KEY(manufacturer, image_type);
+    image = eina_hash_find(_latest, &key);
+    if(!image || image->version <= version)
+    {
+        _send_status(addr, endpoint, seq, COMMAND_QUERY_NEXT_IMAGE_RESPONSE, STATUS_NO_IMAGE_AVAILABLE);
+        return;
+    }
+
+    INF("Offering image version 0x%08X to device 0x%04X", image->version, addr);
+    response[0] = STATUS_SUCCESS;
+    memcpy(response + 1, &image->manufacturer, sizeof(image->manufacturer));
+    memcpy(response + 3, &image->image_type, sizeof(image->image_type));
+    memcpy(response + 5, &image->version, sizeof(image->version));
+    memcpy(response + 9, &image->size, sizeof(image->size));
+    zg_aps_send_response(addr, OTA_ENDPOINT, endpoint, ZCL_CLUSTER_OTA_UPGRADE,
+            COMMAND_QUERY_NEXT_IMAGE_RESPONSE, seq, response, sizeof(response), NULL);
+}
+
+static void _send_wait_for_data(uint16_t addr, uint8_t endpoint, uint8_t seq, uint64_t delay)
+{
+    uint8_t response[11] = {0};
+    /* A null current time makes request time relative */
+    uint32_t current_time = 0;
+    uint32_t request_time = (delay + 999) / 1000;
+    uint16_t block_period = _block_interval;
+
+    response[0] = STATUS_WAIT_FOR_DATA;
+    memcpy(response + 1, &current_time, sizeof(current_time));
+    memcpy(response + 5, &request_time, sizeof(request_time));
+    memcpy(response + 9, &block_period, sizeof(block_period));
+    zg_aps_send_response(addr, OTA_ENDPOINT, endpoint, ZCL_CLUSTER_OTA_UPGRADE,
+            COMMAND_IMAGE_BLOCK_RESPONSE, seq, response, sizeof(response), NULL);
+}
+
+static void _process_image_block(uint16_t addr, uint8_t endpoint, uint8_t seq, uint8_t *payload, int len)
+{
+    uint8_t response[LEN_IMAGE_BLOCK_RESPONSE_HEADER + OTA_MAX_BLOCK_SIZE] = {0};
+    uint16_t manufacturer = 0;
+    uint16_t image_type = 0;
+    uint32_t version = 0;
+    uint32_t offset = 0;
+    uint8_t size = 0;
+    uint64_t delay = 0;
+    int64_t key = 0;
+    OtaImage *image = NULL;
+    OtaClient *client = NULL;
+
+    if(len < LEN_IMAGE_BLOCK_REQUEST)
+    {
+        WRN("Image Block request from 0x%04X is too short", addr);
+        return;
+    }
+    memcpy(&manufacturer, payload + INDEX_BLOCK_MANUFACTURER, sizeof(manufacturer));
+    memcpy(&image_type, payload + INDEX_BLOCK_IMAGE_TYPE, sizeof(image_type));
+    memcpy(&version, payload + INDEX_BLOCK_FILE_VERSION, sizeof(version));
+    memcpy(&offset, payload + INDEX_BLOCK_FILE_OFFSET, sizeof(offset));
+    size = payload[INDEX_BLOCK_MAX_DATA_SIZE];
+
+    key = OTA_IMAGE_KEY(manufacturer, image_type, version);
+    image = eina_hash_find(_images, &key);
+    if(!image || offset >= image->size)
+    {
+        WRN("Device 0x%04X asks for an unknown image block (0x%04X/0x%04X version 0x%08X, offset %u)",
+                addr, manufacturer, image_type, version, offset);
+        _remove_client(addr);
+        _send_status(addr, endpoint, seq, COMMAND_IMAGE_BLOCK_RESPONSE, STATUS_ABORT);
+        return;
+    }
+
+    client = _get_client(addr);
+    if(!client)
+        return;
+    delay = _get_block_delay(client);
+    if(delay > 0)
+    {
+        DBG("Delaying block of device 0x%04X for %"PRIu64" ms", addr, delay);
+        _send_wait_for_data(addr, endpoint, seq, delay);
+        return;
+    }
+
+    if(size > OTA_MAX_BLOCK_SIZE)
+        size = OTA_MAX_BLOCK_SIZE;
+    if(size > image->size - offset)
+        size = image->size - offset;
+
+    DBG("Sending %d bytes at offset %u to device 0x%04X", size, offset, addr);
+    response[0] = STATUS_SUCCESS;
+    memcpy(response + 1, &manufacturer, sizeof(manufacturer));
+    memcpy(response + 3, &image_type, sizeof(image_type));
+    memcpy(response + 5, &version, sizeof(version));
+    memcpy(response + 9, &offset, sizeof(offset));
+    response[13] = size;
+    memcpy(response + LEN_IMAGE_BLOCK_RESPONSE_HEADER, image->data + offset, size);
+    zg_aps_send_response(addr, OTA_ENDPOINT, endpoint, ZCL_CLUSTER_OTA_UPGRADE,
+            COMMAND_IMAGE_BLOCK_RESPONSE, seq, response, LEN_IMAGE_BLOCK_RESPONSE_HEADER + size, NULL);
+}
+
+static void _process_upgrade_end(uint16_t addr, uint8_t endpoint, uint8_t seq, uint8_t *payload, int len)
+{
+    uint8_t response[16] = {0};
+    uint8_t status = 0;
+
+    if(len < LEN_UPGRADE_END_REQUEST)
+    {
+        WRN("Upgrade End request from 0x%04X is too short", addr);
+        return;
+    }
+    _remove_client(addr);
+    status = payload[INDEX_END_STATUS];
+    if(status != STATUS_SUCCESS)
+    {
+        ERR("Device 0x%04X has failed its upgrade (status 0x%02X)", addr, status);
+        return;
+    }
+
+    INF("Device 0x%04X has downloaded its new image, asking it to upgrade now", addr);
+    /* Manufacturer, type and version are echoed, null current and upgrade
+     * times mean upgrade now */
+    memcpy(response, payload + INDEX_END_MANUFACTURER, 8);
+    zg_aps_send_response(addr, OTA_ENDPOINT, endpoint, ZCL_CLUSTER_OTA_UPGRADE,
+            COMMAND_UPGRADE_END_RESPONSE, seq, response, sizeof(response), NULL);
+}
+
+static void _ota_message_cb(uint16_t addr, uint8_t src_endpoint, uint16_t cluster, void *data, int len)
+{
+    uint8_t *buffer = data;
+    uint8_t *payload = NULL;
+    uint8_t seq = 0;
+
+    if(!buffer || len < ZCL_HEADER_SIZE)
+        return;
+    if(cluster != ZCL_CLUSTER_OTA_UPGRADE)
+    {
+        WRN("Unsupported OTA cluster 0x%04X", cluster);
+        return;
+    }
+
+    seq = buffer[INDEX_TRANS_SEQ_NUM];
+    payload = buffer + ZCL_HEADER_SIZE;
+    len -= ZCL_HEADER_SIZE;
+    switch(buffer[INDEX_COMMAND])
+    {
+        case COMMAND_QUERY_NEXT_IMAGE_REQUEST:
+            _process_query_next_image(addr, src_endpoint, seq, payload, len);
+            break;
+        case COMMAND_IMAGE_BLOCK_REQUEST:
+            _process_image_block(addr, src_endpoint, seq, payload, len);
+            break;
+        case COMMAND_UPGRADE_END_REQUEST:
+            _process_upgrade_end(addr, src_endpoint, seq, payload, len);
+            break;
+        case COMMAND_IMAGE_PAGE_REQUEST:
+        default:
+            WRN("Unsupported OTA command 0x%02X", buffer[INDEX_COMMAND]);
+            break;
+    }
+}
+
+/********************************
+ *          OTA API             *
+ *******************************/
+
+uint8_t zg_ota_init(InitCompleteCb cb)
+{
+    const char *dir = NULL;
+    int nb_images = 0;
+
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_ota", ZG_COLOR_LIGHTCYAN);
+
+    dir = zg_conf_get_ota_image_dir();
+    if(!dir)
+    {
+        INF("No OTA image directory configured, OTA server is disabled");
+        if(cb)
+            cb();
+        return 0;
+    }
+
+    if(zg_conf_get_ota_block_interval() > 0)
+        _block_interval = zg_conf_get_ota_block_interval();
+    if(zg_conf_get_ota_max_blocks_rate() > 0)
+        _max_blocks_rate = zg_conf_get_ota_max_blocks_rate();
+
+    _images = eina_hash_int64_new(_free_image);
+    _latest = eina_hash_int32_new(NULL);
+    _clients = eina_hash_int32_new(free);
+    if(!_images || !_latest || !_clients)
+    {
+        CRI("Cannot allocate OTA images index");
+        return 1;
+    }
+    nb_images = _load_images(dir);
+    INF("OTA server serves %d images from %s", nb_images, dir);
+
+    zg_aps_init();
+    _enabled = 1;
+    zg_aps_register_endpoint(   OTA_ENDPOINT,
+                                OTA_PROFIL_ID,
+                                OTA_DEVICE_ID,
+                                OTA_DEVICE_VERSION,
+                                _ota_in_clusters_num,
+                                _ota_in_clusters,
+                                0,
+                                NULL,
+                                _ota_message_cb,
+                                cb);
+    return 0;
+}
+
+void zg_ota_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(_enabled)
+        zg_aps_shutdown();
+    _enabled = 0;
+    /* Latest versions hash only points to images, free it first */
+    if(_latest)
+        eina_hash_free(_latest);
+    if(_images)
+        eina_hash_free(_images);
+    if(_clients)
+        eina_hash_free(_clients);
+    _latest = NULL;
+    _images = NULL;
+    _clients = NULL;
+}
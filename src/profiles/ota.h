@@ -0,0 +1,22 @@
+#ifndef ZG_OTA_H
+#define ZG_OTA_H
+
+#include <stdint.h>
+#include "types.h"
+
+/**
+ * \brief Initialize the OTA Upgrade server. Image files found in the
+ * configured directory are mapped in memory and indexed by manufacturer, image
+ * type and version, then the OTA endpoint is registered. If no image
+ * directory is configured, the server is disabled
+ * \param cb The callback to call once initialization is complete
+ * \return 0 if initialization has started, otherwise 1
+ */
+uint8_t zg_ota_init(InitCompleteCb cb);
+
+/**
+ * \brief Stop the OTA Upgrade server and unmap all images
+ */
+void zg_ota_shutdown(void);
+
+#endif
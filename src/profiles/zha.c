@@ -22,10 +22,21 @@
 #define COMMAND_OFF                             0x00
 #define COMMAND_ON                              0x01
 #define COMMAND_TOGGLE                          0x02
+#define COMMAND_READ_ATTRIBUTES                 0x00
+#define COMMAND_READ_ATTRIBUTES_RESPONSE        0x01
 #define COMMAND_REPORT_ATTRIBUTE                0x0A
 #define COMMAND_OFF_WITH_EFFECT                 0x40
 #define COMMAND_ON_WITH_RECALL_GLOBAL_SCENE     0x41
 
+/* First attribute value in attribute reports and read attributes responses */
+#define ZCL_HEADER_SIZE                         3
+#define INDEX_COMMAND                           2
+#define INDEX_REPORT_VALUE                      6
+#define INDEX_READ_RSP_STATUS                   5
+#define INDEX_READ_RSP_VALUE                    7
+#define ZCL_STATUS_SUCCESS                      0x00
+#define READ_ATTRIBUTES_MAX                     16
+
 /* Off with effect frame format */
 #define LEN_OFF_WITH_EFFECT                     2
 #define INDEX_EFFECT_IDENTIFIER                 0
@@ -68,6 +79,7 @@ static void (*_temperature_cb)(uint16_t short_addr, int16_t temp) = NULL;
 static void (*_humidity_cb)(uint16_t short_addr, uint16_t humidity) = NULL;
 static void (*_pressure_cb)(uint16_t short_addr, int16_t pressure) = NULL;
 static NewDeviceJoinedCb _new_device_ind_cb = NULL;
+static ZhaAttributesCb _attributes_cb = NULL;
 
 static uint16_t _zha_in_clusters[] = {
     ZCL_CLUSTER_ON_OFF};
@@ -80,6 +92,19 @@ static uint8_t _zha_out_clusters_num = sizeof(_zha_out_clusters)/sizeof(uint8_t)
 /********************************
  *   ZHA messages callbacks     *
  *******************************/
+
+/* Returns the value of the first attribute, received either in a report or
+ * in a read attributes response, or NULL if there is no such value */
+static uint8_t *_get_first_attribute_value(uint8_t *buffer, int len, int size)
+{
+    if(buffer[INDEX_COMMAND] == COMMAND_REPORT_ATTRIBUTE && len >= INDEX_REPORT_VALUE + size)
+        return buffer + INDEX_REPORT_VALUE;
+    if(buffer[INDEX_COMMAND] == COMMAND_READ_ATTRIBUTES_RESPONSE && len >= INDEX_READ_RSP_VALUE + size &&
+            buffer[INDEX_READ_RSP_STATUS] == ZCL_STATUS_SUCCESS)
+        return buffer + INDEX_READ_RSP_VALUE;
+    return NULL;
+}
+
 static void _process_on_off_command(uint16_t addr, void *data, int len __attribute__((unused)))
 {
     uint8_t *buffer = (uint8_t *) data;
@@ -97,16 +122,17 @@ static void _process_on_off_command(uint16_t addr, void *data, int len __attribu
     }
 }
 
-static void _process_temperature_measurement_command(uint16_t addr, void *data, int len __attribute__((unused)))
+static void _process_temperature_measurement_command(uint16_t addr, void *data, int len)
 {
     uint8_t *buffer = (uint8_t *)data;
+    uint8_t *value = _get_first_attribute_value(buffer, len, sizeof(int16_t));
     int16_t temp;
-    if(buffer[2] == COMMAND_REPORT_ATTRIBUTE)
+    if(value)
     {
         INF("Received new temperature status");
         if(_temperature_cb)
         {
-            memcpy(&temp, buffer+6, 2);
+            memcpy(&temp, value, 2);
             _temperature_cb(addr, temp);
         }
     }
@@ -116,16 +142,17 @@ static void _process_temperature_measurement_command(uint16_t addr, void *data,
     }
 }
 
-static void _process_pressure_measurement_command(uint16_t addr, void *data, int len __attribute__((unused)))
+static void _process_pressure_measurement_command(uint16_t addr, void *data, int len)
 {
     uint8_t *buffer = (uint8_t *)data;
+    uint8_t *value = _get_first_attribute_value(buffer, len, sizeof(int16_t));
     int16_t pressure;
-    if(buffer[2] == COMMAND_REPORT_ATTRIBUTE)
+    if(value)
     {
         INF("Received new pressure status");
         if(_pressure_cb)
         {
-            memcpy(&pressure, buffer+6, 2);
+            memcpy(&pressure, value, 2);
             _pressure_cb(addr, pressure);
         }
     }
@@ -135,16 +162,17 @@ static void _process_pressure_measurement_command(uint16_t addr, void *data, int
     }
 }
 
-static void _process_humidity_measurement_command(uint16_t addr, void *data, int len __attribute__((unused)))
+static void _process_humidity_measurement_command(uint16_t addr, void *data, int len)
 {
     uint8_t *buffer = (uint8_t *)data;
+    uint8_t *value = _get_first_attribute_value(buffer, len, sizeof(uint16_t));
     uint16_t humidity;
-    if(buffer[2] == COMMAND_REPORT_ATTRIBUTE)
+    if(value)
     {
         INF("Received new humidity status");
         if(_humidity_cb)
         {
-            memcpy(&humidity, buffer+6, 2);
+            memcpy(&humidity, value, 2);
             _humidity_cb(addr, humidity);
         }
     }
@@ -155,13 +183,19 @@ static void _process_humidity_measurement_command(uint16_t addr, void *data, int
 }
 
 
-static void _zha_message_cb(uint16_t addr, uint16_t cluster, void *data, int len)
+static void _zha_message_cb(uint16_t addr, uint8_t src_endpoint __attribute__((unused)), uint16_t cluster, void *data, int len)
 {
     uint8_t *buffer = data;
     if(!buffer || len <= 0)
         return;
 
     DBG("Received ZHA data (%d bytes)", len);
+    if(_attributes_cb && len > ZCL_HEADER_SIZE &&
+            (buffer[INDEX_COMMAND] == COMMAND_REPORT_ATTRIBUTE ||
+             buffer[INDEX_COMMAND] == COMMAND_READ_ATTRIBUTES_RESPONSE))
+        _attributes_cb(addr, cluster, buffer[INDEX_COMMAND] == COMMAND_REPORT_ATTRIBUTE,
+                buffer + ZCL_HEADER_SIZE, len - ZCL_HEADER_SIZE);
+
     switch(cluster)
     {
         case ZCL_CLUSTER_ON_OFF:
@@ -257,12 +291,12 @@ void zg_zha_shutdown(void)
     zg_al_destroy(_init_sm);
 }
 
-void zg_zha_on_off_set(uint16_t addr, uint8_t endpoint, uint8_t state)
+int zg_zha_on_off_set(uint16_t addr, uint8_t endpoint, uint8_t state)
 {
     uint8_t command = state ? COMMAND_ON:COMMAND_OFF;
 
     INF("Sending state %d to device 0x%04X on enpoint 0x%02X", command, addr, endpoint);
-    zg_aps_send_data(addr,
+    return zg_aps_send_data(addr,
             0xABCD,
             ZHA_ENDPOINT,
             endpoint,
@@ -273,6 +307,46 @@ void zg_zha_on_off_set(uint16_t addr, uint8_t endpoint, uint8_t state)
             NULL);
 }
 
+int zg_zha_send_command(uint16_t addr, uint8_t endpoint, uint16_t cluster, uint8_t command, void *data, int len)
+{
+    DBG("Sending command 0x%02X of cluster 0x%04X to device 0x%04X on endpoint 0x%02X",
+            command, cluster, addr, endpoint);
+    return zg_aps_send_data(addr,
+            0xABCD,
+            ZHA_ENDPOINT,
+            endpoint,
+            cluster,
+            command,
+            data,
+            len,
+            NULL);
+}
+
+int zg_zha_read_attributes(uint16_t addr, uint8_t endpoint, uint16_t cluster, uint16_t *attributes, uint8_t nb_attributes)
+{
+    uint8_t payload[READ_ATTRIBUTES_MAX * sizeof(uint16_t)];
+
+    if(!attributes || !nb_attributes || nb_attributes > READ_ATTRIBUTES_MAX)
+        return -1;
+
+    memcpy(payload, attributes, nb_attributes * sizeof(uint16_t));
+    DBG("Reading %d attributes of cluster 0x%04X on device 0x%04X", nb_attributes, cluster, addr);
+    return zg_aps_send_profile_command(addr,
+            0xABCD,
+            ZHA_ENDPOINT,
+            endpoint,
+            cluster,
+            COMMAND_READ_ATTRIBUTES,
+            payload,
+            nb_attributes * sizeof(uint16_t),
+            NULL);
+}
+
+void zg_zha_register_attributes_cb(ZhaAttributesCb cb)
+{
+    _attributes_cb = cb;
+}
+
 void zg_zha_register_device_ind_callback(NewDeviceJoinedCb cb)
 {
     _new_device_ind_cb = cb;
@@ -298,19 +372,19 @@ void zg_zha_register_pressure_cb(void (*cb)(uint16_t short_addr, int16_t pressur
     _pressure_cb = cb;
 }
 
-void zg_zha_move_to_color(uint16_t short_addr, uint16_t x, uint16_t y, uint8_t duration_s)
+int zg_zha_move_to_color(uint16_t addr, uint8_t endpoint, uint16_t x, uint16_t y, uint16_t transition)
 {
     uint8_t command[6];
-    uint16_t duration = duration_s * 10;
 
     memcpy(command, &x, 2);
     memcpy(command+2, &y, 2);
-    memcpy(command+4, &duration, 2);
+    memcpy(command+4, &transition, 2);
 
-    zg_aps_send_data(short_addr,
+    DBG("Moving device 0x%04X on endpoint 0x%02X to color (%u, %u)", addr, endpoint, x, y);
+    return zg_aps_send_data(addr,
             0xABCD,
             ZHA_ENDPOINT,
-            0x0B,
+            endpoint,
             ZCL_CLUSTER_COLOR_CONTROL,
             0x07,
             command,
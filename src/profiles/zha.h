@@ -6,16 +6,25 @@
 #include "types.h"
 
 typedef void (*NewDeviceJoinedCb)(uint16_t short_addr, uint64_t ext_addr);
+/* Called with the attribute records of reports (reported set) and of read
+ * attributes responses, ZCL header excluded */
+typedef void (*ZhaAttributesCb)(uint16_t short_addr, uint16_t cluster, uint8_t reported, uint8_t *records, int len);
 
 uint8_t zg_zha_init(InitCompleteCb cb);
 void zg_zha_shutdown(void);
-void zg_zha_on_off_set(uint16_t addr, uint8_t endpoint, uint8_t state);
+/* Commands senders return the transaction id of the sent frame, or -1 */
+int zg_zha_on_off_set(uint16_t addr, uint8_t endpoint, uint8_t state);
+int zg_zha_send_command(uint16_t addr, uint8_t endpoint, uint16_t cluster, uint8_t command, void *data, int len);
+/* Transition time is given in tenths of second */
+int zg_zha_move_to_color(uint16_t addr, uint8_t endpoint, uint16_t x, uint16_t y, uint16_t transition);
+/* Attributes, up to 16, are read in a single request */
+int zg_zha_read_attributes(uint16_t addr, uint8_t endpoint, uint16_t cluster, uint16_t *attributes, uint8_t nb_attributes);
 void zg_zha_register_device_ind_callback(NewDeviceJoinedCb cb);
 void zg_zha_register_button_state_cb(void (*cb)(uint16_t short_addr, uint8_t state));
 void zg_zha_register_temperature_cb(void (*cb)(uint16_t short_addr, int16_t temp));
 void zg_zha_register_humidity_cb(void (*cb)(uint16_t short_addr, uint16_t humidity));
 void zg_zha_register_pressure_cb(void (*cb)(uint16_t short_addr, int16_t humidity));
-void zg_zha_move_to_color(uint16_t short_addr, uint16_t x, uint16_t y, uint8_t duration_s);
+void zg_zha_register_attributes_cb(ZhaAttributesCb cb);
 
 #endif
 
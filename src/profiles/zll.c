@@ -47,6 +47,17 @@
 /* Factory reset request frame format */
 #define LEN_FACTORY_RESET_REQUEST               4
 
+/* Scan Response frame format, after ZCL header */
+#define LEN_SCAN_RESPONSE                       29
+#define INDEX_RSSI_CORRECTION                   4
+#define INDEX_RESPONSE_ZIGBEE_INFORMATION       5
+#define INDEX_RESPONSE_ZLL_INFORMATION          6
+#define INDEX_RESPONSE_PAN_ID                   23
+#define INDEX_RESPONSE_NETWORK_ADDRESS          25
+
+#define ZLL_ZCL_HEADER_SIZE                     3
+#define ZLL_INFORMATION_FACTORY_NEW             0x01
+
 /********** Application data **********/
 
 /* Scan request */
@@ -70,7 +81,48 @@
 #define ZLL_INFORMATION_FIELD                   0x12
 
 #define ZLL_IDENTIFY_DELAY_MS                   3000
-#define EVENT_STR_TOUCHLINK_END                 "touchlink_end"
+
+/* Touchlink scan */
+#define ZLL_FIRST_CHANNEL_NB_SCANS              5
+/* Scans sent on a candidate channel before giving up on it */
+#define ZLL_TARGET_NB_SCANS                     3
+#define ZLL_MAX_CANDIDATES                      8
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef enum
+{
+    TOUCHLINK_MODE_SCAN,
+    TOUCHLINK_MODE_IDENTIFY,
+    TOUCHLINK_MODE_RESET
+} TouchlinkMode;
+
+typedef struct
+{
+    uint64_t ext_addr;
+    /* Channel on which device has answered */
+    uint8_t channel;
+    uint8_t link_quality;
+    uint8_t rssi_correction;
+    uint8_t zigbee_info;
+    uint8_t factory_new;
+    uint16_t pan_id;
+    uint16_t short_addr;
+} TouchlinkCandidate;
+
+typedef struct
+{
+    TouchlinkMode mode;
+    /* Candidate to identify or reset */
+    TouchlinkCandidate target;
+    uint8_t target_found;
+    uint8_t channel_index;
+    uint8_t channel;
+    uint8_t scan_count;
+} TouchlinkContext;
+
 /********************************
  *          Local variables     *
  *******************************/
@@ -87,6 +139,16 @@ static uint8_t _zll_out_clusters_num = sizeof(_zll_out_clusters)/sizeof(uint8_t)
 
 static uint32_t _interpan_transaction_identifier = 0;
 
+/* ZLL primary channels, scanned in this order */
+static const uint8_t _primary_channels[] = {11, 15, 20, 25};
+static uint8_t _nb_primary_channels = sizeof(_primary_channels)/sizeof(uint8_t);
+
+/* Responders of last scan, best ranked first */
+static TouchlinkCandidate _candidates[ZLL_MAX_CANDIDATES];
+static int _nb_candidates = 0;
+
+static ZgSm *_touchlink_sm = NULL;
+
 /********************************
  *          Internal            *
  *******************************/
@@ -129,19 +191,18 @@ void _zll_send_scan_request(SyncActionCb cb)
             cb);
 }
 
-void _zll_send_identify_request(SyncActionCb cb)
+void _zll_send_identify_request(uint64_t ext_addr, SyncActionCb cb)
 {
     char zll_data[LEN_IDENTIFY_REQUEST] = {0};
     uint16_t identify_duration = DEFAULT_IDENTIFY_DURATION;
 
-    INF("Sending identify request");
+    INF("Sending identify request to 0x%"PRIx64, ext_addr);
     memcpy(zll_data+INDEX_INTERPAN_TRANSACTION_IDENTIFIER,
             &_interpan_transaction_identifier,
             sizeof(_interpan_transaction_identifier));
     memcpy(zll_data + INDEX_IDENTIFY_DURATION, &identify_duration, 2);
 
-    zg_aps_send_data(ZCL_BROADCAST_SHORT_ADDR,
-            ZCL_BROADCAST_INTER_PAN,
+    zg_aps_send_inter_pan_data(ext_addr,
             ZLL_ENDPOINT,
             ZCL_BROADCAST_ENDPOINT,
             ZCL_CLUSTER_TOUCHLINK_COMMISSIONING,
@@ -151,17 +212,16 @@ void _zll_send_identify_request(SyncActionCb cb)
             cb);
 }
 
-void _zll_send_factory_reset_request(SyncActionCb cb)
+void _zll_send_factory_reset_request(uint64_t ext_addr, SyncActionCb cb)
 {
     char zll_data[LEN_FACTORY_RESET_REQUEST] = {0};
 
-    INF("Sending factory reset request");
+    INF("Sending factory reset request to 0x%"PRIx64, ext_addr);
     memcpy(zll_data+INDEX_INTERPAN_TRANSACTION_IDENTIFIER,
             &_interpan_transaction_identifier,
             sizeof(_interpan_transaction_identifier));
 
-    zg_aps_send_data(ZCL_BROADCAST_SHORT_ADDR,
-            ZCL_BROADCAST_INTER_PAN,
+    zg_aps_send_inter_pan_data(ext_addr,
             ZLL_ENDPOINT,
             ZCL_BROADCAST_ENDPOINT,
             ZCL_CLUSTER_TOUCHLINK_COMMISSIONING,
@@ -174,16 +234,62 @@ void _zll_send_factory_reset_request(SyncActionCb cb)
 
 
 /********************************
- *    Touchlink state machine   *
+ *     Touchlink candidates     *
  *******************************/
 
-/*** Local variables ***/
+/* Responses are ranked on link quality, corrected with the RSSI correction
+ * announced by the responder to compensate for its antenna */
+static int _candidate_score(const TouchlinkCandidate *candidate)
+{
+    return candidate->link_quality + candidate->rssi_correction;
+}
+
+static void _clear_candidates(void)
+{
+    memset(_candidates, 0, sizeof(_candidates));
+    _nb_candidates = 0;
+}
 
-static uv_timer_t _scan_timeout_timer;
-static uv_timer_t _identify_timer;
-static uint8_t _scan_count = 0;
-static ZgSm *_touchlink_sm = NULL;
+static void _add_candidate(const TouchlinkCandidate *candidate)
+{
+    int index = 0;
+    int pos = 0;
+    int nb_moved = 0;
 
+    /* A device answers every scan request, only keep its best reception */
+    for(index = 0; index < _nb_candidates; index++)
+    {
+        if(_candidates[index].ext_addr == candidate->ext_addr)
+            break;
+    }
+    if(index < _nb_candidates)
+    {
+        if(_candidate_score(candidate) <= _candidate_score(&_candidates[index]))
+            return;
+        memmove(&_candidates[index], &_candidates[index + 1],
+                (_nb_candidates - index - 1) * sizeof(TouchlinkCandidate));
+        _nb_candidates--;
+    }
+
+    while(pos < _nb_candidates && _candidate_score(&_candidates[pos]) >= _candidate_score(candidate))
+        pos++;
+    if(pos >= ZLL_MAX_CANDIDATES)
+    {
+        DBG("Ignoring touchlink candidate 0x%"PRIx64" : too many better candidates", candidate->ext_addr);
+        return;
+    }
+
+    nb_moved = (_nb_candidates < ZLL_MAX_CANDIDATES ? _nb_candidates : ZLL_MAX_CANDIDATES - 1) - pos;
+    memmove(&_candidates[pos + 1], &_candidates[pos], nb_moved * sizeof(TouchlinkCandidate));
+    _candidates[pos] = *candidate;
+    if(_nb_candidates < ZLL_MAX_CANDIDATES)
+        _nb_candidates++;
+}
+
+
+/********************************
+ *    Touchlink state machine   *
+ *******************************/
 
 /*** States and events ***/
 
@@ -191,13 +297,17 @@ enum
 {
     STATE_INIT,
     STATE_DISABLE_SECURITY,
+    STATE_SET_CHANNEL,
     STATE_SEND_SCAN,
     STATE_WAIT_SCAN_RESPONSE,
+    STATE_NEXT_SCAN,
     STATE_IDENTIY,
     STATE_WAIT_IDENTIFY,
     STATE_FACTORY_RESET,
+    STATE_RESTORE_CHANNEL,
     STATE_ENABLE_SECURITY,
     STATE_SHUTDOWN,
+    NB_STATES
 };
 
 enum
@@ -205,45 +315,68 @@ enum
     EVENT_INIT_DONE,
     EVENT_SECURITY_DISABLED,
     EVENT_SECURITY_ENABLED,
+    EVENT_CHANNEL_SET,
     EVENT_SCAN_SENT,
-    EVENT_SCAN_TIMEOUT_RESCAN,
-    EVENT_SCAN_TIMEOUT_NO_RESCAN,
-    EVENT_SCAN_RESPONSE_RECEIVED,
+    EVENT_SCAN_TIMEOUT,
+    EVENT_SCAN_AGAIN,
+    EVENT_SCAN_NEXT_CHANNEL,
+    EVENT_SCAN_DONE,
+    EVENT_TARGET_FOUND,
     EVENT_IDENTIFY_REQUEST_SENT,
+    EVENT_IDENTIFY_DONE,
     EVENT_IDENTIFY_DELAY_PAST,
-    EVENT_FACTORY_RESET_SENT
+    EVENT_FACTORY_RESET_SENT,
+    NB_EVENTS
 };
 
 /*** States entry functions ***/
 
-static void _init_touchlink(void)
+static void _init_touchlink(ZgSm *sm, void *ctx)
 {
+    TouchlinkContext *data = ctx;
+
     INF("Initializing touchlink state machine");
     _interpan_transaction_identifier = _generate_new_interpan_transaction_identifier();
-    uv_timer_init(uv_default_loop(), &_scan_timeout_timer);
-    uv_timer_init(uv_default_loop(), &_identify_timer);
-    _scan_count = 0;
-    zg_sm_send_event(_touchlink_sm, EVENT_INIT_DONE);
+    data->channel_index = 0;
+    data->scan_count = 0;
+    data->target_found = 0;
+    if(data->mode == TOUCHLINK_MODE_SCAN)
+        _clear_candidates();
+    zg_sm_send_event(sm, EVENT_INIT_DONE);
+}
+
+static const char *_mode_to_string(TouchlinkMode mode)
+{
+    switch(mode)
+    {
+        case TOUCHLINK_MODE_IDENTIFY:
+            return "identify";
+        case TOUCHLINK_MODE_RESET:
+            return "reset";
+        default:
+            return "scan";
+    }
 }
 
-static void _send_ipc_event_touchlink_end()
+static void _send_ipc_event_touchlink_end(TouchlinkContext *ctx)
 {
-    json_t *root;
-    root = json_object();
-    json_object_set_new(root, "status", json_string("finished"));
+    ZgInterfacesEvent event;
+    uint8_t success = ctx->mode == TOUCHLINK_MODE_SCAN || ctx->target_found;
 
-    zg_interfaces_send_event(EVENT_STR_TOUCHLINK_END, root);
-    json_decref(root);
+    zg_interfaces_event_init(&event, ZG_INTERFACES_EVENT_TOUCHLINK_END, ZG_INTERFACES_EVENT_NO_DEVICE);
+    zg_interfaces_event_add_string(&event, "status", success ? "finished" : "not_found");
+    zg_interfaces_event_add_string(&event, "action", _mode_to_string(ctx->mode));
+    zg_interfaces_event_add_int(&event, "candidates", _nb_candidates);
+    zg_interfaces_send_event(&event);
 }
 
-static void _shutdown_touchlink(void)
+static void _shutdown_touchlink(ZgSm *sm, void *ctx)
 {
-    uv_unref((uv_handle_t *)&_scan_timeout_timer);
-    uv_unref((uv_handle_t *)&_identify_timer);
-    zg_sm_destroy(_touchlink_sm);
+    zg_sm_destroy(sm);
     _touchlink_sm = NULL;
     INF("Touchlink procedure finished");
-    _send_ipc_event_touchlink_end();
+    _send_ipc_event_touchlink_end(ctx);
+    ZG_VAR_FREE(ctx);
 }
 
 static void _security_disabled_cb(void)
@@ -251,7 +384,7 @@ static void _security_disabled_cb(void)
     zg_sm_send_event(_touchlink_sm, EVENT_SECURITY_DISABLED);
 }
 
-static void _disable_security(void)
+static void _disable_security(ZgSm *sm __attribute__((unused)), void *ctx __attribute__((unused)))
 {
     zg_mt_sys_nv_write_disable_security(_security_disabled_cb);
 }
@@ -261,35 +394,95 @@ static void _security_enabled_cb(void)
     zg_sm_send_event(_touchlink_sm, EVENT_SECURITY_ENABLED);
 }
 
-static void _enable_security(void)
+static void _enable_security(ZgSm *sm __attribute__((unused)), void *ctx __attribute__((unused)))
 {
     zg_mt_sys_nv_write_enable_security(_security_enabled_cb);
 }
 
+static void _channel_set_cb(void)
+{
+    zg_sm_send_event(_touchlink_sm, EVENT_CHANNEL_SET);
+}
+
+static void _set_scan_channel(ZgSm *sm __attribute__((unused)), void *ctx)
+{
+    TouchlinkContext *data = ctx;
+
+    if(data->mode == TOUCHLINK_MODE_SCAN)
+        data->channel = _primary_channels[data->channel_index];
+    else
+        data->channel = data->target.channel;
+    INF("Scanning for touchlink devices on channel %d", data->channel);
+    zg_mt_af_set_inter_pan_channel(data->channel, _channel_set_cb);
+}
+
+static void _restore_channel(ZgSm *sm __attribute__((unused)), void *ctx __attribute__((unused)))
+{
+    zg_mt_af_set_inter_pan_channel(ZLL_CHANNEL, _channel_set_cb);
+}
+
 static void _scan_request_sent(void)
 {
-    _scan_count++;
     zg_sm_send_event(_touchlink_sm, EVENT_SCAN_SENT);
 }
 
-static void _send_single_scan_request()
+static void _send_single_scan_request(ZgSm *sm __attribute__((unused)), void *ctx)
 {
+    TouchlinkContext *data = ctx;
+
+    data->scan_count++;
     _zll_send_scan_request(_scan_request_sent);
 }
 
-static void _scan_timeout_cb(uv_timer_t *s __attribute__((unused)))
+static void _wait_scan_response(ZgSm *sm, void *ctx)
 {
-    INF("Scan response timeout");
-    if(_scan_count < 5)
-        zg_sm_send_event(_touchlink_sm, EVENT_SCAN_TIMEOUT_RESCAN);
-    else
-        zg_sm_send_event(_touchlink_sm, EVENT_SCAN_TIMEOUT_NO_RESCAN);
+    TouchlinkContext *data = ctx;
+
+    /* Target may have answered a previous scan late */
+    if(data->target_found)
+    {
+        zg_sm_send_event(sm, EVENT_TARGET_FOUND);
+        return;
+    }
+    INF("Waiting for scan responses...");
 }
 
-static void _wait_scan_response(void)
+/* First primary channel is scanned several times, as ZLL specification
+ * requires, then each other primary channel once */
+static void _plan_next_scan(ZgSm *sm, void *ctx)
 {
-    INF("Waiting for a scan response...");
-    uv_timer_start(&_scan_timeout_timer, _scan_timeout_cb, ZLL_SCAN_TIMEOUT_MS, 0);
+    TouchlinkContext *data = ctx;
+    uint8_t nb_scans = data->channel_index == 0 ? ZLL_FIRST_CHANNEL_NB_SCANS : 1;
+
+    if(data->mode != TOUCHLINK_MODE_SCAN)
+    {
+        if(data->target_found)
+            zg_sm_send_event(sm, EVENT_TARGET_FOUND);
+        else if(data->scan_count < ZLL_TARGET_NB_SCANS)
+            zg_sm_send_event(sm, EVENT_SCAN_AGAIN);
+        else
+        {
+            WRN("Touchlink target 0x%"PRIx64" did not answer", data->target.ext_addr);
+            zg_sm_send_event(sm, EVENT_SCAN_DONE);
+        }
+        return;
+    }
+
+    if(data->scan_count < nb_scans)
+    {
+        zg_sm_send_event(sm, EVENT_SCAN_AGAIN);
+    }
+    else if(data->channel_index + 1 < _nb_primary_channels)
+    {
+        data->channel_index++;
+        data->scan_count = 0;
+        zg_sm_send_event(sm, EVENT_SCAN_NEXT_CHANNEL);
+    }
+    else
+    {
+        INF("Touchlink scan finished, %d candidates found", _nb_candidates);
+        zg_sm_send_event(sm, EVENT_SCAN_DONE);
+    }
 }
 
 static void _identify_request_sent_cb(void)
@@ -297,20 +490,20 @@ static void _identify_request_sent_cb(void)
     zg_sm_send_event(_touchlink_sm, EVENT_IDENTIFY_REQUEST_SENT);
 }
 
-static void _send_identify_request(void)
+static void _send_identify_request(ZgSm *sm __attribute__((unused)), void *ctx)
 {
-    uv_timer_stop(&_scan_timeout_timer);
-    _zll_send_identify_request(_identify_request_sent_cb);
-}
+    TouchlinkContext *data = ctx;
 
-static void _identify_delay_timeout_cb(uv_timer_t *s __attribute__((unused)))
-{
-    zg_sm_send_event(_touchlink_sm, EVENT_IDENTIFY_DELAY_PAST);
+    _zll_send_identify_request(data->target.ext_addr, _identify_request_sent_cb);
 }
 
-static void _wait_identify_period(void)
+static void _wait_identify_period(ZgSm *sm, void *ctx)
 {
-    uv_timer_start(&_identify_timer, _identify_delay_timeout_cb, ZLL_IDENTIFY_DELAY_MS, 0);
+    TouchlinkContext *data = ctx;
+
+    /* Device keeps identifying on its own, only reset needs to wait */
+    if(data->mode == TOUCHLINK_MODE_IDENTIFY)
+        zg_sm_send_event(sm, EVENT_IDENTIFY_DONE);
 }
 
 static void _factory_reset_sent_cb(void)
@@ -318,37 +511,55 @@ static void _factory_reset_sent_cb(void)
     zg_sm_send_event(_touchlink_sm, EVENT_FACTORY_RESET_SENT);
 }
 
-static void _send_factory_reset_request(void)
+static void _send_factory_reset_request(ZgSm *sm __attribute__((unused)), void *ctx)
 {
-    _zll_send_factory_reset_request(_factory_reset_sent_cb);
+    TouchlinkContext *data = ctx;
+
+    _zll_send_factory_reset_request(data->target.ext_addr, _factory_reset_sent_cb);
 }
 
-static ZgSmStateData _touchlink_states[] = {
-    {STATE_INIT, _init_touchlink},
-    {STATE_DISABLE_SECURITY, _disable_security},
-    {STATE_SEND_SCAN, _send_single_scan_request},
-    {STATE_WAIT_SCAN_RESPONSE, _wait_scan_response},
-    {STATE_IDENTIY, _send_identify_request},
-    {STATE_WAIT_IDENTIFY, _wait_identify_period},
-    {STATE_FACTORY_RESET, _send_factory_reset_request},
-    {STATE_ENABLE_SECURITY, _enable_security},
-    {STATE_SHUTDOWN, _shutdown_touchlink}
+static const ZgSmStateData _touchlink_states[] = {
+    {STATE_INIT, _init_touchlink, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_DISABLE_SECURITY, _disable_security, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_SET_CHANNEL, _set_scan_channel, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_SEND_SCAN, _send_single_scan_request, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_WAIT_SCAN_RESPONSE, _wait_scan_response, NULL, ZLL_SCAN_TIMEOUT_MS, EVENT_SCAN_TIMEOUT},
+    {STATE_NEXT_SCAN, _plan_next_scan, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_IDENTIY, _send_identify_request, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_WAIT_IDENTIFY, _wait_identify_period, NULL, ZLL_IDENTIFY_DELAY_MS, EVENT_IDENTIFY_DELAY_PAST},
+    {STATE_FACTORY_RESET, _send_factory_reset_request, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_RESTORE_CHANNEL, _restore_channel, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_ENABLE_SECURITY, _enable_security, NULL, ZG_SM_NO_TIMEOUT, 0},
+    {STATE_SHUTDOWN, _shutdown_touchlink, NULL, ZG_SM_NO_TIMEOUT, 0}
 };
-static ZgSmStateNb _touchlink_nb_states = sizeof(_touchlink_states)/sizeof(ZgSmStateData);
 
-static ZgSmTransitionData _touchlink_transitions[] = {
+static const ZgSmTransitionData _touchlink_transitions[] = {
     {STATE_INIT, EVENT_INIT_DONE, STATE_DISABLE_SECURITY},
-    {STATE_DISABLE_SECURITY, EVENT_SECURITY_DISABLED, STATE_SEND_SCAN},
+    {STATE_DISABLE_SECURITY, EVENT_SECURITY_DISABLED, STATE_SET_CHANNEL},
+    {STATE_SET_CHANNEL, EVENT_CHANNEL_SET, STATE_SEND_SCAN},
     {STATE_SEND_SCAN, EVENT_SCAN_SENT, STATE_WAIT_SCAN_RESPONSE},
-    {STATE_WAIT_SCAN_RESPONSE, EVENT_SCAN_TIMEOUT_RESCAN, STATE_SEND_SCAN},
-    {STATE_WAIT_SCAN_RESPONSE, EVENT_SCAN_RESPONSE_RECEIVED, STATE_IDENTIY},
-    {STATE_WAIT_SCAN_RESPONSE, EVENT_SCAN_TIMEOUT_NO_RESCAN, STATE_ENABLE_SECURITY},
+    {STATE_WAIT_SCAN_RESPONSE, EVENT_SCAN_TIMEOUT, STATE_NEXT_SCAN},
+    {STATE_WAIT_SCAN_RESPONSE, EVENT_TARGET_FOUND, STATE_IDENTIY},
+    {STATE_NEXT_SCAN, EVENT_SCAN_AGAIN, STATE_SEND_SCAN},
+    {STATE_NEXT_SCAN, EVENT_TARGET_FOUND, STATE_IDENTIY},
+    {STATE_NEXT_SCAN, EVENT_SCAN_NEXT_CHANNEL, STATE_SET_CHANNEL},
+    {STATE_NEXT_SCAN, EVENT_SCAN_DONE, STATE_RESTORE_CHANNEL},
     {STATE_IDENTIY, EVENT_IDENTIFY_REQUEST_SENT, STATE_WAIT_IDENTIFY},
+    {STATE_WAIT_IDENTIFY, EVENT_IDENTIFY_DONE, STATE_RESTORE_CHANNEL},
     {STATE_WAIT_IDENTIFY, EVENT_IDENTIFY_DELAY_PAST, STATE_FACTORY_RESET},
-    {STATE_FACTORY_RESET, EVENT_FACTORY_RESET_SENT, STATE_ENABLE_SECURITY},
+    {STATE_FACTORY_RESET, EVENT_FACTORY_RESET_SENT, STATE_RESTORE_CHANNEL},
+    {STATE_RESTORE_CHANNEL, EVENT_CHANNEL_SET, STATE_ENABLE_SECURITY},
     {STATE_ENABLE_SECURITY, EVENT_SECURITY_ENABLED, STATE_SHUTDOWN}
 };
-static ZgSmTransitionNb _touchlink_nb_transtitions = sizeof(_touchlink_transitions)/sizeof(ZgSmTransitionData);
+
+static ZgSmDefinition _touchlink_sm_def = {
+    .name = "touchlink",
+    .states = _touchlink_states,
+    .nb_states = NB_STATES,
+    .transitions = _touchlink_transitions,
+    .nb_transitions = sizeof(_touchlink_transitions)/sizeof(ZgSmTransitionData),
+    .nb_events = NB_EVENTS,
+};
 
 
 
@@ -356,22 +567,82 @@ static ZgSmTransitionNb _touchlink_nb_transtitions = sizeof(_touchlink_transitio
  *   ZLL messages callbacks     *
  *******************************/
 
-static uint8_t _process_scan_response(uint16_t short_addr __attribute__((unused)), void *data __attribute__((unused)), int len __attribute__((unused)))
+static void _process_scan_response(uint64_t ext_addr, uint8_t link_quality, uint8_t *data, int len)
 {
-    INF("A device has sent a scan response");
-    zg_sm_send_event(_touchlink_sm, EVENT_SCAN_RESPONSE_RECEIVED);
-    return 0;
+    TouchlinkContext *ctx = zg_sm_get_context(_touchlink_sm);
+    TouchlinkCandidate candidate;
+    uint32_t transaction_identifier = 0;
+    uint8_t *payload = data + ZLL_ZCL_HEADER_SIZE;
+
+    if(!ctx)
+    {
+        DBG("Ignoring scan response received out of touchlink procedure");
+        return;
+    }
+    if(len < ZLL_ZCL_HEADER_SIZE + LEN_SCAN_RESPONSE)
+    {
+        WRN("Scan response from 0x%"PRIx64" is too short (%d bytes)", ext_addr, len);
+        return;
+    }
+    memcpy(&transaction_identifier, payload + INDEX_INTERPAN_TRANSACTION_IDENTIFIER, sizeof(transaction_identifier));
+    if(transaction_identifier != _interpan_transaction_identifier)
+    {
+        DBG("Ignoring scan response from 0x%"PRIx64" to a previous scan", ext_addr);
+        return;
+    }
+
+    memset(&candidate, 0, sizeof(candidate));
+    candidate.ext_addr = ext_addr;
+    candidate.channel = ctx->channel;
+    candidate.link_quality = link_quality;
+    candidate.rssi_correction = payload[INDEX_RSSI_CORRECTION];
+    candidate.zigbee_info = payload[INDEX_RESPONSE_ZIGBEE_INFORMATION];
+    candidate.factory_new = payload[INDEX_RESPONSE_ZLL_INFORMATION] & ZLL_INFORMATION_FACTORY_NEW;
+    memcpy(&candidate.pan_id, payload + INDEX_RESPONSE_PAN_ID, sizeof(candidate.pan_id));
+    memcpy(&candidate.short_addr, payload + INDEX_RESPONSE_NETWORK_ADDRESS, sizeof(candidate.short_addr));
+    INF("Device 0x%"PRIx64" has sent a scan response on channel %d (LQI %d, RSSI correction %d)",
+            ext_addr, candidate.channel, candidate.link_quality, candidate.rssi_correction);
+
+    if(ctx->mode == TOUCHLINK_MODE_SCAN)
+    {
+        _add_candidate(&candidate);
+    }
+    else if(ext_addr == ctx->target.ext_addr && !ctx->target_found)
+    {
+        switch(zg_sm_get_state(_touchlink_sm))
+        {
+            case STATE_WAIT_SCAN_RESPONSE:
+                ctx->target_found = 1;
+                zg_sm_send_event(_touchlink_sm, EVENT_TARGET_FOUND);
+                break;
+            /* Response to a scan which has timed out : target is handled once
+             * current scan step is over */
+            case STATE_SET_CHANNEL:
+            case STATE_SEND_SCAN:
+            case STATE_NEXT_SCAN:
+                ctx->target_found = 1;
+                break;
+            default:
+                DBG("Ignoring scan response from 0x%"PRIx64" received after scan", ext_addr);
+                break;
+        }
+    }
 }
 
-static void _process_touchlink_commissioning_command(uint16_t short_addr, uint8_t *data, int len)
+static void _process_touchlink_commissioning_command(uint64_t ext_addr, uint8_t link_quality, uint8_t *data, int len)
 {
     int i;
     for (i = 0; i< len; i++)
-        INF("Data %d : 0x%02X", i, data[i]);
+        DBG("Data %d : 0x%02X", i, data[i]);
+    if(len < ZLL_ZCL_HEADER_SIZE)
+    {
+        WRN("Touchlink commissioning command is too short");
+        return;
+    }
     switch(data[2])
     {
         case COMMAND_SCAN_RESPONSE:
-            _process_scan_response(short_addr, data, len);
+            _process_scan_response(ext_addr, link_quality, data, len);
             break;
         default:
             WRN("Unsupported ZLL touchlink commissioning command 0x%02X", data[2]);
@@ -379,7 +650,25 @@ static void _process_touchlink_commissioning_command(uint16_t short_addr, uint8_
     }
 }
 
-static void _zll_message_cb(uint16_t short_addr, uint16_t cluster, void *data, int len)
+static void _zll_inter_pan_message_cb(uint64_t ext_addr, uint16_t cluster, uint8_t link_quality, void *data, int len)
+{
+    uint8_t *buffer = data;
+    if(!buffer || len <= 0)
+        return;
+
+    DBG("Received ZLL inter-pan data (%d bytes)", len);
+    switch(cluster)
+    {
+        case ZCL_CLUSTER_TOUCHLINK_COMMISSIONING:
+            _process_touchlink_commissioning_command(ext_addr, link_quality, data, len);
+            break;
+        default:
+            WRN("Unsupported ZLL cluster 0x%04X", cluster);
+            break;
+    }
+}
+
+static void _zll_message_cb(uint16_t short_addr, uint8_t src_endpoint __attribute__((unused)), uint16_t cluster, void *data, int len)
 {
     uint8_t *buffer = data;
     if(!buffer || len <= 0)
@@ -389,7 +678,9 @@ static void _zll_message_cb(uint16_t short_addr, uint16_t cluster, void *data, i
     switch(cluster)
     {
         case ZCL_CLUSTER_TOUCHLINK_COMMISSIONING:
-            _process_touchlink_commissioning_command(short_addr, data, len);
+            /* Touchlink responders can only be addressed by their extended
+             * address, which is given with inter-pan messages only */
+            WRN("Ignoring touchlink command from 0x%04X received without extended address", short_addr);
             break;
         default:
             WRN("Unsupported ZLL cluster 0x%04X", cluster);
@@ -442,6 +733,7 @@ void _register_zll_endpoint(SyncActionCb cb)
                                 _zll_out_clusters,
                                 _zll_message_cb,
                                 cb);
+    zg_aps_register_inter_pan_callback(ZLL_ENDPOINT, _zll_inter_pan_message_cb);
 }
 
 static ZgAlState _init_states[] = {
@@ -475,30 +767,96 @@ void zg_zll_shutdown(void)
     zg_al_destroy(_init_sm);
 }
 
-uint8_t zg_zll_start_touchlink(void)
+static uint8_t _start_touchlink(TouchlinkMode mode, int candidate)
 {
+    TouchlinkContext *ctx = NULL;
+
     if(_touchlink_sm)
     {
         WRN("A touchlink procedure is already in progress");
         return 1;
     }
 
-    _touchlink_sm = zg_sm_create(   "touchlink",
-                                    _touchlink_states,
-                                    _touchlink_nb_states,
-                                    _touchlink_transitions,
-                                    _touchlink_nb_transtitions);
+    if(mode != TOUCHLINK_MODE_SCAN && (candidate < 0 || candidate >= _nb_candidates))
+    {
+        ERR("Touchlink candidate %d does not exist (%d candidates)", candidate, _nb_candidates);
+        return 1;
+    }
+
+    ctx = calloc(1, sizeof(TouchlinkContext));
+    if(!ctx)
+    {
+        CRI("Cannot allocate memory for touchlink procedure");
+        return 1;
+    }
+    ctx->mode = mode;
+    if(mode != TOUCHLINK_MODE_SCAN)
+        ctx->target = _candidates[candidate];
+    _touchlink_sm = zg_sm_create(&_touchlink_sm_def, ctx);
     if(!_touchlink_sm)
     {
         ERR("Abort touchlink procedure");
+        ZG_VAR_FREE(ctx);
         return 1;
     }
 
-    INF("Starting touchlink procedure");
+    INF("Starting touchlink procedure (%s)", _mode_to_string(mode));
     if(zg_sm_start(_touchlink_sm) != 0)
     {
         ERR("Error encountered while starting touchlink state machine");
+        zg_sm_destroy(_touchlink_sm);
+        _touchlink_sm = NULL;
+        ZG_VAR_FREE(ctx);
         return 1;
     }
     return 0;
 }
+
+uint8_t zg_zll_start_touchlink(void)
+{
+    return _start_touchlink(TOUCHLINK_MODE_SCAN, -1);
+}
+
+uint8_t zg_zll_touchlink_identify(int candidate)
+{
+    return _start_touchlink(TOUCHLINK_MODE_IDENTIFY, candidate);
+}
+
+uint8_t zg_zll_touchlink_reset(int candidate)
+{
+    return _start_touchlink(TOUCHLINK_MODE_RESET, candidate);
+}
+
+json_t *zg_zll_get_touchlink_candidates_json(void)
+{
+    json_t *result = json_array();
+    json_t *candidate = NULL;
+    int index = 0;
+
+    if(!result)
+    {
+        ERR("Cannot allocate touchlink candidates list");
+        return NULL;
+    }
+
+    for(index = 0; index < _nb_candidates; index++)
+    {
+        candidate = json_object();
+        if(!candidate ||
+                json_object_set_new(candidate, "index", json_integer(index)) ||
+                json_object_set_new(candidate, "ext_addr", json_integer(_candidates[index].ext_addr)) ||
+                json_object_set_new(candidate, "channel", json_integer(_candidates[index].channel)) ||
+                json_object_set_new(candidate, "lqi", json_integer(_candidates[index].link_quality)) ||
+                json_object_set_new(candidate, "rssi_correction", json_integer(_candidates[index].rssi_correction)) ||
+                json_object_set_new(candidate, "pan_id", json_integer(_candidates[index].pan_id)) ||
+                json_object_set_new(candidate, "factory_new", json_boolean(_candidates[index].factory_new)) ||
+                json_array_append_new(result, candidate))
+        {
+            ERR("Cannot build touchlink candidate %d", index);
+            json_decref(candidate);
+            json_decref(result);
+            return NULL;
+        }
+    }
+    return result;
+}
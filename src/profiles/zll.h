@@ -1,6 +1,7 @@
 #ifndef ZG_ZLL_H
 #define ZG_ZLL_H
 
+#include <jansson.h>
 #include "types.h"
 
 uint8_t zg_zll_init(InitCompleteCb cb);
@@ -8,8 +9,35 @@ void zg_zll_shutdown(void);
 void zg_zll_send_scan_request(SyncActionCb cb);
 void zg_zll_send_identify_request(SyncActionCb cb);
 void zg_zll_send_factory_reset_request(SyncActionCb cb);
+
+/**
+ * \brief Scan ZLL primary channels for touchlink devices. Responders are
+ * ranked on their link quality, and can be retrieved once the touchlink end
+ * event has been sent
+ * \return 0 if scan has started, otherwise 1
+ */
 uint8_t zg_zll_start_touchlink(void);
+
+/**
+ * \brief Ask a device found by last touchlink scan to identify itself
+ * \param candidate The candidate index in the ranked candidates list
+ * \return 0 if procedure has started, otherwise 1
+ */
+uint8_t zg_zll_touchlink_identify(int candidate);
+
+/**
+ * \brief Factory reset a device found by last touchlink scan
+ * \param candidate The candidate index in the ranked candidates list
+ * \return 0 if procedure has started, otherwise 1
+ */
+uint8_t zg_zll_touchlink_reset(int candidate);
+
+/**
+ * \brief Get the devices found by last touchlink scan, best ranked first
+ * \return A newly allocated JSON array, to be released by the caller
+ */
+json_t *zg_zll_get_touchlink_candidates_json(void);
+
 void zg_zll_switch_bulb_state(void);
 
 #endif
-
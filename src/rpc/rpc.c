@@ -1,11 +1,16 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <fcntl.h>
-#include <termios.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <uv.h>
+#include <Eina.h>
 #include "types.h"
 #include "rpc.h"
+#include "transport.h"
 #include "logs.h"
 #include "utils.h"
 #include "conf.h"
@@ -49,39 +54,99 @@
                                     + x \
                                     + RPC_FCS_SIZE
 
+/* Subsystem ids are coded on CMD0 subsystem bits */
+#define RPC_MAX_SUBSYS              (RPC_CMD0_SUBSYS_MASK + 1)
+
+/* Frames waiting for the link to be writable. Must be a power of 2 */
+#define RPC_TX_QUEUE_SIZE           32
+#define RPC_TX_QUEUE_MASK           (RPC_TX_QUEUE_SIZE - 1)
+/* Maximum number of frames written at once */
+#define RPC_TX_MAX_IOV              16
+/* Synchronous requests waiting for the one in flight to be answered. Must be
+ * a power of 2 */
+#define RPC_SREQ_QUEUE_SIZE         16
+#define RPC_SREQ_QUEUE_MASK         (RPC_SREQ_QUEUE_SIZE - 1)
+#define RPC_SRSP_TIMEOUT_MS         3000
+
 /********************************
  *          Structs             *
  *******************************/
 
+typedef struct
+{
+    uint8_t data[RPC_FRAME_MAX_SIZE];
+    uint16_t len;
+} RpcTxFrame;
+
+/* Synchronous request and the callback to install once it is sent */
+typedef struct
+{
+    RpcTxFrame frame;
+    SyncActionCb *slot;
+    SyncActionCb cb;
+    /* Asynchronous request only waiting for its callback to be installed */
+    uint8_t async;
+} RpcSreq;
+
+/* ZNP link state */
+typedef struct
+{
+    char *device;
+    int fd;
+    ZgTransportType transport;
+    uv_poll_t poll;
+    /* Events currently polled, 0 once link has been closed */
+    int poll_events;
+    /* Outgoing frames ring, indexes only grow. Offset is the number of bytes
+     * of head frame already written */
+    RpcTxFrame tx_frames[RPC_TX_QUEUE_SIZE];
+    unsigned int tx_head;
+    unsigned int tx_tail;
+    uint16_t tx_offset;
+    /* ZNP processes one synchronous request at a time : next ones wait for
+     * the SRSP of the request in flight, or for its timeout */
+    RpcSreq sreq[RPC_SREQ_QUEUE_SIZE];
+    unsigned int sreq_head;
+    unsigned int sreq_tail;
+    uint8_t sreq_in_flight;
+    uint8_t sreq_cmd0;
+    uint8_t sreq_cmd1;
+    SyncActionCb *sreq_slot;
+    SyncActionCb sreq_cb;
+    uv_timer_t sreq_timer;
+    /* Handles still to be closed before freeing context */
+    uint8_t nb_handles;
+    /* Callbacks table for MT subsystems, indexed by subsystem id */
+    mt_subsys_cb_t subsys_cb[RPC_MAX_SUBSYS];
+} RpcContext;
+
 typedef struct
 {
     const char *name;
     ZgMtSubSys subsys;
-    mt_subsys_cb_t cb;
 } mt_subsys_t;
 
 /********************************
  *       Local variables        *
  *******************************/
 
-static const char *_device = NULL;
-static int _znp_fd = -1;
 static int _log_domain = -1;
 static int _init_count = 0;
-/* Callbacks table for MT subsystems */
+static RpcContext *_context = NULL;
+
 static mt_subsys_t _mt_subsys_table[] = {
-    {"RESERVED", ZG_MT_SUBSYS_RESERVED, NULL},
-    {"SYS", ZG_MT_SUBSYS_SYS, NULL},
-    {"MAC", ZG_MT_SUBSYS_MAC, NULL},
-    {"NWK", ZG_MT_SUBSYS_NWK, NULL},
-    {"AF", ZG_MT_SUBSYS_AF, NULL},
-    {"ZDO", ZG_MT_SUBSYS_ZDO, NULL},
-    {"SAPI", ZG_MT_SUBSYS_SAPI, NULL},
-    {"UTIL", ZG_MT_SUBSYS_UTIL, NULL},
-    {"DEBUG", ZG_MT_SUBSYS_DEBUG, NULL},
-    {"APP_INT", ZG_MT_SUBSYS_APP_INT, NULL},
-    {"APP_CONFIG", ZG_MT_SUBSYS_APP_CONFIG, NULL},
-    {"GREENPOWER", ZG_MT_SUBSYS_GREENPOWER, NULL}
+    {"RESERVED", ZG_MT_SUBSYS_RESERVED},
+    {"SYS", ZG_MT_SUBSYS_SYS},
+    {"MAC", ZG_MT_SUBSYS_MAC},
+    {"NWK", ZG_MT_SUBSYS_NWK},
+    {"AF", ZG_MT_SUBSYS_AF},
+    {"ZDO", ZG_MT_SUBSYS_ZDO},
+    {"SAPI", ZG_MT_SUBSYS_SAPI},
+    {"UTIL", ZG_MT_SUBSYS_UTIL},
+    {"DEBUG", ZG_MT_SUBSYS_DEBUG},
+    {"APP_INT", ZG_MT_SUBSYS_APP_INT},
+    {"APP_CONFIG", ZG_MT_SUBSYS_APP_CONFIG},
+    {"GREENPOWER", ZG_MT_SUBSYS_GREENPOWER}
 };
 
 static uint8_t _mt_subsys_table_size = sizeof(_mt_subsys_table)/sizeof(mt_subsys_t);
@@ -99,77 +164,186 @@ static uint8_t _compute_frame_fcs(uint8_t *buffer, uint8_t len)
     return res;
 }
 
-static void _process_rpc_frame(ZgMtMsg *msg)
+static const char *_get_subsys_name(ZgMtSubSys subsys)
 {
     uint8_t index = 0;
 
     for(index = 0; index < _mt_subsys_table_size; index++)
     {
-        if(_mt_subsys_table[index].subsys == msg->subsys &&
-                _mt_subsys_table[index].cb)
+        if(_mt_subsys_table[index].subsys == subsys)
+            return _mt_subsys_table[index].name;
+    }
+    return NULL;
+}
+
+static void _process_rpc_frame(RpcContext *ctx, ZgMtMsg *msg)
+{
+    if(!ctx->subsys_cb[msg->subsys])
+    {
+        ERR("No registered callback found for incoming RPC message (subsys 0x%02X)", msg->subsys);
+        return;
+    }
+
+    ctx->subsys_cb[msg->subsys](msg);
+}
+
+
+static void _update_poll(RpcContext *ctx);
+
+static void _encode_frame(RpcTxFrame *frame, ZgMtMsg *msg)
+{
+    uint8_t *buf = frame->data;
+    uint16_t i = 0;
+
+    frame->len = FRAME_SIZE(msg->len);
+    buf[RPC_SOF_INDEX] = RPC_SOF;
+    buf[RPC_DATA_LEN_INDEX] = msg->len;
+    buf[RPC_CMD0_INDEX] = msg->type|msg->subsys;
+    buf[RPC_CMD1_INDEX] = msg->cmd;
+    if(msg->len && msg->data)
+        memcpy(buf+RPC_DATA_INDEX, msg->data, msg->len);
+    buf[RPC_FCS_INDEX(msg->len)] = _compute_frame_fcs(buf + RPC_DATA_LEN_INDEX,
+            RPC_DATA_LEN_SIZE + RPC_CMD0_SIZE + RPC_CMD1_SIZE + msg->len);
+
+    for(i = 0; i < frame->len; i++)
+        DBG("Data %d : 0x%02X", i, buf[i]);
+}
+
+static uint8_t _tx_queue_frame(RpcContext *ctx, const RpcTxFrame *frame)
+{
+    if(ctx->tx_tail - ctx->tx_head == RPC_TX_QUEUE_SIZE)
+    {
+        ERR("Cannot send data to ZNP, transmit queue is full");
+        return 1;
+    }
+
+    INF("Queuing %d bytes to ZNP", frame->len);
+    /* Frame is written once link is writable, along with all frames queued
+     * in the meantime */
+    memcpy(&ctx->tx_frames[ctx->tx_tail & RPC_TX_QUEUE_MASK], frame, sizeof(RpcTxFrame));
+    ctx->tx_tail++;
+    _update_poll(ctx);
+    return 0;
+}
+
+static void _sreq_timeout_cb(uv_timer_t *timer);
+
+static void _sreq_send_next(RpcContext *ctx)
+{
+    RpcSreq *sreq = NULL;
+
+    while(!ctx->sreq_in_flight && ctx->sreq_head != ctx->sreq_tail)
+    {
+        /* Request stays at queue head until transmit queue has room for it :
+         * sending is retried once link has been written */
+        if(ctx->tx_tail - ctx->tx_head == RPC_TX_QUEUE_SIZE)
         {
-            _mt_subsys_table[index].cb(msg);
+            DBG("Transmit queue is full, request kept until ZNP link is written");
             break;
         }
+        sreq = &ctx->sreq[ctx->sreq_head & RPC_SREQ_QUEUE_MASK];
+        ctx->sreq_head++;
+        _tx_queue_frame(ctx, &sreq->frame);
+
+        /* Callback is installed only now, so that the SRSP processing
+         * callback always finds the one of the request in flight */
+        if(sreq->slot)
+            *sreq->slot = sreq->cb;
+        if(sreq->async)
+            continue;
+        ctx->sreq_slot = sreq->slot;
+        ctx->sreq_cb = sreq->cb;
+        ctx->sreq_cmd0 = sreq->frame.data[RPC_CMD0_INDEX];
+        ctx->sreq_cmd1 = sreq->frame.data[RPC_CMD1_INDEX];
+        ctx->sreq_in_flight = 1;
+        uv_timer_start(&ctx->sreq_timer, _sreq_timeout_cb, RPC_SRSP_TIMEOUT_MS, 0);
     }
-    if(index == _mt_subsys_table_size)
-        ERR("No registered callback found for incoming RPC message (subsys 0x%02X)", msg->subsys);
 }
 
+static void _sreq_timeout_cb(uv_timer_t *timer)
+{
+    RpcContext *ctx = timer->data;
+
+    ERR("No answer from ZNP to request 0x%02X 0x%02X", ctx->sreq_cmd0, ctx->sreq_cmd1);
+    /* A late answer must not complete a later request */
+    if(ctx->sreq_slot && *ctx->sreq_slot == ctx->sreq_cb)
+        *ctx->sreq_slot = NULL;
+    ctx->sreq_in_flight = 0;
+    _sreq_send_next(ctx);
+}
 
-static void _read_znp_data(void)
+
+static void _read_znp_data(RpcContext *ctx)
 {
-    uint8_t buffer[RPC_MAX_DATA_SIZE] = {0};
+    uint8_t buffer[RPC_FRAME_MAX_SIZE] = {0};
     uint8_t fcs_computed = 0x00;
     uint8_t len = 0;
     ssize_t bytes_read = 0;
+    ssize_t ret = 0;
     int8_t i;
     ZgMtMsg msg;
 
-    if(_znp_fd < 0)
+    if(ctx->fd < 0)
     {
         ERR("Cannot read data : ZNP medium not opened");
         return;
     }
 
-    read(_znp_fd, buffer + RPC_SOF_INDEX, RPC_SOF_SIZE);
+    ret = zg_transport_read(ctx->fd, buffer + RPC_SOF_INDEX, RPC_SOF_SIZE);
+    if(ret == 0)
+    {
+        ERR("ZNP link has been closed");
+        uv_poll_stop(&ctx->poll);
+        ctx->poll_events = 0;
+        return;
+    }
+    if(ret < 0)
+    {
+        if(errno != ETIMEDOUT)
+            ERR("Error reading ZNP link : %s", strerror(errno));
+        return;
+    }
     if(buffer[RPC_SOF_INDEX] != RPC_SOF)
     {
         ERR("Error : invalid start of frame");
         goto znp_read_err;
     }
 
-    if(read(_znp_fd, buffer + RPC_DATA_LEN_INDEX, RPC_DATA_LEN_SIZE) != RPC_DATA_LEN_INDEX)
+    if(zg_transport_read(ctx->fd, buffer + RPC_DATA_LEN_INDEX, RPC_DATA_LEN_SIZE) != RPC_DATA_LEN_INDEX)
     {
         ERR("Error reading Length field in incoming frame");
         goto znp_read_err;
     }
-    if(read(_znp_fd, buffer + RPC_CMD0_INDEX, RPC_CMD0_SIZE) != RPC_CMD1_SIZE)
+    if(zg_transport_read(ctx->fd, buffer + RPC_CMD0_INDEX, RPC_CMD0_SIZE) != RPC_CMD1_SIZE)
     {
         ERR("Error reading CMD0 field in incoming frame");
         goto znp_read_err;
     }
 
-    if(read(_znp_fd, buffer + RPC_CMD1_INDEX, RPC_CMD1_SIZE) != RPC_CMD1_SIZE)
+    if(zg_transport_read(ctx->fd, buffer + RPC_CMD1_INDEX, RPC_CMD1_SIZE) != RPC_CMD1_SIZE)
     {
         ERR("Error reading CMD1 field in incoming frame");
         goto znp_read_err;
     }
     len = buffer[RPC_DATA_LEN_INDEX];
     DBG("Data size is %d", len);
-    do
+    if(len > RPC_MAX_DATA_SIZE)
     {
-        bytes_read += read(_znp_fd, buffer + RPC_DATA_INDEX + bytes_read, len - bytes_read);
-        if(bytes_read < 0)
+        ERR("Error : frame is too large (%d bytes)", len);
+        goto znp_read_err;
+    }
+
+    /* Reads time out on both transports, so a truncated frame is dropped */
+    while(bytes_read < len)
+    {
+        ret = zg_transport_read(ctx->fd, buffer + RPC_DATA_INDEX + bytes_read, len - bytes_read);
+        if(ret <= 0)
         {
-            ERR("Did not manage to read %d bytes : %s", len, strerror(errno));
+            ERR("Did not manage to read %d bytes : %s", len, ret < 0 ? strerror(errno) : "link closed");
             goto znp_read_err;
         }
-        else if(bytes_read < len)
-        {
-            usleep(100);
-        }
-    }while(bytes_read != len);
+        bytes_read += ret;
+    }
 
     if(bytes_read != len)
     {
@@ -177,7 +351,11 @@ static void _read_znp_data(void)
         goto znp_read_err;
     }
 
-    read(_znp_fd, buffer + RPC_FCS_INDEX(len), RPC_FCS_SIZE);
+    if(zg_transport_read(ctx->fd, buffer + RPC_FCS_INDEX(len), RPC_FCS_SIZE) != RPC_FCS_SIZE)
+    {
+        ERR("Error reading FCS field in incoming frame");
+        goto znp_read_err;
+    }
 
     /* Display complete frame in debug log */
     for(i = 0; i < FRAME_SIZE(len); i++)
@@ -196,95 +374,221 @@ static void _read_znp_data(void)
     msg.data = buffer + RPC_DATA_INDEX;
     msg.len = buffer[RPC_DATA_LEN_INDEX];
 
-    _process_rpc_frame(&msg);
+    /* Only the answer to the request in flight is processed, so that a late
+     * answer to a timed out request does not complete the next one. Next
+     * request is sent once this one has been processed */
+    if(msg.type == ZG_MT_CMD_SRSP)
+    {
+        if(!ctx->sreq_in_flight
+                || msg.subsys != (ctx->sreq_cmd0 & RPC_CMD0_SUBSYS_MASK)
+                || msg.cmd != ctx->sreq_cmd1)
+        {
+            WRN("Dropping unexpected answer 0x%02X 0x%02X from ZNP",
+                    buffer[RPC_CMD0_INDEX], msg.cmd);
+            return;
+        }
+        uv_timer_stop(&ctx->sreq_timer);
+        ctx->sreq_in_flight = 0;
+    }
+    _process_rpc_frame(ctx, &msg);
+    _sreq_send_next(ctx);
     return;
 
 znp_read_err:
     DBG("Purging invalid ZNP data");
-	tcflush(_znp_fd, TCIFLUSH);
+    zg_transport_flush_input(ctx->fd, ctx->transport);
 }
 
-/********************************
- *              API             *
- *******************************/
+static void _poll_cb(uv_poll_t *handle, int status, int events);
 
-uint8_t zg_rpc_init(void)
+static void _update_poll(RpcContext *ctx)
 {
-    struct termios tio;
-    const char *device = zg_conf_get_znp_device_path();
-    //int baudrate = 0;
+    int events = UV_READABLE;
 
-    ENSURE_SINGLE_INIT(_init_count);
-    _log_domain = zg_logs_domain_register("zg_rpc", EINA_COLOR_BLUE);
-    if(!device)
+    /* Polling is not restarted once link has been closed */
+    if(!ctx->poll_events)
+        return;
+
+    if(ctx->tx_head != ctx->tx_tail)
+        events |= UV_WRITABLE;
+    if(events == ctx->poll_events)
+        return;
+
+    ctx->poll_events = events;
+    uv_poll_start(&ctx->poll, events, _poll_cb);
+}
+
+static void _tx_flush(RpcContext *ctx)
+{
+    struct iovec iov[RPC_TX_MAX_IOV];
+    RpcTxFrame *frame = NULL;
+    unsigned int index = 0;
+    int nb_iov = 0;
+    ssize_t ret = 0;
+
+    while(ctx->tx_head != ctx->tx_tail)
     {
-        ERR("No device provided, abort");
-        return 1;
+        nb_iov = 0;
+        for(index = ctx->tx_head; index != ctx->tx_tail && nb_iov < RPC_TX_MAX_IOV; index++)
+        {
+            frame = &ctx->tx_frames[index & RPC_TX_QUEUE_MASK];
+            iov[nb_iov].iov_base = frame->data;
+            iov[nb_iov].iov_len = frame->len;
+            nb_iov++;
+        }
+        iov[0].iov_base = (uint8_t *)iov[0].iov_base + ctx->tx_offset;
+        iov[0].iov_len -= ctx->tx_offset;
+
+        ret = zg_transport_writev(ctx->fd, ctx->transport, iov, nb_iov);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            ERR("Error writing data to ZNP medium : %s (%u frames dropped)",
+                    strerror(errno), ctx->tx_tail - ctx->tx_head);
+            ctx->tx_head = ctx->tx_tail;
+            ctx->tx_offset = 0;
+            break;
+        }
+        /* Link is full, wait for it to be writable again */
+        if(ret <= 0)
+            break;
+
+        DBG("%zd bytes written to ZNP (%d frames)", ret, nb_iov);
+        /* Release fully written frames and remember how much of the next one
+         * has been written */
+        ret += ctx->tx_offset;
+        while(ctx->tx_head != ctx->tx_tail)
+        {
+            frame = &ctx->tx_frames[ctx->tx_head & RPC_TX_QUEUE_MASK];
+            if(ret < frame->len)
+                break;
+            ret -= frame->len;
+            ctx->tx_head++;
+        }
+        ctx->tx_offset = ret;
     }
 
-    INF("Opening ZNP device %s", device);
-    _device = device;
+    _update_poll(ctx);
+}
 
-    _znp_fd = open(_device, O_RDWR|O_NOCTTY);
-    if(_znp_fd < 0)
+static void _poll_cb(uv_poll_t *handle, int status, int events)
+{
+    RpcContext *ctx = handle->data;
+
+    if(status < 0)
     {
-        ERR("Cannot open device %s : %s", _device, strerror(errno));
-        return 1;
+        ERR("ZNP socket error : %s (%s)", uv_err_name(status), uv_strerror(status));
+        return;
     }
-    DBG("ZNP medium opened (fd %d)", _znp_fd);
 
-    /*switch(zg_conf_get_znp_baudrate())
+    if(events & UV_WRITABLE)
     {
-        case 9600:
-            baudrate = B9600;
-            break;
-        default:
-            baudrate = B115200;
-            break;
-    }*/
-	tio.c_cflag = B115200 | CS8 | CLOCAL | CREAD;
-	tio.c_iflag = IGNPAR & ~ICRNL;
-	tio.c_oflag = 0;
-	tio.c_lflag = 0;
-	tio.c_cc[VMIN] = 1;
-
-	tcflush(_znp_fd, TCIFLUSH);
-	tcsetattr(_znp_fd, TCSANOW, &tio);
-    INF("RPC module initialized");
+        _tx_flush(ctx);
+        _sreq_send_next(ctx);
+    }
 
+    if(events & UV_READABLE)
+    {
+        DBG("ZNP socket has received data");
+        _read_znp_data(ctx);
+    }
+}
+
+static uint8_t _open_device(RpcContext *ctx)
+{
+    INF("Opening ZNP device %s", ctx->device);
+    ctx->fd = zg_transport_open(ctx->device, &ctx->transport);
+    if(ctx->fd < 0)
+        return 1;
+    DBG("ZNP medium opened (fd %d)", ctx->fd);
     return 0;
 }
 
+static void _close_device(RpcContext *ctx)
+{
+    if(ctx->fd < 0)
+        return;
+
+    /* Give a last chance to pending frames */
+    if(ctx->tx_head != ctx->tx_tail)
+        _tx_flush(ctx);
+    if(ctx->tx_head != ctx->tx_tail)
+        WRN("%u frames not sent to ZNP", ctx->tx_tail - ctx->tx_head);
+    INF("Closing ZNP medium");
+    zg_transport_close(ctx->fd, ctx->transport);
+    ctx->fd = -1;
+}
 
-void zg_rpc_shutdown(void)
+static void _handle_close_cb(uv_handle_t *handle)
 {
-    ENSURE_SINGLE_SHUTDOWN(_init_count);
-    if(_znp_fd > 0)
+    RpcContext *ctx = handle->data;
+
+    if(--ctx->nb_handles > 0)
+        return;
+    ZG_VAR_FREE(ctx->device);
+    ZG_VAR_FREE(ctx);
+}
+
+static RpcContext *_context_new(const char *device)
+{
+    RpcContext *ctx = NULL;
+
+    ctx = calloc(1, sizeof(RpcContext));
+    if(!ctx)
+    {
+        CRI("Cannot allocate memory for ZNP link");
+        return NULL;
+    }
+    ctx->fd = -1;
+    ctx->device = strdup(device);
+    if(!ctx->device || _open_device(ctx) != 0)
     {
-        INF("Closing ZNP medium");
-        tcflush(_znp_fd, TCIFLUSH);
-        close(_znp_fd);
-        _znp_fd = -1;
+        ZG_VAR_FREE(ctx->device);
+        ZG_VAR_FREE(ctx);
+        return NULL;
     }
 
+    if(uv_poll_init(uv_default_loop(), &ctx->poll, ctx->fd) != 0)
+    {
+        ERR("Cannot add ZNP descriptor (%d) to main event loop", ctx->fd);
+        _close_device(ctx);
+        ZG_VAR_FREE(ctx->device);
+        ZG_VAR_FREE(ctx);
+        return NULL;
+    }
+    ctx->poll.data = ctx;
+    uv_timer_init(uv_default_loop(), &ctx->sreq_timer);
+    ctx->sreq_timer.data = ctx;
+    ctx->nb_handles = 2;
+    ctx->poll_events = UV_READABLE;
+    uv_poll_start(&ctx->poll, ctx->poll_events, _poll_cb);
+    return ctx;
 }
 
-void zg_rpc_read(void)
+static void _context_free(RpcContext *ctx)
 {
-    _read_znp_data();
+    _close_device(ctx);
+    uv_poll_stop(&ctx->poll);
+    uv_close((uv_handle_t *)&ctx->poll, _handle_close_cb);
+    uv_close((uv_handle_t *)&ctx->sreq_timer, _handle_close_cb);
 }
 
-uint8_t zg_rpc_write(ZgMtMsg *msg)
+static uint8_t _context_write(RpcContext *ctx, ZgMtMsg *msg, SyncActionCb *slot, SyncActionCb cb)
 {
-    uint8_t buf[RPC_FRAME_MAX_SIZE] = {0};
-    uint16_t total_size = 0;
-    uint8_t i = 0;
+    RpcTxFrame frame;
+    RpcSreq *sreq = NULL;
 
-    if(_znp_fd < 0)
+    if(!ctx || ctx->fd < 0)
     {
         ERR("Cannot send data to ZNP, medium not initialized");
         return 1;
     }
+    if(!ctx->poll_events)
+    {
+        ERR("Cannot send data to ZNP, link has been closed");
+        return 1;
+    }
     if(!msg)
     {
         ERR("Cannot send data to ZNP, message object is empty");
@@ -297,46 +601,99 @@ uint8_t zg_rpc_write(ZgMtMsg *msg)
         return 1;
     }
 
-    total_size = FRAME_SIZE(msg->len);
-    buf[RPC_SOF_INDEX] = RPC_SOF;
-    buf[RPC_DATA_LEN_INDEX] = msg->len;
-    buf[RPC_CMD0_INDEX] = msg->type|msg->subsys;
-    buf[RPC_CMD1_INDEX] = msg->cmd;
-    if(msg->len && msg->data)
-        memcpy(buf+RPC_DATA_INDEX, msg->data, msg->len);
-    buf[RPC_FCS_INDEX(msg->len)] = _compute_frame_fcs(buf + RPC_DATA_LEN_INDEX,
-            RPC_DATA_LEN_SIZE + RPC_CMD0_SIZE + RPC_CMD1_SIZE + msg->len);
+    if(msg->type == ZG_MT_CMD_AREQ && !slot)
+    {
+        _encode_frame(&frame, msg);
+        return _tx_queue_frame(ctx, &frame);
+    }
 
-    INF("Writing %d bytes to ZNP", total_size);
-    for(i = 0; i < total_size; i++)
-        DBG("Data %d : 0x%02X", i, buf[i]);
+    /* Any other request is answered with a SRSP. An asynchronous request
+     * with a callback is queued too, so that its callback is not installed
+     * while a request from the same module is waiting for its answer */
+    if(ctx->sreq_tail - ctx->sreq_head == RPC_SREQ_QUEUE_SIZE)
+    {
+        ERR("Cannot send data to ZNP, too many requests waiting for an answer");
+        return 1;
+    }
+    sreq = &ctx->sreq[ctx->sreq_tail & RPC_SREQ_QUEUE_MASK];
+    _encode_frame(&sreq->frame, msg);
+    sreq->slot = slot;
+    sreq->cb = cb;
+    sreq->async = (msg->type == ZG_MT_CMD_AREQ);
+    ctx->sreq_tail++;
+    if(ctx->sreq_in_flight)
+        DBG("Request queued until ZNP answers 0x%02X 0x%02X", ctx->sreq_cmd0, ctx->sreq_cmd1);
+    _sreq_send_next(ctx);
+    return 0;
+}
+
+/********************************
+ *              API             *
+ *******************************/
+
+uint8_t zg_rpc_init(void)
+{
+    const char *device = zg_conf_get_znp_device_path();
 
-    if(write(_znp_fd, buf, total_size) != total_size)
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_rpc", EINA_COLOR_BLUE);
+    zg_transport_init();
+    if(!device)
     {
-        ERR("Error writing data to ZNP medium");
+        ERR("No device provided, abort");
         return 1;
     }
-    tcflush(_znp_fd, TCOFLUSH);
+
+    _context = _context_new(device);
+    if(!_context)
+        return 1;
+    INF("RPC module initialized");
+
     return 0;
 }
 
+
+void zg_rpc_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(_context)
+        _context_free(_context);
+    _context = NULL;
+}
+
+void zg_rpc_read(void)
+{
+    if(_context)
+        _read_znp_data(_context);
+}
+
+uint8_t zg_rpc_write(ZgMtMsg *msg)
+{
+    return _context_write(_context, msg, NULL, NULL);
+}
+
+uint8_t zg_rpc_write_sync(ZgMtMsg *msg, SyncActionCb *slot, SyncActionCb cb)
+{
+    return _context_write(_context, msg, slot, cb);
+}
+
 int zg_rpc_get_fd(void)
 {
-    return _znp_fd;
+    return _context ? _context->fd : -1;
 }
 
 void zg_rpc_subsys_cb_set(ZgMtSubSys subsys, mt_subsys_cb_t cb)
 {
-    int index = 0;
-    for(index = 0; index < _mt_subsys_table_size; index++)
+    const char *name = _get_subsys_name(subsys);
+
+    if(!_context)
+        return;
+
+    if(!name || subsys >= RPC_MAX_SUBSYS)
     {
-        if(_mt_subsys_table[index].subsys == subsys)
-        {
-            INF("Registering new callback for %s subsystem", _mt_subsys_table[index].name);
-            _mt_subsys_table[index].cb = cb;
-            break;
-        }
-    }
-    if(index == _mt_subsys_table_size)
         WRN("Cannot register callback : no subsystem with id %d found", subsys);
+        return;
+    }
+    INF("Registering new callback for %s subsystem", name);
+    _context->subsys_cb[subsys] = cb;
 }
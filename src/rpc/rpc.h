@@ -2,6 +2,7 @@
 #define ZG_RPC_H
 
 #include <stdint.h>
+#include "types.h"
 
 typedef enum
 {
@@ -40,9 +41,8 @@ typedef void (*znp_frame_cb_t)(uint8_t *buf, uint8_t len);
 typedef void (*mt_subsys_cb_t)(ZgMtMsg *msg);
 
 /**
- * \brief Initialize the communication medium to the ZNP.
- * \param device A string containing the name of serial device to open. If not
- * provided, it will try to open the device defined in configuration
+ * \brief Initialize the communication medium to the ZNP defined in
+ * configuration, and start listening to it in main loop
  * \return 0 if init is successfull, otherwise 1;
  */
 uint8_t zg_rpc_init(void);
@@ -53,8 +53,9 @@ uint8_t zg_rpc_init(void);
 void zg_rpc_shutdown();
 
 /**
- * \brief Manually read data on znp medium. must be used each time that znp fd
- * notify data available.
+ * \brief Manually read data on znp medium. The medium is read automatically
+ * from main loop, so this is only needed when polling it from outside the main
+ * loop.
  */
 void zg_rpc_read(void);
 
@@ -66,6 +67,19 @@ void zg_rpc_read(void);
  */
 uint8_t zg_rpc_write(ZgMtMsg *msg);
 
+/**
+ * \brief Write a request to ZNP medium, and install its completion
+ * callback once it is actually sent. ZNP only processes one synchronous
+ * request at a time, so requests are queued until the one in flight has been
+ * answered : installing the callback when the request leaves the queue lets
+ * MT modules keep a single callback slot while several requests are pending
+ * \param msg A ZNP message object
+ * \param slot The callback slot of the MT module sending the request
+ * \param cb The callback to store in slot
+ * \return 0 if success, otherwise 1
+ */
+uint8_t zg_rpc_write_sync(ZgMtMsg *msg, SyncActionCb *slot, SyncActionCb cb);
+
 /**
  * \brief Return the filed descriptor of ZNP medium
  * \return A valid fd, or -1 if not opened.
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#include "transport.h"
+#include "logs.h"
+#include "conf.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define TRANSPORT_DEFAULT_BAUDRATE      115200
+#define TRANSPORT_HOST_MAX_LEN          128
+#define TRANSPORT_FLUSH_BUFFER_SIZE     64
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    int baudrate;
+    speed_t speed;
+} BaudrateEntry;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+
+static BaudrateEntry _baudrates[] =
+{
+    {9600, B9600},
+    {19200, B19200},
+    {38400, B38400},
+    {57600, B57600},
+    {115200, B115200},
+    {230400, B230400},
+#ifdef B460800
+    {460800, B460800},
+#endif
+#ifdef B921600
+    {921600, B921600},
+#endif
+};
+
+static int _nb_baudrates = sizeof(_baudrates)/sizeof(BaudrateEntry);
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+/* Writes are queued and driven by main loop, so they must never block it */
+static uint8_t _set_non_blocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+    {
+        ERR("Cannot set link in non-blocking mode : %s", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/********************************
+ *          Serial              *
+ *******************************/
+
+static speed_t _get_speed(int baudrate)
+{
+    int i = 0;
+
+    for(i = 0; i < _nb_baudrates; i++)
+    {
+        if(_baudrates[i].baudrate == baudrate)
+            return _baudrates[i].speed;
+    }
+
+    if(baudrate)
+        WRN("Unsupported baudrate %d, using %d", baudrate, TRANSPORT_DEFAULT_BAUDRATE);
+    return B115200;
+}
+
+/* Ask the UART driver to push received bytes right away instead of waiting
+ * for its FIFO to fill up or its timer to expire */
+static void _set_low_latency(int fd)
+{
+#if defined(__linux__) && defined(ASYNC_LOW_LATENCY)
+    struct serial_struct serial;
+
+    if(ioctl(fd, TIOCGSERIAL, &serial) != 0)
+    {
+        WRN("Cannot get serial settings, low latency mode not enabled : %s", strerror(errno));
+        return;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    if(ioctl(fd, TIOCSSERIAL, &serial) != 0)
+        WRN("Cannot enable serial low latency mode : %s", strerror(errno));
+#else
+    (void)fd;
+    WRN("Serial low latency mode is not supported on this platform");
+#endif
+}
+
+static int _open_serial(const char *device)
+{
+    struct termios tio;
+    speed_t speed = _get_speed(zg_conf_get_znp_baudrate());
+    int fd = -1;
+
+    fd = open(device, O_RDWR|O_NOCTTY);
+    if(fd < 0)
+    {
+        ERR("Cannot open device %s : %s", device, strerror(errno));
+        return -1;
+    }
+
+    memset(&tio, 0, sizeof(tio));
+    tio.c_cflag = CS8 | CLOCAL | CREAD;
+    if(zg_conf_get_znp_flow_control())
+        tio.c_cflag |= CRTSCTS;
+    tio.c_iflag = IGNPAR & ~ICRNL;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    /* Link is non-blocking, read timeouts are handled by zg_transport_read */
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    tcflush(fd, TCIFLUSH);
+    if(tcsetattr(fd, TCSANOW, &tio) != 0 || _set_non_blocking(fd) != 0)
+    {
+        ERR("Cannot configure device %s : %s", device, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if(zg_conf_get_znp_low_latency())
+        _set_low_latency(fd);
+
+    INF("Serial link opened on %s (%s flow control%s)", device,
+            zg_conf_get_znp_flow_control() ? "RTS/CTS" : "no",
+            zg_conf_get_znp_low_latency() ? ", low latency" : "");
+    return fd;
+}
+
+/********************************
+ *          TCP                 *
+ *******************************/
+
+static int _open_tcp(const char *device)
+{
+    char host[TRANSPORT_HOST_MAX_LEN] = {0};
+    const char *address = device + strlen(ZG_TRANSPORT_TCP_PREFIX);
+    const char *port = strrchr(address, ':');
+    struct addrinfo hints, *result = NULL, *ai = NULL;
+    int fd = -1;
+    int flag = 1;
+
+    if(!port || port == address || (size_t)(port - address) >= TRANSPORT_HOST_MAX_LEN)
+    {
+        ERR("Invalid TCP device %s, expected %shost:port", device, ZG_TRANSPORT_TCP_PREFIX);
+        return -1;
+    }
+    memcpy(host, address, port - address);
+    port++;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &result) != 0)
+    {
+        ERR("Cannot resolve ZNP host %s", host);
+        return -1;
+    }
+
+    for(ai = result; ai; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd < 0)
+            continue;
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if(fd < 0)
+    {
+        ERR("Cannot connect to ZNP at %s:%s", host, port);
+        return -1;
+    }
+
+    /* Frames are small and already batched by RPC module, send them right away */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if(_set_non_blocking(fd) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    INF("TCP link opened to %s:%s", host, port);
+    return fd;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+void zg_transport_init(void)
+{
+    _log_domain = zg_logs_domain_register("zg_transport", EINA_COLOR_BLUE);
+}
+
+int zg_transport_open(const char *device, ZgTransportType *type)
+{
+    if(!device || !type)
+        return -1;
+
+    if(strncmp(device, ZG_TRANSPORT_TCP_PREFIX, strlen(ZG_TRANSPORT_TCP_PREFIX)) == 0)
+    {
+        *type = ZG_TRANSPORT_TCP;
+        return _open_tcp(device);
+    }
+
+    *type = ZG_TRANSPORT_SERIAL;
+    return _open_serial(device);
+}
+
+ssize_t zg_transport_read(int fd, void *buf, size_t len)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    ssize_t ret = 0;
+
+    for(;;)
+    {
+        ret = read(fd, buf, len);
+        if(ret >= 0)
+            return ret;
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+
+        ret = poll(&pfd, 1, ZG_TRANSPORT_READ_TIMEOUT_MS);
+        if(ret == 0)
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if(ret < 0 && errno != EINTR)
+            return -1;
+    }
+}
+
+ssize_t zg_transport_writev(int fd, ZgTransportType type, const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+
+    if(type == ZG_TRANSPORT_SERIAL)
+        return writev(fd, iov, iovcnt);
+
+    /* A closed socket must report an error instead of raising SIGPIPE */
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+void zg_transport_flush_input(int fd, ZgTransportType type)
+{
+    uint8_t buffer[TRANSPORT_FLUSH_BUFFER_SIZE];
+
+    if(fd < 0)
+        return;
+
+    if(type == ZG_TRANSPORT_SERIAL)
+    {
+        tcflush(fd, TCIFLUSH);
+        return;
+    }
+
+    while(recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+}
+
+void zg_transport_close(int fd, ZgTransportType type)
+{
+    if(fd < 0)
+        return;
+
+    zg_transport_flush_input(fd, type);
+    close(fd);
+}
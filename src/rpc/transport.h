@@ -0,0 +1,73 @@
+#ifndef ZG_TRANSPORT_H
+#define ZG_TRANSPORT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Devices starting with this prefix are reached over TCP, eg a ZNP exported
+ * by ser2net : "tcp://192.168.1.10:2000" */
+#define ZG_TRANSPORT_TCP_PREFIX         "tcp://"
+
+/* Longest time spent waiting for the remaining bytes of a frame */
+#define ZG_TRANSPORT_READ_TIMEOUT_MS    100
+
+typedef enum
+{
+    ZG_TRANSPORT_SERIAL,
+    ZG_TRANSPORT_TCP
+} ZgTransportType;
+
+/**
+ * \brief Initialize the transport module
+ */
+void zg_transport_init(void);
+
+/**
+ * \brief Open a link to a ZNP. Serial links are configured following
+ * configuration (baudrate, flow control, low latency mode). On both transports,
+ * the link is non-blocking
+ * \param device The serial device path, or ZG_TRANSPORT_TCP_PREFIX followed by
+ * host and port
+ * \param type Filled with the transport type used
+ * \return A file descriptor, or -1 on error
+ */
+int zg_transport_open(const char *device, ZgTransportType *type);
+
+/**
+ * \brief Read data from a link, waiting up to ZG_TRANSPORT_READ_TIMEOUT_MS for
+ * some data to come
+ * \param fd The link file descriptor
+ * \param buf The buffer to fill
+ * \param len The maximum number of bytes to read
+ * \return The number of bytes read, 0 if the link has been closed, or -1 on
+ * error (errno is set to ETIMEDOUT if no data has come)
+ */
+ssize_t zg_transport_read(int fd, void *buf, size_t len);
+
+/**
+ * \brief Write a set of buffers to a link without blocking
+ * \param fd The link file descriptor
+ * \param type The link transport type
+ * \param iov The buffers to write
+ * \param iovcnt The number of buffers
+ * \return The number of bytes written, which can be lower than the total
+ * size, or -1 on error (errno is set to EAGAIN if link is not writable)
+ */
+ssize_t zg_transport_writev(int fd, ZgTransportType type, const struct iovec *iov, int iovcnt);
+
+/**
+ * \brief Drop all received data not read yet
+ * \param fd The link file descriptor
+ * \param type The link transport type
+ */
+void zg_transport_flush_input(int fd, ZgTransportType type);
+
+/**
+ * \brief Close a link
+ * \param fd The link file descriptor
+ * \param type The link transport type
+ */
+void zg_transport_close(int fd, ZgTransportType type);
+
+#endif
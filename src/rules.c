@@ -0,0 +1,469 @@
+#include <stdlib.h>
+#include <string.h>
+#include <jansson.h>
+#include <Eina.h>
+#include "rules.h"
+#include "zha.h"
+#include "zcl.h"
+#include "conf.h"
+#include "worker.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *    Constants and macros      *
+ *******************************/
+
+#define RULES_NB_INDENT             4
+/* Rules file saves go through the same worker so that they are written in order */
+#define RULES_WORKER_KEY            1
+#define RULES_MAX_PAYLOAD           6
+
+#define COMMAND_OFF                 0x00
+#define COMMAND_ON                  0x01
+#define COMMAND_TOGGLE              0x02
+#define COMMAND_MOVE_TO_COLOR       0x07
+
+#define RULES_DISPATCH_KEY(id, cluster) (((uint32_t)(id) << 16) | (cluster))
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef enum
+{
+    RULE_MATCH_ANY,
+    RULE_MATCH_EQUAL,
+    RULE_MATCH_ABOVE,
+    RULE_MATCH_BELOW
+} RuleMatch;
+
+/* Rule as stored in the dispatch table : everything needed to send the
+ * command is resolved when building the table */
+typedef struct
+{
+    int id;
+    RuleMatch match;
+    int value;
+    uint16_t dst_addr;
+    uint8_t dst_endpoint;
+    uint16_t cluster;
+    uint8_t command;
+    uint8_t payload[RULES_MAX_PAYLOAD];
+    uint8_t len;
+} CompiledRule;
+
+typedef struct
+{
+    const char *string;
+    uint16_t cluster;
+} TriggerEntry;
+
+typedef struct
+{
+    const char *string;
+    uint16_t cluster;
+    uint8_t command;
+} ActionEntry;
+
+typedef struct
+{
+    json_t *root;
+    const char *path;
+    int status;
+} RulesSave;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+/* Rules descriptions, as loaded from or saved to rules file */
+static json_t *_rules = NULL;
+/* Lists of CompiledRule, indexed by trigger device and cluster */
+static Eina_Hash *_dispatch = NULL;
+
+static TriggerEntry _trigger_table[] =
+{
+    {"button", ZCL_CLUSTER_ON_OFF},
+    {"temperature", ZCL_CLUSTER_TEMPERATURE_MEASUREMENT},
+    {"pressure", ZCL_CLUSTER_PRESSURE_MEASUREMENT},
+    {"humidity", ZCL_CLUSTER_HUMIDITY_MEASUREMENT}
+};
+
+static ActionEntry _action_table[] =
+{
+    {"off", ZCL_CLUSTER_ON_OFF, COMMAND_OFF},
+    {"on", ZCL_CLUSTER_ON_OFF, COMMAND_ON},
+    {"toggle", ZCL_CLUSTER_ON_OFF, COMMAND_TOGGLE},
+    {"color", ZCL_CLUSTER_COLOR_CONTROL, COMMAND_MOVE_TO_COLOR}
+};
+
+/********************************
+ *       Rules compilation      *
+ *******************************/
+
+static int _get_trigger_cluster(const char *string)
+{
+    unsigned int index = 0;
+
+    if(!string)
+        return -1;
+
+    for(index = 0; index < sizeof(_trigger_table)/sizeof(TriggerEntry); index++)
+    {
+        if(!strcmp(string, _trigger_table[index].string))
+            return _trigger_table[index].cluster;
+    }
+    return -1;
+}
+
+static ActionEntry *_get_action(const char *string)
+{
+    unsigned int index = 0;
+
+    if(!string)
+        return NULL;
+
+    for(index = 0; index < sizeof(_action_table)/sizeof(ActionEntry); index++)
+    {
+        if(!strcmp(string, _action_table[index].string))
+            return &_action_table[index];
+    }
+    return NULL;
+}
+
+static void _compile_match(CompiledRule *compiled, json_t *trigger)
+{
+    json_t *value = NULL;
+
+    if((value = json_object_get(trigger, "value")))
+        compiled->match = RULE_MATCH_EQUAL;
+    else if((value = json_object_get(trigger, "above")))
+        compiled->match = RULE_MATCH_ABOVE;
+    else if((value = json_object_get(trigger, "below")))
+        compiled->match = RULE_MATCH_BELOW;
+    else
+        compiled->match = RULE_MATCH_ANY;
+    compiled->value = json_integer_value(value);
+}
+
+static void _compile_payload(CompiledRule *compiled, json_t *action)
+{
+    uint16_t x, y, duration;
+
+    if(compiled->command != COMMAND_MOVE_TO_COLOR)
+        return;
+
+    x = json_integer_value(json_object_get(action, "x"));
+    y = json_integer_value(json_object_get(action, "y"));
+    duration = json_integer_value(json_object_get(action, "duration")) * 10;
+    memcpy(compiled->payload, &x, 2);
+    memcpy(compiled->payload + 2, &y, 2);
+    memcpy(compiled->payload + 4, &duration, 2);
+    compiled->len = 6;
+}
+
+/* Returns NULL if rule is malformed or if its target cannot be reached */
+static CompiledRule *_compile_rule(json_t *rule, uint32_t *key)
+{
+    json_t *trigger = json_object_get(rule, "trigger");
+    json_t *action = json_object_get(rule, "action");
+    json_t *id = json_object_get(rule, "id");
+    CompiledRule *compiled = NULL;
+    ActionEntry *entry = NULL;
+    int cluster = -1;
+    int endpoint = -1;
+
+    if(!json_is_integer(id) || !json_is_object(trigger) || !json_is_object(action)
+            || !json_is_integer(json_object_get(trigger, "device"))
+            || !json_is_integer(json_object_get(action, "device")))
+    {
+        ERR("Rule is not properly formatted");
+        return NULL;
+    }
+
+    cluster = _get_trigger_cluster(json_string_value(json_object_get(trigger, "event")));
+    entry = _get_action(json_string_value(json_object_get(action, "command")));
+    if(cluster < 0 || !entry)
+    {
+        ERR("Rule %d has an unsupported event or command", (int)json_integer_value(id));
+        return NULL;
+    }
+
+    compiled = calloc(1, sizeof(CompiledRule));
+    if(!compiled)
+    {
+        CRI("Cannot allocate memory for rule %d", (int)json_integer_value(id));
+        return NULL;
+    }
+
+    compiled->id = json_integer_value(id);
+    compiled->dst_addr = zg_device_get_short_addr(json_integer_value(json_object_get(action, "device")));
+    endpoint = zg_device_zha_endpoint_get(compiled->dst_addr);
+    if(endpoint < 0)
+    {
+        WRN("Rule %d is disabled : target device has no ZHA endpoint", compiled->id);
+        ZG_VAR_FREE(compiled);
+        return NULL;
+    }
+    compiled->dst_endpoint = endpoint;
+    compiled->cluster = entry->cluster;
+    compiled->command = entry->command;
+    _compile_match(compiled, trigger);
+    _compile_payload(compiled, action);
+
+    *key = RULES_DISPATCH_KEY(json_integer_value(json_object_get(trigger, "device")), cluster);
+    return compiled;
+}
+
+static void _free_dispatch_entry(void *data)
+{
+    Eina_List *list = data;
+    CompiledRule *compiled = NULL;
+
+    EINA_LIST_FREE(list, compiled)
+        free(compiled);
+}
+
+static void _build_dispatch_table(void)
+{
+    CompiledRule *compiled = NULL;
+    Eina_List *list = NULL;
+    json_t *rule = NULL;
+    uint32_t key = 0;
+    int nb_compiled = 0;
+    size_t index;
+
+    if(_dispatch)
+        eina_hash_free(_dispatch);
+    _dispatch = eina_hash_int32_new(_free_dispatch_entry);
+    if(!_dispatch)
+    {
+        CRI("Cannot allocate rules dispatch table");
+        return;
+    }
+
+    json_array_foreach(_rules, index, rule)
+    {
+        compiled = _compile_rule(rule, &key);
+        if(!compiled)
+            continue;
+        list = eina_hash_find(_dispatch, &key);
+        list = eina_list_append(list, compiled);
+        eina_hash_set(_dispatch, &key, list);
+        nb_compiled++;
+    }
+    INF("%d rules enabled out of %d", nb_compiled, (int)json_array_size(_rules));
+}
+
+static uint8_t _match(CompiledRule *compiled, int value)
+{
+    switch(compiled->match)
+    {
+        case RULE_MATCH_EQUAL:
+            return value == compiled->value;
+        case RULE_MATCH_ABOVE:
+            return value > compiled->value;
+        case RULE_MATCH_BELOW:
+            return value < compiled->value;
+        default:
+            return 1;
+    }
+}
+
+/********************************
+ *       Rules file storage     *
+ *******************************/
+
+static void _load_rules(void)
+{
+    const char *path = zg_conf_get_rules_path();
+    json_t *root = NULL;
+    json_error_t error;
+
+    _rules = json_array();
+    if(!path)
+    {
+        INF("No rules file configured");
+        return;
+    }
+
+    root = json_load_file(path, 0, &error);
+    if(!root)
+    {
+        WRN("Cannot load rules from file %s : [%s] l.%d c.%d : %s",
+            path, error.source, error.line, error.column, error.text);
+        return;
+    }
+    if(json_is_array(json_object_get(root, "rules")))
+        json_array_extend(_rules, json_object_get(root, "rules"));
+    else
+        ERR("Cannot get rules array from rules file");
+    json_decref(root);
+}
+
+/* Run on a worker thread, the JSON tree being owned by the save job */
+static void _save_rules_work(void *data)
+{
+    RulesSave *save = data;
+
+    save->status = json_dump_file(save->root, save->path, JSON_INDENT(RULES_NB_INDENT));
+}
+
+static void _save_rules_done(void *data)
+{
+    RulesSave *save = data;
+
+    if(save->status)
+        ERR("Cannot save rules in file %s", save->path);
+    json_decref(save->root);
+    free(save);
+}
+
+static void _save_rules(void)
+{
+    RulesSave *save = NULL;
+
+    if(!zg_conf_get_rules_path())
+    {
+        WRN("No rules file configured, rules will be lost on exit");
+        return;
+    }
+
+    save = calloc(1, sizeof(RulesSave));
+    if(!save)
+    {
+        CRI("Cannot allocate memory to save rules");
+        return;
+    }
+    save->root = json_object();
+    json_object_set_new(save->root, "rules", json_deep_copy(_rules));
+    save->path = zg_conf_get_rules_path();
+    if(zg_worker_submit(RULES_WORKER_KEY, _save_rules_work, _save_rules_done, save) != 0)
+    {
+        save->status = -1;
+        _save_rules_done(save);
+    }
+}
+
+static int _find_rule(int id)
+{
+    json_t *rule = NULL;
+    size_t index;
+
+    json_array_foreach(_rules, index, rule)
+    {
+        if(json_integer_value(json_object_get(rule, "id")) == id)
+            return index;
+    }
+    return -1;
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+uint8_t zg_rules_init(void)
+{
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_rules", ZG_COLOR_GREEN);
+    _load_rules();
+    _build_dispatch_table();
+    return 0;
+}
+
+void zg_rules_shutdown(void)
+{
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(_dispatch)
+        eina_hash_free(_dispatch);
+    _dispatch = NULL;
+    json_decref(_rules);
+    _rules = NULL;
+}
+
+void zg_rules_refresh(void)
+{
+    if(!_rules)
+        return;
+    _build_dispatch_table();
+}
+
+void zg_rules_process(DeviceId id, uint16_t cluster, int value)
+{
+    uint32_t key = RULES_DISPATCH_KEY(id, cluster);
+    CompiledRule *compiled = NULL;
+    Eina_List *list = NULL, *l = NULL;
+
+    if(!_dispatch)
+        return;
+
+    list = eina_hash_find(_dispatch, &key);
+    EINA_LIST_FOREACH(list, l, compiled)
+    {
+        if(!_match(compiled, value))
+            continue;
+        DBG("Rule %d triggered", compiled->id);
+        zg_zha_send_command(compiled->dst_addr,
+                compiled->dst_endpoint,
+                compiled->cluster,
+                compiled->command,
+                compiled->len ? compiled->payload : NULL,
+                compiled->len);
+    }
+}
+
+uint8_t zg_rules_add(json_t *rule)
+{
+    CompiledRule *compiled = NULL;
+    uint32_t key = 0;
+    int index = -1;
+
+    if(!_rules)
+        return 1;
+
+    /* Only check that rule is valid, table is built again from descriptions */
+    compiled = _compile_rule(rule, &key);
+    if(!compiled)
+        return 1;
+
+    index = _find_rule(compiled->id);
+    if(index >= 0)
+        json_array_set(_rules, index, rule);
+    else
+        json_array_append(_rules, rule);
+    INF("Rule %d %s", compiled->id, index >= 0 ? "replaced" : "added");
+    free(compiled);
+
+    _build_dispatch_table();
+    _save_rules();
+    return 0;
+}
+
+uint8_t zg_rules_remove(int id)
+{
+    int index = -1;
+
+    if(!_rules)
+        return 1;
+
+    index = _find_rule(id);
+    if(index < 0)
+    {
+        WRN("Cannot remove rule %d : rule is unknown", id);
+        return 1;
+    }
+    json_array_remove(_rules, index);
+    INF("Rule %d removed", id);
+
+    _build_dispatch_table();
+    _save_rules();
+    return 0;
+}
+
+json_t *zg_rules_get_json(void)
+{
+    return _rules ? json_deep_copy(_rules) : json_array();
+}
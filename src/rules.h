@@ -0,0 +1,76 @@
+#ifndef ZG_RULES_H
+#define ZG_RULES_H
+
+#include <stdint.h>
+#include <jansson.h>
+#include "device.h"
+
+/**
+ * \brief Local automation rules
+ *
+ * A rule binds a trigger (a device reporting a value on a cluster) to an
+ * action (a ZCL command sent to a device). Rules are loaded from the rules
+ * file and compiled into a dispatch table indexed by device and cluster, so
+ * that a matching report fires its command directly from the gateway, without
+ * going through any interface client.
+ *
+ * A rule is described in JSON as follows :
+ * {
+ *   "id": 1,
+ *   "trigger": {"device": 2, "event": "button", "value": 1},
+ *   "action": {"device": 3, "command": "toggle"}
+ * }
+ * Trigger event can be "button", "temperature", "pressure" or "humidity". It
+ * matches if reported value is equal to "value", greater than "above" or lower
+ * than "below" ; if none of those is set, any report matches.
+ * Action command can be "on", "off", "toggle", or "color" with "x", "y" and
+ * "duration" fields.
+ */
+
+/**
+ * \brief Load rules from rules file and build the dispatch table
+ * \return 0 if rules engine is initialized, otherwise 1
+ */
+uint8_t zg_rules_init(void);
+
+/**
+ * \brief Free all loaded rules
+ */
+void zg_rules_shutdown(void);
+
+/**
+ * \brief Build again the dispatch table, e.g. when devices addresses or
+ * endpoints have changed
+ */
+void zg_rules_refresh(void);
+
+/**
+ * \brief Fire actions of all rules triggered by a device report
+ * \param id The device which sent the report
+ * \param cluster The cluster of the reported value
+ * \param value The reported value
+ */
+void zg_rules_process(DeviceId id, uint16_t cluster, int value);
+
+/**
+ * \brief Add a new rule, or replace the rule with the same id. Rules file is
+ * updated accordingly
+ * \param rule The JSON description of the rule
+ * \return 0 if rule has been added, otherwise 1
+ */
+uint8_t zg_rules_add(json_t *rule);
+
+/**
+ * \brief Remove a rule. Rules file is updated accordingly
+ * \param id The rule id
+ * \return 0 if rule has been removed, otherwise 1
+ */
+uint8_t zg_rules_remove(int id);
+
+/**
+ * \brief Get all rules
+ * \return A new JSON array containing all rules descriptions
+ */
+json_t *zg_rules_get_json(void);
+
+#endif
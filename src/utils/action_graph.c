@@ -0,0 +1,308 @@
+#include <stdlib.h>
+#include <uv.h>
+#include "action_graph.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+/* Steps running at the same time, all graphs included */
+#define AG_MAX_RUNNING_STEPS    32
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+/* Steps completion callbacks do not carry any context, so each running step
+ * gets a slot with its own callback */
+typedef struct
+{
+    uint8_t used;
+    /* NULL once step has been abandoned (timeout or graph destroyed) */
+    ZgAg *ag;
+    int step;
+} AgSlot;
+
+struct _ZgAg
+{
+    const ZgAgStep *steps;
+    int nb_steps;
+    ZgAgDoneCb done;
+    uint32_t started;
+    uint32_t completed;
+    uint32_t failed;
+    uint64_t deadlines[ZG_AG_MAX_STEPS];
+    int nb_running;
+    uv_timer_t timer;
+    uint8_t scheduling;
+    uint8_t reschedule;
+    uint8_t finished;
+};
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static AgSlot _slots[AG_MAX_RUNNING_STEPS];
+
+static void _slot_done(int index);
+
+#define AG_SLOT_CB(x) static void _slot_cb_##x(void) { _slot_done(x); }
+AG_SLOT_CB(0)  AG_SLOT_CB(1)  AG_SLOT_CB(2)  AG_SLOT_CB(3)
+AG_SLOT_CB(4)  AG_SLOT_CB(5)  AG_SLOT_CB(6)  AG_SLOT_CB(7)
+AG_SLOT_CB(8)  AG_SLOT_CB(9)  AG_SLOT_CB(10) AG_SLOT_CB(11)
+AG_SLOT_CB(12) AG_SLOT_CB(13) AG_SLOT_CB(14) AG_SLOT_CB(15)
+AG_SLOT_CB(16) AG_SLOT_CB(17) AG_SLOT_CB(18) AG_SLOT_CB(19)
+AG_SLOT_CB(20) AG_SLOT_CB(21) AG_SLOT_CB(22) AG_SLOT_CB(23)
+AG_SLOT_CB(24) AG_SLOT_CB(25) AG_SLOT_CB(26) AG_SLOT_CB(27)
+AG_SLOT_CB(28) AG_SLOT_CB(29) AG_SLOT_CB(30) AG_SLOT_CB(31)
+
+static SyncActionCb _slot_cbs[AG_MAX_RUNNING_STEPS] = {
+    _slot_cb_0,  _slot_cb_1,  _slot_cb_2,  _slot_cb_3,
+    _slot_cb_4,  _slot_cb_5,  _slot_cb_6,  _slot_cb_7,
+    _slot_cb_8,  _slot_cb_9,  _slot_cb_10, _slot_cb_11,
+    _slot_cb_12, _slot_cb_13, _slot_cb_14, _slot_cb_15,
+    _slot_cb_16, _slot_cb_17, _slot_cb_18, _slot_cb_19,
+    _slot_cb_20, _slot_cb_21, _slot_cb_22, _slot_cb_23,
+    _slot_cb_24, _slot_cb_25, _slot_cb_26, _slot_cb_27,
+    _slot_cb_28, _slot_cb_29, _slot_cb_30, _slot_cb_31,
+};
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static int _slot_get(void)
+{
+    int index = 0;
+
+    for(index = 0; index < AG_MAX_RUNNING_STEPS; index++)
+    {
+        if(!_slots[index].used)
+            return index;
+    }
+
+    /* Slot of an abandoned step is never reused : its callback may still be
+     * called late, and would complete the new step before it has run */
+    return -1;
+}
+
+static int _count_bits(uint32_t mask)
+{
+    int count = 0;
+
+    for(; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+static void _timer_cb(uv_timer_t *timer);
+
+static void _arm_timer(ZgAg *ag)
+{
+    uint64_t now = uv_now(uv_default_loop());
+    uint64_t deadline = 0;
+    int index = 0;
+
+    for(index = 0; index < AG_MAX_RUNNING_STEPS; index++)
+    {
+        if(!_slots[index].used || _slots[index].ag != ag)
+            continue;
+        if(!deadline || ag->deadlines[_slots[index].step] < deadline)
+            deadline = ag->deadlines[_slots[index].step];
+    }
+
+    if(!deadline)
+    {
+        uv_timer_stop(&ag->timer);
+        return;
+    }
+    uv_timer_start(&ag->timer, _timer_cb, deadline > now ? deadline - now : 0, 0);
+}
+
+static void _start_step(ZgAg *ag, int step)
+{
+    const ZgAgStep *data = &ag->steps[step];
+    int index = _slot_get();
+
+    ag->started |= ZG_AG_DEP(step);
+    if(index < 0)
+    {
+        ERR("Cannot run step %s : too many steps running", data->name);
+        ag->failed |= ZG_AG_DEP(step);
+        ag->reschedule = 1;
+        return;
+    }
+
+    DBG("Running step %s", data->name);
+    _slots[index].used = 1;
+    _slots[index].ag = ag;
+    _slots[index].step = step;
+    ag->deadlines[step] = uv_now(uv_default_loop())
+        + (data->timeout_ms ? data->timeout_ms : ZG_AG_DEFAULT_TIMEOUT_MS);
+    ag->nb_running++;
+    data->func(_slot_cbs[index]);
+}
+
+static void _schedule(ZgAg *ag)
+{
+    const ZgAgStep *step = NULL;
+    int index = 0;
+
+    /* Steps completing synchronously end up here while steps are started */
+    if(ag->scheduling)
+    {
+        ag->reschedule = 1;
+        return;
+    }
+
+    ag->scheduling = 1;
+    do
+    {
+        ag->reschedule = 0;
+        for(index = 0; index < ag->nb_steps; index++)
+        {
+            step = &ag->steps[index];
+            if(ag->started & ZG_AG_DEP(index))
+                continue;
+            if(step->deps & ag->failed)
+            {
+                WRN("Step %s skipped : a step it depends on has failed", step->name);
+                ag->started |= ZG_AG_DEP(index);
+                ag->failed |= ZG_AG_DEP(index);
+                ag->reschedule = 1;
+                continue;
+            }
+            if((step->deps & ag->completed) == step->deps)
+                _start_step(ag, index);
+        }
+    } while(ag->reschedule);
+    ag->scheduling = 0;
+
+    _arm_timer(ag);
+    if(ag->finished || ag->nb_running || _count_bits(ag->started) != ag->nb_steps)
+        return;
+
+    /* Graph may be destroyed from its completion callback */
+    ag->finished = 1;
+    if(ag->failed)
+        ERR("Action graph complete, %d steps failed", _count_bits(ag->failed));
+    if(ag->done)
+        ag->done(_count_bits(ag->failed));
+}
+
+static void _slot_done(int index)
+{
+    AgSlot *slot = &_slots[index];
+    ZgAg *ag = slot->ag;
+
+    if(!slot->used)
+    {
+        WRN("Unexpected step completion");
+        return;
+    }
+    slot->used = 0;
+    slot->ag = NULL;
+    if(!ag)
+    {
+        DBG("Abandoned step has completed");
+        return;
+    }
+
+    DBG("Step %s complete", ag->steps[slot->step].name);
+    ag->nb_running--;
+    ag->completed |= ZG_AG_DEP(slot->step);
+    _schedule(ag);
+}
+
+static void _timer_cb(uv_timer_t *timer)
+{
+    ZgAg *ag = timer->data;
+    uint64_t now = uv_now(uv_default_loop());
+    int index = 0;
+
+    for(index = 0; index < AG_MAX_RUNNING_STEPS; index++)
+    {
+        if(!_slots[index].used || _slots[index].ag != ag)
+            continue;
+        if(ag->deadlines[_slots[index].step] > now)
+            continue;
+        ERR("Step %s has timed out", ag->steps[_slots[index].step].name);
+        ag->failed |= ZG_AG_DEP(_slots[index].step);
+        ag->nb_running--;
+        /* Slot is kept until step completes, if it ever does */
+        _slots[index].ag = NULL;
+    }
+    _schedule(ag);
+}
+
+static void _timer_close_cb(uv_handle_t *handle)
+{
+    ZgAg *ag = handle->data;
+
+    ZG_VAR_FREE(ag);
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+ZgAg *zg_ag_create(const ZgAgStep *steps, int nb_steps, ZgAgDoneCb done)
+{
+    ZgAg *ag = NULL;
+    int index = 0;
+
+    if(_log_domain < 0)
+        _log_domain = zg_logs_domain_register("zg_ag", ZG_COLOR_LIGHTBLUE);
+
+    if(!steps || nb_steps <= 0 || nb_steps > ZG_AG_MAX_STEPS)
+        return NULL;
+
+    /* Depending only on previous steps guarantees that graph has no cycle */
+    for(index = 0; index < nb_steps; index++)
+    {
+        if(!steps[index].func || (steps[index].deps & ~(ZG_AG_DEP(index) - 1)))
+        {
+            ERR("Invalid step %s", steps[index].name);
+            return NULL;
+        }
+    }
+
+    ag = calloc(1, sizeof(ZgAg));
+    if(!ag)
+    {
+        CRI("Cannot allocate memory for action graph");
+        return NULL;
+    }
+    ag->steps = steps;
+    ag->nb_steps = nb_steps;
+    ag->done = done;
+    uv_timer_init(uv_default_loop(), &ag->timer);
+    ag->timer.data = ag;
+    return ag;
+}
+
+void zg_ag_run(ZgAg *ag)
+{
+    if(ag)
+        _schedule(ag);
+}
+
+void zg_ag_destroy(ZgAg *ag)
+{
+    int index = 0;
+
+    if(!ag)
+        return;
+
+    for(index = 0; index < AG_MAX_RUNNING_STEPS; index++)
+    {
+        if(_slots[index].used && _slots[index].ag == ag)
+            _slots[index].ag = NULL;
+    }
+    uv_timer_stop(&ag->timer);
+    uv_close((uv_handle_t *)&ag->timer, _timer_close_cb);
+}
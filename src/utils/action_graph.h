@@ -0,0 +1,65 @@
+#ifndef ZG_AG_H
+#define ZG_AG_H
+
+#include <stdint.h>
+#include "types.h"
+
+/**
+ * @brief Dependency-aware action list
+ *
+ * Like action list, an action graph runs asynchronous actions, each one
+ * calling the provided callback once done. Each step declares the steps it
+ * depends on, and all steps which dependencies are complete run at the same
+ * time. A step which does not complete before its timeout fails, and all the
+ * steps depending on it are skipped. Once no step can run anymore, the graph
+ * completion callback is called with the number of failed or skipped steps
+ */
+
+#define ZG_AG_MAX_STEPS             32
+#define ZG_AG_DEFAULT_TIMEOUT_MS    10000
+
+/* Build a dependency mask from a step index */
+#define ZG_AG_DEP(x)                (1U << (x))
+
+typedef void (*ZgAgFunc)(SyncActionCb cb);
+typedef void (*ZgAgDoneCb)(int nb_failed);
+
+typedef struct
+{
+    const char *name;
+    ZgAgFunc func;
+    /* Mask of the steps which must be complete before running this one */
+    uint32_t deps;
+    /* 0 to use ZG_AG_DEFAULT_TIMEOUT_MS */
+    uint32_t timeout_ms;
+} ZgAgStep;
+
+typedef struct _ZgAg ZgAg;
+
+/**
+ * @brief Create an action graph
+ *
+ * @param steps The graph steps, a step can only depend on steps with a lower
+ * index
+ * @param nb_steps The number of steps, up to ZG_AG_MAX_STEPS
+ * @param done The function called once no step can run anymore
+ * @return A newly allocated action graph, or NULL on error
+ */
+ZgAg *zg_ag_create(const ZgAgStep *steps, int nb_steps, ZgAgDoneCb done);
+
+/**
+ * @brief Start all the steps without dependencies
+ *
+ * @param ag The action graph to run
+ */
+void zg_ag_run(ZgAg *ag);
+
+/**
+ * @brief Destroy an action graph. Steps still running are abandoned, their
+ * completion is ignored
+ *
+ * @param ag The action graph to free
+ */
+void zg_ag_destroy(ZgAg *ag);
+
+#endif
@@ -1,102 +1,222 @@
 #include <stdlib.h>
 #include <string.h>
-#include <Eina.h>
+#include <uv.h>
 #include "sm.h"
+#include "logs.h"
 #include "utils.h"
 
-ZgSm *zg_sm_create( const char *name,
-                    ZgSmStateData *states,
-                    ZgSmStateNb nb_states,
-                    ZgSmTransitionData *transitions,
-                    ZgSmTransitionNb nb_transitions)
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define SM_NO_TRANSITION        0xFF
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+struct _ZgSm
 {
-    ZgSm *result = NULL;
+    ZgSmDefinition *def;
+    void *ctx;
+    ZgSmState current_state;
+    uint8_t started;
+    /* Armed when entering a state with a timeout */
+    uv_timer_t timer;
+};
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static uint8_t _compile_definition(ZgSmDefinition *def)
+{
+    const ZgSmTransitionData *transition = NULL;
+    ZgSmState *table = NULL;
+    int index = 0;
 
-    if(!name)
+    if(def->table)
+        return 0;
+
+    if(!def->states || !def->nb_states || !def->nb_events)
     {
-        fprintf(stderr,"Cannot create state machine without proper name");
-        return NULL;
+        ERR("Cannot create state machine %s with no states or events", def->name);
+        return 1;
+    }
+    if(!def->transitions || !def->nb_transitions)
+    {
+        ERR("Cannot create state machine %s with no transitions", def->name);
+        return 1;
+    }
+    if(def->nb_states >= SM_NO_TRANSITION)
+    {
+        ERR("State machine %s has too many states", def->name);
+        return 1;
     }
 
-    if(!states || !nb_states)
+    for(index = 0; index < def->nb_states; index++)
     {
-        fprintf(stderr,"Cannot create state machine %s with no states", name);
-        return NULL;
+        if(def->states[index].state != index)
+        {
+            ERR("State %d of state machine %s is not declared in order", index, def->name);
+            return 1;
+        }
     }
 
-    if(!transitions || !nb_transitions)
+    table = malloc(def->nb_states * def->nb_events * sizeof(ZgSmState));
+    if(!table)
     {
-        fprintf(stderr,"Cannot create state machine %s with no transitions", name);
+        CRI("Cannot allocate transitions table for state machine %s", def->name);
+        return 1;
+    }
+    memset(table, SM_NO_TRANSITION, def->nb_states * def->nb_events * sizeof(ZgSmState));
+
+    for(index = 0; index < def->nb_transitions; index++)
+    {
+        transition = &def->transitions[index];
+        if(transition->state >= def->nb_states || transition->new_state >= def->nb_states
+                || transition->event >= def->nb_events)
+        {
+            ERR("Invalid transition %d in state machine %s", index, def->name);
+            free(table);
+            return 1;
+        }
+        table[transition->state * def->nb_events + transition->event] = transition->new_state;
+    }
+
+    def->table = table;
+    return 0;
+}
+
+static void _timeout_cb(uv_timer_t *timer)
+{
+    ZgSm *sm = timer->data;
+    const ZgSmStateData *state = &sm->def->states[sm->current_state];
+
+    DBG("[%s] Timeout in state %d", sm->def->name, sm->current_state);
+    zg_sm_send_event(sm, state->timeout_event);
+}
+
+/* Entry function is called last, since it may destroy the instance */
+static void _enter_state(ZgSm *sm, ZgSmState new_state)
+{
+    const ZgSmStateData *state = &sm->def->states[new_state];
+
+    sm->current_state = new_state;
+    if(state->timeout_ms != ZG_SM_NO_TIMEOUT)
+        uv_timer_start(&sm->timer, _timeout_cb, state->timeout_ms, 0);
+    if(state->entry)
+        state->entry(sm, sm->ctx);
+}
+
+static void _close_cb(uv_handle_t *handle)
+{
+    ZgSm *sm = handle->data;
+
+    ZG_VAR_FREE(sm);
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+ZgSm *zg_sm_create(ZgSmDefinition *def, void *ctx)
+{
+    ZgSm *result = NULL;
+
+    if(_log_domain < 0)
+        _log_domain = zg_logs_domain_register("zg_sm", ZG_COLOR_LIGHTBLUE);
+
+    if(!def || !def->name)
+    {
+        ERR("Cannot create state machine without proper definition");
         return NULL;
     }
 
+    if(_compile_definition(def) != 0)
+        return NULL;
+
     result = calloc(1, sizeof(ZgSm));
     if(!result)
     {
-        fprintf(stderr,"Cannot allocate memory for new state machine %s", name);
+        CRI("Cannot allocate memory for new state machine %s", def->name);
         return NULL;
     }
 
-    strncpy(result->name, name, ZG_SM_NAME_MAX_LEN);
-    result->states = states;
-    result->nb_states = nb_states;
-    result->transitions = transitions;
-    result->nb_transitions = nb_transitions;
+    result->def = def;
+    result->ctx = ctx;
+    uv_timer_init(uv_default_loop(), &result->timer);
+    result->timer.data = result;
     return result;
 }
 
 uint8_t zg_sm_start(ZgSm *sm)
 {
-    uint8_t res = 1;
-    if(sm && sm->states && sm->states[sm->current_state].func)
-    {
-        sm->states[sm->current_state].func();
-        res = 0;
-    }
-    else if (sm && sm->name)
+    if(!sm || sm->started)
     {
-        fprintf(stderr,"Cannot start state machine %s", sm->name);
-    }
-    else
-    {
-        fprintf(stderr,"Cannot start state machine because of missing data");
+        ERR("Cannot start state machine");
+        return 1;
     }
 
-    return res;
+    sm->started = 1;
+    _enter_state(sm, 0);
+    return 0;
 }
 
 void zg_sm_destroy(ZgSm *sm)
 {
-    ZG_VAR_FREE(sm);
+    if(!sm)
+        return;
+
+    /* Instance is freed once its timer is closed, ignore events until then */
+    sm->started = 0;
+    uv_timer_stop(&sm->timer);
+    uv_close((uv_handle_t *)&sm->timer, _close_cb);
 }
 
 void zg_sm_send_event(ZgSm *sm, ZgSmEvent event)
 {
-    ZgSmTransitionNb index = 0;
+    const ZgSmStateData *state = NULL;
     ZgSmState new_state;
 
     if(!sm)
     {
-        fprintf(stderr,"No state machine associated to received event");
+        ERR("No state machine associated to received event");
         return;
     }
 
-    new_state=sm->current_state;
-    for(index = 0; index < sm->nb_transitions; index++)
+    if(!sm->started || event >= sm->def->nb_events)
     {
-        if(sm->transitions[index].state != sm->current_state)
-            continue;
+        WRN("[%s] Ignoring event %d", sm->def->name, event);
+        return;
+    }
 
-        if(sm->transitions[index].event == event)
-        {
-            new_state = sm->transitions[index].new_state;
-            break;
-        }
+    new_state = sm->def->table[sm->current_state * sm->def->nb_events + event];
+    if(new_state == SM_NO_TRANSITION)
+    {
+        DBG("[%s] No transition from state %d on event %d", sm->def->name, sm->current_state, event);
+        return;
     }
 
-    if(new_state != sm->current_state)
-        sm->current_state = new_state;
+    state = &sm->def->states[sm->current_state];
+    uv_timer_stop(&sm->timer);
+    if(state->exit)
+        state->exit(sm, sm->ctx);
+    _enter_state(sm, new_state);
+}
+
+void *zg_sm_get_context(ZgSm *sm)
+{
+    return sm ? sm->ctx : NULL;
+}
 
-    if(sm->states[new_state].func)
-        sm->states[new_state].func();
+ZgSmState zg_sm_get_state(ZgSm *sm)
+{
+    return sm ? sm->current_state : SM_NO_TRANSITION;
 }
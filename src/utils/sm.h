@@ -3,47 +3,114 @@
 
 #include <stdint.h>
 
-#define ZG_SM_NAME_MAX_LEN              256
+/**
+ * @brief Table-driven state machine
+ *
+ * A state machine definition (states, transitions) is static and shared by
+ * all its instances. On first instance creation, transitions are compiled into
+ * a table indexed by state and event, so that sending an event does not
+ * depend on the number of transitions. Each instance carries a context
+ * pointer given to states entry and exit functions, so that several instances
+ * of the same definition can run at the same time.
+ *
+ * States must be declared in the order of their value, starting from 0. A
+ * state can have a timeout : if the state machine is still in this state
+ * after timeout, the state timeout event is sent to the instance. Events
+ * without transition from current state are ignored.
+ */
+
+#define ZG_SM_NO_TIMEOUT                0
 
 typedef uint8_t ZgSmState;
 typedef uint8_t ZgSmStateNb;
 typedef uint8_t ZgSmEvent;
 typedef uint8_t ZgSmTransitionNb;
-typedef void (*ZgSmEntryFunc)(void);
+
+typedef struct _ZgSm ZgSm;
+
+typedef void (*ZgSmActionFunc)(ZgSm *sm, void *ctx);
 
 typedef struct
 {
     ZgSmState state;
-    ZgSmEvent event;
-    ZgSmState new_state;
-} ZgSmTransitionData;
+    /* Called when entering state, can be NULL */
+    ZgSmActionFunc entry;
+    /* Called when leaving state, can be NULL */
+    ZgSmActionFunc exit;
+    /* ZG_SM_NO_TIMEOUT, or delay in ms after which timeout_event is sent */
+    uint32_t timeout_ms;
+    ZgSmEvent timeout_event;
+} ZgSmStateData;
 
 typedef struct
 {
     ZgSmState state;
-    ZgSmEntryFunc func;
-} ZgSmStateData;
+    ZgSmEvent event;
+    ZgSmState new_state;
+} ZgSmTransitionData;
 
 typedef struct
 {
-    char name[ZG_SM_NAME_MAX_LEN];
-    ZgSmStateData *states;
+    const char *name;
+    const ZgSmStateData *states;
     ZgSmStateNb nb_states;
-    ZgSmTransitionData *transitions;
+    const ZgSmTransitionData *transitions;
     ZgSmTransitionNb nb_transitions;
-    ZgSmState current_state;
-} ZgSm;
-
-ZgSm *zg_sm_create( const char *name,
-                    ZgSmStateData *states,
-                    ZgSmStateNb nb_states,
-                    ZgSmTransitionData *transitions,
-                    ZgSmTransitionNb nb_transitions);
+    /* Events values must be lower than this */
+    ZgSmEvent nb_events;
+    /* Compiled transitions, built on first instance creation */
+    ZgSmState *table;
+} ZgSmDefinition;
+
+/**
+ * @brief Create a new state machine instance. State machine is not started
+ *
+ * @param def The state machine definition, which must outlive the instance
+ * @param ctx The context passed to states entry and exit functions
+ * @return A newly allocated instance, or NULL on error
+ */
+ZgSm *zg_sm_create(ZgSmDefinition *def, void *ctx);
+
+/**
+ * @brief Enter first state of state machine
+ *
+ * @param sm The state machine instance
+ * @return 0 if state machine has been started, otherwise 1
+ */
 uint8_t zg_sm_start(ZgSm *sm);
+
+/**
+ * @brief Destroy a state machine instance. This can be called from an entry
+ * function, but the instance must not be used anymore afterwards
+ *
+ * @param sm The state machine instance
+ */
 void zg_sm_destroy(ZgSm *sm);
+
+/**
+ * @brief Send an event to a state machine instance. If a transition matches
+ * current state and event, current state exit function and new state entry
+ * function are called
+ *
+ * @param sm The state machine instance
+ * @param event The event
+ */
 void zg_sm_send_event(ZgSm *sm, ZgSmEvent event);
 
+/**
+ * @brief Get the context of a state machine instance
+ *
+ * @param sm The state machine instance
+ * @return The instance context
+ */
+void *zg_sm_get_context(ZgSm *sm);
 
+/**
+ * @brief Get the current state of a state machine instance
+ *
+ * @param sm The state machine instance
+ * @return The current state
+ */
+ZgSmState zg_sm_get_state(ZgSm *sm);
 
 #endif
-
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <uv.h>
+#include "worker.h"
+#include "logs.h"
+#include "utils.h"
+
+/********************************
+ *          Constants           *
+ *******************************/
+
+#define WORKER_NB_THREADS           2
+/* Must be a power of 2 */
+#define WORKER_QUEUE_SIZE           64
+#define WORKER_QUEUE_MASK           (WORKER_QUEUE_SIZE - 1)
+/* Keys with a job in flight. Each key has at most one job queued to its
+ * worker, so keeping it below queue size ensures queues never overflow */
+#define WORKER_MAX_KEYS             16
+
+/********************************
+ *          Data types          *
+ *******************************/
+
+typedef struct
+{
+    uint32_t key;
+    ZgWorkerJobCb work;
+    ZgWorkerJobCb done;
+    void *data;
+} WorkerJob;
+
+/* Only used from main loop. While a job of the key is in flight, the latest
+ * job submitted with the same key waits here */
+typedef struct
+{
+    uint32_t key;
+    uint8_t busy;
+    uint8_t has_next;
+    WorkerJob next;
+} WorkerKey;
+
+/* Lock-free ring with a single producer and a single consumer. Indexes only
+ * grow, producer owns tail and consumer owns head */
+typedef struct
+{
+    WorkerJob jobs[WORKER_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+} WorkerQueue;
+
+typedef struct
+{
+    uv_thread_t thread;
+    uv_sem_t sem;
+    /* Main loop to worker */
+    WorkerQueue pending;
+    /* Worker to main loop */
+    WorkerQueue completed;
+    atomic_int stopping;
+} Worker;
+
+/********************************
+ *          Local variables     *
+ *******************************/
+
+static int _log_domain = -1;
+static int _init_count = 0;
+static uint8_t _running = 0;
+static Worker _workers[WORKER_NB_THREADS];
+static WorkerKey _keys[WORKER_MAX_KEYS];
+static uv_async_t _async;
+
+/********************************
+ *          Queues              *
+ *******************************/
+
+static uint8_t _queue_push(WorkerQueue *queue, const WorkerJob *job)
+{
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if(tail - head == WORKER_QUEUE_SIZE)
+        return 1;
+
+    queue->jobs[tail & WORKER_QUEUE_MASK] = *job;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+static uint8_t _queue_pop(WorkerQueue *queue, WorkerJob *job)
+{
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if(head == tail)
+        return 1;
+
+    *job = queue->jobs[head & WORKER_QUEUE_MASK];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return 0;
+}
+
+/********************************
+ *          Internal            *
+ *******************************/
+
+static void _worker_main(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    WorkerJob job;
+
+    /* Semaphore is posted once per submitted job, and once to stop */
+    for(;;)
+    {
+        uv_sem_wait(&worker->sem);
+        if(_queue_pop(&worker->pending, &job) != 0)
+        {
+            if(atomic_load(&worker->stopping))
+                break;
+            continue;
+        }
+
+        job.work(job.data);
+        _queue_push(&worker->completed, &job);
+        uv_async_send(&_async);
+    }
+}
+
+static WorkerKey *_key_get(uint32_t key)
+{
+    WorkerKey *free_key = NULL;
+    int i = 0;
+
+    for(i = 0; i < WORKER_MAX_KEYS; i++)
+    {
+        if(_keys[i].busy && _keys[i].key == key)
+            return &_keys[i];
+        if(!_keys[i].busy && !free_key)
+            free_key = &_keys[i];
+    }
+    return free_key;
+}
+
+static void _run_job(const WorkerJob *job)
+{
+    job->work(job->data);
+    if(job->done)
+        job->done(job->data);
+}
+
+static void _queue_job(const WorkerJob *job)
+{
+    Worker *worker = &_workers[job->key % WORKER_NB_THREADS];
+
+    _queue_push(&worker->pending, job);
+    uv_sem_post(&worker->sem);
+}
+
+static void _drain_completed(void)
+{
+    WorkerJob job, next;
+    WorkerKey *key = NULL;
+    int i = 0;
+
+    for(i = 0; i < WORKER_NB_THREADS; i++)
+    {
+        while(_queue_pop(&_workers[i].completed, &job) == 0)
+        {
+            key = _key_get(job.key);
+            if(key && key->busy && key->has_next)
+            {
+                /* Workers are stopped during shutdown */
+                next = key->next;
+                key->has_next = 0;
+                if(_running)
+                    _queue_job(&next);
+                else
+                {
+                    key->busy = 0;
+                    _run_job(&next);
+                }
+            }
+            else if(key)
+                key->busy = 0;
+            if(job.done)
+                job.done(job.data);
+        }
+    }
+}
+
+static void _async_cb(uv_async_t *handle __attribute__((unused)))
+{
+    _drain_completed();
+}
+
+/********************************
+ *             API              *
+ *******************************/
+
+int zg_worker_init(void)
+{
+    int i = 0;
+
+    ENSURE_SINGLE_INIT(_init_count);
+    _log_domain = zg_logs_domain_register("zg_worker", ZG_COLOR_LIGHTYELLOW);
+    memset(_workers, 0, sizeof(_workers));
+    memset(_keys, 0, sizeof(_keys));
+    if(uv_async_init(uv_default_loop(), &_async, _async_cb) != 0)
+    {
+        ERR("Cannot create workers notification handle");
+        _init_count--;
+        return 1;
+    }
+
+    for(i = 0; i < WORKER_NB_THREADS; i++)
+    {
+        uv_sem_init(&_workers[i].sem, 0);
+        if(uv_thread_create(&_workers[i].thread, _worker_main, &_workers[i]) != 0)
+        {
+            ERR("Cannot start worker thread %d, jobs will run on main loop", i);
+            uv_sem_destroy(&_workers[i].sem);
+            break;
+        }
+    }
+
+    /* Without all workers, keep running jobs synchronously */
+    if(i != WORKER_NB_THREADS)
+    {
+        while(--i >= 0)
+        {
+            atomic_store(&_workers[i].stopping, 1);
+            uv_sem_post(&_workers[i].sem);
+            uv_thread_join(&_workers[i].thread);
+            uv_sem_destroy(&_workers[i].sem);
+        }
+        uv_close((uv_handle_t *)&_async, NULL);
+        return 0;
+    }
+
+    _running = 1;
+    INF("Worker module initialized (%d threads)", WORKER_NB_THREADS);
+    return 0;
+}
+
+void zg_worker_shutdown(void)
+{
+    int i = 0;
+
+    ENSURE_SINGLE_SHUTDOWN(_init_count);
+    if(!_running)
+        return;
+
+    /* Workers run all pending jobs before stopping */
+    for(i = 0; i < WORKER_NB_THREADS; i++)
+    {
+        atomic_store(&_workers[i].stopping, 1);
+        uv_sem_post(&_workers[i].sem);
+    }
+    for(i = 0; i < WORKER_NB_THREADS; i++)
+    {
+        uv_thread_join(&_workers[i].thread);
+        uv_sem_destroy(&_workers[i].sem);
+    }
+    _running = 0;
+    _drain_completed();
+    uv_close((uv_handle_t *)&_async, NULL);
+    INF("Worker module shut down");
+}
+
+uint8_t zg_worker_submit(uint32_t key, ZgWorkerJobCb work, ZgWorkerJobCb done, void *data)
+{
+    WorkerJob job = {.key = key, .work = work, .done = done, .data = data};
+    WorkerKey *state = NULL;
+
+    if(!work)
+        return 1;
+
+    if(!_running)
+    {
+        _run_job(&job);
+        return 0;
+    }
+
+    state = _key_get(key);
+    if(!state)
+    {
+        ERR("Cannot submit job : too many jobs in flight");
+        return 1;
+    }
+
+    /* Main loop must never wait for a worker : only the latest job submitted
+     * while one is in flight is kept, the replaced one is not run */
+    if(state->busy)
+    {
+        if(state->has_next)
+        {
+            DBG("Job replaced by a newer one with the same key");
+            if(state->next.done)
+                state->next.done(state->next.data);
+        }
+        state->next = job;
+        state->has_next = 1;
+        return 0;
+    }
+
+    state->key = key;
+    state->busy = 1;
+    state->has_next = 0;
+    _queue_job(&job);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef ZG_WORKER_H
+#define ZG_WORKER_H
+
+#include <stdint.h>
+
+/**
+ * @brief Small pool of worker threads used to move slow jobs (file writes,
+ * large encodings) out of main loop.
+ *
+ * Each worker owns a single-producer/single-consumer queue fed by main loop,
+ * and a second one used to hand results back, main loop being woken up with
+ * an uv_async. Job work functions run on a worker thread and must only touch
+ * data owned by the job, while done functions run on main loop. Jobs submitted
+ * with the same key run on the same worker, in submission order. A key has at
+ * most one job in flight : jobs submitted meanwhile are coalesced, only the
+ * latest one being run once the job in flight is done
+ */
+
+typedef void (*ZgWorkerJobCb)(void *data);
+
+/**
+ * @brief Start worker threads
+ *
+ * @return 0 if workers have been started, otherwise 1
+ */
+int zg_worker_init(void);
+
+/**
+ * @brief Stop worker threads, after all submitted jobs have been run
+ */
+void zg_worker_shutdown(void);
+
+/**
+ * @brief Submit a new job. If workers are not running, the job is run
+ * synchronously
+ *
+ * A job replaced by a newer one with the same key is not run, only its done
+ * function is called so that job data can be released. Jobs of a key must
+ * thus only need the data of the latest job (e.g. saving a whole file)
+ *
+ * @param key Jobs with the same key are run in submission order
+ * @param work The function run on a worker thread
+ * @param done The function run on main loop once work is done, can be NULL
+ * @param data The job data, passed to both functions
+ * @return 0 if job has been submitted, otherwise 1 and job data still belongs
+ * to the caller
+ */
+uint8_t zg_worker_submit(uint32_t key, ZgWorkerJobCb work, ZgWorkerJobCb done, void *data);
+
+#endif
@@ -11,6 +11,7 @@
 #define ZCL_CLUSTER_SIMPLE_DESCRIPTOR_REQUEST   0x0004
 #define ZCL_CLUSTER_ACTIVE_ENDPOINTS_REQUEST    0x0005
 #define ZCL_CLUSTER_ON_OFF                      0x0006
+#define ZCL_CLUSTER_OTA_UPGRADE                 0x0019
 #define ZCL_CLUSTER_COLOR_CONTROL               0x0300
 #define ZCL_CLUSTER_TEMPERATURE_MEASUREMENT     0x0402
 #define ZCL_CLUSTER_PRESSURE_MEASUREMENT        0x0403